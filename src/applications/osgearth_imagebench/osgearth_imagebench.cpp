@@ -0,0 +1,299 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <osg/Image>
+
+#include <osgEarth/Notify>
+#include <osgEarth/ImageUtils>
+
+#include <cstring>
+#include <cmath>
+
+#define LC "[osgearth_imagebench] "
+
+using namespace osgEarth;
+
+/**
+ * Compares the row-based ImageUtils operations with the per-pixel loops
+ * they replaced. The "old" versions below are the previous implementations,
+ * reading and writing one pixel at a time through PixelReader/PixelWriter.
+ *
+ * Usage: osgearth_imagebench [--size n] [--iterations n]
+ */
+
+namespace
+{
+    typedef ImageUtils::PixelReader PixelReader;
+    typedef ImageUtils::PixelWriter PixelWriter;
+
+    osg::Image* makeImage( int size, GLenum format, const osg::Vec4& color )
+    {
+        osg::Image* image = new osg::Image();
+        image->allocateImage( size, size, 1, format, GL_UNSIGNED_BYTE );
+        image->setInternalTextureFormat( format );
+        PixelWriter write( image );
+        for( int t=0; t<size; ++t )
+            for( int s=0; s<size; ++s )
+                write( color, s, t );
+        return image;
+    }
+
+    bool sameData( const osg::Image* a, const osg::Image* b )
+    {
+        return
+            a->getTotalSizeInBytes() == b->getTotalSizeInBytes() &&
+            ::memcmp( a->data(), b->data(), a->getTotalSizeInBytes() ) == 0;
+    }
+
+    // --- the per-pixel implementations ---
+
+    void oldCopyAsSubImage( const osg::Image* src, osg::Image* dst )
+    {
+        PixelReader read(src);
+        PixelWriter write(dst);
+        for( int t=0; t<src->t(); ++t )
+            for( int s=0; s<src->s(); ++s )
+                write( read(s, t), s, t );
+    }
+
+    void oldResizeImage( const osg::Image* input, unsigned out_s, unsigned out_t, osg::ref_ptr<osg::Image>& output )
+    {
+        output = new osg::Image();
+        output->allocateImage( out_s, out_t, 1, input->getPixelFormat(), input->getDataType(), input->getPacking() );
+        output->setInternalTextureFormat( input->getInternalTextureFormat() );
+
+        PixelReader read( input );
+        PixelWriter write( output.get() );
+        unsigned in_s = input->s(), in_t = input->t();
+
+        for( unsigned output_row=0; output_row < out_t; output_row++ )
+        {
+            int input_row = osg::minimum( (unsigned)((float)output_row/(float)out_t * (float)in_t), in_t-1 );
+            for( unsigned output_col=0; output_col < out_s; output_col++ )
+            {
+                int input_col = osg::minimum( (unsigned)((float)output_col/(float)out_s * (float)in_s), in_s-1 );
+                write( read(input_col, input_row), output_col, output_row );
+            }
+        }
+    }
+
+    bool oldIsEmptyImage( const osg::Image* image, float alphaThreshold )
+    {
+        PixelReader read(image);
+        for( int t=0; t<image->t(); ++t )
+            for( int s=0; s<image->s(); ++s )
+                if ( read(s, t).a() > alphaThreshold )
+                    return false;
+        return true;
+    }
+
+    bool oldIsSingleColorImage( const osg::Image* image, float threshold )
+    {
+        PixelReader read(image);
+        osg::Vec4 ref = read(0, 0);
+        for( int t=0; t<image->t(); ++t )
+        {
+            for( int s=0; s<image->s(); ++s )
+            {
+                osg::Vec4 color = read(s, t);
+                if (fabs(color.r()-ref.r()) > threshold || fabs(color.g()-ref.g()) > threshold ||
+                    fabs(color.b()-ref.b()) > threshold || fabs(color.a()-ref.a()) > threshold )
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    bool oldHasTransparency( const osg::Image* image, float threshold )
+    {
+        PixelReader read(image);
+        for( int t=0; t<image->t(); ++t )
+            for( int s=0; s<image->s(); ++s )
+                if ( read(s, t).a() < threshold )
+                    return true;
+        return false;
+    }
+
+    void oldConvertToPremultipliedAlpha( osg::Image* image )
+    {
+        PixelReader read(image);
+        PixelWriter write(image);
+        for( int s=0; s<image->s(); ++s ) {
+            for( int t=0; t<image->t(); ++t ) {
+                osg::Vec4f c = read(s, t);
+                write( osg::Vec4f(c.r()*c.a(), c.g()*c.a(), c.b()*c.a(), c.a()), s, t );
+            }
+        }
+    }
+
+    // --- timing ---
+
+    struct Bench
+    {
+        Bench( unsigned iterations ) : _iterations( iterations ) { }
+
+        void start() { _start = osg::Timer::instance()->tick(); }
+
+        // milliseconds per iteration since start()
+        double stop() { return osg::Timer::instance()->delta_m( _start, osg::Timer::instance()->tick() ) / (double)_iterations; }
+
+        void report( const std::string& name, double oldMs, double newMs, bool same )
+        {
+            OE_NOTICE << LC << name
+                << ": old = " << oldMs << " ms"
+                << ", new = " << newMs << " ms"
+                << ", speedup = " << (newMs > 0.0 ? oldMs/newMs : 0.0)
+                << (same ? "" : "  ** RESULTS DIFFER **")
+                << std::endl;
+        }
+
+        unsigned     _iterations;
+        osg::Timer_t _start;
+    };
+}
+
+int main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc,argv);
+
+    int size = 256;
+    arguments.read("--size", size);
+
+    unsigned iterations = 100;
+    arguments.read("--iterations", iterations);
+
+    if ( size < 2 || iterations == 0 )
+    {
+        OE_NOTICE << "USAGE: osgearth_imagebench [--size n] [--iterations n]" << std::endl;
+        return -1;
+    }
+
+    OE_NOTICE << LC << size << "x" << size << " images, " << iterations << " iterations" << std::endl;
+
+    Bench bench( iterations );
+    double oldMs, newMs;
+
+    osg::Vec4 gray( 0.5f, 0.5f, 0.5f, 0.5f );
+    osg::ref_ptr<osg::Image> rgb       = makeImage( size, GL_RGB,  osg::Vec4(0.2f, 0.4f, 0.6f, 1.0f) );
+    osg::ref_ptr<osg::Image> rgba      = makeImage( size, GL_RGBA, gray );
+    osg::ref_ptr<osg::Image> clear     = makeImage( size, GL_RGBA, osg::Vec4(0,0,0,0) );
+    osg::ref_ptr<osg::Image> opaque    = makeImage( size, GL_RGBA, osg::Vec4(1,1,1,1) );
+
+    // copyAsSubImage, RGB into RGBA (so it takes the converting path):
+    {
+        osg::ref_ptr<osg::Image> oldDst = makeImage( size, GL_RGBA, gray );
+        osg::ref_ptr<osg::Image> newDst = makeImage( size, GL_RGBA, gray );
+
+        bench.start();
+        for( unsigned i=0; i<iterations; ++i )
+            oldCopyAsSubImage( rgb.get(), oldDst.get() );
+        oldMs = bench.stop();
+
+        bench.start();
+        for( unsigned i=0; i<iterations; ++i )
+            ImageUtils::copyAsSubImage( rgb.get(), newDst.get(), 0, 0 );
+        newMs = bench.stop();
+
+        bench.report( "copyAsSubImage", oldMs, newMs, sameData(oldDst.get(), newDst.get()) );
+    }
+
+    // resizeImage, to half size:
+    {
+        osg::ref_ptr<osg::Image> oldOut, newOut;
+
+        bench.start();
+        for( unsigned i=0; i<iterations; ++i )
+            oldResizeImage( rgba.get(), size/2, size/2, oldOut );
+        oldMs = bench.stop();
+
+        bench.start();
+        for( unsigned i=0; i<iterations; ++i )
+        {
+            newOut = 0L;
+            ImageUtils::resizeImage( rgba.get(), size/2, size/2, newOut );
+        }
+        newMs = bench.stop();
+
+        bench.report( "resizeImage", oldMs, newMs, sameData(oldOut.get(), newOut.get()) );
+    }
+
+    // the predicates, on images that make them scan every pixel:
+    {
+        bool oldResult = false, newResult = false;
+
+        bench.start();
+        for( unsigned i=0; i<iterations; ++i )
+            oldResult = oldIsEmptyImage( clear.get(), 0.01f );
+        oldMs = bench.stop();
+
+        bench.start();
+        for( unsigned i=0; i<iterations; ++i )
+            newResult = ImageUtils::isEmptyImage( clear.get(), 0.01f );
+        newMs = bench.stop();
+
+        bench.report( "isEmptyImage", oldMs, newMs, oldResult == newResult );
+
+        bench.start();
+        for( unsigned i=0; i<iterations; ++i )
+            oldResult = oldIsSingleColorImage( rgba.get(), 0.01f );
+        oldMs = bench.stop();
+
+        bench.start();
+        for( unsigned i=0; i<iterations; ++i )
+            newResult = ImageUtils::isSingleColorImage( rgba.get(), 0.01f );
+        newMs = bench.stop();
+
+        bench.report( "isSingleColorImage", oldMs, newMs, oldResult == newResult );
+
+        bench.start();
+        for( unsigned i=0; i<iterations; ++i )
+            oldResult = oldHasTransparency( opaque.get(), 1.0f );
+        oldMs = bench.stop();
+
+        bench.start();
+        for( unsigned i=0; i<iterations; ++i )
+            newResult = ImageUtils::hasTransparency( opaque.get(), 1.0f );
+        newMs = bench.stop();
+
+        bench.report( "hasTransparency", oldMs, newMs, oldResult == newResult );
+    }
+
+    // convertToPremultipliedAlpha; the result changes with each call, so
+    // compare the two after the same number of calls.
+    {
+        osg::ref_ptr<osg::Image> oldImage = makeImage( size, GL_RGBA, gray );
+        osg::ref_ptr<osg::Image> newImage = makeImage( size, GL_RGBA, gray );
+
+        bench.start();
+        for( unsigned i=0; i<iterations; ++i )
+            oldConvertToPremultipliedAlpha( oldImage.get() );
+        oldMs = bench.stop();
+
+        bench.start();
+        for( unsigned i=0; i<iterations; ++i )
+            ImageUtils::convertToPremultipliedAlpha( newImage.get() );
+        newMs = bench.stop();
+
+        bench.report( "convertToPremultipliedAlpha", oldMs, newMs, sameData(oldImage.get(), newImage.get()) );
+    }
+
+    return 0;
+}
@@ -30,6 +30,7 @@
 #include <osgEarth/HTTPClient>
 #include <osgEarthUtil/TMSPackager>
 #include <osgEarthDrivers/tms/TMSOptions>
+#include <osgEarthDrivers/mbtiles/MBTilesOptions>
 
 #include <iostream>
 #include <sstream>
@@ -66,6 +67,10 @@ usage( const std::string& msg = "" )
         << "            [--keep-empties]                : writes out fully transparent image tiles (normally discarded)\n"
         << "            [--continue-single-color]       : continues to subdivide single color tiles, subdivision typicall stops on single color images\n"
         << "            [--db-options]                : db options string to pass to the image writer in quotes (e.g., \"JPEG_QUALITY 60\")\n"
+        << "            [--fetch-threads <num>]         : number of threads that fetch tiles (default=4)\n"
+        << "            [--encode-threads <num>]        : number of threads that encode tiles (default=number of processors)\n"
+        << "            [--write-threads <num>]         : number of threads that write tiles to disk (default=1)\n"
+        << "            [--mbtiles]                     : writes each image layer to an MBTiles file instead of a TMS folder\n"
         << std::endl
         << "         [--quiet]               : suppress progress output" << std::endl;
 
@@ -159,6 +164,15 @@ makeTMS( osg::ArgumentParser& args )
 
     bool continueSingleColor = args.read("--continue-single-color");
 
+    // write MBTiles databases instead of TMS folders
+    bool mbtiles = args.read("--mbtiles");
+
+    // pipeline worker counts
+    unsigned fetchThreads = 0, encodeThreads = 0, writeThreads = 0;
+    args.read( "--fetch-threads", fetchThreads );
+    args.read( "--encode-threads", encodeThreads );
+    args.read( "--write-threads", writeThreads );
+
     // load up the map
     osg::ref_ptr<MapNode> mapNode = MapNode::load( args );
     if ( !mapNode.valid() )
@@ -182,6 +196,13 @@ makeTMS( osg::ArgumentParser& args )
     if ( maxLevel != ~0 )
         packager.setMaxLevel( maxLevel );
 
+    if ( fetchThreads > 0 )
+        packager.setNumFetchThreads( fetchThreads );
+    if ( encodeThreads > 0 )
+        packager.setNumEncodeThreads( encodeThreads );
+    if ( writeThreads > 0 )
+        packager.setNumWriteThreads( writeThreads );
+
     if (bounds.size() > 0)
     {
         for (unsigned int i = 0; i < bounds.size(); ++i)
@@ -224,6 +245,51 @@ makeTMS( osg::ArgumentParser& args )
                 OE_NOTICE << LC << "Packaging image layer \"" << layerFolder << "\"" << std::endl;
             }
 
+            if ( mbtiles )
+            {
+                std::string layerFile = osgDB::concatPaths( rootFolder, layerFolder + ".mbtiles" );
+
+                MBTilesOptions mbOptions;
+                mbOptions.filename() = layerFile;
+                mbOptions.writable() = true;
+                if ( !extension.empty() )
+                    mbOptions.format() = extension;
+
+                osg::ref_ptr<TileSource> output = TileSourceFactory::create( mbOptions );
+                if ( !output.valid() || output->startup(0L) != TileSource::STATUS_OK )
+                {
+                    OE_WARN << LC << "Failed to create MBTiles database \"" << layerFile << "\"" << std::endl;
+                    continue;
+                }
+
+                TMSPackager::Result r = packager.package( layer, output.get() );
+
+                // releasing the source commits the last batch of tiles.
+                output = 0L;
+
+                if ( r.ok )
+                {
+                    if ( outMap.valid() )
+                    {
+                        MBTilesOptions mbReadOptions;
+                        mbReadOptions.filename() = osgDB::getRealPath( layerFile );
+                        if ( !extension.empty() )
+                            mbReadOptions.format() = extension;
+
+                        ImageLayerOptions layerOptions( layer->getName(), mbReadOptions );
+                        layerOptions.mergeConfig( layer->getInitialOptions().getConfig(true) );
+                        layerOptions.cachePolicy() = CachePolicy::NO_CACHE;
+
+                        outMap->addImageLayer( new ImageLayer(layerOptions) );
+                    }
+                }
+                else
+                {
+                    OE_WARN << LC << r.message << std::endl;
+                }
+                continue;
+            }
+
             std::string layerRoot = osgDB::concatPaths( rootFolder, layerFolder );
             TMSPackager::Result r = packager.package( layer, layerRoot, extension );
             if ( r.ok )
@@ -263,7 +329,11 @@ makeTMS( osg::ArgumentParser& args )
     for( ElevationLayerVector::iterator i = elevationLayers.begin(); i != elevationLayers.end(); ++i, ++counter )
     {
         ElevationLayer* layer = i->get();
-        if ( layer->getElevationLayerOptions().enabled() == true )
+        if ( mbtiles )
+        {
+            OE_NOTICE << LC << "Skipping elevation layer \"" << layer->getName() << "\"; MBTiles holds imagery only" << std::endl;
+        }
+        else if ( layer->getElevationLayerOptions().enabled() == true )
         {
             std::string layerFolder = toLegalFileName( layer->getName() );
             if ( layerFolder.empty() )
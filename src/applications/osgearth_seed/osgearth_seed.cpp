@@ -35,6 +35,7 @@
 #include <iostream>
 #include <sstream>
 #include <iterator>
+#include <map>
 
 using namespace osgEarth;
 using namespace osgEarth::Drivers;
@@ -86,6 +87,10 @@ usage( const std::string& msg )
         << "        [--index shapefile]             ; Use the feature extents in a shapefile to set the bounding boxes for seeding" << std::endl
         << "        [--cache-path path]             ; Overrides the cache path in the .earth file" << std::endl
         << "        [--cache-type type]             ; Overrides the cache type in the .earth file" << std::endl
+        << "        [--threads num]                 ; Number of tiles to fetch at the same time (default=1)" << std::endl
+        << "        [--journal file]                ; Records progress in a file, and resumes from it if it exists" << std::endl
+        << "        [--rate-limit tiles]            ; Maximum tiles per second to request from each layer" << std::endl
+        << "        [--layer-rate-limit name tiles]*; Maximum tiles per second to request from the named layer" << std::endl
         << std::endl
         << "    --purge file.earth                  ; Purges a layer cache in a .earth file (interactive)" << std::endl
         << std::endl;
@@ -137,6 +142,26 @@ seed( osg::ArgumentParser& args )
 
     bool verbose = args.read("--verbose");
 
+    //Read the number of seeding threads
+    unsigned int numThreads = 1;
+    while (args.read("--threads", numThreads));
+
+    //Read the journal file
+    std::string journal;
+    while (args.read("--journal", journal));
+
+    //Read the rate limits
+    double rateLimit = 0.0;
+    while (args.read("--rate-limit", rateLimit));
+
+    std::map<std::string, double> layerRateLimits;
+    std::string layerName;
+    double layerRateLimit;
+    while (args.read("--layer-rate-limit", layerName, layerRateLimit))
+    {
+        layerRateLimits[layerName] = layerRateLimit;
+    }
+
     //Read in the earth file.
     osg::ref_ptr<osg::Node> node = osgDB::readNodeFiles( args );
     if ( !node.valid() )
@@ -199,7 +224,13 @@ seed( osg::ArgumentParser& args )
     CacheSeed seeder;
     seeder.setMinLevel( minLevel );
     seeder.setMaxLevel( maxLevel );
-
+    seeder.setNumThreads( numThreads );
+    seeder.setJournal( journal );
+    seeder.setRateLimit( rateLimit );
+    for (std::map<std::string, double>::const_iterator i = layerRateLimits.begin(); i != layerRateLimits.end(); ++i)
+    {
+        seeder.setRateLimit( i->first, i->second );
+    }
 
     for (unsigned int i = 0; i < bounds.size(); i++)
     {
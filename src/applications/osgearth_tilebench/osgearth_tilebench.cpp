@@ -0,0 +1,166 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+* Copyright 2008-2013 Pelican Mapping
+* http://osgearth.org
+*
+* osgEarth is free software; you can redistribute it and/or modify
+* it under the terms of the GNU Lesser General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU Lesser General Public License for more details.
+*
+* You should have received a copy of the GNU Lesser General Public License
+* along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <OpenThreads/Thread>
+#include <OpenThreads/Atomic>
+
+#include <osgEarth/Notify>
+#include <osgEarth/TileSource>
+#include <osgEarth/TaskService>
+#include <osgEarthDrivers/gdal/GDALOptions>
+
+#include <vector>
+
+#define LC "[osgearth_tilebench] "
+
+using namespace osgEarth;
+using namespace osgEarth::Drivers;
+
+/**
+ * Measures how TileSource::createImage throughput scales with the number
+ * of threads calling it at once, reading a raster through the GDAL driver.
+ *
+ * Usage: osgearth_tilebench <raster file> [--lod n] [--max-tiles n] [--threads n] [--passes n]
+ */
+
+namespace
+{
+    struct CreateImage
+    {
+        CreateImage( TileSource* source, const std::vector<TileKey>& keys ) :
+            _source( source ), _keys( keys ) { }
+
+        void operator()( unsigned i )
+        {
+            osg::ref_ptr<osg::Image> image = _source->createImage( _keys[i] );
+            if ( !image.valid() )
+                ++_failures;
+        }
+
+        TileSource*                 _source;
+        const std::vector<TileKey>& _keys;
+        OpenThreads::Atomic         _failures;
+    };
+
+    int usage( const std::string& msg )
+    {
+        OE_NOTICE
+            << msg << std::endl
+            << "USAGE: osgearth_tilebench <raster file>" << std::endl
+            << "    [--lod n]           LOD of the tiles to create (default: 8)" << std::endl
+            << "    [--max-tiles n]     Tiles per pass (default: 1024)" << std::endl
+            << "    [--threads n]       Highest number of threads to try (default: number of cores)" << std::endl
+            << "    [--passes n]        Passes per thread count; the best one is reported (default: 3)" << std::endl;
+        return -1;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc,argv);
+
+    unsigned lod = 8;
+    arguments.read("--lod", lod);
+
+    unsigned maxTiles = 1024;
+    arguments.read("--max-tiles", maxTiles);
+
+    unsigned maxThreads = osg::maximum( OpenThreads::GetNumberOfProcessors(), 1 );
+    arguments.read("--threads", maxThreads);
+    maxThreads = osg::maximum( maxThreads, 1u );
+
+    unsigned passes = 3;
+    arguments.read("--passes", passes);
+
+    if ( arguments.argc() < 2 || arguments.isOption(1) )
+        return usage( "Please specify a raster file." );
+
+    GDALOptions gdalOptions;
+    gdalOptions.url() = arguments[1];
+
+    osg::ref_ptr<TileSource> source = TileSourceFactory::create( gdalOptions );
+    if ( !source.valid() || source->startup(0L) != TileSource::STATUS_OK || !source->getProfile() )
+        return usage( "Failed to open the raster." );
+
+    // the tiles at the LOD that have data, up to the limit:
+    std::vector<TileKey> allKeys, keys;
+    source->getProfile()->getAllKeysAtLOD( lod, allKeys );
+    for( unsigned i=0; i<allKeys.size() && keys.size() < maxTiles; ++i )
+    {
+        if ( source->hasData(allKeys[i]) )
+            keys.push_back( allKeys[i] );
+    }
+
+    if ( keys.empty() )
+        return usage( "No tiles with data at that LOD." );
+
+    OE_NOTICE << LC << keys.size() << " tiles at LOD " << lod << std::endl;
+
+    // warm up the GDAL block cache and the driver, so the first thread count
+    // isn't penalized.
+    {
+        CreateImage warmup( source.get(), keys );
+        parallel_for( (TaskService*)0L, 0, keys.size(), warmup );
+        if ( warmup._failures > 0 )
+            OE_NOTICE << LC << "Warning: " << (unsigned)warmup._failures << " tiles failed" << std::endl;
+    }
+
+    // powers of two, then the maximum.
+    std::vector<unsigned> threadCounts;
+    for( unsigned t = 1; t < maxThreads; t *= 2 )
+        threadCounts.push_back( t );
+    threadCounts.push_back( maxThreads );
+
+    double baseRate = 0.0;
+
+    for( unsigned c=0; c<threadCounts.size(); ++c )
+    {
+        unsigned threads = threadCounts[c];
+
+        // parallel_for runs on the calling thread too, so it needs one worker less.
+        osg::ref_ptr<TaskService> service;
+        if ( threads > 1 )
+            service = new TaskService( "osgearth_tilebench", threads-1 );
+
+        double best = 0.0;
+        for( unsigned p=0; p<passes; ++p )
+        {
+            CreateImage work( source.get(), keys );
+            osg::Timer_t start = osg::Timer::instance()->tick();
+            parallel_for( service.get(), 0, keys.size(), work );
+            double seconds = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+
+            if ( seconds > 0.0 )
+                best = osg::maximum( best, (double)keys.size() / seconds );
+        }
+
+        if ( threads == 1 )
+            baseRate = best;
+
+        OE_NOTICE << LC
+            << "threads = " << threads
+            << ", tiles/s = " << best
+            << ", speedup = " << (baseRate > 0.0 ? best/baseRate : 0.0)
+            << std::endl;
+    }
+
+    return 0;
+}
@@ -20,7 +20,16 @@
 #include <osgEarth/CacheSeed>
 #include <osgEarth/CacheEstimator>
 #include <osgEarth/MapFrame>
+#include <OpenThreads/Condition>
+#include <OpenThreads/Mutex>
 #include <OpenThreads/ScopedLock>
+#include <OpenThreads/Thread>
+#include <osg/Timer>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <set>
+#include <sstream>
 #include <limits.h>
 
 #define LC "[CacheSeed] "
@@ -28,11 +37,145 @@
 using namespace osgEarth;
 using namespace OpenThreads;
 
+namespace
+{
+    // Once the work queue holds this many keys, workers take the most recently
+    // queued (deepest) keys instead of the oldest ones. Those subtrees then
+    // drain depth-first, which keeps the queue from growing with the width
+    // of the pyramid.
+    const unsigned MAX_QUEUE_SIZE = 4096;
+
+    // Subtrees rooted this many levels above the max level (or higher) are
+    // recorded in the journal when they complete.
+    const unsigned JOURNAL_DEPTH = 4;
+
+    /**
+     * Spaces out requests to one layer so they don't exceed a number of
+     * tiles per second, across all seeding threads.
+     */
+    struct RateLimiter : public osg::Referenced
+    {
+        RateLimiter( double tilesPerSecond ) :
+            _interval( 1.0/tilesPerSecond ),
+            _next    ( osg::Timer::instance()->tick() ) { }
+
+        void acquire()
+        {
+            double wait = 0.0;
+            {
+                ScopedLock<Mutex> lock( _mutex );
+                osg::Timer* timer = osg::Timer::instance();
+                osg::Timer_t now = timer->tick();
+                if ( _next > now )
+                {
+                    wait = timer->delta_s( now, _next );
+                    _next += (osg::Timer_t)(_interval / timer->getSecondsPerTick());
+                }
+                else
+                {
+                    _next = now + (osg::Timer_t)(_interval / timer->getSecondsPerTick());
+                }
+            }
+            if ( wait > 0.0 )
+                OpenThreads::Thread::microSleep( (unsigned)(wait * 1.0e6) );
+        }
+
+        double       _interval;
+        osg::Timer_t _next;
+        Mutex        _mutex;
+    };
+
+    typedef std::map< UID, osg::ref_ptr<RateLimiter> > RateLimiters;
+
+    std::string formatDuration( double seconds )
+    {
+        unsigned s = (unsigned)seconds;
+        std::stringstream buf;
+        buf << std::setfill('0') << std::setw(2) << (s/3600) << ":"
+            << std::setw(2) << ((s/60)%60) << ":" << std::setw(2) << (s%60);
+        return buf.str();
+    }
+}
+
+//------------------------------------------------------------------------
+
+struct CacheSeed::SeedState
+{
+    SeedState() : _active(0), _canceled(false), _completed(0), _journalLevel(0) { }
+
+    // work queue: keys waiting to be cached, and keys whose children are still
+    // in progress (with the number of children left).
+    Mutex                         _mutex;
+    Condition                     _cond;
+    std::deque<TileKey>           _queue;
+    std::map<TileKey, unsigned>   _pending;
+    unsigned                      _active;
+    bool                          _canceled;
+
+    // progress reporting
+    Mutex                         _progressMutex;
+    unsigned                      _completed;
+    osg::Timer_t                  _startTime;
+
+    // journal of completed subtrees
+    std::set<TileKey>             _journaled;
+    std::ofstream                 _journal;
+    unsigned                      _journalLevel;
+
+    RateLimiters                  _rateLimiters;
+
+    bool isJournaled( const TileKey& key ) const
+    {
+        return _journaled.find( key ) != _journaled.end();
+    }
+
+    // Called with _mutex held when a key and everything below it is done.
+    void completeSubtree( const TileKey& key )
+    {
+        if ( _journal.is_open() && key.getLevelOfDetail() <= _journalLevel )
+        {
+            unsigned x, y;
+            key.getTileXY( x, y );
+            _journal << key.getLevelOfDetail() << " " << x << " " << y << std::endl;
+        }
+
+        if ( key.getLevelOfDetail() > 0 )
+        {
+            std::map<TileKey, unsigned>::iterator i = _pending.find( key.createParentKey() );
+            if ( i != _pending.end() && --i->second == 0 )
+            {
+                TileKey parent = i->first;
+                _pending.erase( i );
+                completeSubtree( parent );
+            }
+        }
+    }
+};
+
+struct CacheSeed::SeedThread : public OpenThreads::Thread
+{
+    SeedThread( const CacheSeed* seed, const MapFrame& mapf, SeedState& state ) :
+        _seed( seed ), _mapf( mapf, "CacheSeed::SeedThread" ), _state( state ) { }
+
+    void run()
+    {
+        _seed->runWorker( _mapf, _state );
+    }
+
+    const CacheSeed* _seed;
+    MapFrame         _mapf;
+    SeedState&       _state;
+};
+
+//------------------------------------------------------------------------
+
 CacheSeed::CacheSeed():
-_minLevel (0),
-_maxLevel (12),
-_total    (0),
-_completed(0)
+_minLevel  (0),
+_maxLevel  (12),
+_total     (0),
+_completed (0),
+_numThreads(1),
+_rateLimit (0.0)
 {
 }
 
@@ -154,84 +297,205 @@ void CacheSeed::seed( Map* map )
 
     OE_INFO << "Processing ~" << _total << " tiles" << std::endl;
 
+    SeedState state;
+
+    // per-layer rate limits:
+    for( ImageLayerVector::const_iterator i = mapf.imageLayers().begin(); i != mapf.imageLayers().end(); ++i )
+    {
+        std::map<std::string, double>::const_iterator r = _layerRateLimits.find( i->get()->getName() );
+        double rate = r != _layerRateLimits.end() ? r->second : _rateLimit;
+        if ( rate > 0.0 )
+            state._rateLimiters[i->get()->getUID()] = new RateLimiter( rate );
+    }
+    for( ElevationLayerVector::const_iterator i = mapf.elevationLayers().begin(); i != mapf.elevationLayers().end(); ++i )
+    {
+        std::map<std::string, double>::const_iterator r = _layerRateLimits.find( i->get()->getName() );
+        double rate = r != _layerRateLimits.end() ? r->second : _rateLimit;
+        if ( rate > 0.0 )
+            state._rateLimiters[i->get()->getUID()] = new RateLimiter( rate );
+    }
+
+    // pick up the subtrees finished by a previous run, then keep appending:
+    if ( !_journal.empty() )
+    {
+        std::ifstream in( _journal.c_str() );
+        unsigned lod, x, y;
+        while( in >> lod >> x >> y )
+        {
+            state._journaled.insert( TileKey(lod, x, y, map->getProfile()) );
+        }
+        if ( !state._journaled.empty() )
+        {
+            OE_NOTICE << LC << "Resuming; skipping " << state._journaled.size()
+                << " completed subtrees listed in " << _journal << std::endl;
+        }
+
+        state._journal.open( _journal.c_str(), std::ios::out | std::ios::app );
+        if ( !state._journal.is_open() )
+        {
+            OE_WARN << LC << "Cannot write to journal " << _journal << "; progress will not be recorded" << std::endl;
+        }
+        state._journalLevel = _maxLevel > JOURNAL_DEPTH ? _maxLevel - JOURNAL_DEPTH : 0;
+    }
+
     for (unsigned int i = 0; i < keys.size(); ++i)
     {
-        processKey( mapf, keys[i] );
+        if ( !state.isJournaled(keys[i]) )
+            state._queue.push_back( keys[i] );
     }
 
+    state._startTime = osg::Timer::instance()->tick();
+
+    // the calling thread is one of the workers.
+    std::vector<SeedThread*> threads;
+    for( unsigned i = 1; i < _numThreads; ++i )
+    {
+        threads.push_back( new SeedThread(this, mapf, state) );
+        threads.back()->start();
+    }
+
+    runWorker( mapf, state );
+
+    for( unsigned i = 0; i < threads.size(); ++i )
+    {
+        threads[i]->join();
+        delete threads[i];
+    }
+
+    _completed = state._completed;
     _total = _completed;
 
     if ( _progress.valid()) _progress->reportProgress(_completed, _total, 0, 1, "Finished");
 }
 
-void CacheSeed::incrementCompleted( unsigned int total ) const
-{    
-    CacheSeed* nonconst_this = const_cast<CacheSeed*>(this);
-    nonconst_this->_completed += total;
-}
-
 void
-CacheSeed::processKey(const MapFrame& mapf, const TileKey& key ) const
+CacheSeed::runWorker( const MapFrame& mapf, SeedState& state ) const
 {
-    unsigned int x, y, lod;
-    key.getTileXY(x, y);
-    lod = key.getLevelOfDetail();
-
-    bool gotData = true;
-
-    if ( _minLevel <= lod && _maxLevel >= lod )
+    for(;;)
     {
-        gotData = cacheTile( mapf, key );
-        if (gotData)
+        TileKey key;
         {
-        incrementCompleted( 1 );
-        }
+            ScopedLock<Mutex> lock( state._mutex );
 
-        if ( _progress.valid() && _progress->isCanceled() )
-            return; // Task has been cancelled by user
+            // an empty queue only means we're done once nobody is working on
+            // a key that might queue more.
+            while( state._queue.empty() && state._active > 0 && !state._canceled )
+                state._cond.wait( &state._mutex );
 
-        if ( _progress.valid() && gotData && _progress->reportProgress(_completed, _total, std::string("Cached tile: ") + key.str()) )
-            return; // Canceled
-    }
+            if ( state._canceled || state._queue.empty() )
+            {
+                state._cond.broadcast();
+                return;
+            }
 
-    if ( gotData && lod <= _maxLevel )
-    {
-        TileKey k0 = key.createChildKey(0);
-        TileKey k1 = key.createChildKey(1);
-        TileKey k2 = key.createChildKey(2);
-        TileKey k3 = key.createChildKey(3); 
+            if ( state._queue.size() < MAX_QUEUE_SIZE )
+            {
+                key = state._queue.front();
+                state._queue.pop_front();
+            }
+            else
+            {
+                key = state._queue.back();
+                state._queue.pop_back();
+            }
+            ++state._active;
+        }
 
-        bool intersectsKey = false;
-        if (_extents.empty()) intersectsKey = true;
-        else
+        unsigned int lod = key.getLevelOfDetail();
+
+        bool gotData  = true;
+        bool canceled = false;
+
+        if ( _minLevel <= lod && _maxLevel >= lod )
         {
-            for (unsigned int i = 0; i < _extents.size(); ++i)
+            gotData = cacheTile( mapf, key, state );
+
+            if ( _progress.valid() && _progress->isCanceled() )
+            {
+                canceled = true; // Task has been cancelled by user
+            }
+            else if ( gotData )
             {
-                if (_extents[i].intersects( k0.getExtent() ) ||
-                    _extents[i].intersects( k1.getExtent() ) ||
-                    _extents[i].intersects( k2.getExtent() ) ||
-                    _extents[i].intersects( k3.getExtent() ))
+                ScopedLock<Mutex> lock( state._progressMutex );
+                ++state._completed;
+                if ( _progress.valid() )
                 {
-                    intersectsKey = true;
+                    double elapsed = osg::Timer::instance()->delta_s( state._startTime, osg::Timer::instance()->tick() );
+                    double rate = elapsed > 0.0 ? (double)state._completed / elapsed : 0.0;
+                    double remaining = _total > state._completed ? (double)(_total - state._completed) : 0.0;
+
+                    std::stringstream msg;
+                    msg << "Cached tile: " << key.str()
+                        << " (" << std::fixed << std::setprecision(1) << rate << " tiles/s, ETA "
+                        << (rate > 0.0 ? formatDuration(remaining / rate) : std::string("--:--:--")) << ")";
+
+                    if ( _progress->reportProgress(state._completed, _total, msg.str()) )
+                        canceled = true;
                 }
+            }
+        }
+
+        std::vector<TileKey> children;
+        if ( !canceled && gotData && lod < _maxLevel && childrenIntersectExtents(key) )
+        {
+            //The bounds intersect at least one of the tile's children, so process all of them
+            for( unsigned q = 0; q < 4; ++q )
+            {
+                TileKey child = key.createChildKey( q );
+                if ( !state.isJournaled(child) )
+                    children.push_back( child );
+            }
+        }
+
+        {
+            ScopedLock<Mutex> lock( state._mutex );
+            --state._active;
 
+            if ( canceled )
+            {
+                state._canceled = true;
+            }
+            else if ( children.empty() )
+            {
+                state.completeSubtree( key );
             }
+            else
+            {
+                state._pending[key] = children.size();
+                state._queue.insert( state._queue.end(), children.begin(), children.end() );
+            }
+
+            state._cond.broadcast();
         }
+    }
+}
+
+bool
+CacheSeed::childrenIntersectExtents( const TileKey& key ) const
+{
+    if ( _extents.empty() )
+        return true;
+
+    TileKey k0 = key.createChildKey(0);
+    TileKey k1 = key.createChildKey(1);
+    TileKey k2 = key.createChildKey(2);
+    TileKey k3 = key.createChildKey(3);
 
-        //Check to see if the bounds intersects ANY of the tile's children.  If it does, then process all of the children
-        //for this level
-        if (intersectsKey)
+    for (unsigned int i = 0; i < _extents.size(); ++i)
+    {
+        if (_extents[i].intersects( k0.getExtent() ) ||
+            _extents[i].intersects( k1.getExtent() ) ||
+            _extents[i].intersects( k2.getExtent() ) ||
+            _extents[i].intersects( k3.getExtent() ))
         {
-            processKey(mapf, k0);
-            processKey(mapf, k1);
-            processKey(mapf, k2);
-            processKey(mapf, k3);
+            return true;
         }
     }
+    return false;
 }
 
 bool
-CacheSeed::cacheTile(const MapFrame& mapf, const TileKey& key ) const
+CacheSeed::cacheTile(const MapFrame& mapf, const TileKey& key, SeedState& state ) const
 {
     bool gotData = false;
 
@@ -240,6 +504,10 @@ CacheSeed::cacheTile(const MapFrame& mapf, const TileKey& key ) const
         ImageLayer* layer = i->get();
         if ( layer->isKeyValid( key ) )
         {
+            RateLimiters::iterator r = state._rateLimiters.find( layer->getUID() );
+            if ( r != state._rateLimiters.end() )
+                r->second->acquire();
+
             GeoImage image = layer->createImage( key );
             if ( image.valid() )
                 gotData = true;
@@ -248,6 +516,15 @@ CacheSeed::cacheTile(const MapFrame& mapf, const TileKey& key ) const
 
     if ( mapf.elevationLayers().size() > 0 )
     {
+        // the heightfield composites every elevation layer, so it counts
+        // against each of their limits.
+        for( ElevationLayerVector::const_iterator i = mapf.elevationLayers().begin(); i != mapf.elevationLayers().end(); ++i )
+        {
+            RateLimiters::iterator r = state._rateLimiters.find( i->get()->getUID() );
+            if ( r != state._rateLimiters.end() )
+                r->second->acquire();
+        }
+
         osg::ref_ptr<osg::HeightField> hf;
         mapf.getHeightField( key, false, hf );
         if ( hf.valid() )
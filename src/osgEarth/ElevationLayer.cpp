@@ -18,7 +18,9 @@
  */
 #include <osgEarth/ElevationLayer>
 #include <osgEarth/VerticalDatum>
+#include <osgEarth/HeightFieldCodec>
 #include <osgEarth/HeightFieldUtils>
+#include <osgEarth/IOTypes>
 #include <osgEarth/Progress>
 #include <osg/Version>
 
@@ -47,6 +49,7 @@ void
 ElevationLayerOptions::setDefaults()
 {
     _offset = false;
+    _cachePrecision.init( 0.1f );
 }
 
 Config
@@ -54,6 +57,7 @@ ElevationLayerOptions::getConfig( bool isolate ) const
 {
     Config conf = TerrainLayerOptions::getConfig( isolate );
     conf.updateIfSet("offset", _offset);
+    conf.updateIfSet("cache_precision", _cachePrecision);
     return conf;
 }
 
@@ -61,6 +65,7 @@ void
 ElevationLayerOptions::fromConfig( const Config& conf )
 {
     conf.getIfSet( "offset", _offset );
+    conf.getIfSet( "cache_precision", _cachePrecision );
 }
 
 void
@@ -129,13 +134,9 @@ ElevationLayer::init()
 std::string
 ElevationLayer::suggestCacheFormat() const
 {
-#if OSG_MIN_VERSION_REQUIRED(2,8,0)
-        //OSG 2.8 onwards should use TIF for heightfields
-        return "tif";
-#else
-        //OSG 2.8 and below should use DDS
-        return "dds";
-#endif
+    // heightfields are cached with the HeightFieldCodec unless the layer's
+    // cache_format says otherwise; any other format stores raw heightfields.
+    return "quantized";
 }
 
 void
@@ -200,6 +201,14 @@ ElevationLayer::createHeightFieldFromTileSource(const TileKey&    key,
         return 0L;
     }
 
+    // Likewise if the source already told us it has no data there.
+    TileAvailability* avail = getTileAvailability( key.getProfile() );
+    if ( avail->get( key ) == TileAvailability::MISSING )
+    {
+        OE_DEBUG << LC << "Tile " << key.str() << " is known to be missing " << std::endl;
+        return 0L;
+    }
+
     // If the profiles are horizontally equivalent (different vdatums is OK), take the
     // quick route:
     if ( key.getProfile()->isHorizEquivalentTo( getProfile() ) )
@@ -211,8 +220,10 @@ ElevationLayer::createHeightFieldFromTileSource(const TileKey&    key,
             return 0L;
         }
 
-        // Make it from the source:
-        result = source->createHeightField( key, _preCacheOp.get(), progress );
+        // Make it from the source, tracking this request on its own since
+        // "progress" may be shared:
+        osg::ref_ptr<RequestProgressCallback> request = new RequestProgressCallback( progress );
+        result = source->createHeightField( key, _preCacheOp.get(), request.get() );
 
         // If the result is good, we how have a heightfield but it's vertical values
         // are still relative to the tile source's vertical datum. Convert them.
@@ -228,10 +239,16 @@ ElevationLayer::createHeightFieldFromTileSource(const TileKey&    key,
             }
         }
         
-        // Blacklist the tile if it is the same projection as the source and we can't get it and it wasn't cancelled
-        if ( !result && (!progress || !progress->isCanceled()))
+        // If the source says there is no data here, remember that in the availability
+        // index (which persists to the cache). Otherwise blacklist the tile if it is the
+        // same projection as the source and we can't get it and it wasn't cancelled;
+        // the failure may be transient, so the blacklist is not persisted.
+        if ( !result && !request->isCanceled() )
         {
-            source->getBlacklist()->add( key.getTileId() );
+            if ( request->dataMissing() )
+                avail->set( key, TileAvailability::MISSING );
+            else
+                source->getBlacklist()->add( key.getTileId() );
         }
     }
 
@@ -426,7 +443,13 @@ ElevationLayer::createHeightField(const TileKey&    key,
         ReadResult r = cacheBin->readObject( key.str() );
         if ( r.succeeded() )
         {
-            result = r.release<osg::HeightField>();
+            // entries written before the quantized format are raw heightfields.
+            const StringObject* encoded = r.get<StringObject>();
+            if ( encoded )
+                result = HeightFieldCodec().decode( encoded->getString() );
+            else
+                result = r.release<osg::HeightField>();
+
             if ( result )
                 fromCache = true;
         }
@@ -451,13 +474,33 @@ ElevationLayer::createHeightField(const TileKey&    key,
         result = createHeightFieldFromTileSource( key, progress );
     }
 
+    // remember that this tile has data so that fallback walks can jump to it.
+    // (createHeightFieldFromTileSource records the definitive misses.)
+    if ( result )
+    {
+        getTileAvailability( key.getProfile() )->set( key, TileAvailability::AVAILABLE );
+    }
+
     // cache if necessary
     if ( result        && 
          cacheBin      && 
          !fromCache    &&
          getCachePolicy().isCacheWriteable() )
     {
-        cacheBin->write( key.str(), result );
+        std::string format = _runtimeOptions.cacheFormat().isSet() ?
+            *_runtimeOptions.cacheFormat() : suggestCacheFormat();
+
+        std::string encoded;
+        if ( format == "quantized" &&
+             HeightFieldCodec(*_runtimeOptions.cachePrecision()).encode(result, encoded) )
+        {
+            osg::ref_ptr<StringObject> obj = new StringObject( encoded );
+            cacheBin->write( key.str(), obj.get() );
+        }
+        else
+        {
+            cacheBin->write( key.str(), result );
+        }
     }
 
     if ( result )
@@ -570,13 +613,16 @@ ElevationLayerVector::createHeightField(const TileKey&                  key,
             // if "fallback" is set, try to fall back on lower LODs.
             if ( !geoHF.valid() && fallback )
             {
-                TileKey hf_key = keyToUse.createParentKey();
+                // the availability index lets us jump straight past ancestors
+                // that are already known to be empty.
+                TileAvailability* avail = layer->getTileAvailability( keyToUse.getProfile() );
+                TileKey hf_key = avail->getFallbackKey( keyToUse );
 
                 while ( hf_key.valid() && !geoHF.valid() )
                 {
                     geoHF = layer->createHeightField( hf_key, progress );
                     if ( !geoHF.valid() )
-                        hf_key = hf_key.createParentKey();
+                        hf_key = avail->getFallbackKey( hf_key );
                 }
 
                 if ( geoHF.valid() )
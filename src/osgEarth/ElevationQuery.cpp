@@ -3,6 +3,7 @@
 #include <osgEarth/HeightFieldUtils>
 #include <osgUtil/IntersectionVisitor>
 #include <osgUtil/LineSegmentIntersector>
+#include <set>
 
 #define LC "[ElevationQuery] "
 
@@ -171,14 +172,16 @@ ElevationQuery::getElevations(std::vector<osg::Vec3d>& points,
                               double                   desiredResolution )
 {
     sync();
-    for( osg::Vec3dArray::iterator i = points.begin(); i != points.end(); ++i )
+
+    std::vector<double>        elevations;
+    std::vector<unsigned char> valid;
+    getElevationsImpl( points, pointsSRS, elevations, valid, desiredResolution );
+
+    for( unsigned i=0; i<points.size(); ++i )
     {
-        double elevation;
-        double z = (*i).z();
-        GeoPoint p(pointsSRS, *i, ALTMODE_ABSOLUTE);
-        if ( getElevationImpl( p, elevation, desiredResolution ) )
+        if ( valid[i] )
         {
-            (*i).z() = ignoreZ ? elevation : elevation + z;
+            points[i].z() = ignoreZ ? elevations[i] : elevations[i] + points[i].z();
         }
     }
     return true;
@@ -191,23 +194,436 @@ ElevationQuery::getElevations(const std::vector<osg::Vec3d>& points,
                               double                         desiredResolution )
 {
     sync();
-    for( osg::Vec3dArray::const_iterator i = points.begin(); i != points.end(); ++i )
+
+    std::vector<double>        elevations;
+    std::vector<unsigned char> valid;
+    getElevationsImpl( points, pointsSRS, elevations, valid, desiredResolution );
+
+    out_elevations.reserve( out_elevations.size() + points.size() );
+    for( unsigned i=0; i<points.size(); ++i )
+    {
+        out_elevations.push_back( valid[i] ? elevations[i] : 0.0 );
+    }
+    return true;
+}
+
+bool
+ElevationQuery::hasDataExtents() const
+{
+    for( ElevationLayerVector::const_iterator i = _mapf.elevationLayers().begin(); i != _mapf.elevationLayers().end(); ++i )
+    {
+        TileSource* ts = i->get()->getTileSource();
+        if ( ts && ts->getDataExtents().size() > 0 )
+            return true;
+    }
+    for( ImageLayerVector::const_iterator i = _mapf.imageLayers().begin(); i != _mapf.imageLayers().end(); ++i )
+    {
+        TileSource* ts = i->get()->getTileSource();
+        if ( ts && ts->getDataExtents().size() > 0 )
+            return true;
+    }
+    return false;
+}
+
+namespace
+{
+    /** All the points in a batch that fall within the same tile. */
+    struct TileGroup
     {
-        double elevation;
-        GeoPoint p(pointsSRS, *i, ALTMODE_ABSOLUTE);
+        TileGroup() : _fetched(false) { }
+        TileKey                        _key;
+        std::vector<unsigned>          _indices;
+        osg::ref_ptr<osg::HeightField> _tile;
+        bool                           _fetched;
+    };
+
+    /**
+     * Fetches the heightfield for a tile group (unless it came from the cache)
+     * and samples every point in the group.
+     */
+    struct SampleTileGroup
+    {
+        SampleTileGroup() : _group(0L), _mapf(0L), _points(0L), _elevations(0L), _valid(0L) { }
 
-        if ( getElevationImpl(p, elevation, desiredResolution) )
+        void execute()
         {
-            out_elevations.push_back( elevation );
+            if ( !_group->_tile.valid() )
+            {
+                _mapf->getHeightField( _group->_key, true, _group->_tile, 0L );
+                if ( !_group->_tile.valid() )
+                {
+                    OE_WARN << LC << "Unable to create heightfield for key " << _group->_key.str() << std::endl;
+                    return;
+                }
+                _group->_fetched = true;
+            }
+
+            const osg::HeightField* tile = _group->_tile.get();
+            const GeoExtent& extent = _group->_key.getExtent();
+            double xInterval = extent.width()  / (double)(tile->getNumColumns()-1);
+            double yInterval = extent.height() / (double)(tile->getNumRows()-1);
+            ElevationInterpolation interp = _mapf->getMapInfo().getElevationInterpolation();
+
+            for( std::vector<unsigned>::const_iterator i = _group->_indices.begin(); i != _group->_indices.end(); ++i )
+            {
+                const osg::Vec3d& p = (*_points)[*i];
+                (*_elevations)[*i] = (double)HeightFieldUtils::getHeightAtLocation(
+                    tile,
+                    p.x(), p.y(),
+                    extent.xMin(), extent.yMin(),
+                    xInterval, yInterval, interp );
+                (*_valid)[*i] = 1;
+            }
         }
-        else
+
+        TileGroup*                     _group;
+        const MapFrame*                _mapf;
+        const std::vector<osg::Vec3d>* _points;
+        std::vector<double>*           _elevations;
+        std::vector<unsigned char>*    _valid;
+    };
+
+    /**
+     * Runs a SampleTileGroup over each group, spread across the task service
+     * if there is one.
+     */
+    struct SampleTileGroups
+    {
+        void operator()( unsigned i )
         {
-            out_elevations.push_back( 0.0 );
+            SampleTileGroup sampler( _sampler );
+            sampler._group = &(*_groups)[i];
+            sampler.execute();
         }
+
+        std::vector<TileGroup>* _groups;
+        SampleTileGroup         _sampler;
+    };
+
+    void runTileGroups(std::vector<TileGroup>&        groups,
+                       const MapFrame&                mapf,
+                       TaskService*                   service,
+                       const std::vector<osg::Vec3d>* points,
+                       std::vector<double>*           elevations,
+                       std::vector<unsigned char>*    valid)
+    {
+        SampleTileGroups op;
+        op._groups              = &groups;
+        op._sampler._mapf       = &mapf;
+        op._sampler._points     = points;
+        op._sampler._elevations = elevations;
+        op._sampler._valid      = valid;
+        parallel_for( service, 0u, groups.size(), op );
     }
+}
+
+bool
+ElevationQuery::getElevationsImpl(const std::vector<osg::Vec3d>& points,
+                                  const SpatialReference*        pointsSRS,
+                                  std::vector<double>&           out_elevations,
+                                  std::vector<unsigned char>&    out_valid,
+                                  double                         desiredResolution)
+{
+    osg::Timer_t start = osg::Timer::instance()->tick();
+
+    unsigned count = points.size();
+    out_elevations.assign( count, 0.0 );
+    out_valid.assign( count, 0 );
+
+    if ( count == 0 )
+        return true;
+
+    if ( _mapf.elevationLayers().empty() )
+    {
+        // this means there are no heightfields.
+        out_valid.assign( count, 1 );
+        return true;
+    }
+
+    const Profile*          profile = _mapf.getProfile();
+    const SpatialReference* mapSRS  = profile->getSRS();
+
+    // transform all the input coords to map coords in a single pass. If the
+    // batch transform reports a failure, redo it point by point so we can
+    // tell which ones failed.
+    std::vector<osg::Vec3d>    mapPoints( points );
+    std::vector<unsigned char> transformed( count, 1 );
+
+    if ( pointsSRS && !pointsSRS->isEquivalentTo(mapSRS) )
+    {
+        if ( !pointsSRS->transform(mapPoints, mapSRS) )
+        {
+            for( unsigned i=0; i<count; ++i )
+            {
+                if ( !pointsSRS->transform(points[i], mapSRS, mapPoints[i]) )
+                    transformed[i] = 0;
+            }
+        }
+    }
+
+    // the desired resolution caps the LOD for every point alike:
+    int desiredLevel = -1;
+    if ( desiredResolution > 0.0 )
+        desiredLevel = (int)profile->getLevelOfDetailForHorizResolution( desiredResolution, _tileSize );
+
+    // without any data extents the best available level does not depend on
+    // the location, so compute it once for the whole batch.
+    bool perPointLevel = hasDataExtents();
+    unsigned sharedLevel = perPointLevel ? 0 : getMaxLevel( 0.0, 0.0, mapSRS, profile );
+
+    // group the points by the tile that contains them:
+    typedef std::map< TileKey, unsigned > KeyIndex;
+    KeyIndex keyIndex;
+    std::vector<TileGroup> groups;
+
+    for( unsigned i=0; i<count; ++i )
+    {
+        if ( !transformed[i] )
+        {
+            OE_WARN << LC << "Fail: coord transform failed" << std::endl;
+            continue;
+        }
+
+        const osg::Vec3d& p = mapPoints[i];
+
+        unsigned bestAvailLevel = perPointLevel ? getMaxLevel( p.x(), p.y(), mapSRS, profile ) : sharedLevel;
+        if ( desiredLevel >= 0 && (unsigned)desiredLevel < bestAvailLevel )
+            bestAvailLevel = (unsigned)desiredLevel;
+
+        TileKey key = profile->createTileKey( p.x(), p.y(), bestAvailLevel );
+        if ( !key.valid() )
+        {
+            OE_WARN << LC << "Fail: coords fall outside map" << std::endl;
+            continue;
+        }
+
+        KeyIndex::iterator k = keyIndex.find( key );
+        if ( k == keyIndex.end() )
+        {
+            k = keyIndex.insert( std::make_pair(key, (unsigned)groups.size()) ).first;
+            groups.push_back( TileGroup() );
+            groups.back()._key = key;
+        }
+        groups[k->second]._indices.push_back( i );
+    }
+
+    // resolve whatever tiles we already have in the LRU cache:
+    for( std::vector<TileGroup>::iterator g = groups.begin(); g != groups.end(); ++g )
+    {
+        TileCache::Record record;
+        if ( _tileCache.get(g->_key, record) )
+            g->_tile = record.value().get();
+    }
+
+    // fetch and sample each tile group, in parallel if possible:
+    runTileGroups( groups, _mapf, _taskService.get(), &mapPoints, &out_elevations, &out_valid );
+
+    // populate the LRU cache with the newly fetched tiles:
+    for( std::vector<TileGroup>::iterator g = groups.begin(); g != groups.end(); ++g )
+    {
+        if ( g->_fetched && g->_tile.valid() )
+            _tileCache.insert( g->_key, g->_tile.get() );
+    }
+
+    osg::Timer_t end = osg::Timer::instance()->tick();
+    _queries   += (double)count;
+    _totalTime += osg::Timer::instance()->delta_s( start, end );
+
     return true;
 }
 
+unsigned
+ElevationQuery::getQueryLevel(const osg::Vec3d& mapPoint, int desiredLevel) const
+{
+    const Profile* profile = _mapf.getProfile();
+    unsigned level = getMaxLevel( mapPoint.x(), mapPoint.y(), profile->getSRS(), profile );
+    if ( desiredLevel >= 0 && (unsigned)desiredLevel < level )
+        level = (unsigned)desiredLevel;
+    return level;
+}
+
+bool
+ElevationQuery::prefetch(const std::vector<osg::Vec3d>& path,
+                         const SpatialReference*        pathSRS,
+                         double                         desiredResolution)
+{
+    sync();
+
+    if ( path.empty() || _mapf.elevationLayers().empty() )
+        return true;
+
+    const Profile*          profile = _mapf.getProfile();
+    const SpatialReference* mapSRS  = profile->getSRS();
+
+    std::vector<osg::Vec3d> mapPath( path );
+    if ( pathSRS && !pathSRS->isEquivalentTo(mapSRS) )
+    {
+        if ( !pathSRS->transform(mapPath, mapSRS) )
+        {
+            OE_WARN << LC << "Prefetch: path transform failed" << std::endl;
+            return false;
+        }
+    }
+
+    int desiredLevel = -1;
+    if ( desiredResolution > 0.0 )
+        desiredLevel = (int)profile->getLevelOfDetailForHorizResolution( desiredResolution, _tileSize );
+
+    // densify the path so consecutive samples are at most half a tile apart at
+    // the query level. That way the samples land in every tile the path crosses
+    // (save perhaps a clipped corner, which will just be fetched on demand).
+    std::vector<osg::Vec3d> samples;
+    samples.reserve( mapPath.size() );
+
+    for( unsigned i=0; i<mapPath.size(); ++i )
+    {
+        const osg::Vec3d& a = mapPath[i];
+        samples.push_back( a );
+
+        if ( i+1 < mapPath.size() )
+        {
+            osg::Vec3d delta = mapPath[i+1] - a;
+            delta.z() = 0.0;
+
+            double tileWidth, tileHeight;
+            profile->getTileDimensions( getQueryLevel(a, desiredLevel), tileWidth, tileHeight );
+            double spacing = 0.5 * osg::minimum( tileWidth, tileHeight );
+
+            unsigned steps = spacing > 0.0 ? (unsigned)ceil( delta.length() / spacing ) : 1u;
+            for( unsigned k=1; k<steps; ++k )
+            {
+                samples.push_back( a + delta * ((double)k / (double)steps) );
+            }
+        }
+    }
+
+    return prefetchImpl( samples, desiredLevel );
+}
+
+bool
+ElevationQuery::prefetch(const GeoExtent& extent,
+                         double           desiredResolution)
+{
+    sync();
+
+    if ( !extent.isValid() || _mapf.elevationLayers().empty() )
+        return true;
+
+    const Profile* profile = _mapf.getProfile();
+
+    GeoExtent mapExtent = profile->clampAndTransformExtent( extent );
+    if ( !mapExtent.isValid() )
+    {
+        OE_WARN << LC << "Prefetch: extent transform failed" << std::endl;
+        return false;
+    }
+
+    int desiredLevel = -1;
+    if ( desiredResolution > 0.0 )
+        desiredLevel = (int)profile->getLevelOfDetailForHorizResolution( desiredResolution, _tileSize );
+
+    std::vector<GeoExtent> parts;
+    GeoExtent west, east;
+    if ( mapExtent.crossesAntimeridian() && mapExtent.splitAcrossAntimeridian(west, east) )
+    {
+        parts.push_back( west );
+        parts.push_back( east );
+    }
+    else
+    {
+        parts.push_back( mapExtent );
+    }
+
+    // lay a grid of samples over the extent, one per tile at the level of
+    // the extent's center, and include the far edges.
+    std::vector<osg::Vec3d> samples;
+
+    for( std::vector<GeoExtent>::const_iterator part = parts.begin(); part != parts.end(); ++part )
+    {
+        double tileWidth, tileHeight;
+        profile->getTileDimensions( getQueryLevel(part->getCentroid(), desiredLevel), tileWidth, tileHeight );
+        if ( tileWidth <= 0.0 || tileHeight <= 0.0 )
+            continue;
+
+        unsigned cols = (unsigned)ceil( part->width()  / tileWidth  ) + 1;
+        unsigned rows = (unsigned)ceil( part->height() / tileHeight ) + 1;
+
+        for( unsigned r=0; r<rows; ++r )
+        {
+            double y = osg::minimum( part->yMin() + tileHeight*(double)r, part->yMax() );
+            for( unsigned c=0; c<cols; ++c )
+            {
+                double x = osg::minimum( part->xMin() + tileWidth*(double)c, part->xMax() );
+                samples.push_back( osg::Vec3d(x, y, 0.0) );
+            }
+        }
+    }
+
+    return prefetchImpl( samples, desiredLevel );
+}
+
+bool
+ElevationQuery::prefetchImpl(const std::vector<osg::Vec3d>& mapPoints,
+                             int                            desiredLevel)
+{
+    osg::Timer_t start = osg::Timer::instance()->tick();
+
+    const Profile* profile = _mapf.getProfile();
+
+    bool perPointLevel = hasDataExtents();
+    unsigned sharedLevel = perPointLevel ? 0 : getQueryLevel( osg::Vec3d(), desiredLevel );
+
+    // collect the distinct keys in path order, skipping anything we already have:
+    std::set<TileKey>      seen;
+    std::vector<TileGroup> groups;
+
+    for( std::vector<osg::Vec3d>::const_iterator p = mapPoints.begin(); p != mapPoints.end(); ++p )
+    {
+        unsigned level = perPointLevel ? getQueryLevel( *p, desiredLevel ) : sharedLevel;
+
+        TileKey key = profile->createTileKey( p->x(), p->y(), level );
+        if ( !key.valid() || !seen.insert(key).second )
+            continue;
+
+        TileCache::Record record;
+        if ( _tileCache.get(key, record) )
+            continue;
+
+        groups.push_back( TileGroup() );
+        groups.back()._key = key;
+    }
+
+    // prefetching more tiles than the LRU cache holds would just evict the
+    // beginning of the path before sampling gets to it.
+    unsigned maxTiles = (unsigned)_tileCache.getMaxSize();
+    if ( groups.size() > maxTiles )
+    {
+        OE_INFO << LC << "Prefetch needs " << groups.size() << " tiles but the cache only holds "
+            << maxTiles << "; prefetching the first " << maxTiles << std::endl;
+        groups.resize( maxTiles );
+    }
+
+    if ( groups.empty() )
+        return true;
+
+    // fetches run concurrently only if the caller installed a task service.
+    runTileGroups( groups, _mapf, _taskService.get(), 0L, 0L, 0L );
+
+    bool ok = true;
+    for( std::vector<TileGroup>::iterator g = groups.begin(); g != groups.end(); ++g )
+    {
+        if ( g->_fetched && g->_tile.valid() )
+            _tileCache.insert( g->_key, g->_tile.get() );
+        else
+            ok = false;
+    }
+
+    OE_DEBUG << LC << "Prefetched " << groups.size() << " tiles in "
+        << osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() ) << "s" << std::endl;
+
+    return ok;
+}
+
 bool
 ElevationQuery::getElevationImpl(const GeoPoint& point,
                                  double&         out_elevation,
@@ -25,6 +25,7 @@
 #include <osgEarth/Cube>
 #include <osgEarth/VerticalDatum>
 #include <osgEarth/Terrain>
+#include <osgEarth/Containers>
 
 #include <osg/Notify>
 #include <osg/Timer>
@@ -1417,17 +1418,20 @@ namespace
                    const std::string destWKT, double destMinX, double destMinY, double destMaxX, double destMaxY,
                    int width = 0, int height = 0, bool useBilinearInterpolation = true)
     {
-        GDAL_SCOPED_LOCK;
         osg::Timer_t start = osg::Timer::instance()->tick();
 
+        // The MEM datasets below are private to this call, so copying pixels in
+        // and out of them does not need the global lock. Only the coordinate
+        // transformation machinery used by the warper does.
+
         //Create a dataset from the source image
         GDALDataset* srcDS = createDataSetFromImage(srcImage, srcMinX, srcMinY, srcMaxX, srcMaxY, srcWKT);
 
         OE_DEBUG << LC << "Source image is " << srcImage->s() << "x" << srcImage->t() << std::endl;
 
-
         if (width == 0 || height == 0)
         {
+            GDAL_SCOPED_LOCK;
             double outgeotransform[6];
             double extents[4];
             void* transformer = GDALCreateGenImgProjTransformer(srcDS, srcWKT.c_str(), NULL, destWKT.c_str(), 1, 0, 0);
@@ -1444,18 +1448,11 @@ namespace
        
         GDALDataset* destDS = createMemDS(width, height, destMinX, destMinY, destMaxX, destMaxY, destWKT);
 
-        if (useBilinearInterpolation == true)
         {
+            GDAL_SCOPED_LOCK;
             GDALReprojectImage(srcDS, NULL,
                                destDS, NULL,
-                               GRA_Bilinear,
-                               0,0,0,0,0);
-        }
-        else
-        {
-            GDALReprojectImage(srcDS, NULL,
-                               destDS, NULL,
-                               GRA_NearestNeighbour,
+                               useBilinearInterpolation ? GRA_Bilinear : GRA_NearestNeighbour,
                                0,0,0,0,0);
         }
 
@@ -1472,6 +1469,390 @@ namespace
     }    
 
 
+    /**
+     * Grid of source-SRS coordinates, one per destination pixel, in row-major order.
+     */
+    struct SourceGrid : public osg::Referenced
+    {
+        std::vector<double> _x;
+        std::vector<double> _y;
+    };
+
+    /**
+     * Identifies a source grid: the (source SRS, destination SRS, destination extent)
+     * triple plus the destination image size. The source extent and image size are
+     * included too, since they determine the error bound of a sparse grid.
+     */
+    struct SourceGridKey
+    {
+        SpatialReference::Key _srcSRS;
+        SpatialReference::Key _destSRS;
+        double                _bounds[8];
+        unsigned              _width, _height;
+        int                   _srcWidth, _srcHeight;
+
+        bool operator < (const SourceGridKey& rhs) const
+        {
+            if ( _width  != rhs._width )  return _width  < rhs._width;
+            if ( _height != rhs._height ) return _height < rhs._height;
+            if ( _srcWidth  != rhs._srcWidth )  return _srcWidth  < rhs._srcWidth;
+            if ( _srcHeight != rhs._srcHeight ) return _srcHeight < rhs._srcHeight;
+            for( unsigned i=0; i<8; ++i )
+                if ( _bounds[i] != rhs._bounds[i] ) return _bounds[i] < rhs._bounds[i];
+            if ( _srcSRS != rhs._srcSRS ) return _srcSRS < rhs._srcSRS;
+            return _destSRS < rhs._destSRS;
+        }
+    };
+
+    typedef LRUCache< SourceGridKey, osg::ref_ptr<SourceGrid> > SourceGridCache;
+
+    // Neighboring layers and repeated requests reproject into the same destination
+    // tile over and over, so cache the most recent grids.
+    SourceGridCache& getSourceGridCache()
+    {
+        static SourceGridCache s_cache( true, 16 );
+        return s_cache;
+    }
+
+    // Spacing (in destination pixels) of the sparse grid that is transformed exactly.
+    const unsigned SPARSE_GRID_STEP = 16;
+
+    // Maximum error, in source pixels, tolerated when interpolating the sparse grid.
+    const double SPARSE_GRID_MAX_ERROR = 0.125;
+
+    /**
+     * Transforms every destination pixel center into the source SRS.
+     */
+    bool computeDenseSourceGrid(const GeoExtent&        src_extent,
+                                const GeoExtent&        dest_extent,
+                                unsigned                width,
+                                unsigned                height,
+                                SourceGrid*             grid)
+    {
+        const double dx = dest_extent.width() / (double)width;
+        const double dy = dest_extent.height() / (double)height;
+
+        std::vector<osg::Vec3d> points;
+        points.reserve( width*height );
+        for( unsigned r=0; r<height; ++r )
+        {
+            double y = dest_extent.yMin() + ((double)r + 0.5) * dy;
+            for( unsigned c=0; c<width; ++c )
+            {
+                points.push_back( osg::Vec3d(dest_extent.xMin() + ((double)c + 0.5) * dx, y, 0.0) );
+            }
+        }
+
+        if ( !dest_extent.getSRS()->transform(points, src_extent.getSRS()) )
+            return false;
+
+        grid->_x.resize( points.size() );
+        grid->_y.resize( points.size() );
+        for( unsigned i=0; i<points.size(); ++i )
+        {
+            grid->_x[i] = points[i].x();
+            grid->_y[i] = points[i].y();
+        }
+        return true;
+    }
+
+    /**
+     * Transforms a sparse lattice of destination pixel centers into the source SRS
+     * and bilinearly interpolates the rest. The interpolation is first checked at
+     * every lattice cell center; if the error exceeds the tolerance, returns false
+     * so the caller can fall back on the dense transform.
+     */
+    bool computeSparseSourceGrid(const GeoExtent&        src_extent,
+                                 const GeoExtent&        dest_extent,
+                                 const osg::Image*       image,
+                                 unsigned                width,
+                                 unsigned                height,
+                                 SourceGrid*             grid)
+    {
+        const unsigned step = SPARSE_GRID_STEP;
+        if ( width <= 2*step || height <= 2*step )
+            return false;
+
+        const double dx = dest_extent.width() / (double)width;
+        const double dy = dest_extent.height() / (double)height;
+
+        // lattice columns and rows; the last one is always the image edge.
+        std::vector<unsigned> cols, rows;
+        for( unsigned c=0; c<width-1; c += step ) cols.push_back( c );
+        cols.push_back( width-1 );
+        for( unsigned r=0; r<height-1; r += step ) rows.push_back( r );
+        rows.push_back( height-1 );
+
+        const unsigned nx = cols.size(), ny = rows.size();
+
+        // lattice points, followed by the cell centers we use to verify the error:
+        std::vector<osg::Vec3d> points;
+        points.reserve( nx*ny + (nx-1)*(ny-1) );
+        for( unsigned j=0; j<ny; ++j )
+            for( unsigned i=0; i<nx; ++i )
+                points.push_back( osg::Vec3d(
+                    dest_extent.xMin() + ((double)cols[i] + 0.5) * dx,
+                    dest_extent.yMin() + ((double)rows[j] + 0.5) * dy, 0.0) );
+
+        for( unsigned j=0; j<ny-1; ++j )
+            for( unsigned i=0; i<nx-1; ++i )
+                points.push_back( osg::Vec3d(
+                    dest_extent.xMin() + (0.5*(double)(cols[i]+cols[i+1]) + 0.5) * dx,
+                    dest_extent.yMin() + (0.5*(double)(rows[j]+rows[j+1]) + 0.5) * dy, 0.0) );
+
+        if ( !dest_extent.getSRS()->transform(points, src_extent.getSRS()) )
+            return false;
+
+        const osg::Vec3d* lattice = &points[0];
+        const osg::Vec3d* centers = &points[nx*ny];
+
+        const double xfac = (double)(image->s() - 1) / src_extent.width();
+        const double yfac = (double)(image->t() - 1) / src_extent.height();
+
+        for( unsigned j=0; j<ny-1; ++j )
+        {
+            for( unsigned i=0; i<nx-1; ++i )
+            {
+                osg::Vec3d mid =
+                    (lattice[j*nx+i] + lattice[j*nx+i+1] + lattice[(j+1)*nx+i] + lattice[(j+1)*nx+i+1]) * 0.25;
+                const osg::Vec3d& exact = centers[j*(nx-1)+i];
+                if ( fabs(mid.x() - exact.x()) * xfac > SPARSE_GRID_MAX_ERROR ||
+                     fabs(mid.y() - exact.y()) * yfac > SPARSE_GRID_MAX_ERROR )
+                {
+                    return false;
+                }
+            }
+        }
+
+        grid->_x.resize( width*height );
+        grid->_y.resize( width*height );
+
+        unsigned j = 0;
+        for( unsigned r=0; r<height; ++r )
+        {
+            while( j < ny-2 && r >= rows[j+1] ) ++j;
+            double v = (double)(r - rows[j]) / (double)(rows[j+1] - rows[j]);
+
+            const osg::Vec3d* lo = &lattice[j*nx];
+            const osg::Vec3d* hi = &lattice[(j+1)*nx];
+
+            double* outX = &grid->_x[r*width];
+            double* outY = &grid->_y[r*width];
+
+            unsigned i = 0;
+            for( unsigned c=0; c<width; ++c )
+            {
+                while( i < nx-2 && c >= cols[i+1] ) ++i;
+                double u = (double)(c - cols[i]) / (double)(cols[i+1] - cols[i]);
+
+                osg::Vec3d bottom = lo[i] * (1.0-u) + lo[i+1] * u;
+                osg::Vec3d top    = hi[i] * (1.0-u) + hi[i+1] * u;
+                outX[c] = bottom.x() * (1.0-v) + top.x() * v;
+                outY[c] = bottom.y() * (1.0-v) + top.y() * v;
+            }
+        }
+
+        return true;
+    }
+
+    /**
+     * Gets the source-SRS coordinates of every destination pixel, from the cache
+     * if possible.
+     */
+    bool getSourceGrid(const osg::Image*         image,
+                       const GeoExtent&          src_extent,
+                       const GeoExtent&          dest_extent,
+                       unsigned                  width,
+                       unsigned                  height,
+                       osg::ref_ptr<SourceGrid>& out_grid)
+    {
+        SourceGridKey key;
+        key._srcSRS    = src_extent.getSRS()->getKey();
+        key._destSRS   = dest_extent.getSRS()->getKey();
+        key._bounds[0] = dest_extent.xMin();
+        key._bounds[1] = dest_extent.yMin();
+        key._bounds[2] = dest_extent.xMax();
+        key._bounds[3] = dest_extent.yMax();
+        key._bounds[4] = src_extent.xMin();
+        key._bounds[5] = src_extent.yMin();
+        key._bounds[6] = src_extent.xMax();
+        key._bounds[7] = src_extent.yMax();
+        key._width     = width;
+        key._height    = height;
+        key._srcWidth  = image->s();
+        key._srcHeight = image->t();
+
+        SourceGridCache& cache = getSourceGridCache();
+        SourceGridCache::Record rec;
+        if ( cache.get(key, rec) )
+        {
+            out_grid = rec.value().get();
+            return true;
+        }
+
+        osg::ref_ptr<SourceGrid> grid = new SourceGrid();
+        if ( !computeSparseSourceGrid(src_extent, dest_extent, image, width, height, grid.get()) )
+        {
+            if ( !computeDenseSourceGrid(src_extent, dest_extent, width, height, grid.get()) )
+                return false;
+        }
+
+        cache.insert( key, grid.get() );
+        out_grid = grid.get();
+        return true;
+    }
+    /**
+     * Per-type bilinear blend of four source pixels into an 8-bit destination pixel.
+     * The 8-bit version works in 8.8 fixed point; both versions use fixed-size
+     * channel loops that the compiler can unroll and vectorize.
+     */
+    template<typename T> struct BilinearBlend;
+
+    template<> struct BilinearBlend<GLubyte>
+    {
+        template<unsigned N>
+        static void blend(const GLubyte* p00, const GLubyte* p10, const GLubyte* p01, const GLubyte* p11,
+                          float fx, float fy, GLubyte* out)
+        {
+            const unsigned wx = (unsigned)(fx * 256.0f + 0.5f), wx0 = 256u - wx;
+            const unsigned wy = (unsigned)(fy * 256.0f + 0.5f), wy0 = 256u - wy;
+            for( unsigned k=0; k<N; ++k )
+            {
+                unsigned bottom = p00[k]*wx0 + p10[k]*wx;
+                unsigned top    = p01[k]*wx0 + p11[k]*wx;
+                out[k] = (GLubyte)((bottom*wy0 + top*wy) >> 16);
+            }
+        }
+    };
+
+    template<> struct BilinearBlend<GLfloat>
+    {
+        template<unsigned N>
+        static void blend(const GLfloat* p00, const GLfloat* p10, const GLfloat* p01, const GLfloat* p11,
+                          float fx, float fy, GLubyte* out)
+        {
+            const float fx0 = 1.0f - fx, fy0 = 1.0f - fy;
+            for( unsigned k=0; k<N; ++k )
+            {
+                float bottom = p00[k]*fx0 + p10[k]*fx;
+                float top    = p01[k]*fx0 + p11[k]*fx;
+                out[k] = (GLubyte)((bottom*fy0 + top*fy) * 255.0f);
+            }
+        }
+    };
+
+    /**
+     * Row-major reprojection kernel for images whose channels map one-to-one
+     * between reading and writing. T is the source channel type and N the
+     * number of channels; the destination is always GL_UNSIGNED_BYTE.
+     */
+    template<typename T, unsigned N>
+    void reprojectRows(const osg::Image* image, const GeoExtent& src_extent, const SourceGrid* grid, osg::Image* result)
+    {
+        const int    s    = image->s();
+        const int    t    = image->t();
+        const double xMin = src_extent.xMin(), xMax = src_extent.xMax();
+        const double yMin = src_extent.yMin(), yMax = src_extent.yMax();
+        const double xfac = (double)(s - 1) / src_extent.width();
+        const double yfac = (double)(t - 1) / src_extent.height();
+
+        const unsigned char* srcData  = image->data();
+        const unsigned       srcRowSize = image->getRowSizeInBytes();
+
+        const unsigned width  = result->s();
+        const unsigned height = result->t();
+
+        for( unsigned r=0; r<height; ++r )
+        {
+            const double* gx  = &grid->_x[r*width];
+            const double* gy  = &grid->_y[r*width];
+            GLubyte*      out = result->data(0, r);
+
+            for( unsigned c=0; c<width; ++c, out += N )
+            {
+                const double src_x = gx[c];
+                const double src_y = gy[c];
+
+                // sample points outside the source extent stay transparent.
+                if ( src_x < xMin || src_x > xMax || src_y < yMin || src_y > yMax )
+                    continue;
+
+                const float px = (float)((src_x - xMin) * xfac);
+                const float py = (float)((src_y - yMin) * yfac);
+
+                const int x0 = osg::clampBetween( (int)floorf(px), 0, s-1 );
+                const int y0 = osg::clampBetween( (int)floorf(py), 0, t-1 );
+                const int x1 = osg::minimum( x0+1, s-1 );
+                const int y1 = osg::minimum( y0+1, t-1 );
+                const float fx = osg::clampBetween( px - (float)x0, 0.0f, 1.0f );
+                const float fy = osg::clampBetween( py - (float)y0, 0.0f, 1.0f );
+
+                const T* row0 = (const T*)(srcData + y0*srcRowSize);
+                const T* row1 = (const T*)(srcData + y1*srcRowSize);
+
+                BilinearBlend<T>::template blend<N>(
+                    row0 + x0*N, row0 + x1*N, row1 + x0*N, row1 + x1*N, fx, fy, out );
+            }
+        }
+    }
+
+    template<typename T>
+    bool reprojectRows(const osg::Image* image, const GeoExtent& src_extent, const SourceGrid* grid, osg::Image* result)
+    {
+        switch( osg::Image::computeNumComponents(image->getPixelFormat()) )
+        {
+        case 1: reprojectRows<T,1>(image, src_extent, grid, result); return true;
+        case 2: reprojectRows<T,2>(image, src_extent, grid, result); return true;
+        case 3: reprojectRows<T,3>(image, src_extent, grid, result); return true;
+        case 4: reprojectRows<T,4>(image, src_extent, grid, result); return true;
+        default: return false;
+        }
+    }
+
+    /**
+     * Format-agnostic fallback that reads and writes through the generic
+     * PixelReader/PixelWriter.
+     */
+    void reprojectRowsGeneric(const osg::Image* image, const GeoExtent& src_extent, const SourceGrid* grid, osg::Image* result)
+    {
+        ImageUtils::PixelReader ia(image);
+        ImageUtils::PixelWriter writer(result);
+
+        const int    s    = image->s();
+        const int    t    = image->t();
+        const double xfac = (double)(s - 1) / src_extent.width();
+        const double yfac = (double)(t - 1) / src_extent.height();
+
+        const unsigned width  = result->s();
+        const unsigned height = result->t();
+
+        for( unsigned r=0; r<height; ++r )
+        {
+            for( unsigned c=0; c<width; ++c )
+            {
+                const double src_x = grid->_x[r*width + c];
+                const double src_y = grid->_y[r*width + c];
+
+                if ( src_x < src_extent.xMin() || src_x > src_extent.xMax() || src_y < src_extent.yMin() || src_y > src_extent.yMax() )
+                    continue;
+
+                const float px = (float)((src_x - src_extent.xMin()) * xfac);
+                const float py = (float)((src_y - src_extent.yMin()) * yfac);
+
+                const int x0 = osg::clampBetween( (int)floorf(px), 0, s-1 );
+                const int y0 = osg::clampBetween( (int)floorf(py), 0, t-1 );
+                const int x1 = osg::minimum( x0+1, s-1 );
+                const int y1 = osg::minimum( y0+1, t-1 );
+                const float fx = osg::clampBetween( px - (float)x0, 0.0f, 1.0f );
+                const float fy = osg::clampBetween( py - (float)y0, 0.0f, 1.0f );
+
+                osg::Vec4 bottom = ia(x0, y0) * (1.0f-fx) + ia(x1, y0) * fx;
+                osg::Vec4 top    = ia(x0, y1) * (1.0f-fx) + ia(x1, y1) * fx;
+                writer( bottom * (1.0f-fy) + top * fy, c, r );
+            }
+        }
+    }
+
     osg::Image*
     manualReproject(
         const osg::Image* image, 
@@ -1488,164 +1869,47 @@ namespace
             height = osg::minimum(image->s(), image->t());
         }
 
-        // need to know this in order to choose the right interpolation algorithm
-        const bool isSrcContiguous = src_extent.getSRS()->isContiguous();
-
         osg::Image *result = new osg::Image();
-        //result->allocateImage(width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE);
         result->allocateImage(width, height, 1, image->getPixelFormat(), GL_UNSIGNED_BYTE);
 
         //Initialize the image to be completely transparent/black
         memset(result->data(), 0, result->getImageSizeInBytes());
 
-        //ImageUtils::PixelReader ra(result);
-        ImageUtils::PixelWriter writer(result);
-        const double dx = dest_extent.width() / (double)width;
-        const double dy = dest_extent.height() / (double)height;
-
-        // offset the sample points by 1/2 a pixel so we are sampling "pixel center".
-        // (This is especially useful in the UnifiedCubeProfile since it nullifes the chances for
-        // edge ambiguity.)
-
-        unsigned int numPixels = width * height;
-
-        // Start by creating a sample grid over the destination
-        // extent. These will be the source coordinates. Then, reproject
-        // the sample grid into the source coordinate system.
-        double *srcPointsX = new double[numPixels * 2];
-        double *srcPointsY = srcPointsX + numPixels;
-        dest_extent.getSRS()->transformExtentPoints(
-            src_extent.getSRS(),
-            dest_extent.xMin() + .5 * dx, dest_extent.yMin() + .5 * dy,
-            dest_extent.xMax() - .5 * dx, dest_extent.yMax() - .5 * dy,
-            srcPointsX, srcPointsY, width, height);
-
-        // Next, go through the source-SRS sample grid, read the color at each point from the source image,
-        // and write it to the corresponding pixel in the destination image.
-        int pixel = 0;
-        ImageUtils::PixelReader ia(image);
-        double xfac = (image->s() - 1) / src_extent.width();
-        double yfac = (image->t() - 1) / src_extent.height();
-        for (unsigned int c = 0; c < width; ++c)
+        // Get the location of each destination pixel center in the source SRS.
+        // We sample "pixel centers" to avoid edge ambiguity (especially in the
+        // UnifiedCubeProfile).
+        osg::ref_ptr<SourceGrid> grid;
+        if ( !getSourceGrid(image, src_extent, dest_extent, width, height, grid) )
         {
-            for (unsigned int r = 0; r < height; ++r)
-            {   
-                double src_x = srcPointsX[pixel];
-                double src_y = srcPointsY[pixel];
-
-                if ( src_x < src_extent.xMin() || src_x > src_extent.xMax() || src_y < src_extent.yMin() || src_y > src_extent.yMax() )
-                {
-                    //If the sample point is outside of the bound of the source extent, increment the pixel and keep looping through.
-                    //OE_WARN << LC << "ERROR: sample point out of bounds: " << src_x << ", " << src_y << std::endl;
-                    pixel++;
-                    continue;
-                }
-
-                float px = (src_x - src_extent.xMin()) * xfac;
-                float py = (src_y - src_extent.yMin()) * yfac;
-
-                int px_i = osg::clampBetween( (int)osg::round(px), 0, image->s()-1 );
-                int py_i = osg::clampBetween( (int)osg::round(py), 0, image->t()-1 );
-
-                osg::Vec4 color(0,0,0,0);
-
-                // TODO: consider this again later. Causes blockiness.
-                if ( false ) //! isSrcContiguous ) // non-contiguous space- use nearest neighbot
-                {
-                    color = ia(px_i, py_i);
-                }
-
-                else // contiguous space - use bilinear sampling
-                {
-                    int rowMin = osg::maximum((int)floor(py), 0);
-                    int rowMax = osg::maximum(osg::minimum((int)ceil(py), (int)(image->t()-1)), 0);
-                    int colMin = osg::maximum((int)floor(px), 0);
-                    int colMax = osg::maximum(osg::minimum((int)ceil(px), (int)(image->s()-1)), 0);
-
-                    if (rowMin > rowMax) rowMin = rowMax;
-                    if (colMin > colMax) colMin = colMax;
-
-                    osg::Vec4 urColor = ia(colMax, rowMax);
-                    osg::Vec4 llColor = ia(colMin, rowMin);
-                    osg::Vec4 ulColor = ia(colMin, rowMax);
-                    osg::Vec4 lrColor = ia(colMax, rowMin);
-
-                    /*Average Interpolation*/
-                    /*double x_rem = px - (int)px;
-                    double y_rem = py - (int)py;
-
-                    double w00 = (1.0 - y_rem) * (1.0 - x_rem);
-                    double w01 = (1.0 - y_rem) * x_rem;
-                    double w10 = y_rem * (1.0 - x_rem);
-                    double w11 = y_rem * x_rem;
-                    double wsum = w00 + w01 + w10 + w11;
-                    wsum = 1.0/wsum;
-
-                    color.r() = (w00 * llColor.r() + w01 * lrColor.r() + w10 * ulColor.r() + w11 * urColor.r()) * wsum;
-                    color.g() = (w00 * llColor.g() + w01 * lrColor.g() + w10 * ulColor.g() + w11 * urColor.g()) * wsum;
-                    color.b() = (w00 * llColor.b() + w01 * lrColor.b() + w10 * ulColor.b() + w11 * urColor.b()) * wsum;
-                    color.a() = (w00 * llColor.a() + w01 * lrColor.a() + w10 * ulColor.a() + w11 * urColor.a()) * wsum;*/
-
-                    /*Nearest Neighbor Interpolation*/
-                    /*if (px_i >= 0 && px_i < image->s() &&
-                    py_i >= 0 && py_i < image->t())
-                    {
-                    //OE_NOTICE << "[osgEarth::GeoData] Sampling pixel " << px << "," << py << std::endl;
-                    color = ImageUtils::getColor(image, px_i, py_i);
-                    }
-                    else
-                    {
-                    OE_NOTICE << "[osgEarth::GeoData] Pixel out of range " << px_i << "," << py_i << "  image is " << image->s() << "x" << image->t() << std::endl;
-                    }*/
-
-                    /*Bilinear interpolation*/
-                    //Check for exact value
-                    if ((colMax == colMin) && (rowMax == rowMin))
-                    {
-                        //OE_NOTICE << "[osgEarth::GeoData] Exact value" << std::endl;
-                        color = ia(px_i, py_i);
-                    }
-                    else if (colMax == colMin)
-                    {
-                        //OE_NOTICE << "[osgEarth::GeoData] Vertically" << std::endl;
-                        //Linear interpolate vertically
-                        for (unsigned int i = 0; i < 4; ++i)
-                        {
-                            color[i] = ((float)rowMax - py) * llColor[i] + (py - (float)rowMin) * ulColor[i];
-                        }
-                    }
-                    else if (rowMax == rowMin)
-                    {
-                        //OE_NOTICE << "[osgEarth::GeoData] Horizontally" << std::endl;
-                        //Linear interpolate horizontally
-                        for (unsigned int i = 0; i < 4; ++i)
-                        {
-                            color[i] = ((float)colMax - px) * llColor[i] + (px - (float)colMin) * lrColor[i];
-                        }
-                    }
-                    else
-                    {
-                        //OE_NOTICE << "[osgEarth::GeoData] Bilinear" << std::endl;
-                        //Bilinear interpolate
-                        float col1 = colMax - px, col2 = px - colMin;
-                        float row1 = rowMax - py, row2 = py - rowMin;
-                        for (unsigned int i = 0; i < 4; ++i)
-                        {
-                            float r1 = col1 * llColor[i] + col2 * lrColor[i];
-                            float r2 = col1 * ulColor[i] + col2 * urColor[i];
-
-                            //OE_INFO << "r1, r2 = " << r1 << " , " << r2 << std::endl;
-                            color[i] = row1 * r1 + row2 * r2;
-                        }
-                    }
-                }
+            OE_WARN << LC << "manualReproject: failed to transform sample grid" << std::endl;
+            return result;
+        }
 
-                writer(color, c, r);
-                pixel++;
-            }
+        // Walk the destination in row-major order, sampling the source with a
+        // kernel specialized for its format when one is available.
+        bool done = false;
+        switch( image->getPixelFormat() )
+        {
+        case GL_LUMINANCE:
+        case GL_ALPHA:
+        case GL_LUMINANCE_ALPHA:
+        case GL_RGB:
+        case GL_RGBA:
+        case GL_BGR:
+        case GL_BGRA:
+            if ( image->getDataType() == GL_UNSIGNED_BYTE )
+                done = reprojectRows<GLubyte>( image, src_extent, grid.get(), result );
+            else if ( image->getDataType() == GL_FLOAT )
+                done = reprojectRows<GLfloat>( image, src_extent, grid.get(), result );
+            break;
+        default:
+            break;
         }
 
-        delete[] srcPointsX;
+        if ( !done )
+        {
+            reprojectRowsGeneric( image, src_extent, grid.get(), result );
+        }
 
         return result;
     }
@@ -992,6 +992,12 @@ HTTPClient::doReadImage(const std::string&    location,
                 callback->setNeedsRetry( true );
             }
         }
+
+        // a 404 means the server has no such data, which will not change on a retry.
+        if ( callback && result.code() == ReadResult::RESULT_NOT_FOUND )
+        {
+            callback->setDataMissing( true );
+        }
     }
 
     // set the source name
@@ -1055,6 +1061,12 @@ HTTPClient::doReadNode(const std::string&    location,
                 callback->setNeedsRetry( true );
             }
         }
+
+        // a 404 means the server has no such data, which will not change on a retry.
+        if ( callback && result.code() == ReadResult::RESULT_NOT_FOUND )
+        {
+            callback->setDataMissing( true );
+        }
     }
 
     return result;
@@ -1114,6 +1126,12 @@ HTTPClient::doReadObject(const std::string&    location,
                 callback->setNeedsRetry( true );
             }
         }
+
+        // a 404 means the server has no such data, which will not change on a retry.
+        if ( callback && result.code() == ReadResult::RESULT_NOT_FOUND )
+        {
+            callback->setDataMissing( true );
+        }
     }
 
     return result;
@@ -1162,6 +1180,12 @@ HTTPClient::doReadString(const std::string&    location,
                 callback->setNeedsRetry( true );
             }
         }
+
+        // a 404 means the server has no such data, which will not change on a retry.
+        if ( callback && result.code() == ReadResult::RESULT_NOT_FOUND )
+        {
+            callback->setDataMissing( true );
+        }
     }
 
     return result;
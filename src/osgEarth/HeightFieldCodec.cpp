@@ -0,0 +1,319 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarth/HeightFieldCodec>
+#include <osgEarth/GeoCommon>
+#include <osg/Math>
+#include <vector>
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+
+#define LC "[HeightFieldCodec] "
+
+using namespace osgEarth;
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    const char     MAGIC[4] = { 'O', 'E', 'H', 'F' };
+    const unsigned VERSION  = 1;
+
+    // 4 magic + 4 version + 2x4 size + 5x8 origin/intervals + 4 skirt
+    // + 4 border + 3x4 min/max/step
+    const std::size_t HEADER_SIZE = 4 + 4 + 8 + 40 + 4 + 4 + 12;
+
+    // largest quantized height, so predictions and residuals fit easily in 64 bits.
+    const double MAX_QUANTIZED = 1073741824.0; // 2^30
+
+    // residual symbol reserved for NO_DATA_VALUE posts.
+    const unsigned long long NO_DATA_SYMBOL = 0;
+
+    // little-endian, so cached tiles can move between machines.
+    void writeU32( std::string& out, unsigned v )
+    {
+        for( unsigned i = 0; i < 4; ++i )
+            out.push_back( (char)((v >> (8*i)) & 0xff) );
+    }
+
+    void writeF32( std::string& out, float v )
+    {
+        unsigned bits;
+        std::memcpy( &bits, &v, 4 );
+        writeU32( out, bits );
+    }
+
+    void writeF64( std::string& out, double v )
+    {
+        unsigned long long bits;
+        std::memcpy( &bits, &v, 8 );
+        writeU32( out, (unsigned)(bits & 0xffffffffull) );
+        writeU32( out, (unsigned)(bits >> 32) );
+    }
+
+    void writeVarint( std::string& out, unsigned long long v )
+    {
+        while( v >= 0x80 )
+        {
+            out.push_back( (char)((v & 0x7f) | 0x80) );
+            v >>= 7;
+        }
+        out.push_back( (char)v );
+    }
+
+    struct Reader
+    {
+        Reader( const std::string& in ) : _p( (const unsigned char*)in.data() ), _end( _p + in.size() ) { }
+
+        bool readU32( unsigned& v )
+        {
+            if ( _end - _p < 4 ) return false;
+            v = (unsigned)_p[0] | ((unsigned)_p[1] << 8) | ((unsigned)_p[2] << 16) | ((unsigned)_p[3] << 24);
+            _p += 4;
+            return true;
+        }
+
+        bool readF32( float& v )
+        {
+            unsigned bits;
+            if ( !readU32(bits) ) return false;
+            std::memcpy( &v, &bits, 4 );
+            return true;
+        }
+
+        bool readF64( double& v )
+        {
+            unsigned lo, hi;
+            if ( !readU32(lo) || !readU32(hi) ) return false;
+            unsigned long long bits = ((unsigned long long)hi << 32) | lo;
+            std::memcpy( &v, &bits, 8 );
+            return true;
+        }
+
+        bool readVarint( unsigned long long& v )
+        {
+            v = 0;
+            for( unsigned shift = 0; shift < 64; shift += 7 )
+            {
+                if ( _p == _end ) return false;
+                unsigned char b = *_p++;
+                v |= (unsigned long long)(b & 0x7f) << shift;
+                if ( (b & 0x80) == 0 ) return true;
+            }
+            return false;
+        }
+
+        const unsigned char* _p;
+        const unsigned char* _end;
+    };
+
+    inline bool isNoData( float h )
+    {
+        return h == NO_DATA_VALUE || osg::isNaN(h);
+    }
+
+    // Gradient predictor: exact for planar terrain, and falls back to the
+    // one neighbor available along the first row and column.
+    inline long long predict( const std::vector<long long>& q, unsigned c, unsigned r, unsigned cols )
+    {
+        unsigned i = r*cols + c;
+        if ( c > 0 && r > 0 ) return q[i-1] + q[i-cols] - q[i-cols-1];
+        if ( c > 0 )          return q[i-1];
+        if ( r > 0 )          return q[i-cols];
+        return 0;
+    }
+
+    inline long long clampQ( long long v, long long maxQ )
+    {
+        return v < 0 ? 0 : v > maxQ ? maxQ : v;
+    }
+
+    // zig-zag maps signed residuals to small unsigned numbers; 0 is kept for no-data.
+    inline unsigned long long toSymbol( long long residual )
+    {
+        unsigned long long zz = residual >= 0 ? ((unsigned long long)residual << 1) : (((unsigned long long)(-residual) << 1) - 1);
+        return zz + 1;
+    }
+
+    inline long long fromSymbol( unsigned long long symbol )
+    {
+        unsigned long long zz = symbol - 1;
+        return (zz & 1) ? -(long long)((zz + 1) >> 1) : (long long)(zz >> 1);
+    }
+}
+
+//------------------------------------------------------------------------
+
+HeightFieldCodec::HeightFieldCodec( float precision ) :
+_precision( precision )
+{
+    //nop
+}
+
+bool
+HeightFieldCodec::isEncoded( const std::string& in )
+{
+    return in.size() >= HEADER_SIZE && std::memcmp( in.data(), MAGIC, 4 ) == 0;
+}
+
+bool
+HeightFieldCodec::encode( const osg::HeightField* hf, std::string& out ) const
+{
+    if ( !hf || hf->getNumColumns() == 0 || hf->getNumRows() == 0 || !(_precision > 0.0f) )
+        return false;
+
+    unsigned cols = hf->getNumColumns();
+    unsigned rows = hf->getNumRows();
+
+    // height range of the valid posts:
+    float minH = FLT_MAX, maxH = -FLT_MAX;
+    for( unsigned r = 0; r < rows; ++r )
+    {
+        for( unsigned c = 0; c < cols; ++c )
+        {
+            float h = hf->getHeight( c, r );
+            if ( !isNoData(h) )
+            {
+                minH = osg::minimum( minH, h );
+                maxH = osg::maximum( maxH, h );
+            }
+        }
+    }
+    if ( minH > maxH )
+        minH = maxH = 0.0f;
+
+    // use a coarser step if the range would not fit at the requested precision.
+    double step = _precision;
+    if ( ((double)maxH - (double)minH) / step > MAX_QUANTIZED )
+        step = ((double)maxH - (double)minH) / MAX_QUANTIZED;
+
+    // the step is stored as a float, so quantize with exactly that value.
+    step = (double)(float)step;
+    long long maxQ = (long long)std::floor( ((double)maxH - (double)minH) / step + 0.5 );
+
+    out.clear();
+    out.reserve( HEADER_SIZE + cols*rows + 16 );
+    out.append( MAGIC, 4 );
+    writeU32( out, VERSION );
+    writeU32( out, cols );
+    writeU32( out, rows );
+    writeF64( out, hf->getOrigin().x() );
+    writeF64( out, hf->getOrigin().y() );
+    writeF64( out, hf->getOrigin().z() );
+    writeF64( out, hf->getXInterval() );
+    writeF64( out, hf->getYInterval() );
+    writeF32( out, hf->getSkirtHeight() );
+    writeU32( out, hf->getBorderWidth() );
+    writeF32( out, minH );
+    writeF32( out, maxH );
+    writeF32( out, (float)step );
+
+    std::vector<long long> q( cols*rows );
+    for( unsigned r = 0; r < rows; ++r )
+    {
+        for( unsigned c = 0; c < cols; ++c )
+        {
+            unsigned i = r*cols + c;
+            long long pred = predict( q, c, r, cols );
+            float h = hf->getHeight( c, r );
+            if ( isNoData(h) )
+            {
+                q[i] = clampQ( pred, maxQ );
+                writeVarint( out, NO_DATA_SYMBOL );
+            }
+            else
+            {
+                q[i] = clampQ( (long long)std::floor( ((double)h - (double)minH) / step + 0.5 ), maxQ );
+                writeVarint( out, toSymbol(q[i] - pred) );
+            }
+        }
+    }
+
+    return true;
+}
+
+osg::HeightField*
+HeightFieldCodec::decode( const std::string& in ) const
+{
+    if ( !isEncoded(in) )
+        return 0L;
+
+    Reader reader( in );
+    reader._p += 4;
+
+    unsigned version, cols, rows, border;
+    double   ox, oy, oz, dx, dy;
+    float    skirt, minH, maxH, stepF;
+
+    if ( !reader.readU32(version) || version != VERSION ||
+         !reader.readU32(cols)    || !reader.readU32(rows) ||
+         !reader.readF64(ox)      || !reader.readF64(oy)   || !reader.readF64(oz) ||
+         !reader.readF64(dx)      || !reader.readF64(dy)   ||
+         !reader.readF32(skirt)   || !reader.readU32(border) ||
+         !reader.readF32(minH)    || !reader.readF32(maxH) || !reader.readF32(stepF) )
+    {
+        return 0L;
+    }
+
+    // every post takes at least one byte, which also bounds the allocation.
+    if ( cols == 0 || rows == 0 || (unsigned long long)cols*rows > (unsigned long long)(reader._end - reader._p) )
+        return 0L;
+
+    double    step = stepF;
+    long long maxQ = step > 0.0 ? (long long)std::floor( ((double)maxH - (double)minH) / step + 0.5 ) : 0;
+
+    osg::ref_ptr<osg::HeightField> hf = new osg::HeightField();
+    hf->allocate( cols, rows );
+    hf->setOrigin( osg::Vec3d(ox, oy, oz) );
+    hf->setXInterval( dx );
+    hf->setYInterval( dy );
+    hf->setSkirtHeight( skirt );
+    hf->setBorderWidth( border );
+
+    // decode straight into the heightfield's buffer.
+    osg::FloatArray& heights = *hf->getFloatArray();
+
+    std::vector<long long> q( cols*rows );
+    for( unsigned r = 0; r < rows; ++r )
+    {
+        for( unsigned c = 0; c < cols; ++c )
+        {
+            unsigned i = r*cols + c;
+            unsigned long long symbol;
+            if ( !reader.readVarint(symbol) )
+                return 0L;
+
+            long long pred = predict( q, c, r, cols );
+            if ( symbol == NO_DATA_SYMBOL )
+            {
+                q[i] = clampQ( pred, maxQ );
+                heights[i] = NO_DATA_VALUE;
+            }
+            else
+            {
+                q[i] = pred + fromSymbol( symbol );
+                if ( q[i] < 0 || q[i] > maxQ )
+                    return 0L;
+                heights[i] = (float)((double)minH + (double)q[i] * step);
+            }
+        }
+    }
+
+    return hf.release();
+}
@@ -643,9 +643,14 @@ ImageLayer::createImageFromTileSource(const TileKey&    key,
         return assembleImageFromTileSource( key, progress, out_isFallback );
     }
 
-    // Fail is the image is blacklisted.
+    // record of which tiles are known to have data, used to skip empty ancestors.
+    TileAvailability* avail = getTileAvailability( key.getProfile() );
+
+    // Fail is the image is blacklisted or known to be missing.
     // ..unless there will be a fallback attempt.
-    if ( source->getBlacklist()->contains( key.getTileId() ) && !forceFallback )
+    if ( !forceFallback &&
+         (source->getBlacklist()->contains( key.getTileId() ) ||
+          avail->get( key ) == TileAvailability::MISSING) )
     {
         OE_DEBUG << LC << "createImageFromTileSource: blacklisted(" << key.str() << ")" << std::endl;
         return GeoImage::INVALID;
@@ -675,11 +680,18 @@ ImageLayer::createImageFromTileSource(const TileKey&    key,
     {        
         while( !result.valid() && finalKey.valid() )
         {
-            if ( !source->getBlacklist()->contains( finalKey.getTileId() ) )
+            if ( source->hasData( finalKey ) &&
+                 !source->getBlacklist()->contains( finalKey.getTileId() ) &&
+                 avail->get( finalKey ) != TileAvailability::MISSING )
             {
-                result = source->createImage( finalKey, op.get(), progress );
+                // track this request on its own, since "progress" may be shared.
+                osg::ref_ptr<RequestProgressCallback> request = new RequestProgressCallback( progress );
+
+                result = source->createImage( finalKey, op.get(), request.get() );
                 if ( result.valid() )
                 {
+                    avail->set( finalKey, TileAvailability::AVAILABLE );
+
                     if ( finalKey.getLevelOfDetail() != key.getLevelOfDetail() )
                     {
                         // crop the fallback image to match the input key, and ensure that it remains the
@@ -691,10 +703,20 @@ ImageLayer::createImageFromTileSource(const TileKey&    key,
                         fellBack = true;
                     }
                 }
+                else if ( !request->isCanceled() )
+                {
+                    // only a definitive miss goes into the availability index, which
+                    // persists to the cache. Other failures may be transient, so they
+                    // only go into the bounded in-memory blacklist.
+                    if ( request->dataMissing() )
+                        avail->set( finalKey, TileAvailability::MISSING );
+                    else
+                        source->getBlacklist()->add( finalKey.getTileId() );
+                }
             }
             if ( !result.valid() )
             {
-                finalKey = finalKey.createParentKey();
+                finalKey = avail->getFallbackKey( finalKey );
                 out_isFallback = true;
             }
         }
@@ -709,7 +731,13 @@ ImageLayer::createImageFromTileSource(const TileKey&    key,
 
     else
     {
-        result = source->createImage( key, op.get(), progress );
+        osg::ref_ptr<RequestProgressCallback> request = new RequestProgressCallback( progress );
+
+        result = source->createImage( key, op.get(), request.get() );
+        if ( result.valid() )
+            avail->set( key, TileAvailability::AVAILABLE );
+        else if ( request->dataMissing() && !request->isCanceled() )
+            avail->set( key, TileAvailability::MISSING );
     }
 
     // Process images with full alpha to properly support MP blending.    
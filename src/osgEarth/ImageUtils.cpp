@@ -104,11 +104,25 @@ ImageUtils::copyAsSubImage(const osg::Image* src, osg::Image* dst, int dst_start
         PixelReader read(src);
         PixelWriter write(dst);
 
+        // read each source row in one pass, then place it in the destination.
+        // If the source spans the full destination width, write it as a row too.
+        std::vector<osg::Vec4f> row( src->s() );
+        bool fullRows = dst_start_col == 0 && src->s() == dst->s();
+
         for( int src_t=0, dst_t=dst_start_row; src_t < src->t(); src_t++, dst_t++ )
         {
-            for( int src_s=0, dst_s=dst_start_col; src_s < src->s(); src_s++, dst_s++ )
-            {           
-                write( read(src_s, src_t), dst_s, dst_t );
+            read.readRow( &row[0], src_t );
+
+            if ( fullRows )
+            {
+                write.writeRow( &row[0], dst_t, dst_img );
+            }
+            else
+            {
+                for( int src_s=0, dst_s=dst_start_col; src_s < src->s(); src_s++, dst_s++ )
+                {           
+                    write( row[src_s], dst_s, dst_t, dst_img );
+                }
             }
         }
     }
@@ -224,10 +238,24 @@ ImageUtils::resizeImage(const osg::Image* input,
         PixelReader read( input );
         PixelWriter write( output.get() );
 
-        unsigned int pixel_size_bytes = input->getRowSizeInBytes() / in_s;
+        // the input column for each output column is the same on every row,
+        // so compute it once up front.
+        std::vector<int> input_cols( out_s );
+        for( unsigned int output_col = 0; output_col < out_s; output_col++ )
+        {
+            float output_col_ratio = (float)output_col/(float)out_s;
+            int input_col = (unsigned int)( output_col_ratio * (float)in_s );
+            if ( input_col >= (int)in_s ) input_col = in_s-1;
+            else if ( input_col < 0 ) input_col = 0;
+            input_cols[output_col] = input_col;
+        }
+
+        std::vector<osg::Vec4f> input_data( in_s );
+        std::vector<osg::Vec4f> output_data( out_s );
+        int last_input_row = -1;
 
-        unsigned char* dataOffset = output->getMipmapData(mipmapLevel);
-        unsigned int   dataRowSizeBytes = output->getRowSizeInBytes() >> mipmapLevel;
+        // a whole row can be written at once when the row lengths agree.
+        bool writeRows = write.rowLength(mipmapLevel) == (int)out_s;
 
         for( unsigned int output_row=0; output_row < out_t; output_row++ )
         {
@@ -237,15 +265,28 @@ ImageUtils::resizeImage(const osg::Image* input,
             if ( input_row >= input->t() ) input_row = in_t-1;
             else if ( input_row < 0 ) input_row = 0;
 
+            // read the row from mip level 0; when downsampling vertically this is
+            // often the same row as last time.
+            if ( input_row != last_input_row )
+            {
+                read.readRow( &input_data[0], input_row );
+                last_input_row = input_row;
+            }
+
             for( unsigned int output_col = 0; output_col < out_s; output_col++ )
             {
-                float output_col_ratio = (float)output_col/(float)out_s;
-                int input_col = (unsigned int)( output_col_ratio * (float)in_s );
-                if ( input_col >= (int)in_s ) input_col = in_s-1;
-                else if ( input_row < 0 ) input_row = 0;
+                output_data[output_col] = input_data[input_cols[output_col]];
+            }
 
-                osg::Vec4 color = read( input_col, input_row ); // read pixel from mip level 0
-                write( color, output_col, output_row, 0, mipmapLevel ); // write to target mip level
+            // write to target mip level
+            if ( writeRows )
+            {
+                write.writeRow( &output_data[0], output_row, 0, mipmapLevel );
+            }
+            else
+            {
+                for( unsigned int output_col = 0; output_col < out_s; output_col++ )
+                    write( output_data[output_col], output_col, output_row, 0, mipmapLevel );
             }
         }
     }
@@ -484,12 +525,13 @@ ImageUtils::isEmptyImage(const osg::Image* image, float alphaThreshold)
         return false;
 
     PixelReader read(image);
+    std::vector<osg::Vec4f> row( image->s() );
     for(unsigned t=0; t<(unsigned)image->t(); ++t) 
     {
+        read.readRow( &row[0], t );
         for(unsigned s=0; s<(unsigned)image->s(); ++s)
         {
-            osg::Vec4 color = read(s, t);
-            if ( color.a() > alphaThreshold )
+            if ( row[s].a() > alphaThreshold )
                 return false;
         }
     }
@@ -522,11 +564,13 @@ ImageUtils::isSingleColorImage(const osg::Image* image, float threshold)
     float refB = referenceColor.b();
     float refA = referenceColor.a();
 
+    std::vector<osg::Vec4f> row( image->s() );
     for(unsigned t=0; t<(unsigned)image->t(); ++t) 
     {
+        read.readRow( &row[0], t );
         for(unsigned s=0; s<(unsigned)image->s(); ++s)
         {
-            osg::Vec4 color = read(s, t);
+            const osg::Vec4f& color = row[s];
             if (   (fabs(color.r()-refR) > threshold)
                 || (fabs(color.g()-refG) > threshold)
                 || (fabs(color.b()-refB) > threshold)
@@ -641,10 +685,14 @@ ImageUtils::hasTransparency(const osg::Image* image, float threshold)
         return false;
 
     PixelReader read(image);
+    std::vector<osg::Vec4f> row( image->s() );
     for( int t=0; t<image->t(); ++t )
+    {
+        read.readRow( &row[0], t );
         for( int s=0; s<image->s(); ++s )
-            if ( read(s, t).a() < threshold )
+            if ( row[s].a() < threshold )
                 return true;
+    }
 
     return false;
 }
@@ -664,26 +712,32 @@ ImageUtils::featherAlphaRegions(osg::Image* image, float maxAlpha)
 
     osg::Vec4 n;
 
+    // horizontal pass works on a buffered copy of each row; the buffer is kept
+    // in sync with what we write so later reads see the same values as before.
+    std::vector<osg::Vec4f> row( ns );
+
     for( int t=0; t<nt; ++t )
     {
+        read.readRow( &row[0], t );
         bool rowdone = false;
         for( int s=0; s<ns && !rowdone; ++s )
         {
-            osg::Vec4 pixel = read(s, t);
-            if ( pixel.a() <= maxAlpha )
+            if ( row[s].a() <= maxAlpha )
             {
                 bool wrote = false;
                 if ( s < ns-1 ) {
-                    n = read( s+1, t );
+                    n = row[s+1];
                     if ( n.a() > maxAlpha ) {
                         write( n, s, t );
+                        row[s] = n;
                         wrote = true;
                     }
                 }
                 if ( !wrote && s > 0 ) {
-                    n = read( s-1, t );
+                    n = row[s-1];
                     if ( n.a() > maxAlpha ) {
                         write( n, s, t );
+                        row[s] = n;
                         rowdone = true;
                     }
                 }
@@ -730,11 +784,14 @@ ImageUtils::convertToPremultipliedAlpha(osg::Image* image)
 
     PixelReader read(image);
     PixelWriter write(image);
-    for(int s=0; s<image->s(); ++s) {
-        for( int t=0; t<image->t(); ++t ) {
-            osg::Vec4f c = read(s, t);
-            write( osg::Vec4f(c.r()*c.a(), c.g()*c.a(), c.b()*c.a(), c.a()), s, t);
+    std::vector<osg::Vec4f> row( image->s() );
+    for( int t=0; t<image->t(); ++t ) {
+        read.readRow( &row[0], t );
+        for(int s=0; s<image->s(); ++s) {
+            osg::Vec4f& c = row[s];
+            c.set( c.r()*c.a(), c.g()*c.a(), c.b()*c.a(), c.a() );
         }
+        write.writeRow( &row[0], t );
     }
     return true;
 }
@@ -1136,6 +1193,30 @@ namespace
         }
     };
 
+    // Row readers and writers call the per-pixel functions directly, so the
+    // compiler can inline them into a single loop for each format/type pair.
+    template<int Format, typename T>
+    struct RowReader
+    {
+        static void read(const ImageUtils::PixelReader* ia, osg::Vec4f* out, int t, int r, int m)
+        {
+            const int len = ia->rowLength(m);
+            for( int s=0; s<len; ++s )
+                out[s] = ColorReader<Format, T>::read(ia, s, t, r, m);
+        }
+    };
+
+    template<int Format, typename T>
+    struct RowWriter
+    {
+        static void write(const ImageUtils::PixelWriter* iw, const osg::Vec4f* in, int t, int r, int m)
+        {
+            const int len = iw->rowLength(m);
+            for( int s=0; s<len; ++s )
+                ColorWriter<Format, T>::write(iw, in[s], s, t, r, m);
+        }
+    };
+
     template<int GLFormat>
     inline ImageUtils::PixelReader::ReaderFunc
     chooseReader(GLenum dataType)
@@ -1202,6 +1283,63 @@ namespace
             break;
         }
     }
+
+    template<int GLFormat>
+    inline ImageUtils::PixelReader::RowReaderFunc
+    chooseRowReader(GLenum dataType)
+    {
+        switch (dataType)
+        {
+        case GL_BYTE:
+            return &RowReader<GLFormat, GLbyte>::read;
+        case GL_UNSIGNED_BYTE:
+            return &RowReader<GLFormat, GLubyte>::read;
+        case GL_SHORT:
+            return &RowReader<GLFormat, GLshort>::read;
+        case GL_UNSIGNED_SHORT:
+            return &RowReader<GLFormat, GLushort>::read;
+        case GL_INT:
+            return &RowReader<GLFormat, GLint>::read;
+        case GL_UNSIGNED_INT:
+            return &RowReader<GLFormat, GLuint>::read;
+        case GL_FLOAT:
+            return &RowReader<GLFormat, GLfloat>::read;
+        case GL_UNSIGNED_SHORT_5_5_5_1:
+            return &RowReader<GL_UNSIGNED_SHORT_5_5_5_1, GLushort>::read;
+        case GL_UNSIGNED_BYTE_3_3_2:
+            return &RowReader<GL_UNSIGNED_BYTE_3_3_2, GLubyte>::read;
+        default:
+            return &RowReader<0, GLbyte>::read;
+        }
+    }
+
+    inline ImageUtils::PixelReader::RowReaderFunc
+    getRowReader( GLenum pixelFormat, GLenum dataType )
+    {
+        switch( pixelFormat )
+        {
+        case GL_DEPTH_COMPONENT:
+            return chooseRowReader<GL_DEPTH_COMPONENT>(dataType);
+        case GL_LUMINANCE:
+            return chooseRowReader<GL_LUMINANCE>(dataType);
+        case GL_ALPHA:
+            return chooseRowReader<GL_ALPHA>(dataType);
+        case GL_LUMINANCE_ALPHA:
+            return chooseRowReader<GL_LUMINANCE_ALPHA>(dataType);
+        case GL_RGB:
+            return chooseRowReader<GL_RGB>(dataType);
+        case GL_RGBA:
+            return chooseRowReader<GL_RGBA>(dataType);
+        case GL_BGR:
+            return chooseRowReader<GL_BGR>(dataType);
+        case GL_BGRA:
+            return chooseRowReader<GL_BGRA>(dataType);
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+            return &RowReader<GL_COMPRESSED_RGB_S3TC_DXT1_EXT, GLubyte>::read;
+        default:
+            return 0L;
+        }
+    }
 }
     
 ImageUtils::PixelReader::PixelReader(const osg::Image* image) :
@@ -1212,10 +1350,12 @@ _image(image)
     _imageSize = _image->getImageSizeInBytes();
     GLenum dataType = _image->getDataType();
     _reader = getReader( _image->getPixelFormat(), dataType );
+    _rowReader = getRowReader( _image->getPixelFormat(), dataType );
     if ( !_reader )
     {
         OE_WARN << "[PixelReader] No reader found for pixel format " << std::hex << _image->getPixelFormat() << std::endl; 
         _reader = &ColorReader<0,GLbyte>::read;
+        _rowReader = &RowReader<0,GLbyte>::read;
     }
 }
 
@@ -1290,6 +1430,59 @@ namespace
             break;
         }
     }
+
+    template<int GLFormat>
+    inline ImageUtils::PixelWriter::RowWriterFunc chooseRowWriter(GLenum dataType)
+    {
+        switch (dataType)
+        {
+        case GL_BYTE:
+            return &RowWriter<GLFormat, GLbyte>::write;
+        case GL_UNSIGNED_BYTE:
+            return &RowWriter<GLFormat, GLubyte>::write;
+        case GL_SHORT:
+            return &RowWriter<GLFormat, GLshort>::write;
+        case GL_UNSIGNED_SHORT:
+            return &RowWriter<GLFormat, GLushort>::write;
+        case GL_INT:
+            return &RowWriter<GLFormat, GLint>::write;
+        case GL_UNSIGNED_INT:
+            return &RowWriter<GLFormat, GLuint>::write;
+        case GL_FLOAT:
+            return &RowWriter<GLFormat, GLfloat>::write;
+        case GL_UNSIGNED_SHORT_5_5_5_1:
+            return &RowWriter<GL_UNSIGNED_SHORT_5_5_5_1, GLushort>::write;
+        case GL_UNSIGNED_BYTE_3_3_2:
+            return &RowWriter<GL_UNSIGNED_BYTE_3_3_2, GLubyte>::write;
+        default:
+            return 0L;
+        }
+    }
+
+    inline ImageUtils::PixelWriter::RowWriterFunc getRowWriter(GLenum pixelFormat, GLenum dataType)
+    {
+        switch( pixelFormat )
+        {
+        case GL_DEPTH_COMPONENT:
+            return chooseRowWriter<GL_DEPTH_COMPONENT>(dataType);
+        case GL_LUMINANCE:
+            return chooseRowWriter<GL_LUMINANCE>(dataType);
+        case GL_ALPHA:
+            return chooseRowWriter<GL_ALPHA>(dataType);
+        case GL_LUMINANCE_ALPHA:
+            return chooseRowWriter<GL_LUMINANCE_ALPHA>(dataType);
+        case GL_RGB:
+            return chooseRowWriter<GL_RGB>(dataType);
+        case GL_RGBA:
+            return chooseRowWriter<GL_RGBA>(dataType);
+        case GL_BGR:
+            return chooseRowWriter<GL_BGR>(dataType);
+        case GL_BGRA:
+            return chooseRowWriter<GL_BGRA>(dataType);
+        default:
+            return 0L;
+        }
+    }
 }
     
 ImageUtils::PixelWriter::PixelWriter(osg::Image* image) :
@@ -1300,10 +1493,12 @@ _image(image)
     _imageSize = _image->getImageSizeInBytes();
     GLenum dataType = _image->getDataType();
     _writer = getWriter( _image->getPixelFormat(), dataType );
-    if ( !_writer )
+    _rowWriter = getRowWriter( _image->getPixelFormat(), dataType );
+    if ( !_writer || !_rowWriter )
     {
         OE_WARN << "[PixelWriter] No writer found for pixel format " << std::hex << _image->getPixelFormat() << std::endl; 
         _writer = &ColorWriter<0, GLbyte>::write;
+        _rowWriter = &RowWriter<0, GLbyte>::write;
     }
 }
 
@@ -20,6 +20,9 @@
 #include <osgEarth/StringUtils>
 #include <osgEarth/ThreadingUtils>
 #include <osgEarth/Containers>
+#include <osg/Shape>
+#include <list>
+#include <map>
 
 using namespace osgEarth;
 
@@ -29,37 +32,148 @@ using namespace osgEarth;
 
 namespace
 {
-    typedef std::pair<osg::ref_ptr<const osg::Object>, Config> MemCacheEntry;
-    typedef LRUCache<std::string, MemCacheEntry> MemCacheLRU;
+    // upper bound on the number of lock stripes in a bin.
+    const unsigned MAX_SHARDS = 16u;
 
-    struct MemCacheBin : public CacheBin
+    // a shard should still hold enough entries to behave like an LRU.
+    const unsigned MIN_ENTRIES_PER_SHARD = 8u;
+
+    // 32-bit FNV-1a hash of a cache key. Tile keys ("lod/x/y") spread
+    // evenly across the shards with this.
+    inline unsigned hashKey( const std::string& key )
+    {
+        unsigned h = 2166136261u;
+        for( std::string::const_iterator i = key.begin(); i != key.end(); ++i )
+        {
+            h ^= (unsigned char)(*i);
+            h *= 16777619u;
+        }
+        return h;
+    }
+
+    // Approximate memory held by a cached object. Only the bulk data is
+    // counted: image pixels (with mipmaps), heightfield samples and strings.
+    inline size_t getFootprint( const osg::Object* object, const std::string& key )
+    {
+        size_t bytes = key.size() + sizeof(osg::Object);
+
+        const osg::Image* image = dynamic_cast<const osg::Image*>( object );
+        if ( image )
+        {
+            bytes += image->getTotalSizeInBytesIncludingMipmaps();
+        }
+        else
+        {
+            const osg::HeightField* hf = dynamic_cast<const osg::HeightField*>( object );
+            if ( hf )
+            {
+                bytes += hf->getNumColumns() * hf->getNumRows() * sizeof(float);
+            }
+            else
+            {
+                const StringObject* so = dynamic_cast<const StringObject*>( object );
+                if ( so )
+                    bytes += so->getString().size();
+            }
+        }
+        return bytes;
+    }
+
+    struct MemCacheEntry
+    {
+        std::string                     _key;
+        unsigned                        _hash;
+        osg::ref_ptr<const osg::Object> _object;
+        Config                          _meta;
+        size_t                          _bytes;
+    };
+
+    /**
+     * One lock stripe of a MemCacheBin. Entries are indexed by key hash; the
+     * full key is kept in the entry and checked on lookup, so a hash collision
+     * just replaces the older entry, which is harmless in a cache.
+     */
+    struct MemCacheShard
+    {
+        typedef std::list<MemCacheEntry>                EntryList;  // front = most recently used
+        typedef std::map<unsigned, EntryList::iterator> EntryIndex;
+
+        MemCacheShard() : _bytes(0), _hits(0), _misses(0), _evictions(0) { }
+
+        EntryList        _lru;
+        EntryIndex       _index;
+        size_t           _bytes;
+        unsigned         _hits;
+        unsigned         _misses;
+        unsigned         _evictions;
+        Threading::Mutex _mutex;
+
+        // caller holds the mutex.
+        void remove( EntryIndex::iterator i )
+        {
+            _bytes -= i->second->_bytes;
+            _lru.erase( i->second );
+            _index.erase( i );
+        }
+    };
+
+    class MemCacheBin : public CacheBin
     {
-        MemCacheBin( const std::string& id, unsigned maxSize )
+    public:
+        MemCacheBin( const std::string& id, unsigned maxSize, size_t maxBytes )
             : CacheBin( id ),
-              _lru    ( true, maxSize )
+              _maxSize ( maxSize ),
+              _maxBytes( maxBytes )
         {
-            //nop
+            _numShards = 1;
+            while ( _numShards < MAX_SHARDS && (_numShards*2)*MIN_ENTRIES_PER_SHARD <= maxSize )
+                _numShards *= 2;
+
+            _shards = new MemCacheShard[_numShards];
+            _maxShardSize  = osg::maximum( maxSize / _numShards, 1u );
+            _maxShardBytes = maxBytes / _numShards;
+        }
+
+        virtual ~MemCacheBin()
+        {
+            delete [] _shards;
         }
 
         ReadResult readObject(const std::string& key,
                               double             maxAge )
         {
-            MemCacheLRU::Record rec;
-            _lru.get(key, rec);
+            unsigned hash = hashKey( key );
+            MemCacheShard& shard = _shards[hash & (_numShards-1)];
 
-            // clone required since the cache is in memory
-
-            if ( rec.valid() )
+            osg::ref_ptr<const osg::Object> object;
+            Config meta;
             {
-                //OE_INFO << LC << "hits: " << _lru.getStats()._hitRatio*100.0f << "%" << std::endl;
+                Threading::ScopedMutexLock lock( shard._mutex );
+                MemCacheShard::EntryIndex::iterator i = shard._index.find( hash );
+                if ( i != shard._index.end() && i->second->_key == key )
+                {
+                    // move to the front of the LRU list
+                    shard._lru.splice( shard._lru.begin(), shard._lru, i->second );
+                    object = i->second->_object.get();
+                    meta   = i->second->_meta;
+                    shard._hits++;
+                }
+                else
+                {
+                    shard._misses++;
+                }
+            }
 
+            // clone required since the cache is in memory. Do it outside the
+            // lock since a deep copy of a large object is not cheap.
+            if ( object.valid() )
+            {
                 return ReadResult( 
-                   osg::clone(rec.value().first.get(), osg::CopyOp::DEEP_COPY_ALL),
-                   rec.value().second );
+                   osg::clone(object.get(), osg::CopyOp::DEEP_COPY_ALL),
+                   meta );
             }
             else
             {
-                //OE_INFO << LC << "hits: " << _lru.getStats()._hitRatio*100.0f << "%" << std::endl;
                 return ReadResult();
             }
         }
@@ -84,28 +198,95 @@ namespace
 
         bool write( const std::string& key, const osg::Object* object, const Config& meta )
         {
-            if ( object ) 
+            if ( !object ) 
+                return false;
+
+            unsigned hash  = hashKey( key );
+            size_t   bytes = getFootprint( object, key );
+            MemCacheShard& shard = _shards[hash & (_numShards-1)];
+
+            Threading::ScopedMutexLock lock( shard._mutex );
+
+            MemCacheShard::EntryIndex::iterator i = shard._index.find( hash );
+            if ( i != shard._index.end() )
+                shard.remove( i );
+
+            MemCacheEntry entry;
+            entry._key    = key;
+            entry._hash   = hash;
+            entry._object = object;
+            entry._meta   = meta;
+            entry._bytes  = bytes;
+            shard._lru.push_front( entry );
+            shard._index[hash] = shard._lru.begin();
+            shard._bytes += bytes;
+
+            // evict from the back until we're under both caps, but always
+            // keep the entry we just added.
+            while (
+                shard._lru.size() > 1 && (
+                shard._lru.size() > _maxShardSize ||
+                (_maxShardBytes > 0 && shard._bytes > _maxShardBytes) ) )
             {
-                _lru.insert( key, std::make_pair(object, meta) );
-                return true;
+                shard.remove( shard._index.find(shard._lru.back()._hash) );
+                shard._evictions++;
             }
-            else
-                return false;
+
+            return true;
         }
 
         bool isCached( const std::string& key, double maxAge ) 
         {
-            return _lru.has(key);
+            unsigned hash = hashKey( key );
+            MemCacheShard& shard = _shards[hash & (_numShards-1)];
+
+            Threading::ScopedMutexLock lock( shard._mutex );
+            MemCacheShard::EntryIndex::iterator i = shard._index.find( hash );
+            return i != shard._index.end() && i->second->_key == key;
         }
 
         bool purge()
         {
-            _lru.clear();
+            for( unsigned s=0; s<_numShards; ++s )
+            {
+                MemCacheShard& shard = _shards[s];
+                Threading::ScopedMutexLock lock( shard._mutex );
+                shard._lru.clear();
+                shard._index.clear();
+                shard._bytes     = 0;
+                shard._hits      = 0;
+                shard._misses    = 0;
+                shard._evictions = 0;
+            }
             return true;
         }
 
+        CacheStats getStats()
+        {
+            unsigned entries = 0, hits = 0, misses = 0, evictions = 0;
+            size_t   bytes = 0;
+
+            for( unsigned s=0; s<_numShards; ++s )
+            {
+                MemCacheShard& shard = _shards[s];
+                Threading::ScopedMutexLock lock( shard._mutex );
+                entries   += shard._lru.size();
+                bytes     += shard._bytes;
+                hits      += shard._hits;
+                misses    += shard._misses;
+                evictions += shard._evictions;
+            }
+
+            return CacheStats( entries, _maxSize, hits, misses, evictions, bytes, _maxBytes );
+        }
+
     private:
-        MemCacheLRU _lru;
+        unsigned       _maxSize;
+        size_t         _maxBytes;
+        unsigned       _numShards;     // always a power of two
+        unsigned       _maxShardSize;
+        size_t         _maxShardBytes;
+        MemCacheShard* _shards;
     };
     
 
@@ -114,8 +295,9 @@ namespace
 
 //------------------------------------------------------------------------
 
-MemCache::MemCache( unsigned maxBinSize ) :
-_maxBinSize( std::max(maxBinSize, 1u) )
+MemCache::MemCache( unsigned maxBinSize, size_t maxBinBytes ) :
+_maxBinSize ( std::max(maxBinSize, 1u) ),
+_maxBinBytes( maxBinBytes )
 {
     //nop
 }
@@ -123,7 +305,7 @@ _maxBinSize( std::max(maxBinSize, 1u) )
 CacheBin*
 MemCache::addBin( const std::string& binID )
 {
-    return _bins.getOrCreate( binID, new MemCacheBin(binID, _maxBinSize) );
+    return _bins.getOrCreate( binID, new MemCacheBin(binID, _maxBinSize, _maxBinBytes) );
 }
 
 CacheBin*
@@ -135,9 +317,19 @@ MemCache::getOrCreateDefaultBin()
         // double check
         if ( !_defaultBin.valid() )
         {
-            _defaultBin = new MemCacheBin("__default", _maxBinSize);
+            _defaultBin = new MemCacheBin("__default", _maxBinSize, _maxBinBytes);
         }
     }
 
     return _defaultBin.get();
 }
+
+CacheStats
+MemCache::getBinStats( const std::string& binID )
+{
+    CacheBin* bin = binID == "__default" ? _defaultBin.get() : _bins.get( binID );
+    if ( bin )
+        return static_cast<MemCacheBin*>( bin )->getStats();
+    else
+        return CacheStats( 0, _maxBinSize, 0, 0, 0, 0, _maxBinBytes );
+}
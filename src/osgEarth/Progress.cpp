@@ -25,7 +25,8 @@ using namespace osgEarth;
 ProgressCallback::ProgressCallback() :
 osg::Referenced( true ),
 _canceled      ( false ),
-_needsRetry    ( false )
+_needsRetry    ( false ),
+_dataMissing   ( false )
 {
     //NOP
 }
@@ -39,6 +40,34 @@ bool ProgressCallback::reportProgress(double             current,
     return false;
 }
 
+/******************************************************************************/
+RequestProgressCallback::RequestProgressCallback(ProgressCallback* parent) :
+ProgressCallback(),
+_parent         ( parent )
+{
+    //NOP
+}
+
+RequestProgressCallback::~RequestProgressCallback()
+{
+    if ( _parent && _needsRetry )
+        _parent->setNeedsRetry( true );
+}
+
+bool
+RequestProgressCallback::reportProgress(double current, double total, 
+                                        unsigned stage, unsigned numStages,
+                                        const std::string& msg)
+{
+    return _parent ? _parent->reportProgress(current, total, stage, numStages, msg) : false;
+}
+
+bool
+RequestProgressCallback::isCanceled() const
+{
+    return _canceled || (_parent && _parent->isCanceled());
+}
+
 /******************************************************************************/
 ConsoleProgressCallback::ConsoleProgressCallback() :
 ProgressCallback()
@@ -57,6 +86,7 @@ ConsoleProgressCallback::reportProgress(double current, double total,
         OE_NOTICE 
             << "Stage " << (stage+1) << "/" << numStages 
             << "; completed " << percentComplete << "% " << current << " of " << total 
+            << (msg.empty() ? "" : "; ") << msg
             << std::endl;
     }
     else
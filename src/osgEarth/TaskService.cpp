@@ -19,6 +19,8 @@
 #include <osgEarth/TaskService>
 #include <osg/Notify>
 #include <osg/Math>
+#include <sstream>
+#include <cstdlib>
 
 using namespace osgEarth;
 using namespace OpenThreads;
@@ -30,7 +32,10 @@ using namespace OpenThreads;
 TaskRequest::TaskRequest( float priority ) :
 osg::Referenced( true ),
 _priority( priority ),
-_state( STATE_IDLE )
+_state( STATE_IDLE ),
+_startTime( 0 ),
+_endTime( 0 ),
+_queuedTime( 0 )
 {
     _progress = new ProgressCallback();
 }
@@ -65,94 +70,236 @@ TaskRequest::wasCanceled() const
 
 //------------------------------------------------------------------------
 
-TaskRequestQueue::TaskRequestQueue() :
+TaskHistogram::TaskHistogram()
+{
+    clear();
+}
+
+void
+TaskHistogram::clear()
+{
+    for( unsigned i=0; i<NUM_BUCKETS; ++i )
+        _buckets[i] = 0;
+    _count = 0;
+    _total = 0.0;
+    _max   = 0.0;
+}
+
+void
+TaskHistogram::add( double seconds )
+{
+    double usec = seconds * 1.0e6;
+    unsigned bucket = 0;
+    while( bucket+1 < NUM_BUCKETS && usec >= (double)(2u << bucket) )
+        ++bucket;
+
+    _buckets[bucket]++;
+    _count++;
+    _total += seconds;
+    if ( seconds > _max )
+        _max = seconds;
+}
+
+void
+TaskHistogram::add( const TaskHistogram& rhs )
+{
+    for( unsigned i=0; i<NUM_BUCKETS; ++i )
+        _buckets[i] += rhs._buckets[i];
+    _count += rhs._count;
+    _total += rhs._total;
+    if ( rhs._max > _max )
+        _max = rhs._max;
+}
+
+double
+TaskHistogram::getBucketUpperBound( unsigned bucket )
+{
+    return bucket < NUM_BUCKETS ? (double)(2u << osg::minimum(bucket, 30u)) * 1.0e-6 : 0.0;
+}
+
+double
+TaskHistogram::getPercentile( float fraction ) const
+{
+    if ( _count == 0 )
+        return 0.0;
+
+    unsigned target = (unsigned)ceil( osg::clampBetween(fraction, 0.0f, 1.0f) * (float)_count );
+    unsigned sum = 0;
+    for( unsigned i=0; i<NUM_BUCKETS; ++i )
+    {
+        sum += _buckets[i];
+        if ( sum >= target && sum > 0 )
+            return osg::minimum( getBucketUpperBound(i), _max );
+    }
+    return _max;
+}
+
+std::string
+TaskHistogram::toString() const
+{
+    std::stringstream buf;
+    buf << "count=" << _count
+        << " mean=" << getMean()*1000.0 << "ms"
+        << " p50<=" << getPercentile(0.5f)*1000.0 << "ms"
+        << " p90<=" << getPercentile(0.9f)*1000.0 << "ms"
+        << " p99<=" << getPercentile(0.99f)*1000.0 << "ms"
+        << " max=" << _max*1000.0 << "ms";
+    return buf.str();
+}
+
+//------------------------------------------------------------------------
+
+TaskRequestQueue::TaskRequestQueue( unsigned numSlots ) :
 osg::Referenced( true ),
-_done( false )
+_numActiveSlots( 1 ),
+_done( false ),
+_stamp( 0 )
 {
+    numSlots = osg::maximum( numSlots, 1u );
+    _slots.reserve( numSlots );
+    for( unsigned i=0; i<numSlots; ++i )
+        _slots.push_back( new Slot() );
+}
+
+TaskRequestQueue::~TaskRequestQueue()
+{
+    for( unsigned i=0; i<_slots.size(); ++i )
+        delete _slots[i];
 }
 
 void
 TaskRequestQueue::clear()
 {
-    ScopedLock<Mutex> lock(_mutex);
-    _requests.clear();
+    for( unsigned i=0; i<_slots.size(); ++i )
+    {
+        Slot* slot = _slots[i];
+        // requests are counted under this same lock when added, so every
+        // request removed here has already been counted.
+        ScopedLock<Mutex> lock( slot->_mutex );
+        for( Buckets::iterator b = slot->_buckets.begin(); b != slot->_buckets.end(); ++b )
+        {
+            for( unsigned n = b->second.size(); n > 0; --n )
+                --_numPending;
+        }
+        slot->_buckets.clear();
+    }
 }
 
 unsigned int
 TaskRequestQueue::getNumRequests() const
 {
-    ScopedLock<Mutex> lock(const_cast<TaskRequestQueue*>(this)->_mutex);
-    return _requests.size();
+    return (unsigned)_numPending;
+}
+
+void
+TaskRequestQueue::setNumActiveSlots( unsigned value )
+{
+    _numActiveSlots = osg::clampBetween( value, 1u, (unsigned)_slots.size() );
+}
+
+unsigned
+TaskRequestQueue::selectSlot()
+{
+    // a task thread queueing more work keeps it for itself (others will
+    // steal it if they run out); everyone else deals round-robin.
+    TaskThread* thread = dynamic_cast<TaskThread*>( OpenThreads::Thread::CurrentThread() );
+    if ( thread && thread->getQueue() == this )
+        return thread->getSlot() % _slots.size();
+
+    return (unsigned)(++_nextSlot) % _numActiveSlots;
 }
 
 void 
 TaskRequestQueue::add( TaskRequest* request )
 {
     request->setState( TaskRequest::STATE_PENDING );
+    request->setQueuedTime( osg::Timer::instance()->tick() );
 
     // install a progress callback if one isn't already installed
     if ( !request->getProgressCallback() )
         request->setProgressCallback( new ProgressCallback() );
 
-    ScopedLock<Mutex> lock(_mutex);
-
-    // insert by priority.
-    _requests.insert( std::pair<float,TaskRequest*>(request->getPriority(), request) );
+    // count the request under the slot lock, so that a thread taking it
+    // can never decrement the count before we've incremented it.
+    Slot* slot = _slots[selectSlot()];
+    {
+        ScopedLock<Mutex> lock( slot->_mutex );
+        ++_numPending;
+        slot->_buckets[request->getPriority()].push_back( request );
+    }
 
-#if 0
-    // insert by priority.
-    bool inserted = false;
-    for( TaskRequestList::iterator i = _requests.begin(); i != _requests.end(); i++ )
+    // since there is data in the queue, wake up one waiting task thread.
+    // (a thread going to sleep bumps _numSleeping before checking _numPending,
+    // so one of us is bound to see the other.)
+    if ( (unsigned)_numSleeping > 0 )
     {
-        if ( request->getPriority() > i->get()->getPriority() )
-        {
-            _requests.insert( i, request );
-            inserted = true;
-            //OE_NOTICE << "TaskRequestQueue size=" << _requests.size() << std::endl;
-            break;
-        }
+        ScopedLock<Mutex> lock( _sleepMutex );
+        _sleepCond.signal();
     }
+}
 
-    if ( !inserted )
-        _requests.push_back( request );
-#endif
+TaskRequest*
+TaskRequestQueue::take( unsigned index )
+{
+    Slot* slot = _slots[index];
+    ScopedLock<Mutex> lock( slot->_mutex );
 
-    // since there is data in the queue, wake up one waiting task thread.
-    _cond.signal();
+    // lowest priority value first:
+    Buckets::iterator b = slot->_buckets.begin();
+    if ( b == slot->_buckets.end() )
+        return 0L;
+
+    osg::ref_ptr<TaskRequest> next = b->second.front();
+    b->second.pop_front();
+    if ( b->second.empty() )
+        slot->_buckets.erase( b );
+
+    --_numPending;
+    return next.release();
 }
 
 TaskRequest* 
-TaskRequestQueue::get()
+TaskRequestQueue::get( unsigned slot )
 {
-    ScopedLock<Mutex> lock(_mutex);
+    unsigned numSlots = _slots.size();
+    slot = slot % numSlots;
 
-    while ( !_done && _requests.empty() )
+    while( !_done )
     {
-        // releases the mutex and waits on the condition.
-        _cond.wait( &_mutex );
-    }
+        // own slot first, then steal from the others:
+        for( unsigned i=0; i<numSlots; ++i )
+        {
+            TaskRequest* next = take( (slot + i) % numSlots );
+            if ( next )
+            {
+                // more work waiting? someone else take a turn.
+                if ( (unsigned)_numPending > 0 && (unsigned)_numSleeping > 0 )
+                {
+                    ScopedLock<Mutex> lock( _sleepMutex );
+                    _sleepCond.signal();
+                }
+                return next;
+            }
+        }
 
-    if ( _done )
-    {
-        return 0L;
+        ScopedLock<Mutex> lock( _sleepMutex );
+        ++_numSleeping;
+        while ( !_done && (unsigned)_numPending == 0 )
+        {
+            // releases the mutex and waits on the condition.
+            _sleepCond.wait( &_sleepMutex );
+        }
+        --_numSleeping;
     }
 
-    osg::ref_ptr<TaskRequest> next = _requests.begin()->second.get(); //_requests.front();
-    _requests.erase( _requests.begin() ); //_requests.pop_front();
-
-    // I'm done, someone else take a turn:
-    // (technically this shouldn't be necessary since add() bumps the semaphore once
-    // for each request in the queue)
-    _cond.signal();
-
-    return next.release();
+    return 0L;
 }
 
 void
 TaskRequestQueue::setDone()
 {
     // we need to obtain the mutex since we're using the Condition
-    ScopedLock<Mutex> lock(_mutex);
+    ScopedLock<Mutex> lock(_sleepMutex);
 
     _done = true;
 
@@ -161,13 +308,49 @@ TaskRequestQueue::setDone()
 
     // alternative to buggy win32 broadcast (OSG pre-r10457 on windows)
     for(int i=0; i<128; i++)
-        _cond.signal();
+        _sleepCond.signal();
+}
+
+void
+TaskRequestQueue::recordTiming( unsigned index, double queueWait, double runTime )
+{
+    Slot* slot = _slots[index % _slots.size()];
+    ScopedLock<Mutex> lock( slot->_mutex );
+    slot->_queueWait.add( queueWait );
+    slot->_runTime.add( runTime );
+}
+
+void
+TaskRequestQueue::getHistograms( TaskHistogram& out_queueWait, TaskHistogram& out_runTime ) const
+{
+    out_queueWait.clear();
+    out_runTime.clear();
+    for( unsigned i=0; i<_slots.size(); ++i )
+    {
+        Slot* slot = _slots[i];
+        ScopedLock<Mutex> lock( slot->_mutex );
+        out_queueWait.add( slot->_queueWait );
+        out_runTime.add( slot->_runTime );
+    }
+}
+
+void
+TaskRequestQueue::resetHistograms()
+{
+    for( unsigned i=0; i<_slots.size(); ++i )
+    {
+        Slot* slot = _slots[i];
+        ScopedLock<Mutex> lock( slot->_mutex );
+        slot->_queueWait.clear();
+        slot->_runTime.clear();
+    }
 }
 
 //------------------------------------------------------------------------
 
-TaskThread::TaskThread( TaskRequestQueue* queue ) :
+TaskThread::TaskThread( TaskRequestQueue* queue, unsigned slot ) :
 _queue( queue ),
+_slot( slot ),
 _done( false )
 {
     //nop
@@ -178,7 +361,7 @@ TaskThread::run()
 {
     while( !_done )
     {
-        _request = _queue->get();
+        _request = _queue->get( _slot );
 
         if ( _done )
             break;
@@ -199,6 +382,8 @@ TaskThread::run()
                 _request->setState( TaskRequest::STATE_IN_PROGRESS );
                 _request->run();
 
+                _queue->recordTiming( _slot, _request->queueWaitTime(), _request->runTime() );
+
                 //OE_INFO << LC << "Task \"" << _request->getName() << "\" runtime = " << _request->runTime() << " s." << std::endl;
             }
             else
@@ -246,7 +431,9 @@ _lastRemoveFinishedThreadsStamp(0),
 _name(name),
 _numThreads( 0 )
 {
-    _queue = new TaskRequestQueue();
+    // one queue slot per processor; threads beyond that share slots.
+    unsigned numSlots = osg::clampBetween( OpenThreads::GetNumberOfProcessors(), 1, 32 );
+    _queue = new TaskRequestQueue( numSlots );
     setNumThreads( numThreads );
 }
 
@@ -263,8 +450,38 @@ TaskService::add( TaskRequest* request )
     _queue->add( request );
 }
 
+TaskHistogram
+TaskService::getQueueWaitHistogram() const
+{
+    TaskHistogram queueWait, runTime;
+    _queue->getHistograms( queueWait, runTime );
+    return queueWait;
+}
+
+TaskHistogram
+TaskService::getRunTimeHistogram() const
+{
+    TaskHistogram queueWait, runTime;
+    _queue->getHistograms( queueWait, runTime );
+    return runTime;
+}
+
+void
+TaskService::resetHistograms()
+{
+    _queue->resetHistograms();
+}
+
 TaskService::~TaskService()
 {
+    if ( ::getenv("OSGEARTH_TASK_STATS") )
+    {
+        TaskHistogram queueWait, runTime;
+        _queue->getHistograms( queueWait, runTime );
+        OE_NOTICE << LC << "TaskService [" << _name << "] queue wait: " << queueWait.toString() << std::endl;
+        OE_NOTICE << LC << "TaskService [" << _name << "] run time:   " << runTime.toString() << std::endl;
+    }
+
     _queue->setDone();
 
     for( TaskThreads::iterator i = _threads.begin(); i != _threads.end(); i++ )
@@ -331,7 +548,7 @@ TaskService::adjustThreadCount()
         //We need to add some threads
         for (int i = 0; i < diff; ++i)
         {
-            TaskThread* thread = new TaskThread( _queue.get() );
+            TaskThread* thread = new TaskThread( _queue.get(), (unsigned)(numActiveThreads + i) );
             _threads.push_back( thread );
             thread->start();
         }       
@@ -353,6 +570,9 @@ TaskService::adjustThreadCount()
         }
     }  
 
+    // spread new requests across as many slots as there are threads to own them:
+    _queue->setNumActiveSlots( (unsigned)_numThreads );
+
     OE_INFO << LC << "TaskService [" << _name << "] using " << _numThreads << " threads" << std::endl;
 }
 
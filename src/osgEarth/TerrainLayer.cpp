@@ -22,6 +22,7 @@
 #include <osgEarth/StringUtils>
 #include <osgEarth/TimeControl>
 #include <osgEarth/URI>
+#include <osgEarth/WriteBehindCacheBin>
 #include <osgDB/WriteFile>
 #include <osg/Version>
 #include <OpenThreads/ScopedLock>
@@ -163,6 +164,22 @@ _tileSource    ( tileSource )
 
 TerrainLayer::~TerrainLayer()
 {
+    // store what we learned about tile availability with the cache bins.
+    for( AvailabilityMap::iterator i = _availability.begin(); i != _availability.end(); ++i )
+    {
+        AvailabilityInfo& info = i->second;
+        if ( info._bin.valid() && info._index->isDirty() )
+        {
+            Config meta = info._bin->readMetadata();
+            if ( !meta.empty() )
+            {
+                meta.remove( "availability" );
+                meta.add( info._index->getConfig() );
+                info._bin->writeMetadata( meta );
+            }
+        }
+    }
+
     if ( _cache.valid() )
     {
         Threading::ScopedWriteLock exclusive( _cacheBinsMutex );
@@ -171,7 +188,11 @@ TerrainLayer::~TerrainLayer()
             CacheBinInfo& info = i->second;
             if ( info._bin.valid() )
             {
-                _cache->removeBin( info._bin.get() );
+                // commit any deferred writes before letting go of the bin.
+                info._bin->flush();
+
+                WriteBehindCacheBin* wb = dynamic_cast<WriteBehindCacheBin*>( info._bin.get() );
+                _cache->removeBin( wb ? wb->getWrappedBin() : info._bin.get() );
             }
         }
     }
@@ -453,6 +474,14 @@ TerrainLayer::getCacheBin( const Profile* profile, const std::string& binId )
             }
 
 
+            // optionally move cache writes off the calling thread.
+            if ( _cache->getCacheOptions().writeBehind() == true )
+            {
+                newBin = new WriteBehindCacheBin(
+                    newBin.get(),
+                    (size_t)*_cache->getCacheOptions().maxPendingWriteMB() * 1024u * 1024u );
+            }
+
             // store the bin.
             CacheBinInfo& newInfo = _cacheBins[binId];
             newInfo._metadata = meta;
@@ -469,6 +498,42 @@ TerrainLayer::getCacheBin( const Profile* profile, const std::string& binId )
     }
 }
 
+TileAvailability*
+TerrainLayer::getTileAvailability( const Profile* profile )
+{
+    if ( !profile )
+        return 0L;
+
+    std::string sig = profile->getFullSignature();
+
+    Threading::ScopedMutexLock lock( _availabilityMutex );
+
+    AvailabilityMap::iterator i = _availability.find( sig );
+    if ( i != _availability.end() )
+        return i->second._index.get();
+
+    AvailabilityInfo& info = _availability[sig];
+    info._index = new TileAvailability();
+    CacheBin* bin = getCacheBin( profile );
+
+    if ( bin )
+    {
+        // only hold on to the bin (for saving the index later) if we may write to it.
+        if ( getCachePolicy().isCacheWriteable() )
+            info._bin = bin;
+
+        Config meta = bin->readMetadata();
+        if ( meta.hasChild("availability") )
+        {
+            info._index->fromConfig( meta.child("availability") );
+            OE_DEBUG << LC << "Loaded availability index for \"" << getName() << "\" ("
+                << info._index->getNumNodes() << " nodes)" << std::endl;
+        }
+    }
+
+    return info._index.get();
+}
+
 bool
 TerrainLayer::getCacheBinMetadata( const Profile* profile, CacheBinMetadata& output )
 {
@@ -0,0 +1,281 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarth/TileAvailability>
+#include <osgEarth/Notify>
+
+#define LC "[TileAvailability] "
+
+using namespace osgEarth;
+using namespace osgEarth::Threading;
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    // Which of the 4 children of the level "lod" ancestor holds the tile (x, y)
+    // at level "keyLod". Children are ordered row-major.
+    inline unsigned childQuadrant( unsigned x, unsigned y, unsigned keyLod, unsigned lod )
+    {
+        unsigned shift = keyLod - lod - 1;
+        return ((x >> shift) & 1u) + 2u*((y >> shift) & 1u);
+    }
+
+    // Node encoding: one character per node, in pre-order.
+    const char ENC_BASE         = 'a';
+    const char ENC_HAS_CHILDREN = 4;
+}
+
+//------------------------------------------------------------------------
+
+TileAvailability::TileAvailability( unsigned maxNodes ) :
+_maxNodes( maxNodes ),
+_dirty   ( false )
+{
+    // node 0 is never used so that a zero child index can mean "no children".
+    _nodes.push_back( Node() );
+}
+
+void
+TileAvailability::set( const TileKey& key, State state )
+{
+    if ( !key.valid() )
+        return;
+
+    unsigned lod = key.getLevelOfDetail();
+    unsigned x, y;
+    key.getTileXY( x, y );
+
+    ScopedWriteLock exclusive( _mutex );
+
+    RootID rootID( x >> lod, y >> lod );
+    Roots::iterator r = _roots.find( rootID );
+    unsigned node;
+    if ( r == _roots.end() )
+    {
+        if ( state == UNKNOWN || _nodes.size() + 1 > _maxNodes )
+            return;
+        node = _nodes.size();
+        _nodes.push_back( Node() );
+        _roots[rootID] = node;
+    }
+    else
+    {
+        node = r->second;
+    }
+
+    for( unsigned level = 0; level < lod; ++level )
+    {
+        if ( _nodes[node]._children == 0 )
+        {
+            if ( state == UNKNOWN || _nodes.size() + 4 > _maxNodes )
+                return;
+            unsigned first = _nodes.size();
+            _nodes.resize( first + 4 );
+            _nodes[node]._children = first;
+        }
+        node = _nodes[node]._children + childQuadrant(x, y, lod, level);
+    }
+
+    if ( _nodes[node]._state != (unsigned char)state )
+    {
+        _nodes[node]._state = (unsigned char)state;
+        _dirty = true;
+    }
+}
+
+TileAvailability::State
+TileAvailability::get( const TileKey& key ) const
+{
+    if ( !key.valid() )
+        return UNKNOWN;
+
+    unsigned lod = key.getLevelOfDetail();
+    unsigned x, y;
+    key.getTileXY( x, y );
+
+    ScopedReadLock shared( _mutex );
+
+    Roots::const_iterator r = _roots.find( RootID(x >> lod, y >> lod) );
+    if ( r == _roots.end() )
+        return UNKNOWN;
+
+    unsigned node = r->second;
+    for( unsigned level = 0; level < lod; ++level )
+    {
+        if ( _nodes[node]._children == 0 )
+            return UNKNOWN;
+        node = _nodes[node]._children + childQuadrant(x, y, lod, level);
+    }
+
+    return (State)_nodes[node]._state;
+}
+
+TileKey
+TileAvailability::getFallbackKey( const TileKey& key ) const
+{
+    if ( !key.valid() || key.getLevelOfDetail() == 0 )
+        return TileKey::INVALID;
+
+    unsigned lod = key.getLevelOfDetail();
+    unsigned x, y;
+    key.getTileXY( x, y );
+
+    // Walk down toward the key once, remembering the deepest ancestor that is
+    // known to have data, and the deepest one that is not known to be missing.
+    // Ancestors below the end of the recorded path are unknown.
+    int available = -1;
+    int best = -1;
+    {
+        ScopedReadLock shared( _mutex );
+
+        Roots::const_iterator r = _roots.find( RootID(x >> lod, y >> lod) );
+        if ( r == _roots.end() )
+            return key.createParentKey();
+
+        unsigned node = r->second;
+        unsigned level = 0;
+        for( ; level < lod; ++level )
+        {
+            if ( _nodes[node]._state == AVAILABLE )
+                available = (int)level;
+            if ( _nodes[node]._state != MISSING )
+                best = (int)level;
+            if ( _nodes[node]._children == 0 )
+                break;
+            node = _nodes[node]._children + childQuadrant(x, y, lod, level);
+        }
+
+        if ( level + 1 < lod )
+            best = (int)lod - 1;
+    }
+
+    // jump straight to known data if we can; otherwise step up past the
+    // known-missing ancestors one level at a time.
+    if ( available >= 0 )
+        best = available;
+
+    if ( best < 0 )
+        return TileKey::INVALID;
+
+    return best == (int)lod - 1 ? key.createParentKey() : key.createAncestorKey( best );
+}
+
+unsigned
+TileAvailability::getNumNodes() const
+{
+    ScopedReadLock shared( _mutex );
+    return _nodes.size() - 1;
+}
+
+void
+TileAvailability::encode( unsigned node, std::string& out ) const
+{
+    const Node& n = _nodes[node];
+    out.push_back( ENC_BASE + (char)n._state + (n._children ? ENC_HAS_CHILDREN : 0) );
+    if ( n._children )
+    {
+        for( unsigned i = 0; i < 4; ++i )
+            encode( n._children + i, out );
+    }
+}
+
+bool
+TileAvailability::decode( const std::string& in, unsigned& pos, unsigned node )
+{
+    if ( pos >= in.size() )
+        return false;
+
+    int code = in[pos++] - ENC_BASE;
+    if ( code < 0 || code >= 2*ENC_HAS_CHILDREN || (code % ENC_HAS_CHILDREN) > MISSING )
+        return false;
+
+    _nodes[node]._state = (unsigned char)(code % ENC_HAS_CHILDREN);
+
+    if ( code >= ENC_HAS_CHILDREN )
+    {
+        if ( _nodes.size() + 4 > _maxNodes )
+            return false;
+        unsigned first = _nodes.size();
+        _nodes.resize( first + 4 );
+        _nodes[node]._children = first;
+        for( unsigned i = 0; i < 4; ++i )
+        {
+            if ( !decode(in, pos, first + i) )
+                return false;
+        }
+    }
+    return true;
+}
+
+Config
+TileAvailability::getConfig() const
+{
+    Config conf( "availability" );
+
+    ScopedReadLock shared( _mutex );
+
+    for( Roots::const_iterator r = _roots.begin(); r != _roots.end(); ++r )
+    {
+        std::string nodes;
+        encode( r->second, nodes );
+
+        Config root( "root" );
+        root.add( "x",     r->first.first );
+        root.add( "y",     r->first.second );
+        root.add( "nodes", nodes );
+        conf.add( root );
+    }
+
+    _dirty = false;
+    return conf;
+}
+
+void
+TileAvailability::fromConfig( const Config& conf )
+{
+    ScopedWriteLock exclusive( _mutex );
+
+    _nodes.clear();
+    _nodes.push_back( Node() );
+    _roots.clear();
+
+    ConfigSet roots = conf.children( "root" );
+    for( ConfigSet::const_iterator i = roots.begin(); i != roots.end(); ++i )
+    {
+        RootID rootID( i->value<unsigned>("x", 0u), i->value<unsigned>("y", 0u) );
+        std::string nodes = i->value( "nodes" );
+
+        unsigned node = _nodes.size();
+        _nodes.push_back( Node() );
+
+        unsigned pos = 0;
+        if ( !decode(nodes, pos, node) || pos != nodes.size() )
+        {
+            OE_WARN << LC << "Discarding unreadable availability index" << std::endl;
+            _nodes.clear();
+            _nodes.push_back( Node() );
+            _roots.clear();
+            break;
+        }
+
+        _roots[rootID] = node;
+    }
+
+    _dirty = false;
+}
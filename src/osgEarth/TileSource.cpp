@@ -24,6 +24,7 @@
 #include <osgEarth/FileUtils>
 #include <osgEarth/Registry>
 #include <osgEarth/ThreadingUtils>
+#include <osg/Math>
 #include <osgDB/FileUtils>
 #include <osgDB/FileNameUtils>
 #include <osgDB/ReadFile>
@@ -38,7 +39,8 @@ using namespace osgEarth;
 
 //------------------------------------------------------------------------
 
-TileBlacklist::TileBlacklist()
+TileBlacklist::TileBlacklist( unsigned maxSize ) :
+_maxSize( osg::maximum(maxSize, 1u) )
 {
     //NOP
 }
@@ -47,7 +49,11 @@ void
 TileBlacklist::add(const osgTerrain::TileID &tile)
 {
     Threading::ScopedWriteLock lock(_mutex);
-    _tiles.insert(tile);
+    if ( _tiles.find(tile) == _tiles.end() )
+    {
+        _tiles[tile] = _order.insert(_order.end(), tile);
+        trim();
+    }
     OE_DEBUG << "Added " << tile.level << " (" << tile.x << ", " << tile.y << ") to blacklist" << std::endl;
 }
 
@@ -55,7 +61,12 @@ void
 TileBlacklist::remove(const osgTerrain::TileID &tile)
 {
     Threading::ScopedWriteLock lock(_mutex);
-    _tiles.erase(tile);
+    BlacklistedTiles::iterator i = _tiles.find(tile);
+    if ( i != _tiles.end() )
+    {
+        _order.erase(i->second);
+        _tiles.erase(i);
+    }
     OE_DEBUG << "Removed " << tile.level << " (" << tile.x << ", " << tile.y << ") from blacklist" << std::endl;
 }
 
@@ -64,9 +75,29 @@ TileBlacklist::clear()
 {
     Threading::ScopedWriteLock lock(_mutex);
     _tiles.clear();
+    _order.clear();
     OE_DEBUG << "Cleared blacklist" << std::endl;
 }
 
+void
+TileBlacklist::setMaxSize( unsigned maxSize )
+{
+    Threading::ScopedWriteLock lock(_mutex);
+    _maxSize = osg::maximum(maxSize, 1u);
+    trim();
+}
+
+void
+TileBlacklist::trim()
+{
+    // oldest entries go first; caller holds the write lock.
+    while ( _tiles.size() > _maxSize )
+    {
+        _tiles.erase(_order.front());
+        _order.pop_front();
+    }
+}
+
 bool
 TileBlacklist::contains(const osgTerrain::TileID &tile) const
 {
@@ -135,7 +166,7 @@ TileBlacklist::write(std::ostream &output) const
     Threading::ScopedReadLock lock(const_cast<TileBlacklist*>(this)->_mutex);
     for (BlacklistedTiles::const_iterator itr = _tiles.begin(); itr != _tiles.end(); ++itr)
     {
-        output << itr->level << " " << itr->x << " " << itr->y << std::endl;
+        output << itr->first.level << " " << itr->first.x << " " << itr->first.y << std::endl;
     }
 }
 
@@ -0,0 +1,304 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarth/WriteBehindCacheBin>
+#include <osgEarth/ThreadingUtils>
+#include <osg/Image>
+#include <osg/Shape>
+#include <map>
+
+using namespace osgEarth;
+
+#define LC "[WriteBehindCacheBin] "
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    // Approximate memory held by a queued object; only bulk data counts.
+    size_t getFootprint( const osg::Object* object )
+    {
+        const osg::Image* image = dynamic_cast<const osg::Image*>( object );
+        if ( image )
+            return image->getTotalSizeInBytesIncludingMipmaps();
+
+        const osg::HeightField* hf = dynamic_cast<const osg::HeightField*>( object );
+        if ( hf )
+            return hf->getNumColumns() * hf->getNumRows() * sizeof(float);
+
+        const StringObject* so = dynamic_cast<const StringObject*>( object );
+        if ( so )
+            return so->getString().size();
+
+        return sizeof(osg::Object);
+    }
+}
+
+//------------------------------------------------------------------------
+
+struct WriteBehindCacheBin::WriteQueue : public osg::Referenced
+{
+    struct Entry
+    {
+        Entry() : _bytes(0), _generation(0), _queued(false) { }
+
+        osg::ref_ptr<const osg::Object> _object;
+        Config                          _meta;
+        size_t                          _bytes;
+        unsigned                        _generation;  // bumped on every write to the key
+        bool                            _queued;      // a commit task hasn't picked it up yet
+    };
+    typedef std::map<std::string, Entry> Entries;
+
+    WriteQueue( CacheBin* bin, size_t maxBytes )
+        : _bin( bin ), _maxBytes( maxBytes ), _bytes( 0 ), _generation( 0 ) { }
+
+    osg::ref_ptr<CacheBin> _bin;
+    size_t                 _maxBytes;
+    size_t                 _bytes;
+    unsigned               _generation;
+    Entries                _entries;
+    Threading::Mutex       _mutex;
+    OpenThreads::Condition _drained;
+
+    // Writes the latest queued object for "key" to the wrapped bin.
+    void commit( const std::string& key )
+    {
+        osg::ref_ptr<const osg::Object> object;
+        Config                          meta;
+        unsigned                        generation;
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            Entries::iterator i = _entries.find( key );
+            if ( i == _entries.end() )
+                return;
+
+            i->second._queued = false;
+            object     = i->second._object.get();
+            meta       = i->second._meta;
+            generation = i->second._generation;
+        }
+
+        if ( !_bin->write(key, object.get(), meta) )
+        {
+            OE_WARN << LC << "Deferred write of \"" << key << "\" to bin " << _bin->getID() << " failed" << std::endl;
+        }
+
+        {
+            Threading::ScopedMutexLock lock( _mutex );
+            Entries::iterator i = _entries.find( key );
+
+            // if the key was rewritten while we were busy, leave it for the
+            // task that the new write queued.
+            if ( i != _entries.end() && i->second._generation == generation )
+            {
+                _bytes -= i->second._bytes;
+                _entries.erase( i );
+            }
+
+            if ( _entries.empty() )
+                _drained.broadcast();
+        }
+    }
+
+    struct CommitTask : public TaskRequest
+    {
+        CommitTask( WriteQueue* queue, const std::string& key )
+            : _queue( queue ), _key( key ) { }
+
+        void operator()( ProgressCallback* progress )
+        {
+            _queue->commit( _key );
+        }
+
+        osg::ref_ptr<WriteQueue> _queue;
+        std::string              _key;
+    };
+};
+
+//------------------------------------------------------------------------
+
+WriteBehindCacheBin::WriteBehindCacheBin(CacheBin*    bin,
+                                         size_t       maxPendingBytes,
+                                         TaskService* service) :
+CacheBin( bin->getID() ),
+_service( service )
+{
+    _queue = new WriteQueue( bin, maxPendingBytes );
+
+    if ( !_service.valid() )
+    {
+        _service = new TaskService( "WriteBehind " + bin->getID(), 1 );
+    }
+}
+
+WriteBehindCacheBin::~WriteBehindCacheBin()
+{
+    flush();
+    _service = 0L;
+}
+
+CacheBin*
+WriteBehindCacheBin::getWrappedBin() const
+{
+    return _queue->_bin.get();
+}
+
+unsigned
+WriteBehindCacheBin::getNumPendingWrites() const
+{
+    Threading::ScopedMutexLock lock( _queue->_mutex );
+    return _queue->_entries.size();
+}
+
+ReadResult
+WriteBehindCacheBin::readObject( const std::string& key, double maxAge )
+{
+    osg::ref_ptr<const osg::Object> object;
+    Config meta;
+    {
+        Threading::ScopedMutexLock lock( _queue->_mutex );
+        WriteQueue::Entries::iterator i = _queue->_entries.find( key );
+        if ( i != _queue->_entries.end() )
+        {
+            object = i->second._object.get();
+            meta   = i->second._meta;
+        }
+    }
+
+    // the queued copy is shared with the commit task, so hand out a clone.
+    if ( object.valid() )
+        return ReadResult( osg::clone(object.get(), osg::CopyOp::DEEP_COPY_ALL), meta );
+
+    return _queue->_bin->readObject( key, maxAge );
+}
+
+ReadResult
+WriteBehindCacheBin::readImage( const std::string& key, double maxAge )
+{
+    {
+        Threading::ScopedMutexLock lock( _queue->_mutex );
+        if ( _queue->_entries.find(key) == _queue->_entries.end() )
+            return _queue->_bin->readImage( key, maxAge );
+    }
+    return readObject( key, maxAge );
+}
+
+ReadResult
+WriteBehindCacheBin::readString( const std::string& key, double maxAge )
+{
+    {
+        Threading::ScopedMutexLock lock( _queue->_mutex );
+        if ( _queue->_entries.find(key) == _queue->_entries.end() )
+            return _queue->_bin->readString( key, maxAge );
+    }
+    return readObject( key, maxAge );
+}
+
+bool
+WriteBehindCacheBin::write( const std::string& key, const osg::Object* object, const Config& meta )
+{
+    if ( !object )
+        return false;
+
+    size_t bytes = getFootprint( object );
+    bool   queueTask = false;
+    {
+        Threading::ScopedMutexLock lock( _queue->_mutex );
+
+        WriteQueue::Entries::iterator i = _queue->_entries.find( key );
+        bool overCap = 
+            i == _queue->_entries.end() &&
+            !_queue->_entries.empty() &&
+            _queue->_bytes + bytes > _queue->_maxBytes;
+
+        if ( !overCap )
+        {
+            WriteQueue::Entry& entry = _queue->_entries[key];
+            _queue->_bytes -= entry._bytes;
+
+            // take a private copy; the caller is free to modify the original
+            // after we return.
+            entry._object     = osg::clone( object, osg::CopyOp::DEEP_COPY_ALL );
+            entry._meta       = meta;
+            entry._bytes      = bytes;
+            entry._generation = ++_queue->_generation;
+            _queue->_bytes   += bytes;
+
+            // a commit task that hasn't started yet will pick up the new object.
+            queueTask = !entry._queued;
+            entry._queued = true;
+
+            if ( !queueTask )
+                return true;
+        }
+    }
+
+    if ( queueTask )
+    {
+        _service->add( new WriteQueue::CommitTask(_queue.get(), key) );
+        return true;
+    }
+
+    // queue is full; write through.
+    return _queue->_bin->write( key, object, meta );
+}
+
+bool
+WriteBehindCacheBin::isCached( const std::string& key, double maxAge )
+{
+    {
+        Threading::ScopedMutexLock lock( _queue->_mutex );
+        if ( _queue->_entries.find(key) != _queue->_entries.end() )
+            return true;
+    }
+    return _queue->_bin->isCached( key, maxAge );
+}
+
+Config
+WriteBehindCacheBin::readMetadata()
+{
+    return _queue->_bin->readMetadata();
+}
+
+bool
+WriteBehindCacheBin::writeMetadata( const Config& meta )
+{
+    return _queue->_bin->writeMetadata( meta );
+}
+
+bool
+WriteBehindCacheBin::purge()
+{
+    // let in-flight writes land first so they don't reappear after the purge.
+    flush();
+    return _queue->_bin->purge();
+}
+
+void
+WriteBehindCacheBin::flush()
+{
+    {
+        Threading::ScopedMutexLock lock( _queue->_mutex );
+        while( !_queue->_entries.empty() )
+        {
+            _queue->_drained.wait( &_queue->_mutex );
+        }
+    }
+    _queue->_bin->flush();
+}
@@ -79,6 +79,186 @@ public:
         return true;
     }
 
+    // a feature, and the geometry to draw for it (in the image SRS)
+    typedef std::pair< const Feature*, osg::ref_ptr<const Geometry> > DrawItem;
+    typedef std::vector<DrawItem> DrawList;
+
+    // Length below which to resample lines, i.e. the size of a pixel, for an
+    // image covering "extent".
+    double getResampleLength( const GeoExtent& extent, const osg::Image* image ) const
+    {
+        return osg::minimum(
+            extent.width()  / (double)image->s(),
+            extent.height() / (double)image->t() );
+    }
+
+    // Buffer distance (half the line width) for lines drawn with "masterLine", in
+    // the units of the SRS of "extent", for an image covering "extent".
+    // "dataExtent" is the extent of the feature data in that same SRS.
+    double getBufferDistance(
+        const LineSymbol* masterLine,
+        const GeoExtent&  extent,
+        const GeoExtent&  dataExtent,
+        const osg::Image* image ) const
+    {
+        const SpatialReference* featureSRS = extent.getSRS();
+
+        double lineWidth = 1.0;
+        if ( masterLine && masterLine->stroke()->width().isSet() )
+        {
+            lineWidth = masterLine->stroke()->width().value();
+
+            double pixelWidth = extent.width() / (double)image->s();
+
+            // if the width units are specified, process them:
+            if (masterLine->stroke()->widthUnits().isSet() &&
+                masterLine->stroke()->widthUnits().get() != Units::PIXELS)
+            {
+                const Units& featureUnits = featureSRS->getUnits();
+                const Units& strokeUnits  = masterLine->stroke()->widthUnits().value();
+
+                // if the units are different than those of the feature data, we need to
+                // do a units conversion.
+                if ( featureUnits != strokeUnits )
+                {
+                    if ( Units::canConvert(strokeUnits, featureUnits) )
+                    {
+                        // linear to linear, no problem
+                        lineWidth = strokeUnits.convertTo( featureUnits, lineWidth );
+                    }
+                    else if ( strokeUnits.isLinear() && featureUnits.isAngular() )
+                    {
+                        // linear to angular? approximate degrees per meter at the 
+                        // latitude of the tile's centroid.
+                        lineWidth = masterLine->stroke()->widthUnits()->convertTo(Units::METERS, lineWidth);
+                        double circ = featureSRS->getEllipsoid()->getRadiusEquator() * 2.0 * osg::PI;
+                        double x, y;
+                        dataExtent.getCentroid(x, y);
+                        double radians = (lineWidth/circ) * cos(osg::DegreesToRadians(y));
+                        lineWidth = osg::RadiansToDegrees(radians);
+                    }
+                }
+
+                // enfore a minimum width of one pixel.
+                float minPixels = masterLine->stroke()->minPixels().getOrUse( 1.0f );
+                lineWidth = osg::clampAbove(lineWidth, pixelWidth*minPixels);
+            }
+
+            else // pixels
+            {
+                lineWidth *= pixelWidth;
+            }
+        }
+
+        return lineWidth * 0.5;   // since the distance is for one side
+    }
+
+    // Draws a list of geometries (in the image SRS) into the image.
+    void rasterize(
+        const DrawList&      drawList,
+        const LineSymbol*    masterLine,
+        const PolygonSymbol* masterPoly,
+        const GeoExtent&     imageExtent,
+        osg::Image*          image )
+    {
+        double xmin = imageExtent.xMin();
+        double ymin = imageExtent.yMin();
+        double xf = (double)image->s() / imageExtent.width();
+        double yf = (double)image->t() / imageExtent.height();
+
+        // set up the AGG renderer:
+        agg::rendering_buffer rbuf( image->data(), image->s(), image->t(), image->s()*4 );
+
+        // Create the renderer and the rasterizer
+        agg::renderer<agg::span_abgr32> ren(rbuf);
+        agg::rasterizer ras;
+
+        // Setup the rasterizer
+        ras.gamma(1.3);
+        ras.filling_rule(agg::fill_even_odd);
+
+        GeoExtent cropExtent = GeoExtent(imageExtent);
+        cropExtent.scale(1.1, 1.1);
+
+        osg::ref_ptr<Symbology::Polygon> cropPoly = new Symbology::Polygon( 4 );
+        cropPoly->push_back( osg::Vec3d( cropExtent.xMin(), cropExtent.yMin(), 0 ));
+        cropPoly->push_back( osg::Vec3d( cropExtent.xMax(), cropExtent.yMin(), 0 ));
+        cropPoly->push_back( osg::Vec3d( cropExtent.xMax(), cropExtent.yMax(), 0 ));
+        cropPoly->push_back( osg::Vec3d( cropExtent.xMin(), cropExtent.yMax(), 0 ));
+
+        double lineWidth = 1.0;
+        if ( masterLine )
+            lineWidth = (double)masterLine->stroke()->width().value();
+
+        osg::Vec4 color = osg::Vec4(1, 1, 1, 1);
+        if ( masterLine )
+            color = masterLine->stroke()->color();
+
+        // render the features
+        for(DrawList::const_iterator i = drawList.begin(); i != drawList.end(); i++)
+        {
+            const Feature* feature = i->first;
+
+            const Geometry* geometry = i->second.get();
+
+            osg::ref_ptr< Geometry > croppedGeometry;
+            if ( ! geometry->crop( cropPoly.get(), croppedGeometry ) )
+                continue;
+
+            // set up a default color:
+            osg::Vec4 c = color;
+            unsigned int a = (unsigned int)(127+(c.a()*255)/2); // scale alpha up
+            agg::rgba8 fgColor( (unsigned int)(c.r()*255), (unsigned int)(c.g()*255), (unsigned int)(c.b()*255), a );
+
+            GeometryIterator gi( croppedGeometry.get() );
+            while( gi.hasMore() )
+            {
+                c = color;
+                Geometry* g = gi.next();
+            
+                const LineSymbol* line = feature->style().isSet() ? 
+                    feature->style()->getSymbol<LineSymbol>() : masterLine;
+
+                const PolygonSymbol* poly =
+                    feature->style().isSet() ? feature->style()->getSymbol<PolygonSymbol>() : masterPoly;
+
+                if (g->getType() == Geometry::TYPE_RING || g->getType() == Geometry::TYPE_LINESTRING)
+                {
+                    if ( line )
+                        c = line->stroke()->color();
+                    else if ( poly )
+                        c = poly->fill()->color();
+                }
+
+                else if ( g->getType() == Geometry::TYPE_POLYGON )
+                {
+                    if ( poly )
+                        c = poly->fill()->color();
+                    else if ( line )
+                        c = line->stroke()->color();
+                }
+
+                a = (unsigned int)(127+(c.a()*255)/2); // scale alpha up
+                fgColor = agg::rgba8( (unsigned int)(c.r()*255), (unsigned int)(c.g()*255), (unsigned int)(c.b()*255), a );
+
+                ras.filling_rule( agg::fill_even_odd );
+                for( Geometry::iterator p = g->begin(); p != g->end(); p++ )
+                {
+                    const osg::Vec3d& p0 = *p;
+                    double x0 = xf*(p0.x()-xmin);
+                    double y0 = yf*(p0.y()-ymin);
+
+                    if ( p == g->begin() )
+                        ras.move_to_d( x0, y0 );
+                    else
+                        ras.line_to_d( x0, y0 );
+                }
+            }
+            ras.render(ren, fgColor);
+            ras.reset();
+        }
+    }
+
     //override
     bool renderFeaturesForStyle(
         const Style&       style,
@@ -110,12 +290,6 @@ public:
         //if ( convertPolysToRings )
         //    OE_INFO << LC << "No PolygonSymbol; will draw polygons to rings" << std::endl;
 
-        // initialize:
-        double xmin = imageExtent.xMin();
-        double ymin = imageExtent.yMin();
-        double xf = (double)image->s() / imageExtent.width();
-        double yf = (double)image->t() / imageExtent.height();
-
         // strictly speaking we should iterate over the features and buffer each one that's a line,
         // rather then checking for the existence of a LineSymbol.
         FeatureList linesToBuffer;
@@ -171,79 +345,22 @@ public:
             const SpatialReference* featureSRS = context.profile()->getSRS();
             GeoExtent transformedExtent = imageExtent.transform(featureSRS);
 
-            double trans_xf = (double)image->s() / transformedExtent.width();
-            double trans_yf = (double)image->t() / transformedExtent.height();
-
-            // resolution of the image (pixel extents):
-            double xres = 1.0/trans_xf;
-            double yres = 1.0/trans_yf;
-
             // downsample the line data so that it is no higher resolution than to image to which
             // we intend to rasterize it. If you don't do this, you run the risk of the buffer 
             // operation taking forever on very high-res input data.
             if ( _options.optimizeLineSampling() == true )
             {
                 ResampleFilter resample;
-                resample.minLength() = osg::minimum( xres, yres );
+                resample.minLength() = getResampleLength( transformedExtent, image );
                 context = resample.push( linesToBuffer, context );
             }
 
             // now run the buffer operation on all lines:
             BufferFilter buffer;
-            double lineWidth = 1.0;
             if ( masterLine )
-            {
                 buffer.capStyle() = masterLine->stroke()->lineCap().value();
 
-                if ( masterLine->stroke()->width().isSet() )
-                {
-                    lineWidth = masterLine->stroke()->width().value();
-
-                    GeoExtent imageExtentInFeatureSRS = imageExtent.transform(featureSRS);
-                    double pixelWidth = imageExtentInFeatureSRS.width() / (double)image->s();
-
-                    // if the width units are specified, process them:
-                    if (masterLine->stroke()->widthUnits().isSet() &&
-                        masterLine->stroke()->widthUnits().get() != Units::PIXELS)
-                    {
-                        const Units& featureUnits = featureSRS->getUnits();
-                        const Units& strokeUnits  = masterLine->stroke()->widthUnits().value();
-
-                        // if the units are different than those of the feature data, we need to
-                        // do a units conversion.
-                        if ( featureUnits != strokeUnits )
-                        {
-                            if ( Units::canConvert(strokeUnits, featureUnits) )
-                            {
-                                // linear to linear, no problem
-                                lineWidth = strokeUnits.convertTo( featureUnits, lineWidth );
-                            }
-                            else if ( strokeUnits.isLinear() && featureUnits.isAngular() )
-                            {
-                                // linear to angular? approximate degrees per meter at the 
-                                // latitude of the tile's centroid.
-                                lineWidth = masterLine->stroke()->widthUnits()->convertTo(Units::METERS, lineWidth);
-                                double circ = featureSRS->getEllipsoid()->getRadiusEquator() * 2.0 * osg::PI;
-                                double x, y;
-                                context.profile()->getExtent().getCentroid(x, y);
-                                double radians = (lineWidth/circ) * cos(osg::DegreesToRadians(y));
-                                lineWidth = osg::RadiansToDegrees(radians);
-                            }
-                        }
-
-                        // enfore a minimum width of one pixel.
-                        float minPixels = masterLine->stroke()->minPixels().getOrUse( 1.0f );
-                        lineWidth = osg::clampAbove(lineWidth, pixelWidth*minPixels);
-                    }
-
-                    else // pixels
-                    {
-                        lineWidth *= pixelWidth;
-                    }
-                }
-            }
-
-            buffer.distance() = lineWidth * 0.5;   // since the distance is for one side
+            buffer.distance() = getBufferDistance( masterLine, transformedExtent, context.profile()->getExtent(), image );
             buffer.push( linesToBuffer, context );
         }
 
@@ -252,98 +369,97 @@ public:
         xform.setLocalizeCoordinates( false );
         context = xform.push( features, context );
 
-        // set up the AGG renderer:
-        agg::rendering_buffer rbuf( image->data(), image->s(), image->t(), image->s()*4 );
-
-        // Create the renderer and the rasterizer
-        agg::renderer<agg::span_abgr32> ren(rbuf);
-        agg::rasterizer ras;
-
-        // Setup the rasterizer
-        ras.gamma(1.3);
-        ras.filling_rule(agg::fill_even_odd);
-
-        GeoExtent cropExtent = GeoExtent(imageExtent);
-        cropExtent.scale(1.1, 1.1);
+        DrawList drawList;
+        drawList.reserve( features.size() );
+        for(FeatureList::iterator i = features.begin(); i != features.end(); i++)
+        {
+            const Feature* feature = i->get();
+            drawList.push_back( DrawItem(feature, feature->getGeometry()) );
+        }
 
-        osg::ref_ptr<Symbology::Polygon> cropPoly = new Symbology::Polygon( 4 );
-        cropPoly->push_back( osg::Vec3d( cropExtent.xMin(), cropExtent.yMin(), 0 ));
-        cropPoly->push_back( osg::Vec3d( cropExtent.xMax(), cropExtent.yMin(), 0 ));
-        cropPoly->push_back( osg::Vec3d( cropExtent.xMax(), cropExtent.yMax(), 0 ));
-        cropPoly->push_back( osg::Vec3d( cropExtent.xMin(), cropExtent.yMax(), 0 ));
+        rasterize( drawList, masterLine, masterPoly, imageExtent, image );
 
-        double lineWidth = 1.0;
-        if ( masterLine )
-            lineWidth = (double)masterLine->stroke()->width().value();
+        bd->_pass++;
+        return true;
+    }
 
-        osg::Vec4 color = osg::Vec4(1, 1, 1, 1);
-        if ( masterLine )
-            color = masterLine->stroke()->color();
+    //override
+    bool supportsFeatureIndex() const
+    {
+        return true;
+    }
 
-        // render the features
-        for(FeatureList::iterator i = features.begin(); i != features.end(); i++)
-        {
-            Feature* feature = i->get();
+    //override
+    bool renderIndexedFeaturesForStyle(
+        const Style&                 style,
+        ProjectedFeatureIndex*       index,
+        const std::vector<unsigned>& hits,
+        osg::Referenced*             buildData,
+        const GeoExtent&             imageExtent,
+        osg::Image*                  image )
+    {
+        BuildData* bd = static_cast<BuildData*>( buildData );
 
-            Geometry* geometry = feature->getGeometry();
+        const LineSymbol* masterLine = style.getSymbol<LineSymbol>();
+        const PolygonSymbol* masterPoly = style.getSymbol<PolygonSymbol>();
 
-            osg::ref_ptr< Geometry > croppedGeometry;
-            if ( ! geometry->crop( cropPoly.get(), croppedGeometry ) )
-                continue;
+        // The features are already in the image SRS. The buffering parameters are the
+        // same for every tile in an LOD, so the index can keep the buffered lines
+        // around for the next tile that needs them.
+        double resampleLength = 0.0;
+        if ( _options.optimizeLineSampling() == true )
+            resampleLength = getResampleLength( imageExtent, image );
 
-            // set up a default color:
-            osg::Vec4 c = color;
-            unsigned int a = (unsigned int)(127+(c.a()*255)/2); // scale alpha up
-            agg::rgba8 fgColor( (unsigned int)(c.r()*255), (unsigned int)(c.g()*255), (unsigned int)(c.b()*255), a );
+        GeoExtent dataExtent = getFeatureSource()->getFeatureProfile()->getExtent().transform( index->getSRS() );
+        double distance = getBufferDistance( masterLine, imageExtent, dataExtent, image );
 
-            GeometryIterator gi( croppedGeometry.get() );
-            while( gi.hasMore() )
-            {
-                c = color;
-                Geometry* g = gi.next();
-            
-                const LineSymbol* line = feature->style().isSet() ? 
-                    feature->style()->getSymbol<LineSymbol>() : masterLine;
+        Stroke::LineCapStyle capStyle = masterLine ?
+            masterLine->stroke()->lineCap().value() :
+            BufferFilter().capStyle();
 
-                const PolygonSymbol* poly =
-                    feature->style().isSet() ? feature->style()->getSymbol<PolygonSymbol>() : masterPoly;
+        bool canBuffer = BufferFilter::isSupported();
 
-                if (g->getType() == Geometry::TYPE_RING || g->getType() == Geometry::TYPE_LINESTRING)
-                {
-                    if ( line )
-                        c = line->stroke()->color();
-                    else if ( poly )
-                        c = poly->fill()->color();
-                }
+        DrawList drawList;
+        drawList.reserve( hits.size() );
+        for( std::vector<unsigned>::const_iterator h = hits.begin(); h != hits.end(); ++h )
+        {
+            const Feature* feature = index->getFeature( *h );
+            const Geometry* geom = feature->getGeometry();
 
-                else if ( g->getType() == Geometry::TYPE_POLYGON )
-                {
-                    if ( poly )
-                        c = poly->fill()->color();
-                    else if ( line )
-                        c = line->stroke()->color();
-                }
+            // check for an embedded style:
+            const LineSymbol* line = feature->style().isSet() ? 
+                feature->style()->getSymbol<LineSymbol>() : masterLine;
 
-                a = (unsigned int)(127+(c.a()*255)/2); // scale alpha up
-                fgColor = agg::rgba8( (unsigned int)(c.r()*255), (unsigned int)(c.g()*255), (unsigned int)(c.b()*255), a );
+            const PolygonSymbol* poly =
+                feature->style().isSet() ? feature->style()->getSymbol<PolygonSymbol>() : masterPoly;
 
-                ras.filling_rule( agg::fill_even_odd );
-                for( Geometry::iterator p = g->begin(); p != g->end(); p++ )
-                {
-                    const osg::Vec3d& p0 = *p;
-                    double x0 = xf*(p0.x()-xmin);
-                    double y0 = yf*(p0.y()-ymin);
+            // lines get buffered; so do polygons if there's only a LineSymbol, in
+            // which case we draw them as outlines.
+            Geometry::Type type = geom->getComponentType();
+            bool drawAsLine =
+                type == Geometry::TYPE_LINESTRING ||
+                type == Geometry::TYPE_RING       ||
+                (type == Geometry::TYPE_POLYGON && !poly && line);
 
-                    if ( p == g->begin() )
-                        ras.move_to_d( x0, y0 );
-                    else
-                        ras.line_to_d( x0, y0 );
-                }
+            if ( drawAsLine && canBuffer )
+            {
+                osg::ref_ptr<Geometry> buffered = index->getBufferedGeometry( *h, distance, capStyle, resampleLength );
+                if ( buffered.valid() )
+                    drawList.push_back( DrawItem(feature, buffered.get()) );
+            }
+            else if ( drawAsLine && type == Geometry::TYPE_POLYGON )
+            {
+                // no buffering available; still draw the polygon as an outline.
+                drawList.push_back( DrawItem(feature, geom->cloneAs(Geometry::TYPE_RING)) );
+            }
+            else
+            {
+                drawList.push_back( DrawItem(feature, geom) );
             }
-            ras.render(ren, fgColor);
-            ras.reset();
         }
 
+        rasterize( drawList, masterLine, masterPoly, imageExtent, image );
+
         bd->_pass++;
         return true;
     }
@@ -23,20 +23,195 @@
 #include <osgEarth/XmlUtils>
 #include <osgEarth/URI>
 #include <osgEarth/Registry>
+#include <osgEarth/Containers>
+#include <osgEarth/IOTypes>
 #include <osgDB/FileUtils>
 #include <osgDB/FileNameUtils>
 #include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
 
 using namespace osgEarth;
 using namespace osgEarth::Drivers;
 using namespace osgEarth::Threading;
 
-#ifndef _WIN32
+#ifdef _WIN32
+#   include <windows.h>
+#else
 #   include <unistd.h>
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
 #endif
 
 namespace
 {
+    /**
+     * Layout of a packed bundle file:
+     *   BundleHeader
+     *   BundleEntry[bundleSize * bundleSize]   (row-major by tile y, then x)
+     *   records, each one serialized object followed by its JSON metadata
+     *
+     * New records are always appended and the index entry is updated last,
+     * so a partial write never leaves an entry pointing at garbage.
+     * Rewriting a tile orphans its old record until the bin is purged.
+     */
+    struct BundleHeader
+    {
+        char     _magic[8];
+        unsigned _bundleSize;
+        unsigned _reserved;
+    };
+
+    struct BundleEntry
+    {
+        unsigned long long _offset;   // 0 = empty slot
+        unsigned           _dataSize;
+        unsigned           _metaSize;
+    };
+
+    const char BUNDLE_MAGIC[8] = { 'O','E','B','U','N','D','L','1' };
+
+    /**
+     * Read-only memory map of a bundle file.
+     */
+    class MappedBundle : public osg::Referenced
+    {
+    public:
+        /** Maps the bundle at "path"; returns NULL if it doesn't exist or isn't valid. */
+        static MappedBundle* open( const std::string& path, unsigned bundleSize );
+
+        /**
+         * Fetches the index entry in "slot". Returns false if the slot is empty;
+         * "outOfRange" is set if the entry points past the end of the mapping,
+         * which means the file grew since it was mapped.
+         */
+        bool getEntry( unsigned slot, BundleEntry& out, bool& outOfRange ) const
+        {
+            outOfRange = false;
+            size_t pos = sizeof(BundleHeader) + slot*sizeof(BundleEntry);
+            if ( pos + sizeof(BundleEntry) > _size )
+                return false;
+            ::memcpy( &out, _data + pos, sizeof(BundleEntry) );
+            if ( out._offset == 0 )
+                return false;
+            if ( out._offset + out._dataSize + out._metaSize > _size ) {
+                outOfRange = true;
+                return false;
+            }
+            return true;
+        }
+
+        const char* data( unsigned long long offset ) const { return _data + offset; }
+
+    protected:
+        MappedBundle();
+        virtual ~MappedBundle();
+        bool map( const std::string& path );
+
+        const char* _data;
+        size_t      _size;
+#ifdef _WIN32
+        HANDLE      _file;
+        HANDLE      _mapping;
+#endif
+    };
+
+    MappedBundle::MappedBundle() :
+    _data( 0L ),
+    _size( 0 )
+    {
+#ifdef _WIN32
+        _file    = INVALID_HANDLE_VALUE;
+        _mapping = 0L;
+#endif
+    }
+
+    MappedBundle::~MappedBundle()
+    {
+#ifdef _WIN32
+        if ( _data )
+            ::UnmapViewOfFile( _data );
+        if ( _mapping )
+            ::CloseHandle( _mapping );
+        if ( _file != INVALID_HANDLE_VALUE )
+            ::CloseHandle( _file );
+#else
+        if ( _data )
+            ::munmap( const_cast<char*>(_data), _size );
+#endif
+    }
+
+    bool
+    MappedBundle::map( const std::string& path )
+    {
+#ifdef _WIN32
+        _file = ::CreateFileA(
+            path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            0L, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0L );
+        if ( _file == INVALID_HANDLE_VALUE )
+            return false;
+
+        LARGE_INTEGER size;
+        if ( !::GetFileSizeEx(_file, &size) || size.QuadPart == 0 )
+            return false;
+
+        _mapping = ::CreateFileMappingA( _file, 0L, PAGE_READONLY, 0, 0, 0L );
+        if ( !_mapping )
+            return false;
+
+        _data = static_cast<const char*>( ::MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0) );
+        if ( !_data )
+            return false;
+
+        _size = (size_t)size.QuadPart;
+#else
+        int fd = ::open( path.c_str(), O_RDONLY );
+        if ( fd < 0 )
+            return false;
+
+        struct stat st;
+        if ( ::fstat(fd, &st) != 0 || st.st_size == 0 )
+        {
+            ::close( fd );
+            return false;
+        }
+
+        void* ptr = ::mmap( 0L, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+        ::close( fd );
+        if ( ptr == MAP_FAILED )
+            return false;
+
+        _data = static_cast<const char*>( ptr );
+        _size = st.st_size;
+#endif
+        return true;
+    }
+
+    MappedBundle*
+    MappedBundle::open( const std::string& path, unsigned bundleSize )
+    {
+        osg::ref_ptr<MappedBundle> bundle = new MappedBundle();
+        if ( !bundle->map(path) )
+            return 0L;
+
+        BundleHeader header;
+        if ( bundle->_size < sizeof(BundleHeader) + bundleSize*bundleSize*sizeof(BundleEntry) )
+            return 0L;
+
+        ::memcpy( &header, bundle->_data, sizeof(BundleHeader) );
+        if ( ::memcmp(header._magic, BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC)) != 0 || header._bundleSize != bundleSize )
+        {
+            OE_WARN << "[FileSystemCache] Ignoring incompatible bundle \"" << path << "\"" << std::endl;
+            return 0L;
+        }
+
+        return bundle.release();
+    }
+
+    typedef LRUCache<std::string, osg::ref_ptr<MappedBundle> > MappedBundleCache;
+
     /** 
      * Cache that stores data in the local file system.
      */
@@ -65,6 +240,7 @@ namespace
         void init();
 
         std::string            _rootPath;
+        FileSystemCacheOptions _fsOptions;
     };
 
     /** 
@@ -74,7 +250,7 @@ namespace
     class FileSystemCacheBin : public CacheBin
     {
     public:
-        FileSystemCacheBin( const std::string& name, const std::string& rootPath );
+        FileSystemCacheBin( const std::string& name, const std::string& rootPath, const FileSystemCacheOptions& options );
 
     public: // CacheBin interface
 
@@ -99,11 +275,24 @@ namespace
     protected:
         bool purgeDirectory( const std::string& dir );
 
+        enum ObjectType { TYPE_IMAGE, TYPE_NODE, TYPE_OBJECT };
+
+        // packed storage. A key belongs in a bundle if it's a "lod/x/y" tile key.
+        bool getBundleLocation( const std::string& key, std::string& bundlePath, unsigned& slot ) const;
+        osg::ref_ptr<MappedBundle> getMappedBundle( const std::string& bundlePath, bool refresh );
+        bool findPacked( const std::string& bundlePath, unsigned slot, osg::ref_ptr<MappedBundle>& bundle, BundleEntry& entry );
+        bool readPacked( const std::string& key, ObjectType type, osgDB::ReaderWriter::ReadResult& r, Config& meta );
+        bool writePacked( const std::string& bundlePath, unsigned slot, const osg::Object* object, const Config& meta );
+
         bool                              _ok;
         std::string                       _metaPath;
+        std::string                       _binPath;
         osg::ref_ptr<osgDB::ReaderWriter> _rw;
         osg::ref_ptr<osgDB::Options>      _rwOptions;
         Threading::ReadWriteMutex         _rwmutex;
+        bool                              _packed;
+        unsigned                          _bundleSize;
+        MappedBundleCache                 _bundles;
     };
 
     void writeMeta( const std::string& fullPath, const Config& meta )
@@ -146,8 +335,8 @@ namespace
     FileSystemCache::FileSystemCache( const CacheOptions& options ) :
     Cache( options )
     {
-        FileSystemCacheOptions fsco( options );
-        _rootPath = URI( *fsco.rootPath(), options.referrer() ).full();
+        _fsOptions = FileSystemCacheOptions( options );
+        _rootPath = URI( *_fsOptions.rootPath(), options.referrer() ).full();
         init();
     }
 
@@ -165,7 +354,7 @@ namespace
     CacheBin*
     FileSystemCache::addBin( const std::string& name )
     {
-        return _bins.getOrCreate( name, new FileSystemCacheBin( name, _rootPath ) );
+        return _bins.getOrCreate( name, new FileSystemCacheBin( name, _rootPath, _fsOptions ) );
     }
 
     CacheBin*
@@ -177,7 +366,7 @@ namespace
             Threading::ScopedMutexLock lock( s_defaultBinMutex );
             if ( !_defaultBin.valid() ) // double-check
             {
-                _defaultBin = new FileSystemCacheBin( "__default", _rootPath );
+                _defaultBin = new FileSystemCacheBin( "__default", _rootPath, _fsOptions );
             }
         }
         return _defaultBin.get();
@@ -185,19 +374,23 @@ namespace
 
     //------------------------------------------------------------------------
 
-    FileSystemCacheBin::FileSystemCacheBin(const std::string&   binID,
-                                           const std::string&   rootPath) :
-    CacheBin ( binID ),
-    _ok      ( true )
+    FileSystemCacheBin::FileSystemCacheBin(const std::string&            binID,
+                                           const std::string&            rootPath,
+                                           const FileSystemCacheOptions& options) :
+    CacheBin   ( binID ),
+    _ok        ( true ),
+    _packed    ( options.packed() == true ),
+    _bundleSize( osg::maximum(*options.bundleSize(), 1u) ),
+    _bundles   ( true, 32 )
     {
-        std::string binPath = osgDB::concatPaths( rootPath, binID );
-        _metaPath = osgDB::concatPaths( binPath, "osgearth_cacheinfo.json" );
+        _binPath = osgDB::concatPaths( rootPath, binID );
+        _metaPath = osgDB::concatPaths( _binPath, "osgearth_cacheinfo.json" );
 
         OE_INFO << LC << "Initializing cache bin: " << _metaPath << std::endl;
         osgDB::makeDirectoryForFile( _metaPath );
-        if ( !osgDB::fileExists( binPath ) )
+        if ( !osgDB::fileExists( _binPath ) )
         {
-            OE_WARN << LC << "FAILED to create folder for cache bin at \"" << binPath << "\"" << std::endl;
+            OE_WARN << LC << "FAILED to create folder for cache bin at \"" << _binPath << "\"" << std::endl;
             _ok = false;
         }
         else
@@ -218,10 +411,16 @@ namespace
 
         //todo: handle maxAge
 
+        osgDB::ReaderWriter::ReadResult r;
+
+        // tile keys live in bundles when packing is on
+        Config packedMeta;
+        if ( readPacked(key, TYPE_IMAGE, r, packedMeta) )
+            return r.success() ? ReadResult( r.getImage(), packedMeta ) : ReadResult();
+
         // mangle "key" into a legal path name
         URI fileURI( toLegalFileName(key), _metaPath );
 
-        osgDB::ReaderWriter::ReadResult r;
         {
             ScopedReadLock sharedLock( _rwmutex );
             r = _rw->readImage( fileURI.full() + ".osgb", _rwOptions.get() );
@@ -229,9 +428,7 @@ namespace
             {
                 // read metadata
                 Config meta;
-                std::string metafile = fileURI.full() + ".meta";
-                if ( osgDB::fileExists(metafile) )
-                    readMeta( metafile, meta );
+                readMeta( fileURI.full() + ".meta", meta );
 
                 return ReadResult( r.getImage(), meta );
             }
@@ -247,10 +444,16 @@ namespace
 
         //todo: handle maxAge
 
+        osgDB::ReaderWriter::ReadResult r;
+
+        // tile keys live in bundles when packing is on
+        Config packedMeta;
+        if ( readPacked(key, TYPE_OBJECT, r, packedMeta) )
+            return r.success() ? ReadResult( r.getObject(), packedMeta ) : ReadResult();
+
         // mangle "key" into a legal path name
         URI fileURI( toLegalFileName(key), _metaPath );
 
-        osgDB::ReaderWriter::ReadResult r;
         {
             ScopedReadLock sharedLock( _rwmutex );
             r = _rw->readObject( fileURI.full() + ".osgb", _rwOptions.get() );
@@ -258,9 +461,7 @@ namespace
             {
                 // read metadata
                 Config meta;
-                std::string metafile = fileURI.full() + ".meta";
-                if ( osgDB::fileExists(metafile) )
-                    readMeta( metafile, meta );
+                readMeta( fileURI.full() + ".meta", meta );
 
                 // TODO: read metadata
                 return ReadResult( r.getObject(), meta );
@@ -277,10 +478,16 @@ namespace
 
         //todo: handle maxAge
 
+        osgDB::ReaderWriter::ReadResult r;
+
+        // tile keys live in bundles when packing is on
+        Config packedMeta;
+        if ( readPacked(key, TYPE_NODE, r, packedMeta) )
+            return r.success() ? ReadResult( r.getNode(), packedMeta ) : ReadResult();
+
         // mangle "key" into a legal path name
         URI fileURI( toLegalFileName(key), _metaPath );
 
-        osgDB::ReaderWriter::ReadResult r;
         {
             ScopedReadLock sharedLock( _rwmutex );
             r = _rw->readNode( fileURI.full() + ".osgb", _rwOptions.get() );
@@ -288,9 +495,7 @@ namespace
             {            
                 // read metadata
                 Config meta;
-                std::string metafile = fileURI.full() + ".meta";
-                if ( osgDB::fileExists(metafile) )
-                    readMeta( metafile, meta );
+                readMeta( fileURI.full() + ".meta", meta );
 
                 return ReadResult( r.getNode(), meta );
             }
@@ -311,10 +516,19 @@ namespace
     {
         if ( !_ok || !object ) return false;
 
+        std::string bundlePath;
+        unsigned    slot;
+        bool        packed = _packed && getBundleLocation( key, bundlePath, slot );
+
         // convert the key into a legal filename:
         URI fileURI( toLegalFileName(key), _metaPath );
 
         bool objWriteOK = false;
+        if ( packed )
+        {
+            objWriteOK = writePacked( bundlePath, slot, object, meta );
+        }
+        else
         {
             // prevent cache contention:
             ScopedWriteLock exclusiveLock( _rwmutex );
@@ -341,7 +555,7 @@ namespace
             else
             {
                 std::string filename = fileURI.full() + ".osgb";
-                r = _rw->writeObject( *object, filename );
+                r = _rw->writeObject( *object, filename, _rwOptions.get() );
                 objWriteOK = r.success();
             }
 
@@ -370,6 +584,16 @@ namespace
     {
         if ( !_ok ) return false;
 
+        std::string bundlePath;
+        unsigned    slot;
+        if ( _packed && getBundleLocation(key, bundlePath, slot) )
+        {
+            ScopedReadLock sharedLock( _rwmutex );
+            osg::ref_ptr<MappedBundle> bundle;
+            BundleEntry entry;
+            return findPacked( bundlePath, slot, bundle, entry );
+        }
+
         URI fileURI( toLegalFileName(key), _metaPath );
         return osgDB::fileExists( fileURI.full() + ".osgb" );
     }
@@ -419,11 +643,203 @@ namespace
         if ( !_ok ) return false;
         {
             ScopedWriteLock exclusiveLock( _rwmutex );
+
+            // release all mappings before deleting the bundles under them
+            _bundles.clear();
+
             std::string binDir = osgDB::getFilePath( _metaPath );
             return purgeDirectory( binDir );
         }
     }
 
+    bool
+    FileSystemCacheBin::getBundleLocation(const std::string& key, std::string& bundlePath, unsigned& slot) const
+    {
+        unsigned lod, x, y;
+        char     extra;
+        if ( sscanf(key.c_str(), "%u/%u/%u%c", &lod, &x, &y, &extra) != 3 )
+            return false;
+
+        bundlePath = osgDB::concatPaths(
+            _binPath,
+            Stringify() << lod << "/" << (x / _bundleSize) << "_" << (y / _bundleSize) << ".bundle" );
+
+        slot = (y % _bundleSize) * _bundleSize + (x % _bundleSize);
+        return true;
+    }
+
+    osg::ref_ptr<MappedBundle>
+    FileSystemCacheBin::getMappedBundle(const std::string& bundlePath, bool refresh)
+    {
+        if ( !refresh )
+        {
+            MappedBundleCache::Record rec;
+            if ( _bundles.get(bundlePath, rec) )
+                return rec.value();
+        }
+
+        osg::ref_ptr<MappedBundle> bundle = MappedBundle::open( bundlePath, _bundleSize );
+        if ( bundle.valid() )
+            _bundles.insert( bundlePath, bundle );
+        else
+            _bundles.erase( bundlePath );
+
+        return bundle;
+    }
+
+    bool
+    FileSystemCacheBin::findPacked(const std::string&          bundlePath,
+                                   unsigned                    slot,
+                                   osg::ref_ptr<MappedBundle>& bundle,
+                                   BundleEntry&                entry)
+    {
+        // caller holds the shared lock.
+        bool outOfRange = false;
+
+        bundle = getMappedBundle( bundlePath, false );
+        if ( bundle.valid() && bundle->getEntry(slot, entry, outOfRange) )
+            return true;
+
+        // another process may have appended to the bundle since we mapped it.
+        if ( outOfRange )
+        {
+            bundle = getMappedBundle( bundlePath, true );
+            if ( bundle.valid() && bundle->getEntry(slot, entry, outOfRange) )
+                return true;
+        }
+
+        return false;
+    }
+
+    bool
+    FileSystemCacheBin::readPacked(const std::string&               key,
+                                   ObjectType                       type,
+                                   osgDB::ReaderWriter::ReadResult& r,
+                                   Config&                          meta)
+    {
+        std::string bundlePath;
+        unsigned    slot;
+        if ( !_packed || !getBundleLocation(key, bundlePath, slot) )
+            return false;
+
+        ScopedReadLock sharedLock( _rwmutex );
+
+        osg::ref_ptr<MappedBundle> bundle;
+        BundleEntry entry;
+        if ( !findPacked(bundlePath, slot, bundle, entry) )
+            return true; // a miss, but still handled
+
+        // decode directly from the mapped record.
+        MemoryStreamBuf buf( bundle->data(entry._offset), entry._dataSize );
+        std::istream in( &buf );
+
+        if ( type == TYPE_IMAGE )
+            r = _rw->readImage( in, _rwOptions.get() );
+        else if ( type == TYPE_NODE )
+            r = _rw->readNode( in, _rwOptions.get() );
+        else
+            r = _rw->readObject( in, _rwOptions.get() );
+
+        if ( r.success() && entry._metaSize > 0 )
+        {
+            meta.fromJSON( std::string(bundle->data(entry._offset + entry._dataSize), entry._metaSize) );
+        }
+
+        return true;
+    }
+
+    bool
+    FileSystemCacheBin::writePacked(const std::string& bundlePath,
+                                    unsigned           slot,
+                                    const osg::Object* object,
+                                    const Config&      meta)
+    {
+        // serialize before taking the lock.
+        std::stringstream buf( std::ios_base::in | std::ios_base::out | std::ios_base::binary );
+        osgDB::ReaderWriter::WriteResult wr;
+
+        if ( dynamic_cast<const osg::Image*>(object) )
+            wr = _rw->writeImage( *static_cast<const osg::Image*>(object), buf, _rwOptions.get() );
+        else if ( dynamic_cast<const osg::Node*>(object) )
+            wr = _rw->writeNode( *static_cast<const osg::Node*>(object), buf, _rwOptions.get() );
+        else
+            wr = _rw->writeObject( *object, buf, _rwOptions.get() );
+
+        if ( !wr.success() )
+            return false;
+
+        std::string data     = buf.str();
+        std::string metaJSON = meta.empty() ? std::string() : meta.toJSON();
+
+        ScopedWriteLock exclusiveLock( _rwmutex );
+
+        std::fstream file( bundlePath.c_str(), std::ios_base::in | std::ios_base::out | std::ios_base::binary );
+        if ( !file.is_open() )
+        {
+            // new bundle: write the header and an empty index.
+            osgDB::makeDirectoryForFile( bundlePath );
+            std::ofstream create( bundlePath.c_str(), std::ios_base::out | std::ios_base::binary );
+            if ( !create.is_open() )
+                return false;
+
+            BundleHeader header;
+            ::memcpy( header._magic, BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC) );
+            header._bundleSize = _bundleSize;
+            header._reserved   = 0;
+            create.write( reinterpret_cast<const char*>(&header), sizeof(BundleHeader) );
+
+            std::vector<char> index( _bundleSize*_bundleSize*sizeof(BundleEntry), 0 );
+            create.write( &index[0], index.size() );
+            create.close();
+            if ( create.fail() )
+                return false;
+
+            file.open( bundlePath.c_str(), std::ios_base::in | std::ios_base::out | std::ios_base::binary );
+            if ( !file.is_open() )
+                return false;
+        }
+        else
+        {
+            BundleHeader header;
+            file.read( reinterpret_cast<char*>(&header), sizeof(BundleHeader) );
+            if ( file.fail() ||
+                 ::memcmp(header._magic, BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC)) != 0 ||
+                 header._bundleSize != _bundleSize )
+            {
+                OE_WARN << LC << "Cannot write to incompatible bundle \"" << bundlePath << "\"" << std::endl;
+                return false;
+            }
+        }
+
+        // append the record, then point the index at it.
+        file.seekp( 0, std::ios_base::end );
+
+        BundleEntry entry;
+        entry._offset   = (unsigned long long)file.tellp();
+        entry._dataSize = (unsigned)data.size();
+        entry._metaSize = (unsigned)metaJSON.size();
+
+        file.write( data.data(), data.size() );
+        if ( !metaJSON.empty() )
+            file.write( metaJSON.data(), metaJSON.size() );
+        file.flush();
+
+        if ( !file.fail() )
+        {
+            file.seekp( sizeof(BundleHeader) + slot*sizeof(BundleEntry), std::ios_base::beg );
+            file.write( reinterpret_cast<const char*>(&entry), sizeof(BundleEntry) );
+            file.flush();
+        }
+
+        bool ok = !file.fail();
+        file.close();
+
+        // the existing mapping (if any) no longer covers the new record.
+        _bundles.erase( bundlePath );
+
+        return ok;
+    }
+
     Config
     FileSystemCacheBin::readMetadata()
     {
@@ -181,7 +181,7 @@ SerialKeyNodeFactory::createNode( const TileKey& key, ProgressCallback* progress
     if ( progress && progress->isCanceled() )
         return 0L;
 
-    _modelFactory->createTileModel(key, model, isReal);
+    _modelFactory->createTileModel(key, model, isReal, progress);
 
     if ( progress && progress->isCanceled() )
         return 0L;
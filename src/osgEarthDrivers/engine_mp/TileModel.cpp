@@ -163,7 +163,8 @@ _tileLocator   ( rhs._tileLocator.get() ),
 _colorData     ( rhs._colorData ),
 _elevationData ( rhs._elevationData ),
 _sampleRatio   ( rhs._sampleRatio ),
-_parentStateSet( rhs._parentStateSet )
+_parentStateSet( rhs._parentStateSet ),
+_fetchTimes    ( rhs._fetchTimes )
 {
     //nop
 }
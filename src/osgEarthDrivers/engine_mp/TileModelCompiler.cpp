@@ -34,6 +34,7 @@
 #include <osg/GL2Extensions>
 #include <osgUtil/DelaunayTriangulator>
 #include <osgUtil/Optimizer>
+#include <typeinfo>
 
 using namespace osgEarth_engine_mp;
 using namespace osgEarth;
@@ -68,6 +69,77 @@ CompilerCache::TexCoordArrayCache::get(const osg::Vec4d& mat,
 }
 
 
+osg::DrawElements*
+CompilerCache::getSurfaceElements(unsigned cols, unsigned rows, bool swapOrientation, bool useVBOs)
+{
+    SurfaceElementsKey key;
+    key._cols            = cols;
+    key._rows            = rows;
+    key._swapOrientation = swapOrientation;
+
+    osg::ref_ptr<osg::DrawElements>& elements = _surfaceElements[key];
+    if ( !elements.valid() )
+    {
+        unsigned numVerts = cols * rows;
+
+        if ( numVerts < 0xFF )
+            elements = new osg::DrawElementsUByte(GL_TRIANGLES);
+        else
+            elements = new osg::DrawElementsUShort(GL_TRIANGLES);
+
+        elements->reserveElements((rows-1) * (cols-1) * 6);
+
+        // same layout that tessellateSurfaceGeometry produces for a complete grid.
+        for(unsigned j=0; j<rows-1; ++j)
+        {
+            for(unsigned i=0; i<cols-1; ++i)
+            {
+                unsigned i00, i01;
+                if (swapOrientation)
+                {
+                    i01 = j*cols + i;
+                    i00 = i01+cols;
+                }
+                else
+                {
+                    i00 = j*cols + i;
+                    i01 = i00+cols;
+                }
+
+                unsigned i10 = i00+1;
+                unsigned i11 = i01+1;
+
+                elements->addElement(i01);
+                elements->addElement(i00);
+                elements->addElement(i11);
+
+                elements->addElement(i00);
+                elements->addElement(i10);
+                elements->addElement(i11);
+            }
+        }
+
+        // give it its own buffer object so the indices go to the GPU once
+        // and are then shared by every tile that uses them.
+        if ( useVBOs )
+            elements->setElementBufferObject( new osg::ElementBufferObject() );
+    }
+
+    return elements.get();
+}
+
+osg::DrawArrays*
+CompilerCache::getSkirtStrip(unsigned numVerts)
+{
+    osg::ref_ptr<osg::DrawArrays>& strip = _skirtStrips[numVerts];
+    if ( !strip.valid() )
+    {
+        strip = new osg::DrawArrays(GL_TRIANGLE_STRIP, 0, numVerts);
+    }
+    return strip.get();
+}
+
+
 //------------------------------------------------------------------------
 
 
@@ -482,6 +554,95 @@ namespace
     }
 
 
+    /**
+     * Transforms a regular grid of unit-space points (one per vertex of the
+     * tile surface) into geocentric model space. The trig for each column and
+     * row is computed once, instead of once per vertex as a call to
+     * GeoLocator::unitToModel would. Only handles a plain geocentric
+     * GeoLocator with an axis-aligned transform; init() returns false for
+     * anything else.
+     */
+    struct GeocentricGrid
+    {
+        bool init( const GeoLocator* locator, unsigned numCols, unsigned numRows )
+        {
+            if ( !locator ||
+                 typeid(*locator) != typeid(GeoLocator) ||
+                 locator->getCoordinateSystemType() != osgTerrain::Locator::GEOCENTRIC ||
+                 !locator->getEllipsoidModel() ||
+                 numCols < 2 || numRows < 2 )
+            {
+                return false;
+            }
+
+            const osg::Matrixd& m = locator->getTransform();
+            if ( m(0,1) != 0.0 || m(0,2) != 0.0 || m(0,3) != 0.0 ||
+                 m(1,0) != 0.0 || m(1,2) != 0.0 || m(1,3) != 0.0 ||
+                 m(2,0) != 0.0 || m(2,1) != 0.0 || m(2,3) != 0.0 ||
+                 m(3,3) != 1.0 )
+            {
+                return false;
+            }
+
+            // same derivation as osg::EllipsoidModel:
+            const osg::EllipsoidModel* em = locator->getEllipsoidModel();
+            double flattening = (em->getRadiusEquator() - em->getRadiusPolar()) / em->getRadiusEquator();
+            _e2      = 2.0*flattening - flattening*flattening;
+            _hScale  = m(2,2);
+            _hOffset = m(3,2);
+
+            _cosLon.resize( numCols );
+            _sinLon.resize( numCols );
+            for( unsigned i=0; i<numCols; ++i )
+            {
+                double lon = ((double)i/(double)(numCols-1)) * m(0,0) + m(3,0);
+                _cosLon[i] = cos( lon );
+                _sinLon[i] = sin( lon );
+            }
+
+            _cosLat.resize( numRows );
+            _sinLat.resize( numRows );
+            _N.resize( numRows );
+            for( unsigned j=0; j<numRows; ++j )
+            {
+                double lat = ((double)j/(double)(numRows-1)) * m(1,1) + m(3,1);
+                _cosLat[j] = cos( lat );
+                _sinLat[j] = sin( lat );
+                _N[j]      = em->getRadiusEquator() / sqrt( 1.0 - _e2*_sinLat[j]*_sinLat[j] );
+            }
+
+            return true;
+        }
+
+        /** Model position and unit up vector for every grid point, row-major. */
+        void transform( const std::vector<double>& unitHeights, std::vector<osg::Vec3d>& out_model, std::vector<osg::Vec3d>& out_up ) const
+        {
+            unsigned numCols = _cosLon.size();
+            unsigned numRows = _cosLat.size();
+            for( unsigned j=0; j<numRows; ++j )
+            {
+                for( unsigned i=0; i<numCols; ++i )
+                {
+                    unsigned iv = j*numCols + i;
+                    double   h  = unitHeights[iv]*_hScale + _hOffset;
+
+                    osg::Vec3d up( _cosLat[j]*_cosLon[i], _cosLat[j]*_sinLon[i], _sinLat[j] );
+
+                    out_model[iv].set(
+                        (_N[j] + h) * up.x(),
+                        (_N[j] + h) * up.y(),
+                        (_N[j]*(1.0-_e2) + h) * up.z() );
+
+                    out_up[iv] = up;
+                }
+            }
+        }
+
+        std::vector<double> _cosLon, _sinLon, _cosLat, _sinLat, _N;
+        double              _e2, _hScale, _hOffset;
+    };
+
+
     /**
      * Iterate over the sampling grid and calculate the vertex positions and normals
      * for each sampling point.
@@ -503,6 +664,74 @@ namespace
         //}
         //bool hfEquivToTile = hfLocator.valid() ? d.geoLocator->isEquivalentTo( *d.hfGeoLocator.get() ) : false;
 
+        // Sample the raw heights for the whole grid first. When the heightfield's
+        // posts line up with the vertex grid (the usual case), copy them directly;
+        // otherwise interpolate at each vertex.
+        std::vector<float> heights( d.numVerticesInSurface, 0.0f );
+        bool heightsValid = true;
+
+        if ( hf )
+        {
+            bool hfMatchesGrid =
+                hfLocator                         &&
+                hf->getNumColumns() == d.numCols  &&
+                hf->getNumRows()    == d.numRows  &&
+                hfLocator->isEquivalentTo( *d.model->_tileLocator.get() );
+
+            for(unsigned j=0; j < d.numRows && heightsValid; ++j)
+            {
+                for(unsigned i=0; i < d.numCols; ++i)
+                {
+                    unsigned int iv = j*d.numCols + i;
+                    if ( hfMatchesGrid )
+                    {
+                        heights[iv] = hf->getHeight( i, j );
+                    }
+                    else
+                    {
+                        osg::Vec3d ndc( ((double)i)/(double)(d.numCols-1), ((double)j)/(double)(d.numRows-1), 0.0);
+                        heightsValid = d.model->_elevationData.getHeight( ndc, d.model->_tileLocator, heights[iv], INTERP_TRIANGULATE );
+                        if ( !heightsValid )
+                            break;
+                    }
+                }
+            }
+        }
+
+        // Then transform the whole grid to model space, along with the local up vectors.
+        std::vector<osg::Vec3d> models( d.numVerticesInSurface );
+        std::vector<osg::Vec3d> ups   ( d.numVerticesInSurface );
+
+        GeocentricGrid grid;
+        if ( heightsValid && grid.init(d.model->_tileLocator.get(), d.numCols, d.numRows) )
+        {
+            std::vector<double> unitHeights( d.numVerticesInSurface );
+            for(unsigned iv=0; iv < d.numVerticesInSurface; ++iv)
+                unitHeights[iv] = heights[iv] * d.scaleHeight;
+
+            grid.transform( unitHeights, models, ups );
+        }
+        else if ( heightsValid )
+        {
+            for(unsigned j=0; j < d.numRows; ++j)
+            {
+                for(unsigned i=0; i < d.numCols; ++i)
+                {
+                    unsigned int iv = j*d.numCols + i;
+                    osg::Vec3d ndc( ((double)i)/(double)(d.numCols-1), ((double)j)/(double)(d.numRows-1), heights[iv] * d.scaleHeight );
+                    d.model->_tileLocator->unitToModel( ndc, models[iv] );
+
+                    // compute the local normal (up vector)
+                    osg::Vec3d ndc_plus_one(ndc.x(), ndc.y(), ndc.z() + 1.0);
+                    osg::Vec3d model_up;
+                    d.model->_tileLocator->unitToModel(ndc_plus_one, model_up);
+                    model_up = model_up - models[iv];
+                    model_up.normalize();
+                    ups[iv] = model_up;
+                }
+            }
+        }
+
         // populate vertex and tex coord arrays    
         for(unsigned j=0; j < d.numRows; ++j)
         {
@@ -512,13 +741,8 @@ namespace
                 osg::Vec3d ndc( ((double)i)/(double)(d.numCols-1), ((double)j)/(double)(d.numRows-1), 0.0);
 
                 // raw height:
-                float heightValue = 0.0f;
-                bool  validValue  = true;
-
-                if ( hf )
-                {
-                    validValue = d.model->_elevationData.getHeight( ndc, d.model->_tileLocator, heightValue, INTERP_TRIANGULATE );
-                }
+                float heightValue = heights[iv];
+                bool  validValue  = heightsValid;
                 //if ( hfLocator )
                 //{
                 //    osg::Vec3d hf_ndc( ndc );
@@ -574,8 +798,7 @@ namespace
                 {
                     d.indices[iv] = d.surfaceVerts->size();
 
-                    osg::Vec3d model;
-                    d.model->_tileLocator->unitToModel( ndc, model );
+                    const osg::Vec3d& model = models[iv];
 
                     (*d.surfaceVerts).push_back(model - d.centerModel);
 
@@ -608,12 +831,8 @@ namespace
                     // record the raw elevation value in our float array for later
                     (*d.elevations).push_back(ndc.z());
 
-                    // compute the local normal (up vector)
-                    osg::Vec3d ndc_plus_one(ndc.x(), ndc.y(), ndc.z() + 1.0);
-                    osg::Vec3d model_up;
-                    d.model->_tileLocator->unitToModel(ndc_plus_one, model_up);
-                    model_up = model_up - model;
-                    model_up.normalize();
+                    // the local normal (up vector)
+                    const osg::Vec3d& model_up = ups[iv];
 
                     (*d.normals).push_back(model_up);
 
@@ -1010,7 +1229,7 @@ namespace
      * tile edges that hides the gap effect caused when you render two adjacent tiles at
      * different LODs.
      */
-    void createSkirtGeometry( Data& d, double skirtRatio )
+    void createSkirtGeometry( Data& d, double skirtRatio, CompilerCache& cache )
     {
         // surface normals will double as our skirt extrusion vectors
         osg::Vec3Array* skirtVectors = d.normals;
@@ -1231,7 +1450,8 @@ namespace
         for (int p=1; p < (int)skirtBreaks.size(); p++)
             d.skirt->addPrimitiveSet( new osg::DrawArrays( GL_TRIANGLE_STRIP, skirtBreaks[p-1], skirtBreaks[p] - skirtBreaks[p-1] ) );
 #else
-        d.skirt->addPrimitiveSet( new osg::DrawArrays(GL_TRIANGLE_STRIP, 0, skirtVerts->size()) );
+        // the strip only depends on the vertex count, so share it.
+        d.skirt->addPrimitiveSet( cache.getSkirtStrip(skirtVerts->size()) );
 #endif
     }
 
@@ -1241,23 +1461,38 @@ namespace
      * Builds triangles for the surface geometry, and recalculates the surface normals
      * to be optimized for slope.
      */
-    void tessellateSurfaceGeometry( Data& d, bool optimizeTriangleOrientation, bool normalizeEdges )
+    void tessellateSurfaceGeometry( Data& d, bool optimizeTriangleOrientation, bool normalizeEdges, CompilerCache& cache )
     {    
         bool swapOrientation = !(d.model->_tileLocator->orientationOpenGL());
 
         bool recalcNormals   = d.model->hasElevation(); //d.model->_elevationData.getHFLayer() != 0L;
 
-        osg::DrawElements* elements;
+        // If every grid point made it into the surface (no masks, no holes) and we
+        // are not choosing triangle orientations per tile, the triangles are the
+        // same for every tile of this size and we can use the shared indices.
+        bool useSharedElements =
+            !optimizeTriangleOrientation &&
+            d.maskRecords.size() == 0    &&
+            d.surfaceVerts->size() == d.numVerticesInSurface;
 
-        if ( d.surfaceVerts->size() < 0xFF )
-            elements = new osg::DrawElementsUByte(GL_TRIANGLES);
-        else if ( d.surfaceVerts->size() < 0xFFFF )
-            elements = new osg::DrawElementsUShort(GL_TRIANGLES);
+        osg::DrawElements* elements = 0L;
+
+        if ( useSharedElements )
+        {
+            d.surface->addPrimitiveSet( cache.getSurfaceElements(d.numCols, d.numRows, swapOrientation, d.useVBOs) );
+        }
         else
-            elements = new osg::DrawElementsUShort(GL_TRIANGLES);
+        {
+            if ( d.surfaceVerts->size() < 0xFF )
+                elements = new osg::DrawElementsUByte(GL_TRIANGLES);
+            else if ( d.surfaceVerts->size() < 0xFFFF )
+                elements = new osg::DrawElementsUShort(GL_TRIANGLES);
+            else
+                elements = new osg::DrawElementsUShort(GL_TRIANGLES);
 
-        elements->reserveElements((d.numRows-1) * (d.numCols-1) * 6);
-        d.surface->addPrimitiveSet( elements );
+            elements->reserveElements((d.numRows-1) * (d.numCols-1) * 6);
+            d.surface->addPrimitiveSet( elements );
+        }
 
         if ( recalcNormals )
         {
@@ -1268,7 +1503,9 @@ namespace
             }
         }
 
-        for(unsigned j=0; j<d.numRows-1; ++j)
+        // walk the grid to build the triangles (unless they're shared) and to
+        // accumulate the recalculated normals.
+        for(unsigned j=0; j<d.numRows-1 && (elements || recalcNormals); ++j)
         {
             for(unsigned i=0; i<d.numCols-1; ++i)
             {
@@ -1331,13 +1568,16 @@ namespace
 
                         if (!optimizeTriangleOrientation || fabsf(e00-e11)<fabsf(e01-e10))
                         {
-                            elements->addElement(i01);
-                            elements->addElement(i00);
-                            elements->addElement(i11);
+                            if (elements)
+                            {
+                                elements->addElement(i01);
+                                elements->addElement(i00);
+                                elements->addElement(i11);
 
-                            elements->addElement(i00);
-                            elements->addElement(i10);
-                            elements->addElement(i11);
+                                elements->addElement(i00);
+                                elements->addElement(i10);
+                                elements->addElement(i11);
+                            }
 
                             if (recalcNormals)
                             {                        
@@ -1354,13 +1594,16 @@ namespace
                         }
                         else
                         {
-                            elements->addElement(i01);
-                            elements->addElement(i00);
-                            elements->addElement(i10);
+                            if (elements)
+                            {
+                                elements->addElement(i01);
+                                elements->addElement(i00);
+                                elements->addElement(i10);
 
-                            elements->addElement(i01);
-                            elements->addElement(i10);
-                            elements->addElement(i11);
+                                elements->addElement(i01);
+                                elements->addElement(i10);
+                                elements->addElement(i11);
+                            }
 
                             if (recalcNormals)
                             {                       
@@ -1919,10 +2162,10 @@ TileModelCompiler::compile(const TileModel* model)
 
     // build the skirts.
     if ( d.createSkirt )
-        createSkirtGeometry( d, *_options.heightFieldSkirtRatio() );
+        createSkirtGeometry( d, *_options.heightFieldSkirtRatio(), _cache );
 
     // tesselate the surface verts into triangles.
-    tessellateSurfaceGeometry( d, _optimizeTriOrientation, *_options.normalizeEdges() );
+    tessellateSurfaceGeometry( d, _optimizeTriOrientation, *_options.normalizeEdges(), _cache );
 
     // installs the per-layer rendering data into the Geometry objects.
     installRenderData( d );
@@ -1936,10 +2179,9 @@ TileModelCompiler::compile(const TileModel* model)
     //    MeshConsolidator::convertToTriangles( *d.surface );
     //}
 
-    if ( d.skirt )
-    {
-        MeshConsolidator::convertToTriangles( *d.skirt );
-    }
+    // note: the skirt stays a (shared) triangle strip. Converting it to triangles
+    // never did anything anyway since MeshConsolidator skips geometry with
+    // vertex attributes.
 
     for (MaskRecordVector::iterator mr = d.maskRecords.begin(); mr != d.maskRecords.end(); ++mr)
     {
@@ -21,6 +21,10 @@
 #include <osgEarth/MapInfo>
 #include <osgEarth/ImageUtils>
 #include <osgEarth/HeightFieldUtils>
+#include <osg/Timer>
+#include <OpenThreads/Atomic>
+#include <osg/Vec2i>
+#include <sstream>
 
 using namespace osgEarth_engine_mp;
 using namespace osgEarth;
@@ -35,24 +39,25 @@ namespace
 {
     struct BuildColorData
     {
+        BuildColorData() : _mapInfo(0L), _layer(0L), _opt(0L), _isFallbackData(false), _seconds(0.0) { }
+
         void init( const TileKey&                      key, 
                    ImageLayer*                         layer, 
-                   unsigned                            order,
                    const MapInfo&                      mapInfo,
-                   const MPTerrainEngineOptions&       opt, 
-                   TileModel*                          model )
+                   const MPTerrainEngineOptions&       opt )
         {
             _key      = key;
             _layer    = layer;
-            _order    = order;
             _mapInfo  = &mapInfo;
             _opt      = &opt;
-            _model    = model;
+            _isFallbackData = false;
+            _seconds  = 0.0;
         }
 
-        bool execute()
+        void execute( ProgressCallback* progress )
         {
-            GeoImage geoImage;
+            osg::Timer_t start = osg::Timer::instance()->tick();
+
             bool isFallbackData = false;
 
             bool useMercatorFastPath =
@@ -84,23 +89,26 @@ namespace
             
             if (hasDataInExtent)
             {
-                while( !geoImage.valid() && imageKey.valid() && _layer->isKeyValid(imageKey) )
+                while( !_geoImage.valid() && imageKey.valid() && _layer->isKeyValid(imageKey) )
                 {
+                    if ( progress && progress->isCanceled() )
+                        break;
+
                     if ( useMercatorFastPath )
                     {
                         bool mercFallbackData = false;
-                        geoImage = _layer->createImageInNativeProfile( imageKey, 0L, autoFallback, mercFallbackData );
-                        if ( geoImage.valid() && mercFallbackData )
+                        _geoImage = _layer->createImageInNativeProfile( imageKey, progress, autoFallback, mercFallbackData );
+                        if ( _geoImage.valid() && mercFallbackData )
                         {
                             isFallbackData = true;
                         }
                     }
                     else
                     {
-                        geoImage = _layer->createImage( imageKey, 0L, autoFallback );
+                        _geoImage = _layer->createImage( imageKey, progress, autoFallback );
                     }
 
-                    if ( !geoImage.valid() )
+                    if ( !_geoImage.valid() )
                     {
                         imageKey = imageKey.createParentKey();
                         isFallbackData = true;
@@ -108,47 +116,56 @@ namespace
                 }
             }
 
-            if ( geoImage.valid() )
+            if ( _geoImage.valid() )
             {
-                GeoLocator* locator = 0L;
-                
                 if ( useMercatorFastPath )
-                    locator = new MercatorLocator(geoImage.getExtent());
+                    _locator = new MercatorLocator(_geoImage.getExtent());
                 else
-                    locator = GeoLocator::createForExtent(geoImage.getExtent(), *_mapInfo);
+                    _locator = GeoLocator::createForExtent(_geoImage.getExtent(), *_mapInfo);
 
                 // convert the image to PMA. This must be done in the CPU; for some
                 // reason (which we could not determine) it fails to try this after the
                 // texture lookup in the shader.
                 if ( _opt->premultipliedAlpha() == true )
                 {
-                    ImageUtils::convertToPremultipliedAlpha( geoImage.getImage() );
+                    ImageUtils::convertToPremultipliedAlpha( _geoImage.getImage() );
                 }
 
-                // add the color layer to the repo.
-                _model->_colorData[_layer->getUID()] = TileModel::ColorData(
-                    _layer,
-                    _order,
-                    geoImage.getImage(),
-                    locator,
-                    _key,
-                    isFallbackData );
-
-                return true;
+                _isFallbackData = isFallbackData;
             }
 
-            else
-            {
+            _seconds = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+        }
+
+        // Adds the fetched image (if any) to the model; returns true if it did.
+        bool addToModel( unsigned order, TileModel* model )
+        {
+            model->_fetchTimes._colorLayers[_layer->getUID()] = _seconds;
+
+            if ( !_geoImage.valid() )
                 return false;
-            }
+
+            // add the color layer to the repo.
+            model->_colorData[_layer->getUID()] = TileModel::ColorData(
+                _layer,
+                order,
+                _geoImage.getImage(),
+                _locator.get(),
+                _key,
+                _isFallbackData );
+
+            return true;
         }
 
         TileKey        _key;
         const MapInfo* _mapInfo;
         ImageLayer*    _layer;
-        unsigned       _order;
-        TileModel*     _model;
         const MPTerrainEngineOptions* _opt;
+
+        GeoImage                 _geoImage;
+        osg::ref_ptr<GeoLocator> _locator;
+        bool                     _isFallbackData;
+        double                   _seconds;
     };
 }
 
@@ -158,93 +175,151 @@ namespace
 {
     struct BuildElevationData
     {
-        void init(const TileKey& key, const MapFrame& mapf, const MPTerrainEngineOptions& opt, TileModel* model, HeightFieldCache* hfCache) //sourceTileNodeBuilder::SourceRepo& repo)
+        // Heightfield requests: the tile itself, its 8 neighbors, and its parent.
+        enum { CENTER = 0, PARENT = 9, NUM_REQUESTS = 10 };
+
+        void init(const TileKey& key, const MapFrame& mapf, const MPTerrainEngineOptions& opt, HeightFieldCache* hfCache)
         {
-            _key   = key;
             _mapf  = &mapf;
             _opt   = &opt;
-            _model = model;
             _hfCache = hfCache;
-            //_repo = &repo;
+
+            _keys[CENTER] = key;
+            unsigned n = 1;
+            for( int y=1; y>=-1; y-- )
+            {
+                for( int x=-1; x<=1; x++ )
+                {
+                    if ( x != 0 || y != 0 )
+                    {
+                        _offsets[n] = osg::Vec2i( x, y );
+                        _keys[n++]  = *_opt->normalizeEdges() ? key.createNeighborKey(x, y) : TileKey::INVALID;
+                    }
+                }
+            }
+            _keys[PARENT] = *_opt->normalizeEdges() && key.getLOD() > 0 ? key.createParentKey() : TileKey::INVALID;
+
+            for( unsigned i=0; i<NUM_REQUESTS; ++i )
+            {
+                _ok[i]         = false;
+                _isFallback[i] = false;
+                _seconds[i]    = 0.0;
+            }
         }
 
-        void execute()
-        {            
+        // Fetches one of the heightfields; safe to call concurrently for different requests.
+        void execute( unsigned i, ProgressCallback* progress )
+        {
+            if ( !_keys[i].valid() )
+                return;
+
+            // the neighbors and the parent are useless without the tile itself.
+            if ( i != CENTER && _centerFailed > 0 )
+                return;
+
+            osg::Timer_t start = osg::Timer::instance()->tick();
+
+            _ok[i] = _hfCache->getOrCreateHeightField(
+                *_mapf, _keys[i], true, _hfs[i], &_isFallback[i],
+                true, SAMPLE_FIRST_VALID, progress );
+
+            if ( i == CENTER && !_ok[i] )
+                ++_centerFailed;
+
+            _seconds[i] = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+        }
+
+        // Assembles the fetched heightfields into the model.
+        void addToModel( TileModel* model )
+        {
             const MapInfo& mapInfo = _mapf->getMapInfo();
 
-            // Request a heightfield from the map, falling back on lower resolution tiles
-            // if necessary (fallback=true)
-            osg::ref_ptr<osg::HeightField> hf;
-            bool isFallback = false;
+            model->_fetchTimes._elevation = 0.0;
+            for( unsigned i=0; i<NUM_REQUESTS; ++i )
+                model->_fetchTimes._elevation += _seconds[i];
+
+            if ( !_ok[CENTER] )
+                return;
 
-            //if ( _mapf->getHeightField( _key, true, hf, &isFallback ) )
-            if (_hfCache->getOrCreateHeightField( *_mapf, _key, true, hf, &isFallback) )
+            model->_elevationData = TileModel::ElevationData(
+                _hfs[CENTER].get(),
+                GeoLocator::createForKey( _keys[CENTER], mapInfo ),
+                _isFallback[CENTER] );
+
+            if ( *_opt->normalizeEdges() )
             {
-#if 0
-                // Put it in the repo
-                osgTerrain::HeightFieldLayer* hfLayer = new osgTerrain::HeightFieldLayer( hf.get() );
-
-                // Generate a locator.
-                hfLayer->setLocator( GeoLocator::createForKey( _key, mapInfo ) );
-
-                _model->_elevationData = TileModel::ElevationData(hfLayer, isFallback);
-#else
-                _model->_elevationData = TileModel::ElevationData(
-                    hf,
-                    GeoLocator::createForKey( _key, mapInfo ),
-                    isFallback );
-#endif
-
-#if 1
-                if ( *_opt->normalizeEdges() )
-#endif
+                // adjacency information for normalizing the edges.
+                for( unsigned i=1; i<PARENT; ++i )
                 {
-                    // next, query the neighboring tiles to get adjacency information.
-                    for( int x=-1; x<=1; x++ )
+                    if ( _ok[i] )
                     {
-                        for( int y=-1; y<=1; y++ )
+                        if ( mapInfo.isPlateCarre() )
                         {
-                            if ( x != 0 || y != 0 )
-                            {
-                                TileKey nk = _key.createNeighborKey(x, y);
-                                if ( nk.valid() )
-                                {
-                                    if (_hfCache->getOrCreateHeightField( *_mapf, nk, true, hf, &isFallback) )
-                                    {
-                                        if ( mapInfo.isPlateCarre() )
-                                        {
-                                            HeightFieldUtils::scaleHeightFieldToDegrees( hf.get() );
-                                        }
-
-                                        _model->_elevationData.setNeighbor( x, y, hf.get() );
-                                    }
-                                }
-                            }
+                            HeightFieldUtils::scaleHeightFieldToDegrees( _hfs[i].get() );
                         }
+
+                        model->_elevationData.setNeighbor( _offsets[i].x(), _offsets[i].y(), _hfs[i].get() );
                     }
+                }
 
-                    // parent too.
-                    if ( _key.getLOD() > 0 )
+                // parent too.
+                if ( _ok[PARENT] )
+                {
+                    if ( mapInfo.isPlateCarre() )
                     {
-                        if ( _hfCache->getOrCreateHeightField( *_mapf, _key.createParentKey(), true, hf, &isFallback) )
-                        {
-                            if ( mapInfo.isPlateCarre() )
-                            {
-                                HeightFieldUtils::scaleHeightFieldToDegrees( hf.get() );
-                            }
-
-                            _model->_elevationData.setParent( hf.get() );
-                        }
+                        HeightFieldUtils::scaleHeightFieldToDegrees( _hfs[PARENT].get() );
                     }
+
+                    model->_elevationData.setParent( _hfs[PARENT].get() );
                 }
             }
         }
 
-        TileKey                  _key;
         const MapFrame*          _mapf;
         const MPTerrainEngineOptions* _opt;
-        TileModel* _model;
         osg::ref_ptr< HeightFieldCache> _hfCache;
+
+        TileKey                        _keys      [NUM_REQUESTS];
+        osg::Vec2i                     _offsets   [NUM_REQUESTS];
+        osg::ref_ptr<osg::HeightField> _hfs       [NUM_REQUESTS];
+        bool                           _ok        [NUM_REQUESTS];
+        bool                           _isFallback[NUM_REQUESTS];
+        double                         _seconds   [NUM_REQUESTS];
+        OpenThreads::Atomic            _centerFailed;
+    };
+}
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    // Runs the color layer fetches and the heightfield requests for one tile
+    // as a single parallel_for range: first the image layers, then elevation.
+    struct FetchTileData
+    {
+        FetchTileData( std::vector<BuildColorData>& color, BuildElevationData& elevation, ProgressCallback* progress ) :
+            _color( color ), _elevation( elevation ), _progress( progress ) { }
+
+        unsigned size() const
+        {
+            return _color.size() + BuildElevationData::NUM_REQUESTS;
+        }
+
+        void operator()( unsigned i )
+        {
+            // the pager gave up on this tile; don't bother.
+            if ( _progress && _progress->isCanceled() )
+                return;
+
+            if ( i < _color.size() )
+                _color[i].execute( _progress );
+            else
+                _elevation.execute( i - _color.size(), _progress );
+        }
+
+        std::vector<BuildColorData>& _color;
+        BuildElevationData&          _elevation;
+        ProgressCallback*            _progress;
     };
 }
 
@@ -258,6 +333,13 @@ _liveTiles     ( liveTiles ),
 _terrainOptions( terrainOptions )
 {
     _hfCache = new HeightFieldCache();
+
+    // shared pool for fetching tile data in parallel.
+    unsigned numThreads = terrainOptions.fetchThreads().value();
+    if ( numThreads > 0 )
+    {
+        _taskService = new TaskService( "TileModelFactory", numThreads );
+    }
 }
 
 HeightFieldCache*
@@ -270,7 +352,8 @@ TileModelFactory::getHeightFieldCache() const
 void
 TileModelFactory::createTileModel(const TileKey&           key, 
                                   osg::ref_ptr<TileModel>& out_model,
-                                  bool&                    out_hasRealData)
+                                  bool&                    out_hasRealData,
+                                  ProgressCallback*        progress)
 {
     MapFrame mapf( _map, Map::MASKED_TERRAIN_LAYERS );
     
@@ -286,31 +369,61 @@ TileModelFactory::createTileModel(const TileKey&           key,
     // LOD key.
     out_hasRealData = false;
     
-    // Fetch the image data and make color layers.
-    unsigned order = 0;
+    osg::Timer_t start = osg::Timer::instance()->tick();
+
+    // Set up a fetch for each enabled image layer, and one for each heightfield
+    // we need (this tile's, its neighbors' and its parent's).
+    std::vector<BuildColorData> color;
+    color.reserve( mapf.imageLayers().size() );
     for( ImageLayerVector::const_iterator i = mapf.imageLayers().begin(); i != mapf.imageLayers().end(); ++i )
     {
         ImageLayer* layer = i->get();
 
         if ( layer->getEnabled() )
         {
-            BuildColorData build;
-            build.init( key, layer, order, mapInfo, _terrainOptions, model.get() );
-            
-            bool addedToModel = build.execute();
-            if ( addedToModel )
-            {
-                // only bump the order if we added something to the data model.
-                order++;
-            }
+            color.push_back( BuildColorData() );
+            color.back().init( key, layer, mapInfo, _terrainOptions );
+        }
+    }
+
+    BuildElevationData elevation;
+    elevation.init( key, mapf, _terrainOptions, _hfCache );
+
+    // Issue all the fetches at once and wait for them to finish, so the tile
+    // takes as long as its slowest layer instead of the sum of all of them.
+    FetchTileData fetch( color, elevation, progress );
+    parallel_for( _taskService.get(), 0, fetch.size(), fetch, (float)key.getLOD() );
+
+    if ( progress && progress->isCanceled() )
+    {
+        return;
+    }
+
+    // Make the color layers. Only bump the order if we added something to the data model.
+    unsigned order = 0;
+    for( std::vector<BuildColorData>::iterator i = color.begin(); i != color.end(); ++i )
+    {
+        if ( i->addToModel(order, model.get()) )
+        {
+            order++;
         }
     }
 
     // make an elevation layer.
-    BuildElevationData build;
-    build.init( key, mapf, _terrainOptions, model.get(), _hfCache );
-    build.execute();
+    elevation.addToModel( model.get() );
+
+    model->_fetchTimes._total = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
 
+    if ( osgEarth::isNotifyEnabled(osg::DEBUG_INFO) )
+    {
+        std::stringstream buf;
+        buf << "Fetched " << key.str() << " in " << model->_fetchTimes._total << "s (elevation "
+            << model->_fetchTimes._elevation << "s";
+        for( std::map<UID, double>::const_iterator i = model->_fetchTimes._colorLayers.begin(); i != model->_fetchTimes._colorLayers.end(); ++i )
+            buf << ", layer " << i->first << " " << i->second << "s";
+        buf << ")";
+        OE_DEBUG << LC << buf.str() << std::endl;
+    }
 
     // Bail out now if there's no data to be had.
     if ( model->_colorData.size() == 0 && !model->_elevationData.getHeightField() )
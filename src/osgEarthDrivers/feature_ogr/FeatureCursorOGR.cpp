@@ -35,7 +35,8 @@ FeatureCursorOGR::FeatureCursorOGR(OGRDataSourceH           dsHandle,
                                    const FeatureSource*     source,
                                    const FeatureProfile*    profile,
                                    const Symbology::Query&  query,
-                                   const FeatureFilterList& filters ) :
+                                   const FeatureFilterList& filters,
+                                   bool                     useBatches ) :
 _source           ( source ),
 _dsHandle         ( dsHandle ),
 _layerHandle      ( layerHandle ),
@@ -45,7 +46,8 @@ _query            ( query ),
 _chunkSize        ( 500 ),
 _nextHandleToQueue( 0L ),
 _profile          ( profile ),
-_filters          ( filters )
+_filters          ( filters ),
+_useBatches       ( useBatches )
 {
     {
         OGR_SCOPED_LOCK;
@@ -195,9 +197,18 @@ FeatureCursorOGR::readChunk()
     
     OGR_SCOPED_LOCK;
 
+    // one batch per chunk; it lives as long as any of the chunk's features.
+    osg::ref_ptr<FeatureBatch> batch;
+    if ( _useBatches )
+    {
+        batch = OgrUtils::createFeatureBatch( OGR_L_GetLayerDefn(_resultSetHandle) );
+        if ( batch.valid() )
+            batch->reserve( _chunkSize );
+    }
+
     if ( _nextHandleToQueue )
     {
-        osg::ref_ptr<Feature> f = OgrUtils::createFeature( _nextHandleToQueue, _profile->getSRS() );
+        osg::ref_ptr<Feature> f = OgrUtils::createFeature( _nextHandleToQueue, _profile->getSRS(), batch.get() );
         if ( f.valid() && !_source->isBlacklisted(f->getFID()) )
         {
             _queue.push( f );
@@ -217,7 +228,7 @@ FeatureCursorOGR::readChunk()
         OGRFeatureH handle = OGR_L_GetNextFeature( _resultSetHandle );
         if ( handle )
         {
-            osg::ref_ptr<Feature> f = OgrUtils::createFeature( handle, _profile->getSRS() );
+            osg::ref_ptr<Feature> f = OgrUtils::createFeature( handle, _profile->getSRS(), batch.get() );
             if ( f.valid() && !_source->isBlacklisted(f->getFID()) )
             {
                 _queue.push( f );
@@ -21,6 +21,7 @@
 #include <osgEarth/FileUtils>
 #include <osgEarth/Registry>
 #include <osgEarth/ImageUtils>
+#include <osgEarth/Containers>
 #include <osgEarth/URI>
 
 #include <osgDB/FileNameUtils>
@@ -33,6 +34,7 @@
 #include <sstream>
 #include <stdlib.h>
 #include <memory.h>
+#include <float.h>
 
 #include <gdal_priv.h>
 #include <gdalwarper.h>
@@ -42,6 +44,9 @@
 
 #define LC "[GDAL driver] "
 
+// Largest pixel window (per band) the driver will read into memory at once.
+#define MAX_WINDOW_PIXELS (2048*2048)
+
 // From easyrgb.com
 float Hue_2_RGB( float v1, float v2, float vH )
 {
@@ -627,14 +632,27 @@ public:
       _srcDS(NULL),
       _warpedDS(NULL),
       _options(options),
-      _maxDataLevel(30)
+      _maxDataLevel(30),
+      _warpMode(WARP_NONE),
+      _numHandles(0),
+      _blockCache(true, 64)
     {    
+        _blockCache.setMaxSize( _options.blockCacheSize().value() );
     }
 
     virtual ~GDALTileSource()
     {                     
         GDAL_SCOPED_LOCK;
 
+        // Close all the pooled per-thread handles first.
+        for( DatasetHandlesList::iterator i = _allHandles.begin(); i != _allHandles.end(); ++i )
+        {
+            closeHandles( *i );
+            delete *i;
+        }
+        _allHandles.clear();
+        _freeHandles.clear();
+
         // Close the _warpedDS dataset if :
         // - it exists
         // - and is different from _srcDS
@@ -783,6 +801,7 @@ public:
                         if (_srcDS)
                         {
                             OE_INFO << LC << "Read VRT from cache!" << std::endl;
+                            _openString = result.getString();
                         }
                     }
                 }
@@ -798,6 +817,12 @@ public:
 
                     if (_srcDS)
                     {
+                        // The VRT only exists in memory, so serialize it to XML so that
+                        // we can open additional handles on it later.
+                        char** vrtXML = _srcDS->GetMetadata( "xml:VRT" );
+                        if ( vrtXML && vrtXML[0] )
+                            _openString = vrtXML[0];
+
                         //Cache the VRT so we don't have to build it next time.
                         if (_cacheBin)
                         {
@@ -855,8 +880,14 @@ public:
                         char *pszSubdatasetName = CPLStrdup( CSLFetchNameValue( subDatasets, buf.str().c_str() ) );
                         GDALClose( _srcDS );
                         _srcDS = (GDALDataset*)GDALOpen( pszSubdatasetName, GA_ReadOnly ) ;
+                        if ( _srcDS )
+                            _openString = pszSubdatasetName;
                         CPLFree( pszSubdatasetName );
                     }
+                    else
+                    {
+                        _openString = files[0];
+                    }
                 }
 
                 if (!_srcDS)
@@ -965,28 +996,15 @@ public:
 
         if ( requiresReprojection || (profile && !profile->getSRS()->isEquivalentTo( src_srs.get() )) )
         {
-            std::string destWKT = profile ? profile->getSRS()->getWKT() : src_srs->getWKT();
+            _warpSrcWKT  = src_srs->getWKT();
+            _warpDestWKT = profile ? profile->getSRS()->getWKT() : src_srs->getWKT();
 
             if ( profile && profile->getSRS()->isGeographic() && (src_srs->isNorthPolar() || src_srs->isSouthPolar()) )
-            {
-                _warpedDS = (GDALDataset*)GDALAutoCreateWarpedVRTforPolarStereographic(
-                    _srcDS,
-                    src_srs->getWKT().c_str(),
-                    profile->getSRS()->getWKT().c_str(),
-                    GRA_NearestNeighbour,
-                    5.0,
-                    NULL);
-            }
+                _warpMode = WARP_POLAR;
             else
-            {                                
-                _warpedDS = (GDALDataset*)GDALAutoCreateWarpedVRT(
-                    _srcDS,
-                    src_srs->getWKT().c_str(),
-                    destWKT.c_str(),
-                    GRA_NearestNeighbour,
-                    5.0,
-                    0);
-            }
+                _warpMode = WARP_AUTO;
+
+            _warpedDS = createWarpedDataset( _srcDS );
 
             if ( _warpedDS )
             {
@@ -1108,17 +1126,172 @@ public:
         //Set the profile
         setProfile( profile );
 
+        // An external dataset is owned by the caller, so we cannot open more handles on it.
+        if ( useExternalDataset || _openString.empty() )
+        {
+            OE_INFO << LC << "Reads from " << source << " will be serialized on a single dataset handle" << std::endl;
+        }
+
         return STATUS_OK;
     }
 
 
+    /**
+     * Wraps a source dataset in a warped VRT according to the warping mode
+     * established in initialize(). Caller must hold the GDAL lock.
+     */
+    GDALDataset* createWarpedDataset( GDALDataset* srcDS )
+    {
+        if ( _warpMode == WARP_POLAR )
+        {
+            return (GDALDataset*)GDALAutoCreateWarpedVRTforPolarStereographic(
+                srcDS,
+                _warpSrcWKT.c_str(),
+                _warpDestWKT.c_str(),
+                GRA_NearestNeighbour,
+                5.0,
+                NULL);
+        }
+        else if ( _warpMode == WARP_AUTO )
+        {
+            return (GDALDataset*)GDALAutoCreateWarpedVRT(
+                srcDS,
+                _warpSrcWKT.c_str(),
+                _warpDestWKT.c_str(),
+                GRA_NearestNeighbour,
+                5.0,
+                0);
+        }
+        else
+        {
+            return srcDS;
+        }
+    }
+
+
+    /**
+     * A private set of handles on the dataset. GDAL allows concurrent reads
+     * as long as each thread uses its own dataset handle.
+     */
+    struct DatasetHandles
+    {
+        DatasetHandles() : _srcDS(0L), _warpedDS(0L) { }
+        GDALDataset* _srcDS;
+        GDALDataset* _warpedDS;
+    };
+    typedef std::vector<DatasetHandles*> DatasetHandlesList;
+
+    /**
+     * Borrows a private set of dataset handles from the pool, opening a new
+     * one if necessary. Returns NULL if the pool is exhausted or the source
+     * cannot be re-opened, in which case the caller must use the shared handle
+     * under the GDAL lock.
+     */
+    DatasetHandles* acquireHandles()
+    {
+        std::string openString;
+        {
+            Threading::ScopedMutexLock lock( _handlesMutex );
+            if ( _openString.empty() )
+                return 0L;
+
+            if ( !_freeHandles.empty() )
+            {
+                DatasetHandles* handles = _freeHandles.back();
+                _freeHandles.pop_back();
+                return handles;
+            }
+
+            if ( _numHandles >= _options.maxDatasetHandles().value() )
+                return 0L;
+
+            // reserve a slot so we can open the dataset outside the pool mutex.
+            ++_numHandles;
+            openString = _openString;
+        }
+
+        DatasetHandles* handles = new DatasetHandles();
+        {
+            GDAL_SCOPED_LOCK;
+            handles->_srcDS = (GDALDataset*)GDALOpen( openString.c_str(), GA_ReadOnly );
+            if ( handles->_srcDS )
+                handles->_warpedDS = createWarpedDataset( handles->_srcDS );
+
+            if ( !handles->_warpedDS )
+            {
+                OE_WARN << LC << "Failed to open an additional dataset handle; reads will be serialized" << std::endl;
+                closeHandles( handles );
+                delete handles;
+                handles = 0L;
+            }
+        }
+
+        Threading::ScopedMutexLock lock( _handlesMutex );
+        if ( handles )
+        {
+            _allHandles.push_back( handles );
+        }
+        else
+        {
+            // give up on opening more handles for this source.
+            _openString.clear();
+        }
+        return handles;
+    }
+
+    /** Returns a set of handles to the pool. */
+    void releaseHandles( DatasetHandles* handles )
+    {
+        Threading::ScopedMutexLock lock( _handlesMutex );
+        _freeHandles.push_back( handles );
+    }
+
+    /** Closes a set of pooled handles. Caller must hold the GDAL lock. */
+    void closeHandles( DatasetHandles* handles )
+    {
+        if ( handles->_warpedDS && handles->_warpedDS != handles->_srcDS )
+            GDALClose( handles->_warpedDS );
+        if ( handles->_srcDS )
+            GDALClose( handles->_srcDS );
+        handles->_warpedDS = 0L;
+        handles->_srcDS = 0L;
+    }
+
+    /**
+     * Scoped access to a readable dataset: either a private handle from the
+     * pool, or the shared handle guarded by the global GDAL lock.
+     */
+    class ScopedDataset
+    {
+    public:
+        ScopedDataset( GDALTileSource* source ) : _source(source), _lock(0L)
+        {
+            _handles = _source->acquireHandles();
+            if ( !_handles )
+                _lock = new OpenThreads::ScopedLock<OpenThreads::ReentrantMutex>( Registry::instance()->getGDALMutex() );
+        }
+
+        ~ScopedDataset()
+        {
+            if ( _handles )
+                _source->releaseHandles( _handles );
+            delete _lock;
+        }
+
+        GDALDataset* get() const { return _handles ? _handles->_warpedDS : _source->_warpedDS; }
+
+    private:
+        GDALTileSource* _source;
+        DatasetHandles* _handles;
+        OpenThreads::ScopedLock<OpenThreads::ReentrantMutex>* _lock;
+    };
+
+
     /**
     * Finds a raster band based on color interpretation 
     */
     static GDALRasterBand* findBandByColorInterp(GDALDataset *ds, GDALColorInterp colorInterp)
     {
-        GDAL_SCOPED_LOCK;
-
         for (int i = 1; i <= ds->GetRasterCount(); ++i)
         {
             if (ds->GetRasterBand(i)->GetColorInterpretation() == colorInterp) return ds->GetRasterBand(i);
@@ -1128,8 +1301,6 @@ public:
 
     static GDALRasterBand* findBandByDataType(GDALDataset *ds, GDALDataType dataType)
     {
-        GDAL_SCOPED_LOCK;
-
         for (int i = 1; i <= ds->GetRasterCount(); ++i)
         {
             if (ds->GetRasterBand(i)->GetRasterDataType() == dataType) return ds->GetRasterBand(i);
@@ -1231,7 +1402,8 @@ public:
             return NULL;
         }
 
-        GDAL_SCOPED_LOCK;
+        ScopedDataset dataset( this );
+        GDALDataset* warpedDS = dataset.get();
 
         int tileSize = _options.tileSize().value();
 
@@ -1256,11 +1428,11 @@ public:
             int width = int(((xmax - _geotransform[0]) / _geotransform[1]) - off_x);
             int height = int(((ymin - _geotransform[3]) / _geotransform[5]) - off_y);
 
-            if (off_x + width > _warpedDS->GetRasterXSize())
+            if (off_x + width > warpedDS->GetRasterXSize())
             {
-                int oversize_right = off_x + width - _warpedDS->GetRasterXSize();
+                int oversize_right = off_x + width - warpedDS->GetRasterXSize();
                 target_width = target_width - int(float(oversize_right) / width * target_width);
-                width = _warpedDS->GetRasterXSize() - off_x;
+                width = warpedDS->GetRasterXSize() - off_x;
             }
 
             if (off_x < 0)
@@ -1272,11 +1444,11 @@ public:
                 off_x = 0;
             }
 
-            if (off_y + height > _warpedDS->GetRasterYSize())
+            if (off_y + height > warpedDS->GetRasterYSize())
             {
-                int oversize_bottom = off_y + height - _warpedDS->GetRasterYSize();
+                int oversize_bottom = off_y + height - warpedDS->GetRasterYSize();
                 target_height = target_height - (int)osg::round(float(oversize_bottom) / height * target_height);
-                height = _warpedDS->GetRasterYSize() - off_y;
+                height = warpedDS->GetRasterYSize() - off_y;
             }
 
 
@@ -1299,44 +1471,44 @@ public:
 
 
 
-            GDALRasterBand* bandRed = findBandByColorInterp(_warpedDS, GCI_RedBand);
-            GDALRasterBand* bandGreen = findBandByColorInterp(_warpedDS, GCI_GreenBand);
-            GDALRasterBand* bandBlue = findBandByColorInterp(_warpedDS, GCI_BlueBand);
-            GDALRasterBand* bandAlpha = findBandByColorInterp(_warpedDS, GCI_AlphaBand);
+            GDALRasterBand* bandRed = findBandByColorInterp(warpedDS, GCI_RedBand);
+            GDALRasterBand* bandGreen = findBandByColorInterp(warpedDS, GCI_GreenBand);
+            GDALRasterBand* bandBlue = findBandByColorInterp(warpedDS, GCI_BlueBand);
+            GDALRasterBand* bandAlpha = findBandByColorInterp(warpedDS, GCI_AlphaBand);
 
-            GDALRasterBand* bandGray = findBandByColorInterp(_warpedDS, GCI_GrayIndex);
+            GDALRasterBand* bandGray = findBandByColorInterp(warpedDS, GCI_GrayIndex);
 
-            GDALRasterBand* bandPalette = findBandByColorInterp(_warpedDS, GCI_PaletteIndex);
+            GDALRasterBand* bandPalette = findBandByColorInterp(warpedDS, GCI_PaletteIndex);
 
             if (!bandRed && !bandGreen && !bandBlue && !bandAlpha && !bandGray && !bandPalette)
             {
                 OE_DEBUG << LC << "Could not determine bands based on color interpretation, using band count" << std::endl;
                 //We couldn't find any valid bands based on the color interp, so just make an educated guess based on the number of bands in the file
                 //RGB = 3 bands
-                if (_warpedDS->GetRasterCount() == 3)
+                if (warpedDS->GetRasterCount() == 3)
                 {
-                    bandRed   = _warpedDS->GetRasterBand( 1 );
-                    bandGreen = _warpedDS->GetRasterBand( 2 );
-                    bandBlue  = _warpedDS->GetRasterBand( 3 );
+                    bandRed   = warpedDS->GetRasterBand( 1 );
+                    bandGreen = warpedDS->GetRasterBand( 2 );
+                    bandBlue  = warpedDS->GetRasterBand( 3 );
                 }
                 //RGBA = 4 bands
-                else if (_warpedDS->GetRasterCount() == 4)
+                else if (warpedDS->GetRasterCount() == 4)
                 {
-                    bandRed   = _warpedDS->GetRasterBand( 1 );
-                    bandGreen = _warpedDS->GetRasterBand( 2 );
-                    bandBlue  = _warpedDS->GetRasterBand( 3 );
-                    bandAlpha = _warpedDS->GetRasterBand( 4 );
+                    bandRed   = warpedDS->GetRasterBand( 1 );
+                    bandGreen = warpedDS->GetRasterBand( 2 );
+                    bandBlue  = warpedDS->GetRasterBand( 3 );
+                    bandAlpha = warpedDS->GetRasterBand( 4 );
                 }
                 //Gray = 1 band
-                else if (_warpedDS->GetRasterCount() == 1)
+                else if (warpedDS->GetRasterCount() == 1)
                 {
-                    bandGray = _warpedDS->GetRasterBand( 1 );
+                    bandGray = warpedDS->GetRasterBand( 1 );
                 }
                 //Gray + alpha = 2 bands
-                else if (_warpedDS->GetRasterCount() == 2)
+                else if (warpedDS->GetRasterCount() == 2)
                 {
-                    bandGray  = _warpedDS->GetRasterBand( 1 );
-                    bandAlpha = _warpedDS->GetRasterBand( 2 );
+                    bandGray  = warpedDS->GetRasterBand( 1 );
+                    bandAlpha = warpedDS->GetRasterBand( 2 );
                 }
             }
 
@@ -1363,13 +1535,19 @@ public:
                 //Nearest interpolation just uses RasterIO to sample the imagery and should be very fast.
                 if (!*_options.interpolateImagery() || _options.interpolation() == INTERP_NEAREST)
                 {
-                    bandRed->RasterIO(GF_Read, off_x, off_y, width, height, red, target_width, target_height, GDT_Byte, 0, 0);
-                    bandGreen->RasterIO(GF_Read, off_x, off_y, width, height, green, target_width, target_height, GDT_Byte, 0, 0);
-                    bandBlue->RasterIO(GF_Read, off_x, off_y, width, height, blue, target_width, target_height, GDT_Byte, 0, 0);
+                    GDALRasterBand* bands[4]   = { bandRed, bandGreen, bandBlue, bandAlpha };
+                    unsigned char*  buffers[4] = { red, green, blue, alpha };
 
-                    if (bandAlpha)
+                    if (!readNearest(warpedDS, bands, buffers, bandAlpha ? 4 : 3, off_x, off_y, width, height, target_width, target_height))
                     {
-                        bandAlpha->RasterIO(GF_Read, off_x, off_y, width, height, alpha, target_width, target_height, GDT_Byte, 0, 0);
+                        bandRed->RasterIO(GF_Read, off_x, off_y, width, height, red, target_width, target_height, GDT_Byte, 0, 0);
+                        bandGreen->RasterIO(GF_Read, off_x, off_y, width, height, green, target_width, target_height, GDT_Byte, 0, 0);
+                        bandBlue->RasterIO(GF_Read, off_x, off_y, width, height, blue, target_width, target_height, GDT_Byte, 0, 0);
+
+                        if (bandAlpha)
+                        {
+                            bandAlpha->RasterIO(GF_Read, off_x, off_y, width, height, alpha, target_width, target_height, GDT_Byte, 0, 0);
+                        }
                     }
 
                     for (int src_row = 0, dst_row = tile_offset_top;
@@ -1402,20 +1580,52 @@ public:
                 }
                 else
                 {
-                    //Sample each point exactly
-                    for (unsigned int c = 0; c < (unsigned int)tileSize; ++c)
+                    // Read all the bands for the tile's pixel window in one go, from the
+                    // best overview, and sample each point exactly from memory.
+                    GDALRasterBand* bands[4] = { bandRed, bandGreen, bandBlue, bandAlpha };
+                    PixelWindow window;
+
+                    if (loadTileWindow(warpedDS, bands, bandAlpha ? 4 : 3, xmin, ymin, xmax, ymax, tileSize, true, window))
                     {
-                        double geoX = xmin + (dx * (double)c); 
+                        WindowReader readRed   = window.reader(0);
+                        WindowReader readGreen = window.reader(1);
+                        WindowReader readBlue  = window.reader(2);
+                        const double* xform    = window._invtransform;
+
                         for (unsigned int r = 0; r < (unsigned int)tileSize; ++r)
                         {
                             double geoY = ymin + (dy * (double)r); 
-                            *(image->data(c,r) + 0) = (unsigned char)getInterpolatedValue(bandRed,  geoX,geoY,false); 
-                            *(image->data(c,r) + 1) = (unsigned char)getInterpolatedValue(bandGreen,geoX,geoY,false); 
-                            *(image->data(c,r) + 2) = (unsigned char)getInterpolatedValue(bandBlue, geoX,geoY,false); 
-                            if (bandAlpha != NULL) 
-                                *(image->data(c,r) + 3) = (unsigned char)getInterpolatedValue(bandAlpha,geoX, geoY, false); 
-                            else 
-                                *(image->data(c,r) + 3) = 255; 
+                            unsigned char* pixel = image->data(0, r);
+                            for (unsigned int c = 0; c < (unsigned int)tileSize; ++c, pixel += 4)
+                            {
+                                double geoX = xmin + (dx * (double)c); 
+                                pixel[0] = (unsigned char)getInterpolatedValue(window._bands[0], readRed,   xform, geoX, geoY, false); 
+                                pixel[1] = (unsigned char)getInterpolatedValue(window._bands[1], readGreen, xform, geoX, geoY, false); 
+                                pixel[2] = (unsigned char)getInterpolatedValue(window._bands[2], readBlue,  xform, geoX, geoY, false); 
+                                if (bandAlpha != NULL) 
+                                    pixel[3] = (unsigned char)getInterpolatedValue(window._bands[3], window.reader(3), xform, geoX, geoY, false); 
+                                else 
+                                    pixel[3] = 255; 
+                            }
+                        }
+                    }
+                    else
+                    {
+                        //Sample each point exactly
+                        for (unsigned int c = 0; c < (unsigned int)tileSize; ++c)
+                        {
+                            double geoX = xmin + (dx * (double)c); 
+                            for (unsigned int r = 0; r < (unsigned int)tileSize; ++r)
+                            {
+                                double geoY = ymin + (dy * (double)r); 
+                                *(image->data(c,r) + 0) = (unsigned char)getInterpolatedValue(bandRed,  geoX,geoY,false); 
+                                *(image->data(c,r) + 1) = (unsigned char)getInterpolatedValue(bandGreen,geoX,geoY,false); 
+                                *(image->data(c,r) + 2) = (unsigned char)getInterpolatedValue(bandBlue, geoX,geoY,false); 
+                                if (bandAlpha != NULL) 
+                                    *(image->data(c,r) + 3) = (unsigned char)getInterpolatedValue(bandAlpha,geoX, geoY, false); 
+                                else 
+                                    *(image->data(c,r) + 3) = 255; 
+                            }
                         }
                     }
                 }
@@ -1440,11 +1650,17 @@ public:
 
                 if (!*_options.interpolateImagery() || _options.interpolation() == INTERP_NEAREST)
                 {
-                    bandGray->RasterIO(GF_Read, off_x, off_y, width, height, gray, target_width, target_height, GDT_Byte, 0, 0);
+                    GDALRasterBand* bands[2]   = { bandGray, bandAlpha };
+                    unsigned char*  buffers[2] = { gray, alpha };
 
-                    if (bandAlpha)
+                    if (!readNearest(warpedDS, bands, buffers, bandAlpha ? 2 : 1, off_x, off_y, width, height, target_width, target_height))
                     {
-                        bandAlpha->RasterIO(GF_Read, off_x, off_y, width, height, alpha, target_width, target_height, GDT_Byte, 0, 0);
+                        bandGray->RasterIO(GF_Read, off_x, off_y, width, height, gray, target_width, target_height, GDT_Byte, 0, 0);
+
+                        if (bandAlpha)
+                        {
+                            bandAlpha->RasterIO(GF_Read, off_x, off_y, width, height, alpha, target_width, target_height, GDT_Byte, 0, 0);
+                        }
                     }
 
                     for (int src_row = 0, dst_row = tile_offset_top;
@@ -1473,22 +1689,52 @@ public:
                 }
                 else
                 {
-                    for (int c = 0; c < tileSize; ++c) 
-                    { 
-                        double geoX = xmin + (dx * (double)c); 
+                    GDALRasterBand* bands[2] = { bandGray, bandAlpha };
+                    PixelWindow window;
+
+                    if (loadTileWindow(warpedDS, bands, bandAlpha ? 2 : 1, xmin, ymin, xmax, ymax, tileSize, true, window))
+                    {
+                        WindowReader  readGray = window.reader(0);
+                        const double* xform    = window._invtransform;
 
                         for (int r = 0; r < tileSize; ++r) 
                         { 
-                            double geoY   = ymin + (dy * (double)r); 
-                            float  color = getInterpolatedValue(bandGray,geoX,geoY,false); 
-
-                            *(image->data(c,r) + 0) = (unsigned char)color; 
-                            *(image->data(c,r) + 1) = (unsigned char)color; 
-                            *(image->data(c,r) + 2) = (unsigned char)color; 
-                            if (bandAlpha != NULL) 
-                                *(image->data(c,r) + 3) = (unsigned char)getInterpolatedValue(bandAlpha,geoX,geoY,false); 
-                            else 
-                                *(image->data(c,r) + 3) = 255; 
+                            double geoY = ymin + (dy * (double)r); 
+                            unsigned char* pixel = image->data(0, r);
+                            for (int c = 0; c < tileSize; ++c, pixel += 4) 
+                            { 
+                                double geoX  = xmin + (dx * (double)c); 
+                                float  color = getInterpolatedValue(window._bands[0], readGray, xform, geoX, geoY, false); 
+
+                                pixel[0] = (unsigned char)color; 
+                                pixel[1] = (unsigned char)color; 
+                                pixel[2] = (unsigned char)color; 
+                                if (bandAlpha != NULL) 
+                                    pixel[3] = (unsigned char)getInterpolatedValue(window._bands[1], window.reader(1), xform, geoX, geoY, false); 
+                                else 
+                                    pixel[3] = 255; 
+                            }
+                        }
+                    }
+                    else
+                    {
+                        for (int c = 0; c < tileSize; ++c) 
+                        { 
+                            double geoX = xmin + (dx * (double)c); 
+
+                            for (int r = 0; r < tileSize; ++r) 
+                            { 
+                                double geoY   = ymin + (dy * (double)r); 
+                                float  color = getInterpolatedValue(bandGray,geoX,geoY,false); 
+
+                                *(image->data(c,r) + 0) = (unsigned char)color; 
+                                *(image->data(c,r) + 1) = (unsigned char)color; 
+                                *(image->data(c,r) + 2) = (unsigned char)color; 
+                                if (bandAlpha != NULL) 
+                                    *(image->data(c,r) + 3) = (unsigned char)getInterpolatedValue(bandAlpha,geoX,geoY,false); 
+                                else 
+                                    *(image->data(c,r) + 3) = 255; 
+                            }
                         }
                     }
                 }
@@ -1507,7 +1753,10 @@ public:
                 image->allocateImage(tileSize, tileSize, 1, pixelFormat, GL_UNSIGNED_BYTE);
                 memset(image->data(), 0, image->getImageSizeInBytes());
 
-                bandPalette->RasterIO(GF_Read, off_x, off_y, width, height, palette, target_width, target_height, GDT_Byte, 0, 0);
+                if (!readNearest(warpedDS, &bandPalette, &palette, 1, off_x, off_y, width, height, target_width, target_height))
+                {
+                    bandPalette->RasterIO(GF_Read, off_x, off_y, width, height, palette, target_width, target_height, GDT_Byte, 0, 0);
+                }
 
                 for (int src_row = 0, dst_row = tile_offset_top;
                     src_row < target_height;
@@ -1565,8 +1814,6 @@ public:
 
     bool isValidValue(float v, GDALRasterBand* band)
     {
-        GDAL_SCOPED_LOCK;
-
         float bandNoData = -32767.0f;
         int success;
         float value = band->GetNoDataValue(&success);
@@ -1592,17 +1839,383 @@ public:
     }
 
 
+    /** Reads single pixels straight from a band. */
+    struct BandReader
+    {
+        BandReader( GDALRasterBand* band ) : _band(band) { }
+
+        float operator()( int col, int row ) const
+        {
+            float value;
+            _band->RasterIO(GF_Read, col, row, 1, 1, &value, 1, 1, GDT_Float32, 0, 0);
+            return value;
+        }
+
+        GDALRasterBand* _band;
+    };
+
+    /**
+     * Reads pixels from a window of a band held in memory. Pixels outside
+     * the window come from the band.
+     */
+    struct WindowReader
+    {
+        WindowReader( GDALRasterBand* band, int x, int y, int width, int height, const float* data ) :
+            _band(band), _x(x), _y(y), _width(width), _height(height), _data(data) { }
+
+        float operator()( int col, int row ) const
+        {
+            int wc = col - _x, wr = row - _y;
+            if ( wc >= 0 && wr >= 0 && wc < _width && wr < _height )
+                return _data[wr * _width + wc];
+            return BandReader(_band)( col, row );
+        }
+
+        GDALRasterBand* _band;
+        int             _x, _y, _width, _height;
+        const float*    _data;
+    };
+
+    /** Identifies a block of source pixels: overview level (-1 for full resolution), band and block index. */
+    struct BlockKey
+    {
+        BlockKey( int level, int band, int x, int y ) : _level(level), _band(band), _x(x), _y(y) { }
+
+        bool operator < ( const BlockKey& rhs ) const
+        {
+            if ( _level != rhs._level ) return _level < rhs._level;
+            if ( _band  != rhs._band )  return _band  < rhs._band;
+            if ( _y     != rhs._y )     return _y     < rhs._y;
+            return _x < rhs._x;
+        }
+
+        int _level, _band, _x, _y;
+    };
+
+    /** A block of source pixels, converted to float. Edge blocks are clipped to the raster. */
+    struct PixelBlock : public osg::Referenced
+    {
+        int                _x, _y, _width, _height;
+        std::vector<float> _data;
+    };
+
+    typedef LRUCache< BlockKey, osg::ref_ptr<PixelBlock> > BlockCache;
+
+    /**
+     * A rectangle of source pixels for several bands, at one resolution level
+     * (full resolution or an overview), stored band after band.
+     */
+    struct PixelWindow
+    {
+        PixelWindow() : _level(-1), _x(0), _y(0), _width(0), _height(0) { }
+
+        WindowReader reader( unsigned i ) const
+        {
+            return WindowReader( _bands[i], _x, _y, _width, _height, &_data[i * _width * _height] );
+        }
+
+        int                          _level;
+        int                          _x, _y, _width, _height;
+        double                       _invtransform[6];
+        std::vector<GDALRasterBand*> _bands;
+        std::vector<float>           _data;
+    };
+
+    /**
+     * Picks the resolution level to read from when each output sample spans
+     * "pixelsPerSample" full-resolution pixels: the coarsest overview that is
+     * still at least as fine as the output, or -1 for full resolution. All the
+     * bands must have a matching overview.
+     */
+    int chooseLevel( GDALRasterBand** bands, int numBands, double pixelsPerSample )
+    {
+        int    best       = -1;
+        double bestFactor = 1.0;
+
+        for (int i = 0; i < bands[0]->GetOverviewCount(); ++i)
+        {
+            GDALRasterBand* ov = bands[0]->GetOverview(i);
+            if ( !ov || ov->GetXSize() <= 0 )
+                continue;
+
+            double factor = (double)bands[0]->GetXSize() / (double)ov->GetXSize();
+            if ( factor <= pixelsPerSample && factor > bestFactor )
+            {
+                bool allBands = true;
+                for (int b = 1; b < numBands && allBands; ++b)
+                {
+                    GDALRasterBand* other = bands[b]->GetOverview(i);
+                    allBands = other && other->GetXSize() == ov->GetXSize() && other->GetYSize() == ov->GetYSize();
+                }
+                if ( allBands )
+                {
+                    best       = i;
+                    bestFactor = factor;
+                }
+            }
+        }
+        return best;
+    }
+
+    /**
+     * Loads the pixel rectangle [x, y, width, height] (in the pixel space of
+     * the given level) of each band into a window. Reads go through the block
+     * cache in whole, block-aligned units, so adjacent tiles share the blocks
+     * they overlap. Full-resolution blocks missing for several bands are read
+     * with a single multi-band RasterIO.
+     */
+    bool loadPixelWindow( GDALDataset* ds, GDALRasterBand** bands, int numBands, int level,
+                          int x, int y, int width, int height, PixelWindow& out )
+    {
+        out._level  = level;
+        out._x      = x;
+        out._y      = y;
+        out._width  = width;
+        out._height = height;
+        out._bands.resize( numBands );
+
+        for (int b = 0; b < numBands; ++b)
+        {
+            out._bands[b] = level < 0 ? bands[b] : bands[b]->GetOverview(level);
+            if ( !out._bands[b] )
+                return false;
+        }
+
+        GDALRasterBand* first = out._bands[0];
+        int rasterWidth  = first->GetXSize();
+        int rasterHeight = first->GetYSize();
+        if ( width <= 0 || height <= 0 || x < 0 || y < 0 || x + width > rasterWidth || y + height > rasterHeight )
+            return false;
+
+        // map-to-pixel transform at this level:
+        double sx = (double)rasterWidth  / (double)bands[0]->GetXSize();
+        double sy = (double)rasterHeight / (double)bands[0]->GetYSize();
+        for (int i = 0; i < 3; ++i)
+        {
+            out._invtransform[i]   = _invtransform[i]   * sx;
+            out._invtransform[i+3] = _invtransform[i+3] * sy;
+        }
+
+        // use the native block size unless it's degenerate (e.g. single-row strips):
+        int blockWidth, blockHeight;
+        first->GetBlockSize( &blockWidth, &blockHeight );
+        if ( blockWidth < 64 || blockWidth > 1024 || blockHeight < 64 || blockHeight > 1024 )
+        {
+            blockWidth  = 256;
+            blockHeight = 256;
+        }
+
+        unsigned windowSize = width * height;
+        out._data.resize( windowSize * numBands );
+
+        std::vector< osg::ref_ptr<PixelBlock> > blocks( numBands );
+        std::vector<int> missing;
+        missing.reserve( numBands );
+
+        for (int by = y / blockHeight; by <= (y + height - 1) / blockHeight; ++by)
+        {
+            for (int bx = x / blockWidth; bx <= (x + width - 1) / blockWidth; ++bx)
+            {
+                missing.clear();
+                for (int b = 0; b < numBands; ++b)
+                {
+                    BlockCache::Record record;
+                    if ( _blockCache.get( BlockKey(level, out._bands[b]->GetBand(), bx, by), record ) )
+                        blocks[b] = record.value().get();
+                    else
+                        missing.push_back( b );
+                }
+
+                if ( !missing.empty() )
+                {
+                    int bx0 = bx * blockWidth;
+                    int by0 = by * blockHeight;
+                    int bw  = osg::minimum( blockWidth,  rasterWidth  - bx0 );
+                    int bh  = osg::minimum( blockHeight, rasterHeight - by0 );
+
+                    std::vector<float> buffer( bw * bh * missing.size() );
+                    bool ok = true;
+
+                    if ( level < 0 && missing.size() > 1 )
+                    {
+                        std::vector<int> bandMap( missing.size() );
+                        for (unsigned m = 0; m < missing.size(); ++m)
+                            bandMap[m] = out._bands[missing[m]]->GetBand();
+
+                        ok = ds->RasterIO(GF_Read, bx0, by0, bw, bh, &buffer[0], bw, bh, GDT_Float32,
+                                          (int)missing.size(), &bandMap[0], 0, 0, 0) == CE_None;
+                    }
+                    else
+                    {
+                        for (unsigned m = 0; m < missing.size() && ok; ++m)
+                        {
+                            ok = out._bands[missing[m]]->RasterIO(GF_Read, bx0, by0, bw, bh, &buffer[m * bw * bh],
+                                                                  bw, bh, GDT_Float32, 0, 0) == CE_None;
+                        }
+                    }
+
+                    if ( !ok )
+                        return false;
+
+                    for (unsigned m = 0; m < missing.size(); ++m)
+                    {
+                        PixelBlock* block = new PixelBlock();
+                        block->_x      = bx0;
+                        block->_y      = by0;
+                        block->_width  = bw;
+                        block->_height = bh;
+                        block->_data.assign( buffer.begin() + m * bw * bh, buffer.begin() + (m+1) * bw * bh );
+                        blocks[missing[m]] = block;
+                        _blockCache.insert( BlockKey(level, out._bands[missing[m]]->GetBand(), bx, by), block );
+                    }
+                }
+
+                // copy the part of the block that overlaps the window:
+                const PixelBlock* block = blocks[0].get();
+                int c0 = osg::maximum( x, block->_x );
+                int c1 = osg::minimum( x + width,  block->_x + block->_width );
+                int r0 = osg::maximum( y, block->_y );
+                int r1 = osg::minimum( y + height, block->_y + block->_height );
+
+                for (int b = 0; b < numBands; ++b)
+                {
+                    const PixelBlock* bandBlock = blocks[b].get();
+                    float* dest = &out._data[b * windowSize];
+                    for (int r = r0; r < r1; ++r)
+                    {
+                        memcpy( dest + (r - y) * width + (c0 - x),
+                                &bandBlock->_data[(r - bandBlock->_y) * bandBlock->_width + (c0 - bandBlock->_x)],
+                                (c1 - c0) * sizeof(float) );
+                    }
+                }
+            }
+        }
+
+        return true;
+    }
+
+    /**
+     * Loads the pixel window that covers a tile's extent, at the resolution
+     * level best suited to sampling it "samples" times across (or at full
+     * resolution if "useOverviews" is false). The geotransform is affine, so
+     * the tile corners bound the window; it is padded by a pixel to cover the
+     * half-pixel offset and edge rounding. Returns false if the window is too
+     * large to be worth reading whole, or the read fails.
+     */
+    bool loadTileWindow( GDALDataset* ds, GDALRasterBand** bands, int numBands,
+                         double xmin, double ymin, double xmax, double ymax, int samples,
+                         bool useOverviews, PixelWindow& out )
+    {
+        double cMin = DBL_MAX, cMax = -DBL_MAX, rMin = DBL_MAX, rMax = -DBL_MAX;
+        double cornersX[4] = { xmin, xmax, xmin, xmax };
+        double cornersY[4] = { ymin, ymin, ymax, ymax };
+        for (int i = 0; i < 4; ++i)
+        {
+            double c, r;
+            GDALApplyGeoTransform(_invtransform, cornersX[i], cornersY[i], &c, &r);
+            cMin = osg::minimum(cMin, c); cMax = osg::maximum(cMax, c);
+            rMin = osg::minimum(rMin, r); rMax = osg::maximum(rMax, r);
+        }
+
+        int level = -1;
+        double sx = 1.0, sy = 1.0;
+        if ( useOverviews && samples > 1 )
+        {
+            level = chooseLevel( bands, numBands, (cMax - cMin) / (double)(samples - 1) );
+            if ( level >= 0 )
+            {
+                GDALRasterBand* ov = bands[0]->GetOverview(level);
+                sx = (double)ov->GetXSize() / (double)bands[0]->GetXSize();
+                sy = (double)ov->GetYSize() / (double)bands[0]->GetYSize();
+            }
+        }
+
+        GDALRasterBand* levelBand = level < 0 ? bands[0] : bands[0]->GetOverview(level);
+        int x0 = osg::clampBetween((int)floor(cMin * sx) - 1, 0, levelBand->GetXSize()-1);
+        int x1 = osg::clampBetween((int)ceil (cMax * sx) + 1, 0, levelBand->GetXSize()-1);
+        int y0 = osg::clampBetween((int)floor(rMin * sy) - 1, 0, levelBand->GetYSize()-1);
+        int y1 = osg::clampBetween((int)ceil (rMax * sy) + 1, 0, levelBand->GetYSize()-1);
+
+        // At low LODs without overviews a tile can cover a huge number of source
+        // pixels, and sampling a few of them directly is cheaper than reading them all.
+        if ( (double)(x1 - x0 + 1) * (double)(y1 - y0 + 1) > (double)MAX_WINDOW_PIXELS )
+            return false;
+
+        return loadPixelWindow( ds, bands, numBands, level, x0, y0, x1 - x0 + 1, y1 - y0 + 1, out );
+    }
+
+    /**
+     * Equivalent of a decimating band->RasterIO of [off_x, off_y, width, height]
+     * into target_width x target_height bytes (nearest neighbor), for several
+     * bands at once: reads go block-aligned through the block cache, straight
+     * from the best overview. Returns false if the caller should fall back on
+     * RasterIO.
+     */
+    bool readNearest( GDALDataset* ds, GDALRasterBand** bands, unsigned char** out, int numBands,
+                      int off_x, int off_y, int width, int height, int target_width, int target_height )
+    {
+        int level = chooseLevel( bands, numBands, (double)width / (double)target_width );
+
+        GDALRasterBand* levelBand = level < 0 ? bands[0] : bands[0]->GetOverview(level);
+        double sx = (double)levelBand->GetXSize() / (double)bands[0]->GetXSize();
+        double sy = (double)levelBand->GetYSize() / (double)bands[0]->GetYSize();
+
+        // source pixel (at the chosen level) for each output column and row, taken at pixel centers:
+        std::vector<int> cols( target_width ), rows( target_height );
+        for (int c = 0; c < target_width; ++c)
+            cols[c] = osg::clampBetween( (int)((off_x + ((double)c + 0.5) * width / target_width) * sx), 0, levelBand->GetXSize()-1 );
+        for (int r = 0; r < target_height; ++r)
+            rows[r] = osg::clampBetween( (int)((off_y + ((double)r + 0.5) * height / target_height) * sy), 0, levelBand->GetYSize()-1 );
+
+        int x0 = cols.front(), x1 = cols.back();
+        int y0 = rows.front(), y1 = rows.back();
+        if ( (double)(x1 - x0 + 1) * (double)(y1 - y0 + 1) > (double)MAX_WINDOW_PIXELS )
+            return false;
+
+        PixelWindow window;
+        if ( !loadPixelWindow( ds, bands, numBands, level, x0, y0, x1 - x0 + 1, y1 - y0 + 1, window ) )
+            return false;
+
+        unsigned windowSize = window._width * window._height;
+        for (int b = 0; b < numBands; ++b)
+        {
+            const float*   src = &window._data[b * windowSize];
+            unsigned char* dst = out[b];
+            for (int r = 0; r < target_height; ++r)
+            {
+                const float* srcRow = src + (rows[r] - y0) * window._width;
+                for (int c = 0; c < target_width; ++c)
+                {
+                    // same rounding and clamping GDAL uses when converting to bytes:
+                    *dst++ = (unsigned char)osg::clampBetween( srcRow[cols[c] - x0] + 0.5f, 0.0f, 255.0f );
+                }
+            }
+        }
+        return true;
+    }
+
     float getInterpolatedValue(GDALRasterBand *band, double x, double y, bool applyOffset=true)
+    {
+        return getInterpolatedValue( band, BandReader(band), _invtransform, x, y, applyOffset );
+    }
+
+    /**
+     * Samples a band at a map location using the configured interpolation,
+     * reading the pixels it needs through "read(col, row)". "invtransform"
+     * maps locations to the band's pixel space.
+     */
+    template<typename READER>
+    float getInterpolatedValue(GDALRasterBand *band, const READER& read, const double* invtransform, double x, double y, bool applyOffset)
     {
         double r, c;
-        GDALApplyGeoTransform(_invtransform, x, y, &c, &r);
+        GDALApplyGeoTransform(const_cast<double*>(invtransform), x, y, &c, &r);
 
         //Account for slight rounding errors.  If we are right on the edge of the dataset, clamp to the edge
         double eps = 0.0001;
         if (osg::equivalent(c, 0, eps)) c = 0;
         if (osg::equivalent(r, 0, eps)) r = 0;
-        if (osg::equivalent(c, (double)_warpedDS->GetRasterXSize(), eps)) c = _warpedDS->GetRasterXSize();
-        if (osg::equivalent(r, (double)_warpedDS->GetRasterYSize(), eps)) r = _warpedDS->GetRasterYSize();
+        if (osg::equivalent(c, (double)band->GetXSize(), eps)) c = band->GetXSize();
+        if (osg::equivalent(r, (double)band->GetYSize(), eps)) r = band->GetYSize();
 
         if (applyOffset)
         {
@@ -1617,30 +2230,30 @@ public:
             {
                 c = 0;
             }
-            else if (c > _warpedDS->GetRasterXSize()-1 && c <= _warpedDS->GetRasterXSize()-0.5)
+            else if (c > band->GetXSize()-1 && c <= band->GetXSize()-0.5)
             {
-                c = _warpedDS->GetRasterXSize()-1;
+                c = band->GetXSize()-1;
             }
 
             if (r < 0 && r >= -0.5)
             {
                 r = 0;
             }
-            else if (r > _warpedDS->GetRasterYSize()-1 && r <= _warpedDS->GetRasterYSize()-0.5)
+            else if (r > band->GetYSize()-1 && r <= band->GetYSize()-0.5)
             {
-                r = _warpedDS->GetRasterYSize()-1;
+                r = band->GetYSize()-1;
             }
         }
 
         float result = 0.0f;
 
         //If the location is outside of the pixel values of the dataset, just return 0
-        if (c < 0 || r < 0 || c > _warpedDS->GetRasterXSize()-1 || r > _warpedDS->GetRasterYSize()-1)
+        if (c < 0 || r < 0 || c > band->GetXSize()-1 || r > band->GetYSize()-1)
             return NO_DATA_VALUE;
 
         if ( _options.interpolation() == INTERP_NEAREST )
         {
-            band->RasterIO(GF_Read, (int)osg::round(c), (int)osg::round(r), 1, 1, &result, 1, 1, GDT_Float32, 0, 0);
+            result = read( (int)osg::round(c), (int)osg::round(r) );
             if (!isValidValue( result, band))
             {
                 return NO_DATA_VALUE;
@@ -1649,19 +2262,17 @@ public:
         else
         {
             int rowMin = osg::maximum((int)floor(r), 0);
-            int rowMax = osg::maximum(osg::minimum((int)ceil(r), (int)(_warpedDS->GetRasterYSize()-1)), 0);
+            int rowMax = osg::maximum(osg::minimum((int)ceil(r), (int)(band->GetYSize()-1)), 0);
             int colMin = osg::maximum((int)floor(c), 0);
-            int colMax = osg::maximum(osg::minimum((int)ceil(c), (int)(_warpedDS->GetRasterXSize()-1)), 0);
+            int colMax = osg::maximum(osg::minimum((int)ceil(c), (int)(band->GetXSize()-1)), 0);
 
             if (rowMin > rowMax) rowMin = rowMax;
             if (colMin > colMax) colMin = colMax;
 
-            float urHeight, llHeight, ulHeight, lrHeight;
-
-            band->RasterIO(GF_Read, colMin, rowMin, 1, 1, &llHeight, 1, 1, GDT_Float32, 0, 0);
-            band->RasterIO(GF_Read, colMin, rowMax, 1, 1, &ulHeight, 1, 1, GDT_Float32, 0, 0);
-            band->RasterIO(GF_Read, colMax, rowMin, 1, 1, &lrHeight, 1, 1, GDT_Float32, 0, 0);
-            band->RasterIO(GF_Read, colMax, rowMax, 1, 1, &urHeight, 1, 1, GDT_Float32, 0, 0);
+            float llHeight = read( colMin, rowMin );
+            float ulHeight = read( colMin, rowMax );
+            float lrHeight = read( colMax, rowMin );
+            float urHeight = read( colMax, rowMax );
 
             /*
             if (!isValidValue(urHeight, band)) urHeight = 0.0f;
@@ -1732,7 +2343,8 @@ public:
             return NULL;
         }
 
-        GDAL_SCOPED_LOCK;
+        ScopedDataset dataset( this );
+        GDALDataset* warpedDS = dataset.get();
 
         int tileSize = _options.tileSize().value();
 
@@ -1747,23 +2359,31 @@ public:
             key.getExtent().getBounds(xmin, ymin, xmax, ymax);
 
             // Try to find a FLOAT band
-            GDALRasterBand* band = findBandByDataType(_warpedDS, GDT_Float32);
+            GDALRasterBand* band = findBandByDataType(warpedDS, GDT_Float32);
             if (band == NULL)
             {
                 // Just get first band
-                band = _warpedDS->GetRasterBand(1);
+                band = warpedDS->GetRasterBand(1);
             }
 
             double dx = (xmax - xmin) / (tileSize-1);
             double dy = (ymax - ymin) / (tileSize-1);
 
-            for (int c = 0; c < tileSize; ++c)
+            // Read the pixel window that covers the whole tile in one go and sample
+            // it in memory, instead of going back to GDAL for every pixel of every post.
+            // Elevation is always sampled at full resolution.
+            PixelWindow window;
+            bool useWindow = loadTileWindow( warpedDS, &band, 1, xmin, ymin, xmax, ymax, tileSize, false, window );
+
+            for (int r = 0; r < tileSize; ++r)
             {
-                double geoX = xmin + (dx * (double)c);
-                for (int r = 0; r < tileSize; ++r)
+                double geoY = ymin + (dy * (double)r);
+                for (int c = 0; c < tileSize; ++c)
                 {
-                    double geoY = ymin + (dy * (double)r);
-                    float h = getInterpolatedValue(band, geoX, geoY);
+                    double geoX = xmin + (dx * (double)c);
+                    float h = useWindow ?
+                        getInterpolatedValue(band, window.reader(0), window._invtransform, geoX, geoY, true) :
+                        getInterpolatedValue(band, geoX, geoY);
                     hf->setHeight(c, r, h);
                 }
             }
@@ -1783,6 +2403,13 @@ public:
 
 private:
 
+    enum WarpMode
+    {
+        WARP_NONE,
+        WARP_AUTO,
+        WARP_POLAR
+    };
+
     GDALDataset* _srcDS;
     GDALDataset* _warpedDS;
     double       _geotransform[6];
@@ -1796,6 +2423,21 @@ private:
     osg::ref_ptr< osgDB::Options > _dbOptions;
 
     unsigned int _maxDataLevel;
+
+    // information necessary to open additional handles on the source:
+    std::string _openString;
+    WarpMode    _warpMode;
+    std::string _warpSrcWKT;
+    std::string _warpDestWKT;
+
+    // pool of per-thread dataset handles:
+    DatasetHandlesList _allHandles;
+    DatasetHandlesList _freeHandles;
+    unsigned           _numHandles;
+    Threading::Mutex   _handlesMutex;
+
+    // source blocks recently read, shared by all the handles:
+    BlockCache _blockCache;
 };
 
 
@@ -23,12 +23,15 @@
 #include <osgEarth/Registry>
 #include <osgEarth/FileUtils>
 #include <osgEarth/ImageUtils>
+#include <osgEarth/IOTypes>
 #include <osg/Notify>
 #include <osgDB/FileNameUtils>
 #include <osgDB/FileUtils>
 #include <osgDB/Registry>
 #include <osgDB/ReadFile>
 #include <osgDB/WriteFile>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
 
 #include <sstream>
 #include <iomanip>
@@ -42,6 +45,13 @@ using namespace osgEarth::Drivers;
 
 #define LC "[MBTilesSource] "
 
+namespace
+{
+    // milliseconds to wait for a lock held by the writer before giving up.
+    const int BUSY_TIMEOUT = 5000;
+}
+
+
 class MBTilesSource : public TileSource
 {
 public:
@@ -50,10 +60,30 @@ public:
       _options( options ),      
       _database( NULL ),
       _minLevel( 0 ),
-      _maxLevel( 20 )
+      _maxLevel( 20 ),
+      _insert( NULL ),
+      _pendingWrites( 0 )
     {
     }
 
+    virtual ~MBTilesSource()
+    {
+        if ( _insert )
+        {
+            commit();
+            sqlite3_finalize( _insert );
+        }
+
+        for( std::vector<Connection>::iterator i = _connections.begin(); i != _connections.end(); ++i )
+        {
+            sqlite3_finalize( i->_select );
+            sqlite3_close( i->_db );
+        }
+
+        if ( _database )
+            sqlite3_close( _database );
+    }
+
     // override
     Status initialize(const osgDB::Options* dbOptions)
     {
@@ -76,7 +106,9 @@ public:
         }
 #endif
 
-        int flags = SQLITE_OPEN_READONLY;
+        bool writable = _options.writable() == true;
+
+        int flags = writable ? (SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE) : SQLITE_OPEN_READONLY;
         int rc = sqlite3_open_v2( _options.filename()->c_str(), &_database, flags, 0L );
         if ( rc != 0 )
         {                        
@@ -84,6 +116,14 @@ public:
             buf << "Failed to open database \"" << *_options.filename() << "\": " << sqlite3_errmsg(_database);
             return Status::Error(buf.str());
         }
+        sqlite3_busy_timeout( _database, BUSY_TIMEOUT );
+
+        if ( writable && !createTables() )
+        {
+            std::stringstream buf;
+            buf << "Failed to create tables in database \"" << *_options.filename() << "\": " << sqlite3_errmsg(_database);
+            return Status::Error(buf.str());
+        }
 
         //Print out some metadata
         std::string name, type, version, description, format;
@@ -120,6 +160,30 @@ public:
         //Get the ReaderWriter
         _rw = osgDB::Registry::instance()->getReaderWriterForExtension( _tileFormat );
 
+        if ( writable )
+        {
+            // fill in the metadata a new database is missing:
+            if ( name.empty() )
+                putMetaData( "name", osgDB::getStrippedName(*_options.filename()) );
+            if ( type.empty() )
+                putMetaData( "type", "baselayer" );
+            if ( version.empty() )
+                putMetaData( "version", "1.1" );
+            if ( description.empty() )
+                putMetaData( "description", "" );
+            if ( format.empty() )
+                putMetaData( "format", _tileFormat );
+
+            std::string query = "INSERT OR REPLACE INTO tiles (zoom_level, tile_column, tile_row, tile_data) VALUES (?, ?, ?, ?)";
+            rc = sqlite3_prepare_v2( _database, query.c_str(), -1, &_insert, 0L );
+            if ( rc != SQLITE_OK )
+            {
+                std::stringstream buf;
+                buf << "Failed to prepare SQL: " << query << "; " << sqlite3_errmsg(_database);
+                return Status::Error(buf.str());
+            }
+        }
+
         computeLevels();
 
         _emptyImage = ImageUtils::createEmptyImage( 256, 256 );
@@ -150,33 +214,27 @@ public:
         key.getProfile()->getNumTiles(key.getLevelOfDetail(), numCols, numRows);
         y  = numRows - y - 1;
 
-        //Get the image
-        sqlite3_stmt* select = NULL;
-        std::string query = "SELECT tile_data from tiles where zoom_level = ? AND tile_column = ? AND tile_row = ?";
-        int rc = sqlite3_prepare_v2( _database, query.c_str(), -1, &select, 0L );
-        if ( rc != SQLITE_OK )
-        {
-            OE_WARN << LC << "Failed to prepare SQL: " << query << "; " << sqlite3_errmsg(_database) << std::endl;
+        Connection conn;
+        if ( !acquireConnection(conn) )
             return NULL;
-        }
 
-        bool valid = true;        
+        //Get the image
+        sqlite3_stmt* select = conn._select;
         sqlite3_bind_int( select, 1, z );
         sqlite3_bind_int( select, 2, x );
         sqlite3_bind_int( select, 3, y );
 
-
         osg::Image* result = NULL;
-        rc = sqlite3_step( select );
+        int rc = sqlite3_step( select );
         if ( rc == SQLITE_ROW)
         {                     
-            // the pointer returned from _blob gets freed internally by sqlite, supposedly
+            // the blob stays valid until the statement is reset, so decode
+            // it in place:
             const char* data = (const char*)sqlite3_column_blob( select, 0 );
             int imageBufLen = sqlite3_column_bytes( select, 0 );
 
-            // deserialize the image from the buffer:
-            std::string imageString( data, imageBufLen );
-            std::stringstream imageBufStream( imageString );
+            MemoryStreamBuf imageBuf( data, imageBufLen );
+            std::istream imageBufStream( &imageBuf );
             osgDB::ReaderWriter::ReadResult rr = _rw->readImage( imageBufStream );
             if (rr.validImage())
             {
@@ -185,15 +243,72 @@ public:
         }
         else
         {
-            OE_DEBUG << LC << "SQL QUERY failed for " << query << ": " << std::endl;
-            valid = false;
+            OE_DEBUG << LC << "SQL QUERY failed for tile " << key.str() << ": " << std::endl;
         }
 
-        sqlite3_finalize( select );
+        sqlite3_reset( select );
+        sqlite3_clear_bindings( select );
+        releaseConnection( conn );
+
         return result;
 
     }
 
+    // override
+    bool storeImage( const TileKey&    key,
+                     osg::Image*       image,
+                     ProgressCallback* progress )
+    {
+        if ( !_insert || !image || !_rw.valid() )
+            return false;
+
+        // encode before taking the lock so that several threads can encode at once.
+        std::stringstream buf;
+        osgDB::ReaderWriter::WriteResult wr = _rw->writeImage( *image, buf );
+        if ( !wr.success() )
+        {
+            OE_WARN << LC << "Failed to encode tile " << key.str() << " as " << _tileFormat << std::endl;
+            return false;
+        }
+        std::string data = buf.str();
+
+        unsigned int numRows, numCols;
+        key.getProfile()->getNumTiles(key.getLevelOfDetail(), numCols, numRows);
+        int z = key.getLevelOfDetail();
+        int x = key.getTileX();
+        int y = numRows - key.getTileY() - 1;
+
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _writeMutex );
+
+        // tiles are written in batches; one transaction per tile is very slow.
+        if ( _pendingWrites == 0 && !execute("BEGIN TRANSACTION") )
+            return false;
+
+        sqlite3_bind_int ( _insert, 1, z );
+        sqlite3_bind_int ( _insert, 2, x );
+        sqlite3_bind_int ( _insert, 3, y );
+        sqlite3_bind_blob( _insert, 4, data.data(), data.size(), SQLITE_STATIC );
+
+        int rc = sqlite3_step( _insert );
+        sqlite3_reset( _insert );
+        sqlite3_clear_bindings( _insert );
+
+        // count the tile either way so the transaction gets closed.
+        ++_pendingWrites;
+
+        if ( rc != SQLITE_DONE )
+        {
+            OE_WARN << LC << "Failed to store tile " << key.str() << ": " << sqlite3_errmsg(_database) << std::endl;
+        }
+
+        if ( _pendingWrites >= std::max(1u, *_options.batchSize()) )
+        {
+            commit();
+        }
+
+        return rc == SQLITE_DONE;
+    }
+
     bool getMetaData( const std::string& key, std::string& value )
     {
         //get the metadata
@@ -213,6 +328,7 @@ public:
         if (rc != SQLITE_OK )
         {
             OE_WARN << LC << "Failed to bind text: " << query << "; " << sqlite3_errmsg(_database) << std::endl;
+            sqlite3_finalize( select );
             return false;
         }
 
@@ -231,6 +347,30 @@ public:
         return valid;
     }
 
+    bool putMetaData( const std::string& key, const std::string& value )
+    {
+        sqlite3_stmt* insert = NULL;
+        std::string query = "INSERT OR REPLACE INTO metadata (name, value) VALUES (?, ?)";
+        int rc = sqlite3_prepare_v2( _database, query.c_str(), -1, &insert, 0L );
+        if ( rc != SQLITE_OK )
+        {
+            OE_WARN << LC << "Failed to prepare SQL: " << query << "; " << sqlite3_errmsg(_database) << std::endl;
+            return false;
+        }
+
+        sqlite3_bind_text( insert, 1, key.c_str(), key.length(), SQLITE_STATIC );
+        sqlite3_bind_text( insert, 2, value.c_str(), value.length(), SQLITE_STATIC );
+
+        rc = sqlite3_step( insert );
+        if ( rc != SQLITE_DONE )
+        {
+            OE_WARN << LC << "Failed to write metadata \"" << key << "\": " << sqlite3_errmsg(_database) << std::endl;
+        }
+
+        sqlite3_finalize( insert );
+        return rc == SQLITE_DONE;
+    }
+
     void computeLevels()
     {        
         sqlite3_stmt* select = NULL;
@@ -239,10 +379,11 @@ public:
         if ( rc != SQLITE_OK )
         {
             OE_WARN << LC << "Failed to prepare SQL: " << query << "; " << sqlite3_errmsg(_database) << std::endl;
+            return;
         }
 
         rc = sqlite3_step( select );
-        if ( rc == SQLITE_ROW)
+        if ( rc == SQLITE_ROW && sqlite3_column_type(select, 0) != SQLITE_NULL )
         {                     
             _minLevel = sqlite3_column_int( select, 0 );
             _maxLevel = sqlite3_column_int( select, 1 );
@@ -263,6 +404,93 @@ public:
     }
 
 private:
+
+    /** A read-only database connection with its tile query, used by one thread at a time. */
+    struct Connection
+    {
+        Connection() : _db( NULL ), _select( NULL ) { }
+        sqlite3*      _db;
+        sqlite3_stmt* _select;
+    };
+
+    // Takes an idle connection from the pool, or opens a new one if they are all in use.
+    bool acquireConnection( Connection& out_conn )
+    {
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _poolMutex );
+            if ( !_idle.empty() )
+            {
+                out_conn = _idle.back();
+                _idle.pop_back();
+                return true;
+            }
+        }
+
+        // each connection is only used by one thread at a time, so it can skip
+        // sqlite's own locking.
+        int flags = SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX;
+        int rc = sqlite3_open_v2( _options.filename()->c_str(), &out_conn._db, flags, 0L );
+        if ( rc != SQLITE_OK )
+        {
+            OE_WARN << LC << "Failed to open database \"" << *_options.filename() << "\": " << sqlite3_errmsg(out_conn._db) << std::endl;
+            sqlite3_close( out_conn._db );
+            return false;
+        }
+        sqlite3_busy_timeout( out_conn._db, BUSY_TIMEOUT );
+
+        std::string query = "SELECT tile_data from tiles where zoom_level = ? AND tile_column = ? AND tile_row = ?";
+        rc = sqlite3_prepare_v2( out_conn._db, query.c_str(), -1, &out_conn._select, 0L );
+        if ( rc != SQLITE_OK )
+        {
+            OE_WARN << LC << "Failed to prepare SQL: " << query << "; " << sqlite3_errmsg(out_conn._db) << std::endl;
+            sqlite3_close( out_conn._db );
+            return false;
+        }
+
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _poolMutex );
+        _connections.push_back( out_conn );
+        OE_DEBUG << LC << "Opened read connection " << _connections.size() << std::endl;
+        return true;
+    }
+
+    void releaseConnection( const Connection& conn )
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _poolMutex );
+        _idle.push_back( conn );
+    }
+
+    bool execute( const std::string& sql )
+    {
+        char* errMsg = 0L;
+        int rc = sqlite3_exec( _database, sql.c_str(), 0L, 0L, &errMsg );
+        if ( rc != SQLITE_OK )
+        {
+            OE_WARN << LC << "Failed to execute SQL: " << sql << "; " << (errMsg ? errMsg : "") << std::endl;
+            sqlite3_free( errMsg );
+            return false;
+        }
+        return true;
+    }
+
+    bool createTables()
+    {
+        return
+            execute( "CREATE TABLE IF NOT EXISTS metadata (name text, value text)" ) &&
+            execute( "CREATE UNIQUE INDEX IF NOT EXISTS name ON metadata (name)" ) &&
+            execute( "CREATE TABLE IF NOT EXISTS tiles (zoom_level integer, tile_column integer, tile_row integer, tile_data blob)" ) &&
+            execute( "CREATE UNIQUE INDEX IF NOT EXISTS tile_index ON tiles (zoom_level, tile_column, tile_row)" );
+    }
+
+    // Ends the current batch of writes. Call with _writeMutex held (or from the dtor).
+    void commit()
+    {
+        if ( _pendingWrites > 0 )
+        {
+            execute( "COMMIT TRANSACTION" );
+            _pendingWrites = 0;
+        }
+    }
+
     const MBTilesOptions _options;    
     sqlite3* _database;
     unsigned int _minLevel;
@@ -273,6 +501,15 @@ private:
     osg::ref_ptr<osgDB::Options> _dbOptions;
     std::string _tileFormat;
 
+    // read connection pool
+    OpenThreads::Mutex      _poolMutex;
+    std::vector<Connection> _connections;
+    std::vector<Connection> _idle;
+
+    // writer
+    OpenThreads::Mutex      _writeMutex;
+    sqlite3_stmt*           _insert;
+    unsigned                _pendingWrites;
 };
 
 
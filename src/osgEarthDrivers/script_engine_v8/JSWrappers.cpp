@@ -20,6 +20,7 @@
 #include <osgEarthDrivers/script_engine_v8/JSWrappers>
 #include <osgEarthDrivers/script_engine_v8/V8Util>
 #include <osgEarthFeatures/FilterContext>
+#include <osgEarthFeatures/FeatureBatch>
 #include <osgEarth/StringUtils>
 #include <v8.h>
 
@@ -81,6 +82,30 @@ JSFeature::GetAttributesObjectTemplate()
 v8::Handle<v8::Value>
 JSFeature::GetFeatureAttr(const std::string& attr, Feature const* feature)
 {
+  // read batched attributes in place rather than detaching the feature from its batch
+  const FeatureBatch* batch = feature->getBatch();
+  if (batch)
+  {
+    int col = batch->getColumn(attr);
+    if (col < 0)
+      return v8::Handle<v8::Value>();
+
+    unsigned row = feature->getBatchRow();
+    bool set = batch->isSet(row, col);
+    switch (batch->getColumnType(col))
+    {
+      case osgEarth::Features::ATTRTYPE_BOOL:
+        return v8::Boolean::New(set ? batch->getBool(row, col) : false);
+      case osgEarth::Features::ATTRTYPE_DOUBLE:
+        return set ? v8::Number::New(batch->getDouble(row, col)) : v8::Undefined();
+      case osgEarth::Features::ATTRTYPE_INT:
+        return set ? v8::Integer::New(batch->getInt(row, col)) : v8::Undefined();
+      default:
+        std::string val = set ? batch->getString(row, col) : "";
+        return v8::String::New(val.c_str(), val.length());
+    }
+  }
+
   AttributeTable::const_iterator it = feature->getAttrs().find(attr);
 
   // If the key is not present return an empty handle as signal
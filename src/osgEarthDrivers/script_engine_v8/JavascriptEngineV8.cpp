@@ -39,44 +39,97 @@ using namespace osgEarth::Features;
 JavascriptEngineV8::JavascriptEngineV8(const ScriptEngineOptions& options)
 : ScriptEngine(options)
 {
-  _isolate = v8::Isolate::New();
+  // create the first instance now so that errors in the script show up at load time.
+  Instance* instance = createInstance();
+  _instances.push_back(instance);
+  _freeInstances.push_back(instance);
+}
+
+JavascriptEngineV8::~JavascriptEngineV8()
+{
+  for (std::vector<Instance*>::iterator i = _instances.begin(); i != _instances.end(); ++i)
+    destroyInstance(*i);
+}
+
+JavascriptEngineV8::Instance*
+JavascriptEngineV8::createInstance()
+{
+  Instance* instance = new Instance();
+  instance->_isolate = v8::Isolate::New();
 
-  v8::Locker locker(_isolate);
-  v8::Isolate::Scope isolate_scope(_isolate);
+  v8::Locker locker(instance->_isolate);
+  v8::Isolate::Scope isolate_scope(instance->_isolate);
 
   v8:: HandleScope handle_scope;
 
   v8::Handle<v8::ObjectTemplate> global = createGlobalObjectTemplate();
-  _globalContext = v8::Context::New(NULL, global);
+  instance->_context = v8::Context::New(NULL, global);
 
-  if (options.script().isSet() && !options.script()->getCode().empty())
+  if (_script.isSet() && !_script->getCode().empty())
   {
     // Create a nested handle scope
     v8::HandleScope local_handle_scope;
 
     // Enter the global context
-    v8::Context::Scope context_scope(_globalContext);
+    v8::Context::Scope context_scope(instance->_context);
 
     // Compile and run the script
-    ScriptResult result = executeScript(v8::String::New(options.script()->getCode().c_str(), options.script()->getCode().length()));
+    ScriptResult result = executeScript(v8::String::New(_script->getCode().c_str(), _script->getCode().length()));
     if (!result.success())
       OE_WARN << LC << "Error reading javascript: " << result.message() << std::endl;
   }
 
-  _globalTemplate = v8::Persistent<v8::ObjectTemplate>::New(global);
+  return instance;
 }
 
-JavascriptEngineV8::~JavascriptEngineV8()
+void
+JavascriptEngineV8::destroyInstance(Instance* instance)
 {
   {
-    v8::Locker locker(_isolate);
-    v8::Isolate::Scope isolate_scope(_isolate);
+    v8::Locker locker(instance->_isolate);
+    v8::Isolate::Scope isolate_scope(instance->_isolate);
 
-    _globalTemplate.Dispose();
-    _globalContext.Dispose();
+    for (Instance::ScriptCache::iterator i = instance->_scripts.begin(); i != instance->_scripts.end(); ++i)
+      i->second.Dispose();
+    instance->_scripts.clear();
+
+    instance->_featureObj.Dispose();
+    instance->_contextObj.Dispose();
+    instance->_context.Dispose();
+  }
+
+  instance->_isolate->Dispose();
+  delete instance;
+}
+
+JavascriptEngineV8::Instance*
+JavascriptEngineV8::acquireInstance()
+{
+  {
+    osgEarth::Threading::ScopedMutexLock lock(_instancesMutex);
+    if (!_freeInstances.empty())
+    {
+      Instance* instance = _freeInstances.back();
+      _freeInstances.pop_back();
+      return instance;
+    }
   }
 
-  _isolate->Dispose();
+  // every instance is busy on another thread; make a new one (outside the
+  // lock, since loading the script may take a while).
+  Instance* instance = createInstance();
+
+  osgEarth::Threading::ScopedMutexLock lock(_instancesMutex);
+  _instances.push_back(instance);
+  OE_DEBUG << LC << "Created javascript isolate " << _instances.size() << std::endl;
+  return instance;
+}
+
+void
+JavascriptEngineV8::releaseInstance(Instance* instance)
+{
+  osgEarth::Threading::ScopedMutexLock lock(_instancesMutex);
+  _freeInstances.push_back(instance);
 }
 
 v8::Local<v8::ObjectTemplate>
@@ -119,6 +172,19 @@ JavascriptEngineV8::executeScript(v8::Handle<v8::String> script)
   // Handle scope for temporary handles.
   v8::HandleScope handle_scope;
 
+  ScriptResult error;
+  v8::Handle<v8::Script> compiled_script = compileScript(script, error);
+  if (compiled_script.IsEmpty())
+    return error;
+
+  return runScript(compiled_script);
+}
+
+v8::Handle<v8::Script>
+JavascriptEngineV8::compileScript(v8::Handle<v8::String> script, ScriptResult& out_error)
+{
+  v8::HandleScope handle_scope;
+
   // TryCatch for any script errors
   v8::TryCatch try_catch;
 
@@ -141,13 +207,24 @@ JavascriptEngineV8::executeScript(v8::Handle<v8::String> script)
 			str <<  std::string(*stack_trace) << std::endl;
 		}
 		*/
-	    return ScriptResult(EMPTY_STRING, false, std::string("Script compile error: ") + str.str());
+	    out_error = ScriptResult(EMPTY_STRING, false, std::string("Script compile error: ") + str.str());
 	}
 	else {
-	    return ScriptResult(EMPTY_STRING, false, std::string("Script compile error: ") + std::string(*error));
+	    out_error = ScriptResult(EMPTY_STRING, false, std::string("Script compile error: ") + std::string(*error));
 	}
   }
 
+  return handle_scope.Close(compiled_script);
+}
+
+ScriptResult
+JavascriptEngineV8::runScript(v8::Handle<v8::Script> compiled_script)
+{
+  v8::HandleScope handle_scope;
+
+  // TryCatch for any script errors
+  v8::TryCatch try_catch;
+
   // Run the script
   v8::Handle<v8::Value> result = compiled_script->Run();
   if (result.IsEmpty())
@@ -163,6 +240,73 @@ JavascriptEngineV8::executeScript(v8::Handle<v8::String> script)
   return ScriptResult(std::string(*ascii));
 }
 
+v8::Handle<v8::Script>
+JavascriptEngineV8::getScript(Instance* instance, const std::string& code, ScriptResult& out_error)
+{
+  // keyed by the full source rather than a hash of it, so two scripts can never collide.
+  Instance::ScriptCache::const_iterator i = instance->_scripts.find(code);
+  if (i != instance->_scripts.end())
+    return i->second;
+
+  v8::HandleScope handle_scope;
+
+  v8::Handle<v8::Script> compiled_script = compileScript(v8::String::New(code.c_str(), code.length()), out_error);
+  if (compiled_script.IsEmpty())
+    return handle_scope.Close(compiled_script);
+
+  // keep the cache from growing without bound if the code varies per feature.
+  const unsigned MAX_CACHED_SCRIPTS = 1024;
+  if (instance->_scripts.size() >= MAX_CACHED_SCRIPTS)
+  {
+    for (Instance::ScriptCache::iterator s = instance->_scripts.begin(); s != instance->_scripts.end(); ++s)
+      s->second.Dispose();
+    instance->_scripts.clear();
+  }
+
+  instance->_scripts[code] = v8::Persistent<v8::Script>::New(compiled_script);
+  return handle_scope.Close(compiled_script);
+}
+
+void
+JavascriptEngineV8::setGlobals(Instance* instance, osgEarth::Features::Feature const* feature, osgEarth::Features::FilterContext const* context)
+{
+  // The wrapper objects are made once per instance, and then just pointed at the
+  // next feature and context; building a wrapper means building its template.
+  if (feature)
+  {
+    if (instance->_featureObj.IsEmpty())
+    {
+      v8::Handle<v8::Object> fObj = JSFeature::WrapFeature(const_cast<Feature*>(feature));
+      if (!fObj.IsEmpty())
+        instance->_featureObj = v8::Persistent<v8::Object>::New(fObj);
+    }
+    else
+    {
+      instance->_featureObj->SetInternalField(0, v8::External::New(const_cast<Feature*>(feature)));
+    }
+
+    if (!instance->_featureObj.IsEmpty())
+      instance->_context->Global()->Set(v8::String::New("feature"), instance->_featureObj);
+  }
+
+  if (context)
+  {
+    if (instance->_contextObj.IsEmpty())
+    {
+      v8::Handle<v8::Object> cObj = JSFilterContext::WrapFilterContext(const_cast<FilterContext*>(context));
+      if (!cObj.IsEmpty())
+        instance->_contextObj = v8::Persistent<v8::Object>::New(cObj);
+    }
+    else
+    {
+      instance->_contextObj->SetInternalField(0, v8::External::New(const_cast<FilterContext*>(context)));
+    }
+
+    if (!instance->_contextObj.IsEmpty())
+      instance->_context->Global()->Set(v8::String::New("context"), instance->_contextObj);
+  }
+}
+
 ScriptResult
 JavascriptEngineV8::run(Script* script, osgEarth::Features::Feature const* feature, osgEarth::Features::FilterContext const* context)
 {
@@ -178,36 +322,68 @@ JavascriptEngineV8::run(const std::string& code, osgEarth::Features::Feature con
   if (code.empty())
     return ScriptResult(EMPTY_STRING, false, "Script is empty.");
 
-  v8::Locker locker(_isolate);
-  v8::Isolate::Scope isolate_scope(_isolate);
+  ScopedInstance scoped(this);
+  Instance* instance = scoped._instance;
+
+  v8::Locker locker(instance->_isolate);
+  v8::Isolate::Scope isolate_scope(instance->_isolate);
 
   v8::HandleScope handle_scope;
 
-  //Create a separate context
-  //v8::Persistent<v8::Context> context = v8::Context::New(NULL, _globalTemplate);
-  //v8::Context::Scope context_scope(context);
-  v8::Context::Scope context_scope(_globalContext);
+  v8::Context::Scope context_scope(instance->_context);
 
-  if (feature)
+  setGlobals(instance, feature, context);
+
+  // Compile (or fetch the compiled) script and run it
+  ScriptResult error;
+  v8::Handle<v8::Script> compiled_script = getScript(instance, code, error);
+  if (compiled_script.IsEmpty())
+    return error;
+
+  return runScript(compiled_script);
+}
+
+void
+JavascriptEngineV8::run(const std::string& code, const FeatureList& features, osgEarth::Features::FilterContext const* context, std::vector<ScriptResult>& out_results)
+{
+  out_results.clear();
+  if (features.empty())
+    return;
+
+  if (code.empty())
   {
-    v8::Handle<v8::Object> fObj = JSFeature::WrapFeature(const_cast<Feature*>(feature));
-    if (!fObj.IsEmpty())
-      _globalContext->Global()->Set(v8::String::New("feature"), fObj);
+    out_results.assign(features.size(), ScriptResult(EMPTY_STRING, false, "Script is empty."));
+    return;
   }
 
-  if (context)
+  // one lock, one compile (or cache lookup) and one context entry for the whole list.
+  ScopedInstance scoped(this);
+  Instance* instance = scoped._instance;
+
+  v8::Locker locker(instance->_isolate);
+  v8::Isolate::Scope isolate_scope(instance->_isolate);
+
+  v8::HandleScope handle_scope;
+
+  v8::Context::Scope context_scope(instance->_context);
+
+  ScriptResult error;
+  v8::Handle<v8::Script> compiled_script = getScript(instance, code, error);
+  if (compiled_script.IsEmpty())
   {
-    v8::Handle<v8::Object> cObj = JSFilterContext::WrapFilterContext(const_cast<FilterContext*>(context));
-    if (!cObj.IsEmpty())
-      _globalContext->Global()->Set(v8::String::New("context"), cObj);
+    out_results.assign(features.size(), error);
+    return;
   }
 
-  // Compile and run the script
-  ScriptResult result = executeScript(v8::String::New(code.c_str(), code.length()));
-
-  //context.Dispose();
+  out_results.reserve(features.size());
+  for (FeatureList::const_iterator i = features.begin(); i != features.end(); ++i)
+  {
+    // temporary handles are freed after each feature
+    v8::HandleScope feature_scope;
 
-  return result;
+    setGlobals(instance, i->get(), context);
+    out_results.push_back(runScript(compiled_script));
+  }
 }
 
 ScriptResult
@@ -216,17 +392,20 @@ JavascriptEngineV8::call(const std::string& function, osgEarth::Features::Featur
   if (function.empty())
     return ScriptResult(EMPTY_STRING, false, "Empty function name parameter.");
 
+  ScopedInstance scoped(this);
+  Instance* instance = scoped._instance;
+
   // Lock for V8 multithreaded uses
-  v8::Locker locker(_isolate);
-  v8::Isolate::Scope isolate_scope(_isolate);
+  v8::Locker locker(instance->_isolate);
+  v8::Isolate::Scope isolate_scope(instance->_isolate);
 
   v8::HandleScope handle_scope;
 
-  v8::Context::Scope context_scope(_globalContext);
+  v8::Context::Scope context_scope(instance->_context);
 
   // Attempt to fetch the function from the global object.
   v8::Handle<v8::String> func_name = v8::String::New(function.c_str(), function.length());
-  v8::Handle<v8::Value> func_val = _globalContext->Global()->Get(func_name);
+  v8::Handle<v8::Value> func_val = instance->_context->Global()->Get(func_name);
 
   // If there is no function, or if it is not a function, bail out
   if (!func_val->IsFunction())
@@ -234,19 +413,7 @@ JavascriptEngineV8::call(const std::string& function, osgEarth::Features::Featur
 
   v8::Handle<v8::Function> func_func = v8::Handle<v8::Function>::Cast(func_val);
 
-  if (feature)
-  {
-    v8::Handle<v8::Object> fObj = JSFeature::WrapFeature(const_cast<Feature*>(feature));
-    if (!fObj.IsEmpty())
-      _globalContext->Global()->Set(v8::String::New("feature"), fObj);
-  }
-
-  if (context)
-  {
-    v8::Handle<v8::Object> cObj = JSFilterContext::WrapFilterContext(const_cast<FilterContext*>(context));
-    if (!cObj.IsEmpty())
-      _globalContext->Global()->Set(v8::String::New("context"), cObj);
-  }
+  setGlobals(instance, feature, context);
 
   // Set up an exception handler before calling the Eval function
   v8::TryCatch try_catch;
@@ -255,7 +422,7 @@ JavascriptEngineV8::call(const std::string& function, osgEarth::Features::Featur
   //const int argc = 1;
   //v8::Handle<v8::Value> argv[argc] = { fObj };
   //v8::Handle<v8::Value> result = func_func->Call(_globalContext->Global(), argc, argv);
-  v8::Handle<v8::Value> result = func_func->Call(_globalContext->Global(), 0, NULL);
+  v8::Handle<v8::Value> result = func_func->Call(instance->_context->Global(), 0, NULL);
 
   if (result.IsEmpty())
   {
@@ -268,6 +435,63 @@ JavascriptEngineV8::call(const std::string& function, osgEarth::Features::Featur
   }
 }
 
+void
+JavascriptEngineV8::call(const std::string& function, const FeatureList& features, osgEarth::Features::FilterContext const* context, std::vector<ScriptResult>& out_results)
+{
+  out_results.clear();
+  if (features.empty())
+    return;
+
+  if (function.empty())
+  {
+    out_results.assign(features.size(), ScriptResult(EMPTY_STRING, false, "Empty function name parameter."));
+    return;
+  }
+
+  ScopedInstance scoped(this);
+  Instance* instance = scoped._instance;
+
+  v8::Locker locker(instance->_isolate);
+  v8::Isolate::Scope isolate_scope(instance->_isolate);
+
+  v8::HandleScope handle_scope;
+
+  v8::Context::Scope context_scope(instance->_context);
+
+  // Look up the function once for the whole list.
+  v8::Handle<v8::String> func_name = v8::String::New(function.c_str(), function.length());
+  v8::Handle<v8::Value> func_val = instance->_context->Global()->Get(func_name);
+  if (!func_val->IsFunction())
+  {
+    out_results.assign(features.size(), ScriptResult(EMPTY_STRING, false, "Function not found in script."));
+    return;
+  }
+
+  v8::Handle<v8::Function> func_func = v8::Handle<v8::Function>::Cast(func_val);
+
+  out_results.reserve(features.size());
+  for (FeatureList::const_iterator i = features.begin(); i != features.end(); ++i)
+  {
+    // temporary handles are freed after each feature
+    v8::HandleScope feature_scope;
+
+    setGlobals(instance, i->get(), context);
+
+    v8::TryCatch try_catch;
+    v8::Handle<v8::Value> result = func_func->Call(instance->_context->Global(), 0, NULL);
+
+    if (result.IsEmpty())
+    {
+      out_results.push_back(ScriptResult(EMPTY_STRING, false, "Function result was empty."));
+    }
+    else
+    {
+      v8::String::AsciiValue ascii(result);
+      out_results.push_back(ScriptResult(std::string(*ascii)));
+    }
+  }
+}
+
 //----------------------------------------------------------------------------
 // Constructor callbacks for constructing native objects in javascript
 
@@ -17,6 +17,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
 #include <osgEarthFeatures/AltitudeFilter>
+#include <osgEarthFeatures/ExpressionEvaluator>
 #include <osgEarth/ElevationQuery>
 #include <osgEarth/GeoData>
 
@@ -66,28 +67,25 @@ AltitudeFilter::push( FeatureList& features, FilterContext& cx )
 void
 AltitudeFilter::pushAndDontClamp( FeatureList& features, FilterContext& cx )
 {
-    NumericExpression scaleExpr;
+    // evaluate the scale and offset for all the features at once.
+    std::vector<double> scales, offsets;
     if ( _altitude.valid() && _altitude->verticalScale().isSet() )
-        scaleExpr = *_altitude->verticalScale();
+        NumericExpressionEvaluator( *_altitude->verticalScale() ).evalAll( features, scales, &cx );
 
-    NumericExpression offsetExpr;
     if ( _altitude.valid() && _altitude->verticalOffset().isSet() )
-        offsetExpr = *_altitude->verticalOffset();
+        NumericExpressionEvaluator( *_altitude->verticalOffset() ).evalAll( features, offsets, &cx );
 
-    for( FeatureList::iterator i = features.begin(); i != features.end(); ++i )
+    unsigned n = 0;
+    for( FeatureList::iterator i = features.begin(); i != features.end(); ++i, ++n )
     {
         Feature* feature = i->get();
 
         double minHAT       =  DBL_MAX;
         double maxHAT       = -DBL_MAX;
 
-        double scaleZ = 1.0;
-        if ( _altitude.valid() && _altitude->verticalScale().isSet() )
-            scaleZ = feature->eval( scaleExpr, &cx );
+        double scaleZ = scales.empty() ? 1.0 : scales[n];
 
-        double offsetZ = 0.0;
-        if ( _altitude.valid() && _altitude->verticalOffset().isSet() )
-            offsetZ = feature->eval( offsetExpr, &cx );
+        double offsetZ = offsets.empty() ? 0.0 : offsets[n];
         
         GeometryIterator gi( feature->getGeometry() );
         while( gi.hasMore() )
@@ -128,13 +126,13 @@ AltitudeFilter::pushAndClamp( FeatureList& features, FilterContext& cx )
     // establish an elevation query interface based on the features' SRS.
     ElevationQuery eq( mapf );
 
-    NumericExpression scaleExpr;
+    // evaluate the scale and offset for all the features at once.
+    std::vector<double> scales, offsets;
     if ( _altitude->verticalScale().isSet() )
-        scaleExpr = *_altitude->verticalScale();
+        NumericExpressionEvaluator( *_altitude->verticalScale() ).evalAll( features, scales, &cx );
 
-    NumericExpression offsetExpr;
     if ( _altitude->verticalOffset().isSet() )
-        offsetExpr = *_altitude->verticalOffset();
+        NumericExpressionEvaluator( *_altitude->verticalOffset() ).evalAll( features, offsets, &cx );
 
     // whether to record the min/max height-above-terrain values.
     bool collectHATs =
@@ -149,7 +147,8 @@ AltitudeFilter::pushAndClamp( FeatureList& features, FilterContext& cx )
     bool vertEquiv =
         featureSRS->isVertEquivalentTo( mapSRS );
 
-    for( FeatureList::iterator i = features.begin(); i != features.end(); ++i )
+    unsigned n = 0;
+    for( FeatureList::iterator i = features.begin(); i != features.end(); ++i, ++n )
     {
         Feature* feature = i->get();
         double maxTerrainZ  = -DBL_MAX;
@@ -157,13 +156,9 @@ AltitudeFilter::pushAndClamp( FeatureList& features, FilterContext& cx )
         double minHAT       =  DBL_MAX;
         double maxHAT       = -DBL_MAX;
 
-        double scaleZ = 1.0;
-        if ( _altitude.valid() && _altitude->verticalScale().isSet() )
-            scaleZ = feature->eval( scaleExpr, &cx );
+        double scaleZ = scales.empty() ? 1.0 : scales[n];
 
-        double offsetZ = 0.0;
-        if ( _altitude.valid() && _altitude->verticalOffset().isSet() )
-            offsetZ = feature->eval( offsetExpr, &cx );
+        double offsetZ = offsets.empty() ? 0.0 : offsets[n];
         
         GeometryIterator gi( feature->getGeometry() );
         while( gi.hasMore() )
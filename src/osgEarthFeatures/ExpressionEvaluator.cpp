@@ -0,0 +1,198 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarthFeatures/ExpressionEvaluator>
+#include <osgEarthFeatures/FeatureBatch>
+#include <osgEarthFeatures/FilterContext>
+#include <osgEarthFeatures/Session>
+#include <osgEarthFeatures/ScriptEngine>
+#include <osgEarth/StringUtils>
+#include <set>
+
+using namespace osgEarth;
+using namespace osgEarth::Features;
+using namespace osgEarth::Symbology;
+
+#define LC "[NumericExpressionEvaluator] "
+
+//------------------------------------------------------------------------
+
+NumericExpressionEvaluator::NumericExpressionEvaluator(const NumericExpression& expr,
+                                                       const FeatureSchema&     schema) :
+_expr( expr )
+{
+    // attribute names are case-insensitive.
+    std::set<std::string> keys;
+    for( FeatureSchema::const_iterator i = schema.begin(); i != schema.end(); ++i )
+        keys.insert( toLower(i->first) );
+
+    for( unsigned slot = 0; slot < _expr.getNumSlots(); ++slot )
+    {
+        _inSchema.push_back( schema.empty() || keys.find(_expr.getSlotKey(slot)) != keys.end() );
+    }
+}
+
+void
+NumericExpressionEvaluator::getColumns(const FeatureBatch* batch,
+                                       std::vector<int>&   out_columns) const
+{
+    out_columns.resize( _inSchema.size() );
+    for( unsigned slot = 0; slot < _inSchema.size(); ++slot )
+        out_columns[slot] = _inSchema[slot] ? batch->getColumn(_expr.getSlotKey(slot)) : -1;
+}
+
+void
+NumericExpressionEvaluator::getSlotValues(const Feature*          feature,
+                                          FilterContext const*    context,
+                                          const std::vector<int>* columns,
+                                          bool                    skipScripts,
+                                          double*                 out_values) const
+{
+    const FeatureBatch* batch = feature->getBatch();
+
+    for( unsigned slot = 0; slot < _inSchema.size(); ++slot )
+    {
+        if ( skipScripts && !_inSchema[slot] )
+            continue;
+
+        double val = 0.0;
+        bool   found = false;
+
+        if ( batch )
+        {
+            int col = columns ? (*columns)[slot] : _inSchema[slot] ? batch->getColumn(_expr.getSlotKey(slot)) : -1;
+            if ( col >= 0 )
+            {
+                val = batch->getDouble( feature->getBatchRow(), col, 0.0 );
+                found = true;
+            }
+        }
+        else if ( _inSchema[slot] )
+        {
+            const AttributeTable& attrs = feature->getAttrs();
+            AttributeTable::const_iterator ai = attrs.find( _expr.getSlotKey(slot) );
+            if ( ai != attrs.end() )
+            {
+                val = ai->second.getDouble(0.0);
+                found = true;
+            }
+        }
+
+        if ( !found && context && context->getSession() )
+        {
+            // not an attribute; look for a script
+            ScriptEngine* engine = context->getSession()->getScriptEngine();
+            if ( engine )
+            {
+                ScriptResult result = engine->run( _expr.getSlotName(slot), feature, context );
+                if ( result.success() )
+                    val = result.asDouble();
+                else
+                    OE_WARN << LC << "Script error:" << result.message() << std::endl;
+            }
+        }
+
+        out_values[slot] = val;
+    }
+}
+
+double
+NumericExpressionEvaluator::eval(const Feature*       feature,
+                                 FilterContext const* context) const
+{
+    if ( !feature )
+        return 0.0;
+
+    NumericExpressionSlots slots( _inSchema.size() );
+    getSlotValues( feature, context, 0L, false, slots.get() );
+    return _expr.eval( slots.get() );
+}
+
+void
+NumericExpressionEvaluator::evalAll(const FeatureList&   features,
+                                    std::vector<double>& out_values,
+                                    FilterContext const* context) const
+{
+    out_values.resize( features.size() );
+
+    // one slot buffer for the whole list.
+    std::vector<double> slots( _inSchema.empty() ? 1 : _inSchema.size() );
+
+    // columns of the attributes in the current FeatureBatch, so consecutive
+    // features from the same batch need no lookups at all.
+    const FeatureBatch* batch = 0L;
+    std::vector<int>    columns;
+
+    // variables that can only be scripts run over the whole list at once,
+    // which lets the engine enter and compile once instead of per feature.
+    ScriptEngine* engine = context && context->getSession() ? context->getSession()->getScriptEngine() : 0L;
+    std::vector< std::vector<ScriptResult> > scripted( _inSchema.size() );
+    bool batchScripts = false;
+    if ( engine )
+    {
+        for( unsigned slot = 0; slot < _inSchema.size(); ++slot )
+        {
+            if ( !_inSchema[slot] )
+            {
+                engine->run( _expr.getSlotName(slot), features, context, scripted[slot] );
+                batchScripts = true;
+            }
+        }
+    }
+
+    unsigned n = 0;
+    for( FeatureList::const_iterator i = features.begin(); i != features.end(); ++i, ++n )
+    {
+        const Feature* feature = i->get();
+        if ( feature )
+        {
+            if ( feature->getBatch() && feature->getBatch() != batch )
+            {
+                batch = feature->getBatch();
+                getColumns( batch, columns );
+            }
+
+            getSlotValues( feature, context, feature->getBatch() ? &columns : 0L, batchScripts, &slots[0] );
+
+            if ( batchScripts )
+            {
+                for( unsigned slot = 0; slot < _inSchema.size(); ++slot )
+                {
+                    if ( _inSchema[slot] )
+                        continue;
+
+                    slots[slot] = 0.0;
+                    if ( n < scripted[slot].size() )
+                    {
+                        ScriptResult& result = scripted[slot][n];
+                        if ( result.success() )
+                            slots[slot] = result.asDouble();
+                        else
+                            OE_WARN << LC << "Script error:" << result.message() << std::endl;
+                    }
+                }
+            }
+
+            out_values[n] = _expr.eval( &slots[0] );
+        }
+        else
+        {
+            out_values[n] = 0.0;
+        }
+    }
+}
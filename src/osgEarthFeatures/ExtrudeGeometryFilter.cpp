@@ -18,6 +18,7 @@
  */
 #include <osgEarthFeatures/ExtrudeGeometryFilter>
 #include <osgEarthFeatures/FeatureSourceIndexNode>
+#include <osgEarthFeatures/ExpressionEvaluator>
 #include <osgEarthSymbology/MeshSubdivider>
 #include <osgEarthSymbology/MeshConsolidator>
 #include <osgEarth/ECEF>
@@ -665,7 +666,20 @@ ExtrudeGeometryFilter::process( FeatureList& features, FilterContext& context )
     Random wallSkinPRNG( _wallSkinSymbol.valid()? *_wallSkinSymbol->randomSeed() : 0, Random::METHOD_FAST );
     Random roofSkinPRNG( _roofSkinSymbol.valid()? *_roofSkinSymbol->randomSeed() : 0, Random::METHOD_FAST );
 
-    for( FeatureList::iterator f = features.begin(); f != features.end(); ++f )
+    // evaluate the height expressions for the whole list up front. No schema, since
+    // earlier filters may have added attributes (like __max_hat) to the features.
+    std::vector<double> heights, offsets;
+    if ( !_heightCallback.valid() && _heightExpr.isSet() )
+    {
+        NumericExpressionEvaluator( *_heightExpr ).evalAll( features, heights, &context );
+    }
+    if ( _heightOffsetExpr.isSet() )
+    {
+        NumericExpressionEvaluator( *_heightOffsetExpr ).evalAll( features, offsets, &context );
+    }
+
+    unsigned n = 0;
+    for( FeatureList::iterator f = features.begin(); f != features.end(); ++f, ++n )
     {
         Feature* input = f->get();
 
@@ -713,7 +727,7 @@ ExtrudeGeometryFilter::process( FeatureList& features, FilterContext& context )
             }
             else if ( _heightExpr.isSet() )
             {
-                height = input->eval( _heightExpr.mutable_value(), &context );
+                height = heights[n];
             }
             else
             {
@@ -724,7 +738,7 @@ ExtrudeGeometryFilter::process( FeatureList& features, FilterContext& context )
             float offset = 0.0;
             if ( _heightOffsetExpr.isSet() )
             {
-                offset = input->eval( _heightOffsetExpr.mutable_value(), &context );
+                offset = offsets[n];
             }
 
             osg::ref_ptr<osg::StateSet> wallStateSet;
@@ -17,6 +17,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
 #include <osgEarthFeatures/Feature>
+#include <osgEarthFeatures/FeatureBatch>
 #include <osgEarth/StringUtils>
 #include <osgEarthFeatures/GeometryUtils>
 #include <osgEarth/JsonUtils>
@@ -144,17 +145,19 @@ AttributeValue::getBool( bool defaultValue ) const
 //----------------------------------------------------------------------------
 
 Feature::Feature( FeatureID fid ) :
-_fid( fid ),
-_srs( 0L )
+_fid     ( fid ),
+_srs     ( 0L ),
+_batchRow( 0 )
 //_cachedBoundingPolytopeValid( false )
 {
     //NOP
 }
 
 Feature::Feature( Geometry* geom, const SpatialReference* srs, const Style& style, FeatureID fid ) :
-_geom ( geom ),
-_srs  ( srs ),
-_fid  ( fid )
+_geom    ( geom ),
+_srs     ( srs ),
+_fid     ( fid ),
+_batchRow( 0 )
 {
     if ( !style.empty() )
         _style = style;
@@ -165,6 +168,8 @@ _fid  ( fid )
 Feature::Feature( const Feature& rhs, const osg::CopyOp& copyOp ) :
 _fid      ( rhs._fid ),
 _attrs    ( rhs._attrs ),
+_batch    ( rhs._batch.get() ),
+_batchRow ( rhs._batchRow ),
 _style    ( rhs._style ),
 _geoInterp( rhs._geoInterp ),
 _srs      ( rhs._srs.get() )
@@ -175,6 +180,11 @@ _srs      ( rhs._srs.get() )
     dirty();
 }
 
+Feature::~Feature()
+{
+    //nop
+}
+
 FeatureID
 Feature::getFID() const 
 {
@@ -203,9 +213,51 @@ Feature::dirty()
     //_cachedBoundingPolytopeValid = false;
 }
 
+const AttributeTable&
+Feature::getAttrs() const
+{
+    if ( _batch.valid() )
+        const_cast<Feature*>(this)->detach();
+    return _attrs;
+}
+
+void
+Feature::getAttrs( AttributeTable& out_attrs ) const
+{
+    if ( _batch.valid() )
+    {
+        _batch->getAttributes( _batchRow, out_attrs );
+    }
+    else
+    {
+        for( AttributeTable::const_iterator i = _attrs.begin(); i != _attrs.end(); ++i )
+            out_attrs[i->first] = i->second;
+    }
+}
+
+void
+Feature::setBatchRow( const FeatureBatch* batch, unsigned row )
+{
+    _attrs.clear();
+    _batch    = batch;
+    _batchRow = row;
+}
+
+void
+Feature::detach()
+{
+    if ( _batch.valid() )
+    {
+        _batch->getAttributes( _batchRow, _attrs );
+        _batch    = 0L;
+        _batchRow = 0;
+    }
+}
+
 void
 Feature::set( const std::string& name, const std::string& value )
 {
+    detach();
     AttributeValue& a = _attrs[name];
     a.first = ATTRTYPE_STRING;
     a.second.stringValue = value;
@@ -215,6 +267,7 @@ Feature::set( const std::string& name, const std::string& value )
 void
 Feature::set( const std::string& name, double value )
 {
+    detach();
     AttributeValue& a = _attrs[name];
     a.first = ATTRTYPE_DOUBLE;
     a.second.doubleValue = value;
@@ -224,6 +277,7 @@ Feature::set( const std::string& name, double value )
 void
 Feature::set( const std::string& name, int value )
 {
+    detach();
     AttributeValue& a = _attrs[name];
     a.first = ATTRTYPE_INT;
     a.second.intValue = value;
@@ -233,6 +287,7 @@ Feature::set( const std::string& name, int value )
 void
 Feature::set( const std::string& name, bool value )
 {
+    detach();
     AttributeValue& a = _attrs[name];
     a.first = ATTRTYPE_BOOL;
     a.second.boolValue = value;
@@ -242,6 +297,7 @@ Feature::set( const std::string& name, bool value )
 void
 Feature::setNull( const std::string& name)
 {
+    detach();
     AttributeValue& a = _attrs[name];    
     a.second.set = false;
 }
@@ -249,6 +305,7 @@ Feature::setNull( const std::string& name)
 void
 Feature::setNull( const std::string& name, AttributeType type)
 {
+    detach();
     AttributeValue& a = _attrs[name];
     a.first = type;    
     a.second.set = false;
@@ -260,12 +317,19 @@ Feature::setNull( const std::string& name, AttributeType type)
 bool
 Feature::hasAttr( const std::string& name ) const
 {
+    if ( _batch.valid() )
+        return _batch->getColumn(toLower(name)) >= 0;
     return _attrs.find(toLower(name)) != _attrs.end();
 }
 
 std::string
 Feature::getString( const std::string& name ) const
 {
+    if ( _batch.valid() )
+    {
+        int col = _batch->getColumn(toLower(name));
+        return col >= 0 ? _batch->getString(_batchRow, col) : EMPTY_STRING;
+    }
     AttributeTable::const_iterator i = _attrs.find(toLower(name));
     return i != _attrs.end()? i->second.getString() : EMPTY_STRING;
 }
@@ -273,6 +337,11 @@ Feature::getString( const std::string& name ) const
 double
 Feature::getDouble( const std::string& name, double defaultValue ) const 
 {
+    if ( _batch.valid() )
+    {
+        int col = _batch->getColumn(toLower(name));
+        return col >= 0 ? _batch->getDouble(_batchRow, col, defaultValue) : defaultValue;
+    }
     AttributeTable::const_iterator i = _attrs.find(toLower(name));
     return i != _attrs.end()? i->second.getDouble(defaultValue) : defaultValue;
 }
@@ -280,6 +349,11 @@ Feature::getDouble( const std::string& name, double defaultValue ) const
 int
 Feature::getInt( const std::string& name, int defaultValue ) const 
 {
+    if ( _batch.valid() )
+    {
+        int col = _batch->getColumn(toLower(name));
+        return col >= 0 ? _batch->getInt(_batchRow, col, defaultValue) : defaultValue;
+    }
     AttributeTable::const_iterator i = _attrs.find(toLower(name));
     return i != _attrs.end()? i->second.getInt(defaultValue) : defaultValue;
 }
@@ -287,6 +361,11 @@ Feature::getInt( const std::string& name, int defaultValue ) const
 bool
 Feature::getBool( const std::string& name, bool defaultValue ) const 
 {
+    if ( _batch.valid() )
+    {
+        int col = _batch->getColumn(toLower(name));
+        return col >= 0 ? _batch->getBool(_batchRow, col, defaultValue) : defaultValue;
+    }
     AttributeTable::const_iterator i = _attrs.find(toLower(name));
     return i != _attrs.end()? i->second.getBool(defaultValue) : defaultValue;
 }
@@ -294,6 +373,11 @@ Feature::getBool( const std::string& name, bool defaultValue ) const
 bool
 Feature::isSet( const std::string& name) const
 {
+    if ( _batch.valid() )
+    {
+        int col = _batch->getColumn(toLower(name));
+        return col >= 0 ? _batch->isSet(_batchRow, col) : false;
+    }
     AttributeTable::const_iterator i = _attrs.find(toLower(name));
     return i != _attrs.end()? i->second.second.set : false;
 }
@@ -301,12 +385,26 @@ Feature::isSet( const std::string& name) const
 double
 Feature::eval( NumericExpression& expr, FilterContext const* context ) const
 {
-    const NumericExpression::Variables& vars = expr.variables();
-    for( NumericExpression::Variables::const_iterator i = vars.begin(); i != vars.end(); ++i )
+    // one lookup per distinct variable, using the expression's pre-lowercased names.
+    unsigned numSlots = expr.getNumSlots();
+    NumericExpressionSlots buffer( numSlots );
+    double* slots = buffer.get();
+
+    for( unsigned slot = 0; slot < numSlots; ++slot )
     {
       double val = 0.0;
-      AttributeTable::const_iterator ai = _attrs.find(toLower(i->first));
-      if (ai != _attrs.end())
+      int col = -1;
+      AttributeTable::const_iterator ai = _attrs.end();
+      if (_batch.valid())
+        col = _batch->getColumn(expr.getSlotKey(slot));
+      else
+        ai = _attrs.find(expr.getSlotKey(slot));
+
+      if (col >= 0)
+      {
+        val = _batch->getDouble(_batchRow, col, 0.0);
+      }
+      else if (ai != _attrs.end())
       {
         val = ai->second.getDouble(0.0);
       }
@@ -316,7 +414,7 @@ Feature::eval( NumericExpression& expr, FilterContext const* context ) const
         ScriptEngine* engine = context->getSession()->getScriptEngine();
         if (engine)
         {
-          ScriptResult result = engine->run(i->first, this, context);
+          ScriptResult result = engine->run(expr.getSlotName(slot), this, context);
           if (result.success())
             val = result.asDouble();
           else
@@ -324,21 +422,33 @@ Feature::eval( NumericExpression& expr, FilterContext const* context ) const
         }
       }
 
-      expr.set( *i, val); //osgEarth::as<double>(getAttr(i->first),0.0) );
+      slots[slot] = val;
     }
 
-    return expr.eval();
+    return expr.eval( slots );
 }
 
 const std::string&
 Feature::eval( StringExpression& expr, FilterContext const* context ) const
 {
     const StringExpression::Variables& vars = expr.variables();
-    for( StringExpression::Variables::const_iterator i = vars.begin(); i != vars.end(); ++i )
+    const StringVector& keys = expr.variableKeys();
+    for( unsigned k = 0; k < vars.size(); ++k )
     {
+      const StringExpression::Variable& var = vars[k];
       std::string val = "";
-      AttributeTable::const_iterator ai = _attrs.find(toLower(i->first));
-      if (ai != _attrs.end())
+      int col = -1;
+      AttributeTable::const_iterator ai = _attrs.end();
+      if (_batch.valid())
+        col = _batch->getColumn(keys[k]);
+      else
+        ai = _attrs.find(keys[k]);
+
+      if (col >= 0)
+      {
+        val = _batch->getString(_batchRow, col);
+      }
+      else if (ai != _attrs.end())
       {
         val = ai->second.getString();
       }
@@ -348,7 +458,7 @@ Feature::eval( StringExpression& expr, FilterContext const* context ) const
         ScriptEngine* engine = context->getSession()->getScriptEngine();
         if (engine)
         {
-          ScriptResult result = engine->run(i->first, this, context);
+          ScriptResult result = engine->run(var.first, this, context);
           if (result.success())
             val = result.asString();
           else
@@ -356,7 +466,7 @@ Feature::eval( StringExpression& expr, FilterContext const* context ) const
         }
       }
 
-      expr.set( *i, val );
+      expr.set( var, val );
     }
 
     return expr.eval();
@@ -461,10 +571,12 @@ Feature::getGeoJSON()
 
     //Write out all the properties         
     Json::Value props(Json::objectValue);    
-    if (getAttrs().size() > 0)
+    AttributeTable attrs;
+    getAttrs( attrs );
+    if (attrs.size() > 0)
     {
 
-        for (AttributeTable::const_iterator itr = getAttrs().begin(); itr != getAttrs().end(); ++itr)
+        for (AttributeTable::const_iterator itr = attrs.begin(); itr != attrs.end(); ++itr)
         {
             if (itr->second.first == ATTRTYPE_INT)
             {
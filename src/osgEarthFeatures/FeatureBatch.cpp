@@ -0,0 +1,245 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarthFeatures/FeatureBatch>
+#include <osgEarth/StringUtils>
+
+using namespace osgEarth;
+using namespace osgEarth::Features;
+
+#define LC "[FeatureBatch] "
+
+//------------------------------------------------------------------------
+
+FeatureBatch::FeatureBatch() :
+_numRows( 0 )
+{
+    // string ID 0 is the empty string, the value of a NULL string.
+    intern( EMPTY_STRING );
+}
+
+FeatureBatch::FeatureBatch( const FeatureSchema& schema ) :
+_numRows( 0 )
+{
+    intern( EMPTY_STRING );
+
+    for( FeatureSchema::const_iterator i = schema.begin(); i != schema.end(); ++i )
+        addColumn( toLower(i->first), i->second );
+}
+
+unsigned
+FeatureBatch::addColumn( const std::string& name, AttributeType type )
+{
+    std::map<std::string, unsigned>::const_iterator i = _columnIndex.find( name );
+    if ( i != _columnIndex.end() )
+        return i->second;
+
+    if ( _numRows > 0 )
+    {
+        OE_WARN << LC << "Columns must be added before rows (column \"" << name << "\")" << std::endl;
+    }
+
+    Column col;
+    col._name = name;
+    col._type = type == ATTRTYPE_UNSPECIFIED ? ATTRTYPE_STRING : type;
+    if ( col._type == ATTRTYPE_DOUBLE )
+        col._doubles.resize( _numRows, 0.0 );
+    else
+        col._ints.resize( _numRows, 0 );
+    col._set.resize( _numRows, false );
+
+    unsigned index = _columns.size();
+    _columns.push_back( col );
+    _columnIndex[name] = index;
+    return index;
+}
+
+int
+FeatureBatch::getColumn( const std::string& key ) const
+{
+    std::map<std::string, unsigned>::const_iterator i = _columnIndex.find( key );
+    return i != _columnIndex.end() ? (int)i->second : -1;
+}
+
+void
+FeatureBatch::reserve( unsigned numRows )
+{
+    for( std::vector<Column>::iterator c = _columns.begin(); c != _columns.end(); ++c )
+    {
+        if ( c->_type == ATTRTYPE_DOUBLE )
+            c->_doubles.reserve( numRows );
+        else
+            c->_ints.reserve( numRows );
+        c->_set.reserve( numRows );
+    }
+}
+
+unsigned
+FeatureBatch::addRow()
+{
+    for( std::vector<Column>::iterator c = _columns.begin(); c != _columns.end(); ++c )
+    {
+        if ( c->_type == ATTRTYPE_DOUBLE )
+            c->_doubles.push_back( 0.0 );
+        else
+            c->_ints.push_back( 0 );
+        c->_set.push_back( false );
+    }
+    return _numRows++;
+}
+
+int
+FeatureBatch::intern( const std::string& value )
+{
+    std::map<std::string, int>::const_iterator i = _stringIDs.find( value );
+    if ( i != _stringIDs.end() )
+        return i->second;
+
+    int id = _strings.size();
+    _strings.push_back( value );
+    _stringIDs[value] = id;
+    return id;
+}
+
+void
+FeatureBatch::setString( unsigned row, unsigned col, const std::string& value )
+{
+    Column& c = _columns[col];
+    switch( c._type ) {
+        case ATTRTYPE_DOUBLE: c._doubles[row] = osgEarth::as<double>(value, 0.0); break;
+        case ATTRTYPE_INT:    c._ints[row] = osgEarth::as<int>(value, 0); break;
+        case ATTRTYPE_BOOL:   c._ints[row] = osgEarth::as<bool>(value, false) ? 1 : 0; break;
+        default:              c._ints[row] = intern(value); break;
+    }
+    c._set[row] = true;
+}
+
+void
+FeatureBatch::setDouble( unsigned row, unsigned col, double value )
+{
+    Column& c = _columns[col];
+    switch( c._type ) {
+        case ATTRTYPE_DOUBLE: c._doubles[row] = value; break;
+        case ATTRTYPE_INT:    c._ints[row] = (int)value; break;
+        case ATTRTYPE_BOOL:   c._ints[row] = value != 0.0 ? 1 : 0; break;
+        default:              c._ints[row] = intern(osgEarth::toString(value)); break;
+    }
+    c._set[row] = true;
+}
+
+void
+FeatureBatch::setInt( unsigned row, unsigned col, int value )
+{
+    Column& c = _columns[col];
+    switch( c._type ) {
+        case ATTRTYPE_DOUBLE: c._doubles[row] = (double)value; break;
+        case ATTRTYPE_INT:    c._ints[row] = value; break;
+        case ATTRTYPE_BOOL:   c._ints[row] = value != 0 ? 1 : 0; break;
+        default:              c._ints[row] = intern(osgEarth::toString(value)); break;
+    }
+    c._set[row] = true;
+}
+
+void
+FeatureBatch::setBool( unsigned row, unsigned col, bool value )
+{
+    Column& c = _columns[col];
+    switch( c._type ) {
+        case ATTRTYPE_DOUBLE: c._doubles[row] = value ? 1.0 : 0.0; break;
+        case ATTRTYPE_INT:
+        case ATTRTYPE_BOOL:   c._ints[row] = value ? 1 : 0; break;
+        default:              c._ints[row] = intern(osgEarth::toString(value)); break;
+    }
+    c._set[row] = true;
+}
+
+void
+FeatureBatch::setNull( unsigned row, unsigned col )
+{
+    Column& c = _columns[col];
+    if ( c._type == ATTRTYPE_DOUBLE )
+        c._doubles[row] = 0.0;
+    else
+        c._ints[row] = 0;
+    c._set[row] = false;
+}
+
+std::string
+FeatureBatch::getString( unsigned row, unsigned col ) const
+{
+    const Column& c = _columns[col];
+    switch( c._type ) {
+        case ATTRTYPE_DOUBLE: return osgEarth::toString(c._doubles[row]);
+        case ATTRTYPE_INT:    return osgEarth::toString(c._ints[row]);
+        case ATTRTYPE_BOOL:   return osgEarth::toString(c._ints[row] != 0);
+        default:              return _strings[c._ints[row]];
+    }
+}
+
+double
+FeatureBatch::getDouble( unsigned row, unsigned col, double defaultValue ) const
+{
+    const Column& c = _columns[col];
+    switch( c._type ) {
+        case ATTRTYPE_DOUBLE: return c._doubles[row];
+        case ATTRTYPE_INT:    return (double)c._ints[row];
+        case ATTRTYPE_BOOL:   return c._ints[row] != 0 ? 1.0 : 0.0;
+        default:              return osgEarth::as<double>(_strings[c._ints[row]], defaultValue);
+    }
+}
+
+int
+FeatureBatch::getInt( unsigned row, unsigned col, int defaultValue ) const
+{
+    const Column& c = _columns[col];
+    switch( c._type ) {
+        case ATTRTYPE_DOUBLE: return (int)c._doubles[row];
+        case ATTRTYPE_INT:    return c._ints[row];
+        case ATTRTYPE_BOOL:   return c._ints[row] != 0 ? 1 : 0;
+        default:              return osgEarth::as<int>(_strings[c._ints[row]], defaultValue);
+    }
+}
+
+bool
+FeatureBatch::getBool( unsigned row, unsigned col, bool defaultValue ) const
+{
+    const Column& c = _columns[col];
+    switch( c._type ) {
+        case ATTRTYPE_DOUBLE: return c._doubles[row] != 0.0;
+        case ATTRTYPE_INT:
+        case ATTRTYPE_BOOL:   return c._ints[row] != 0;
+        default:              return osgEarth::as<bool>(_strings[c._ints[row]], defaultValue);
+    }
+}
+
+void
+FeatureBatch::getAttributes( unsigned row, AttributeTable& out_attrs ) const
+{
+    for( std::vector<Column>::const_iterator c = _columns.begin(); c != _columns.end(); ++c )
+    {
+        AttributeValue& a = out_attrs[c->_name];
+        a.first = c->_type;
+        switch( c->_type ) {
+            case ATTRTYPE_DOUBLE: a.second.doubleValue = c->_doubles[row]; break;
+            case ATTRTYPE_INT:    a.second.intValue = c->_ints[row]; break;
+            case ATTRTYPE_BOOL:   a.second.boolValue = c->_ints[row] != 0; break;
+            default:              a.second.stringValue = _strings[c->_ints[row]]; break;
+        }
+        a.second.set = c->_set[row];
+    }
+}
@@ -311,6 +311,13 @@ _overlayChange     ( OVERLAY_NO_CHANGE )
         OE_INFO << LC << "Added fading post-merge operation" << std::endl;
     }
 
+    // thread pool for compiling the style groups of a tile in parallel.
+    unsigned numCompileThreads = _options.compileThreads().value();
+    if ( numCompileThreads > 0 )
+    {
+        _compileService = new TaskService( "FeatureModelGraph", numCompileThreads );
+    }
+
     ADJUST_EVENT_TRAV_COUNT( this, 1 );
 
     redraw();
@@ -953,11 +960,41 @@ FeatureModelGraph::buildStyleGroups(const StyleSelector* selector,
 }
 
 
+/**
+ * Compiles the style bins of a tile, one per call; see parallel_for. The
+ * results are attached to the graph afterwards, on the calling thread.
+ */
+struct FeatureModelGraph::CompileStyleBins
+{
+    struct Bin
+    {
+        Bin() : _features(0L), _ok(false) { }
+        Style                   _style;
+        FeatureList*            _features;
+        osg::ref_ptr<osg::Node> _node;
+        bool                    _ok;
+    };
+
+    CompileStyleBins( FeatureModelGraph* graph, const FilterContext& context ) :
+        _graph( graph ), _context( context ) { }
+
+    void operator()( unsigned i )
+    {
+        Bin& bin = _bins[i];
+        bin._ok = _graph->compileStyleGroup( bin._style, *bin._features, _context, bin._node );
+    }
+
+    FeatureModelGraph*   _graph;
+    const FilterContext& _context;
+    std::vector<Bin>     _bins;
+};
+
+
 /**
  * Querys the feature source;
  * Visits each feature and uses the Style Expression to resolve its style class;
  * Sorts the features into bins based on style class;
- * Compiles each bin into a separate style group;
+ * Compiles the bins into separate style groups (in parallel if possible);
  * Adds the resulting style groups to the provided parent.
  */
 void
@@ -994,11 +1031,13 @@ FeatureModelGraph::queryAndSortIntoStyleGroups(const Query&            query,
         }
     }
 
-    // next create a style group per bin.
+    // resolve the style of each bin.
+    CompileStyleBins compile( this, context );
+    compile._bins.reserve( styleBins.size() );
+
     for( std::map<std::string,FeatureList>::iterator i = styleBins.begin(); i != styleBins.end(); ++i )
     {
         const std::string& styleString = i->first;
-        FeatureList&       workingSet  = i->second;
 
         // resolve the style:
         Style combinedStyle;
@@ -1006,10 +1045,7 @@ FeatureModelGraph::queryAndSortIntoStyleGroups(const Query&            query,
         // if the style string begins with an open bracket, it's an inline style definition.
         if ( styleString.length() > 0 && styleString.at(0) == '{' )
         {
-            Config conf( "style", styleString );
-            conf.setReferrer( styleExpr.uriContext().referrer() );
-            conf.set( "type", "text/css" );
-            combinedStyle = Style(conf);
+            getInlineStyle( styleString, styleExpr.uriContext(), combinedStyle );
         }
 
         // otherwise, look up the style in the stylesheet. Do NOT fall back on a default
@@ -1023,25 +1059,72 @@ FeatureModelGraph::queryAndSortIntoStyleGroups(const Query&            query,
                 combinedStyle = *selectedStyle;
         }
 
-        // if there is a valid style, create the node and add it. (Otherwise we will skip
+        // if there is a valid style, queue the bin for compilation. (Otherwise we will skip
         // the feature.)
         if ( !combinedStyle.empty() )
         {
-            osg::Group* styleGroup = createStyleGroup(combinedStyle, workingSet, context);
-            if ( styleGroup )
-                parent->addChild( styleGroup );
+            compile._bins.push_back( CompileStyleBins::Bin() );
+            compile._bins.back()._style    = combinedStyle;
+            compile._bins.back()._features = &i->second;
+        }
+    }
+
+    // run the filter chains; each bin is independent of the others.
+    parallel_for( _compileService.get(), 0u, compile._bins.size(), compile );
+
+    // create the style groups and add them, in bin order.
+    for( std::vector<CompileStyleBins::Bin>::iterator b = compile._bins.begin(); b != compile._bins.end(); ++b )
+    {
+        if ( b->_ok )
+        {
+            osg::Group* styleGroup = getOrCreateStyleGroupFromFactory( b->_style );
+
+            // if it returned a node, add it. (it doesn't necessarily have to)
+            if ( b->_node.valid() )
+                styleGroup->addChild( b->_node.get() );
+
+            parent->addChild( styleGroup );
         }
     }
 }
 
 
-osg::Group*
-FeatureModelGraph::createStyleGroup(const Style&         style, 
-                                    FeatureList&         workingSet, 
-                                    const FilterContext& contextPrototype)
+bool
+FeatureModelGraph::getInlineStyle(const std::string& styleString,
+                                  const URIContext&  uriContext,
+                                  Style&             out_style)
 {
-    osg::Group* styleGroup = 0L;
+    // style expressions tend to produce the same few inline styles for every
+    // tile, so only parse each one once.
+    std::pair<std::string,std::string> key( uriContext.referrer(), styleString );
+
+    Threading::ScopedMutexLock lock( _inlineStylesMutex );
+
+    InlineStyleCache::const_iterator i = _inlineStyles.find( key );
+    if ( i == _inlineStyles.end() )
+    {
+        // expressions that generate a unique style per feature would grow
+        // the cache without bound, so start over when it gets big.
+        if ( _inlineStyles.size() >= 1024 )
+            _inlineStyles.clear();
+
+        Config conf( "style", styleString );
+        conf.setReferrer( uriContext.referrer() );
+        conf.set( "type", "text/css" );
+        i = _inlineStyles.insert( std::make_pair(key, Style(conf)) ).first;
+    }
+
+    out_style = i->second;
+    return !out_style.empty();
+}
+
 
+bool
+FeatureModelGraph::compileStyleGroup(const Style&             style, 
+                                     FeatureList&             workingSet, 
+                                     const FilterContext&     contextPrototype,
+                                     osg::ref_ptr<osg::Node>& out_node)
+{
     FilterContext context(contextPrototype);
 
     // first Crop the feature set to the working extent:
@@ -1065,18 +1148,29 @@ FeatureModelGraph::createStyleGroup(const Style&         style,
     // finally, compile the features into a node.
     if ( workingSet.size() > 0 )
     {
-        osg::ref_ptr<osg::Node> node;
         osg::ref_ptr<FeatureCursor> newCursor = new FeatureListCursor(workingSet);
+        return _factory->createOrUpdateNode( newCursor.get(), style, context, out_node );
+    }
 
-        if ( _factory->createOrUpdateNode( newCursor.get(), style, context, node ) )
-        {
-            if ( !styleGroup )
-                styleGroup = getOrCreateStyleGroupFromFactory( style );
+    return false;
+}
 
-            // if it returned a node, add it. (it doesn't necessarily have to)
-            if ( node.valid() )
-                styleGroup->addChild( node.get() );
-        }
+
+osg::Group*
+FeatureModelGraph::createStyleGroup(const Style&         style, 
+                                    FeatureList&         workingSet, 
+                                    const FilterContext& contextPrototype)
+{
+    osg::Group* styleGroup = 0L;
+
+    osg::ref_ptr<osg::Node> node;
+    if ( compileStyleGroup(style, workingSet, contextPrototype, node) )
+    {
+        styleGroup = getOrCreateStyleGroupFromFactory( style );
+
+        // if it returned a node, add it. (it doesn't necessarily have to)
+        if ( node.valid() )
+            styleGroup->addChild( node.get() );
     }
 
     return styleGroup;
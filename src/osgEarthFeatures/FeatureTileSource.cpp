@@ -30,8 +30,10 @@ using namespace osgEarth::Symbology;
 /*************************************************************************/
 
 FeatureTileSourceOptions::FeatureTileSourceOptions( const ConfigOptions& options ) :
-TileSourceOptions( options ),
-_geomTypeOverride( Geometry::TYPE_UNKNOWN )
+TileSourceOptions  ( options ),
+_geomTypeOverride  ( Geometry::TYPE_UNKNOWN ),
+_featureIndex      ( true ),
+_maxIndexedFeatures( 100000 )
 {
     fromConfig( _conf );
 }
@@ -53,6 +55,9 @@ FeatureTileSourceOptions::getConfig() const
             conf.update( "geometry_type", "polygon" );
     }
 
+    conf.updateIfSet( "feature_index",        _featureIndex );
+    conf.updateIfSet( "max_indexed_features", _maxIndexedFeatures );
+
     return conf;
 }
 
@@ -79,6 +84,9 @@ FeatureTileSourceOptions::fromConfig( const Config& conf )
         _geomTypeOverride = Geometry::TYPE_POINTSET;
     else if ( gt == "polygon" || gt == "polygons" )
         _geomTypeOverride = Geometry::TYPE_POLYGON;
+
+    conf.getIfSet( "feature_index",        _featureIndex );
+    conf.getIfSet( "max_indexed_features", _maxIndexedFeatures );
 }
 
 /*************************************************************************/
@@ -165,7 +173,26 @@ FeatureTileSource::createImage( const TileKey& key, ProgressCallback* progress )
     preProcess( image.get(), buildData.get() );
 
     // figure out if and how to style the geometry.
+    // (features with embedded styles have never had the geometry type override applied)
+    osg::ref_ptr<ProjectedFeatureIndex> embeddedIndex;
     if ( _features->hasEmbeddedStyles() )
+        embeddedIndex = getFeatureIndex( Query(), false );
+
+    if ( embeddedIndex.valid() && embeddedIndex->getSRS()->isEquivalentTo(key.getExtent().getSRS()) )
+    {
+        // Each feature has its own embedded style data, so render them one at a time,
+        // but only the ones that touch this tile:
+        std::vector<unsigned> hits;
+        embeddedIndex->query( key.getExtent().bounds(), hits );
+        for( std::vector<unsigned>::const_iterator h = hits.begin(); h != hits.end(); ++h )
+        {
+            std::vector<unsigned> hit( 1, *h );
+            renderIndexedFeaturesForStyle(
+                *embeddedIndex->getFeature(*h)->style(), embeddedIndex.get(), hit,
+                buildData.get(), key.getExtent(), image.get() );
+        }
+    }
+    else if ( _features->hasEmbeddedStyles() )
     {
         // Each feature has its own embedded style data, so use that:
         osg::ref_ptr<FeatureCursor> cursor = _features->createFeatureCursor( Query() );
@@ -218,6 +245,19 @@ FeatureTileSource::queryAndRenderFeaturesForStyle(const Style&     style,
                                                   const GeoExtent& imageExtent,
                                                   osg::Image*      out_image)
 {   
+    // if the features are indexed, they are already in the image SRS, and all
+    // we need to do is find the ones in this tile.
+    osg::ref_ptr<ProjectedFeatureIndex> index = getFeatureIndex( query );
+    if ( index.valid() && index->getSRS()->isEquivalentTo(imageExtent.getSRS()) )
+    {
+        std::vector<unsigned> hits;
+        index->query( imageExtent.bounds(), hits );
+        if ( hits.empty() )
+            return false;
+
+        return renderIndexedFeaturesForStyle( style, index.get(), hits, data, imageExtent, out_image );
+    }
+
     // first we need the overall extent of the layer:
     const GeoExtent& featuresExtent = getFeatureSource()->getFeatureProfile()->getExtent();
     
@@ -277,3 +317,71 @@ FeatureTileSource::queryAndRenderFeaturesForStyle(const Style&     style,
     }
 }
 
+
+osg::ref_ptr<ProjectedFeatureIndex>
+FeatureTileSource::getFeatureIndex( const Query& query, bool applyTypeOverride )
+{
+    if ( _options.featureIndex() == false || !supportsFeatureIndex() || !_features.valid() || !getProfile() )
+        return 0L;
+
+    // tiled sources are meant to be queried tile by tile.
+    const FeatureProfile* featureProfile = _features->getFeatureProfile();
+    if ( !featureProfile || featureProfile->getTiled() )
+        return 0L;
+
+    Threading::ScopedMutexLock lock( _indexMutex );
+
+    // start over if the feature data changed.
+    if ( _features->outOfSyncWith(_indexRevision) )
+    {
+        _indexes.clear();
+        _features->sync( _indexRevision );
+
+        // a source that is always out of sync would be re-indexed for every tile.
+        if ( _features->outOfSyncWith(_indexRevision) )
+            return 0L;
+    }
+
+    // The query bounds are ignored: tiles query the features in their own extent.
+    FeatureIndexKey key(
+        std::make_pair(
+            query.expression().isSet() ? query.expression().value() : "",
+            query.orderby().isSet()    ? query.orderby().value()    : "" ),
+        applyTypeOverride );
+
+    FeatureIndexes::iterator i = _indexes.find( key );
+    if ( i == _indexes.end() )
+    {
+        Query indexQuery;
+        indexQuery.expression() = query.expression();
+        indexQuery.orderby()    = query.orderby();
+
+        osg::ref_ptr<ProjectedFeatureIndex> index;
+        osg::ref_ptr<FeatureCursor> cursor = _features->createFeatureCursor( indexQuery );
+        if ( cursor.valid() )
+        {
+            unsigned maxFeatures = _options.maxIndexedFeatures().value();
+
+            index = new ProjectedFeatureIndex( getProfile()->getSRS() );
+            optional<Geometry::Type> typeOverride;
+            if ( applyTypeOverride )
+                typeOverride = _options.geometryTypeOverride();
+
+            if ( index->build(cursor.get(), featureProfile->getSRS(), maxFeatures, typeOverride) )
+            {
+                OE_INFO << LC << getName() << ": indexed " << index->size() << " features" << std::endl;
+            }
+            else
+            {
+                OE_INFO << LC << getName() << ": more than " << maxFeatures
+                    << " features; querying them per tile instead of indexing them" << std::endl;
+                index = 0L;
+            }
+        }
+
+        // remember failures too, so we don't try again for every tile.
+        i = _indexes.insert( std::make_pair(key, index) ).first;
+    }
+
+    return i->second;
+}
@@ -334,6 +334,80 @@ Feature*
     return feature;
 }
 
+FeatureBatch*
+    OgrUtils::createFeatureBatch( OGRFeatureDefnH defn )
+{
+    osg::ref_ptr<FeatureBatch> batch = new FeatureBatch();
+
+    int numFields = OGR_FD_GetFieldCount( defn );
+    for( int i = 0; i < numFields; ++i )
+    {
+        OGRFieldDefnH field_handle_ref = OGR_FD_GetFieldDefn( defn, i );
+        std::string name = toLower( std::string(OGR_Fld_GetNameRef(field_handle_ref)) );
+
+        // same types createFeature() stores; anything else is kept as a string.
+        OGRFieldType field_type = OGR_Fld_GetType( field_handle_ref );
+        AttributeType type =
+            field_type == OFTInteger ? ATTRTYPE_INT :
+            field_type == OFTReal    ? ATTRTYPE_DOUBLE :
+            ATTRTYPE_STRING;
+
+        if ( batch->addColumn(name, type) != (unsigned)i )
+        {
+            // duplicate (case-insensitive) field names; fields no longer map to columns.
+            OE_DEBUG << "[OgrUtils] Duplicate field \"" << name << "\"; not using a feature batch" << std::endl;
+            return 0L;
+        }
+    }
+
+    return batch.release();
+}
+
+Feature*
+    OgrUtils::createFeature( OGRFeatureH handle, const SpatialReference* srs, FeatureBatch* batch )
+{
+    if ( !batch || (unsigned)OGR_F_GetFieldCount(handle) != batch->getNumColumns() )
+        return createFeature( handle, srs );
+
+    long fid = OGR_F_GetFID( handle );
+
+    OGRGeometryH geomRef = OGR_F_GetGeometryRef( handle );	
+
+    Symbology::Geometry* geom = 0;
+
+    if ( geomRef )
+    {
+        geom = OgrUtils::createGeometry( geomRef );
+    }
+
+    Feature* feature = new Feature( geom, srs, Style(), fid );
+
+    // field i is column i, so no names or map lookups here.
+    unsigned row = batch->addRow();
+    unsigned numColumns = batch->getNumColumns();
+    for( unsigned i = 0; i < numColumns; ++i )
+    {
+        if ( !OGR_F_IsFieldSet(handle, i) )
+            continue; // rows start out NULL
+
+        switch( batch->getColumnType(i) )
+        {
+        case ATTRTYPE_INT:
+            batch->setInt( row, i, OGR_F_GetFieldAsInteger(handle, i) );
+            break;
+        case ATTRTYPE_DOUBLE:
+            batch->setDouble( row, i, OGR_F_GetFieldAsDouble(handle, i) );
+            break;
+        default:
+            batch->setString( row, i, std::string(OGR_F_GetFieldAsString(handle, i)) );
+        }
+    }
+
+    feature->setBatchRow( batch, row );
+
+    return feature;
+}
+
 AttributeType OgrUtils::getAttributeType( OGRFieldType type )
 {
     switch (type)
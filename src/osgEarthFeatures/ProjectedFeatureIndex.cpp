@@ -0,0 +1,361 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2013 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarthFeatures/ProjectedFeatureIndex>
+#include <osgEarthFeatures/BufferFilter>
+#include <osgEarthFeatures/ResampleFilter>
+#include <osgEarthFeatures/FilterContext>
+#include <algorithm>
+#include <cmath>
+
+using namespace osgEarth;
+using namespace osgEarth::Features;
+
+#define LC "[ProjectedFeatureIndex] "
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    // maximum number of children per R-tree node.
+    const unsigned NODE_SIZE = 16;
+
+    // maximum number of buffer widths to keep geometry for.
+    const unsigned MAX_BUFFER_SETS = 8;
+
+    struct LessCenterX
+    {
+        LessCenterX( const std::vector<Bounds>& b ) : _b(b) { }
+        bool operator()( unsigned lhs, unsigned rhs ) const {
+            return _b[lhs].xMin() + _b[lhs].xMax() < _b[rhs].xMin() + _b[rhs].xMax(); }
+        const std::vector<Bounds>& _b;
+    };
+
+    struct LessCenterY
+    {
+        LessCenterY( const std::vector<Bounds>& b ) : _b(b) { }
+        bool operator()( unsigned lhs, unsigned rhs ) const {
+            return _b[lhs].yMin() + _b[lhs].yMax() < _b[rhs].yMin() + _b[rhs].yMax(); }
+        const std::vector<Bounds>& _b;
+    };
+
+    // Sort-Tile-Recursive ordering: sorts the boxes into vertical slices by x,
+    // then each slice by y, so that runs of NODE_SIZE make compact nodes.
+    void strSort( std::vector<unsigned>& ids, const std::vector<Bounds>& bounds )
+    {
+        unsigned n         = ids.size();
+        unsigned numNodes  = (n + NODE_SIZE - 1) / NODE_SIZE;
+        unsigned numSlices = (unsigned)std::ceil( std::sqrt((double)numNodes) );
+        unsigned sliceSize = osg::maximum( numSlices, 1u ) * NODE_SIZE;
+
+        std::sort( ids.begin(), ids.end(), LessCenterX(bounds) );
+
+        for( unsigned s = 0; s < n; s += sliceSize )
+        {
+            std::sort( ids.begin() + s, ids.begin() + osg::minimum(s + sliceSize, n), LessCenterY(bounds) );
+        }
+    }
+
+    inline bool intersects2d( const Bounds& a, const Bounds& b )
+    {
+        return
+            a.xMin() <= b.xMax() && b.xMin() <= a.xMax() &&
+            a.yMin() <= b.yMax() && b.yMin() <= a.yMax();
+    }
+
+    // Rounds a value to 24 significant bits. Buffer parameters are usually
+    // derived from tile widths, which vary in the last few bits from tile to
+    // tile within an LOD; rounding them lets all those tiles share one set.
+    double quantize( double value )
+    {
+        if ( value <= 0.0 )
+            return value;
+        int exponent;
+        double mantissa = frexp( value, &exponent );
+        return ldexp( floor(mantissa * 16777216.0 + 0.5) / 16777216.0, exponent );
+    }
+}
+
+//------------------------------------------------------------------------
+
+bool
+ProjectedFeatureIndex::BufferKey::operator < ( const BufferKey& rhs ) const
+{
+    if ( _distance < rhs._distance ) return true;
+    if ( _distance > rhs._distance ) return false;
+    if ( _cap < rhs._cap ) return true;
+    if ( _cap > rhs._cap ) return false;
+    return _resample < rhs._resample;
+}
+
+//------------------------------------------------------------------------
+
+ProjectedFeatureIndex::ProjectedFeatureIndex( const SpatialReference* srs ) :
+_srs( srs )
+{
+    //nop
+}
+
+bool
+ProjectedFeatureIndex::build(FeatureCursor*                  cursor,
+                             const SpatialReference*         featureSRS,
+                             unsigned                        maxFeatures,
+                             const optional<Geometry::Type>& typeOverride)
+{
+    _features.clear();
+    _bounds.clear();
+    _items.clear();
+    _nodes.clear();
+
+    if ( !cursor || !featureSRS || !_srs.valid() )
+        return false;
+
+    bool needsXform = !featureSRS->isEquivalentTo( _srs.get() );
+
+    while( cursor->hasMore() )
+    {
+        osg::ref_ptr<Feature> feature = cursor->nextFeature();
+        if ( !feature.valid() )
+            continue;
+
+        Geometry* geom = feature->getGeometry();
+        if ( !geom )
+            continue;
+
+        // apply a type override if requested:
+        if ( typeOverride.isSet() && typeOverride.value() != geom->getComponentType() )
+        {
+            geom = geom->cloneAs( typeOverride.value() );
+            if ( !geom )
+                continue;
+            feature->setGeometry( geom );
+        }
+
+        if ( _features.size() >= maxFeatures )
+        {
+            _features.clear();
+            _bounds.clear();
+            return false;
+        }
+
+        if ( needsXform )
+        {
+            GeometryIterator parts( geom );
+            while( parts.hasMore() )
+            {
+                Geometry* part = parts.next();
+                featureSRS->transform( part->asVector(), _srs.get() );
+            }
+            feature->setSRS( _srs.get() );
+        }
+
+        Bounds bounds = geom->getBounds();
+        if ( !bounds.isValid() )
+            continue;
+
+        _features.push_back( feature.get() );
+        _bounds.push_back( bounds );
+    }
+
+    buildTree();
+
+    OE_DEBUG << LC << "Indexed " << _features.size() << " features in " << _nodes.size() << " nodes" << std::endl;
+    return true;
+}
+
+void
+ProjectedFeatureIndex::buildTree()
+{
+    unsigned n = _features.size();
+    if ( n == 0 )
+        return;
+
+    _items.resize( n );
+    for( unsigned i = 0; i < n; ++i )
+        _items[i] = i;
+
+    strSort( _items, _bounds );
+
+    // leaves hold runs of the sorted items.
+    std::vector<Node> level;
+    for( unsigned i = 0; i < n; i += NODE_SIZE )
+    {
+        Node leaf;
+        leaf._first  = i;
+        leaf._count  = osg::minimum( NODE_SIZE, n - i );
+        leaf._leaf   = true;
+        leaf._bounds = _bounds[_items[i]];
+        for( unsigned k = 1; k < leaf._count; ++k )
+            leaf._bounds.expandBy( _bounds[_items[i+k]] );
+        level.push_back( leaf );
+    }
+
+    // build each level up from the one below, storing the children of a node
+    // contiguously. The root goes in last.
+    while( level.size() > 1 )
+    {
+        std::vector<Bounds>   levelBounds( level.size() );
+        std::vector<unsigned> order( level.size() );
+        for( unsigned i = 0; i < level.size(); ++i )
+        {
+            levelBounds[i] = level[i]._bounds;
+            order[i] = i;
+        }
+
+        strSort( order, levelBounds );
+
+        unsigned base = _nodes.size();
+        for( unsigned i = 0; i < order.size(); ++i )
+            _nodes.push_back( level[order[i]] );
+
+        std::vector<Node> parents;
+        for( unsigned i = 0; i < order.size(); i += NODE_SIZE )
+        {
+            Node parent;
+            parent._first  = base + i;
+            parent._count  = osg::minimum( NODE_SIZE, (unsigned)order.size() - i );
+            parent._leaf   = false;
+            parent._bounds = _nodes[base + i]._bounds;
+            for( unsigned k = 1; k < parent._count; ++k )
+                parent._bounds.expandBy( _nodes[base + i + k]._bounds );
+            parents.push_back( parent );
+        }
+
+        level.swap( parents );
+    }
+
+    _nodes.push_back( level.front() );
+}
+
+void
+ProjectedFeatureIndex::query( const Bounds& bounds, std::vector<unsigned>& out_hits ) const
+{
+    if ( _nodes.empty() )
+        return;
+
+    unsigned start = out_hits.size();
+
+    std::vector<unsigned> stack;
+    stack.push_back( _nodes.size() - 1 );
+
+    while( !stack.empty() )
+    {
+        const Node& node = _nodes[stack.back()];
+        stack.pop_back();
+
+        if ( !intersects2d(node._bounds, bounds) )
+            continue;
+
+        if ( node._leaf )
+        {
+            for( unsigned k = node._first; k < node._first + node._count; ++k )
+            {
+                if ( intersects2d(_bounds[_items[k]], bounds) )
+                    out_hits.push_back( _items[k] );
+            }
+        }
+        else
+        {
+            for( unsigned k = node._first; k < node._first + node._count; ++k )
+                stack.push_back( k );
+        }
+    }
+
+    // keep the source order, so features overlap the same way in every tile.
+    std::sort( out_hits.begin() + start, out_hits.end() );
+}
+
+osg::ref_ptr<Geometry>
+ProjectedFeatureIndex::getBufferedGeometry(unsigned             i,
+                                           double               distance,
+                                           Stroke::LineCapStyle capStyle,
+                                           double               resampleLength)
+{
+    if ( i >= _features.size() || !BufferFilter::isSupported() )
+        return 0L;
+
+    // buffer with the rounded values too, so every caller sharing a set gets the
+    // same result.
+    distance       = quantize( distance );
+    resampleLength = quantize( resampleLength );
+
+    BufferKey key( distance, capStyle, resampleLength );
+
+    // already buffered at this width?
+    {
+        Threading::ScopedReadLock shared( _buffersMutex );
+        BufferSets::const_iterator s = _buffers.find( key );
+        if ( s != _buffers.end() && s->second._done[i] )
+            return s->second._geometry[i];
+    }
+
+    // buffer a copy of the geometry, as a line.
+    const Geometry* geom = _features[i]->getGeometry();
+    osg::ref_ptr<Geometry> line = geom->getComponentType() == Geometry::TYPE_POLYGON ?
+        geom->cloneAs( Geometry::TYPE_RING ) :
+        geom->clone();
+
+    osg::ref_ptr<Geometry> output;
+    if ( line.valid() )
+    {
+        FeatureList work;
+        work.push_back( new Feature(line.get(), _srs.get()) );
+        FilterContext context;
+
+        if ( resampleLength > 0.0 )
+        {
+            ResampleFilter resample;
+            resample.minLength() = resampleLength;
+            context = resample.push( work, context );
+        }
+
+        BufferFilter buffer;
+        buffer.distance() = distance;
+        buffer.capStyle() = capStyle;
+        buffer.push( work, context );
+
+        if ( !work.empty() )
+            output = work.front()->getGeometry();
+    }
+
+    Threading::ScopedWriteLock exclusive( _buffersMutex );
+
+    BufferSets::iterator s = _buffers.find( key );
+    if ( s == _buffers.end() )
+    {
+        if ( _buffers.size() >= MAX_BUFFER_SETS )
+        {
+            _buffers.erase( _bufferOrder.front() );
+            _bufferOrder.pop_front();
+        }
+
+        s = _buffers.insert( std::make_pair(key, BufferSet()) ).first;
+        s->second._geometry.resize( _features.size() );
+        s->second._done.resize( _features.size(), 0 );
+        _bufferOrder.push_back( key );
+    }
+
+    // another thread may have beaten us to it; keep the first result.
+    if ( !s->second._done[i] )
+    {
+        s->second._geometry[i] = output.get();
+        s->second._done[i] = 1;
+    }
+
+    return s->second._geometry[i];
+}
@@ -18,6 +18,7 @@
  */
 #include <osgEarthFeatures/SubstituteModelFilter>
 #include <osgEarthFeatures/FeatureSourceIndexNode>
+#include <osgEarthFeatures/ExpressionEvaluator>
 #include <osgEarthSymbology/MeshConsolidator>
 #include <osgEarth/ECEF>
 #include <osgEarth/VirtualProgram>
@@ -140,16 +141,20 @@ SubstituteModelFilter::process(const FeatureList&           features,
     std::set< URI > missing;
 
     StringExpression  uriEx   = *symbol->url();
-    NumericExpression scaleEx = *symbol->scale();
 
     const ModelSymbol* modelSymbol = dynamic_cast<const ModelSymbol*>(symbol);
     const IconSymbol*  iconSymbol  = dynamic_cast<const IconSymbol*> (symbol);
 
-    NumericExpression headingEx;
-    if ( modelSymbol )
-        headingEx = *modelSymbol->heading();
+    // evaluate the scale and heading expressions for all the features at once.
+    std::vector<double> scales, headings;
+    if ( symbol->scale().isSet() )
+        NumericExpressionEvaluator( *symbol->scale() ).evalAll( features, scales, &context );
 
-    for( FeatureList::const_iterator f = features.begin(); f != features.end(); ++f )
+    if ( modelSymbol && modelSymbol->heading().isSet() )
+        NumericExpressionEvaluator( *modelSymbol->heading() ).evalAll( features, headings, &context );
+
+    unsigned n = 0;
+    for( FeatureList::const_iterator f = features.begin(); f != features.end(); ++f, ++n )
     {
         Feature* input = f->get();
 
@@ -168,7 +173,7 @@ SubstituteModelFilter::process(const FeatureList&           features,
 
         if ( symbol->scale().isSet() )
         {
-            scale = input->eval( scaleEx, &context );
+            scale = scales[n];
             if ( scale == 0.0 )
                 scale = 1.0;
             if ( scale != 1.0 )
@@ -180,7 +185,7 @@ SubstituteModelFilter::process(const FeatureList&           features,
 
         if ( modelSymbol && modelSymbol->heading().isSet() )
         {
-            float heading = input->eval(headingEx, &context);
+            float heading = headings[n];
             rotationMatrix.makeRotate( osg::Quat(osg::DegreesToRadians(heading), osg::Vec3(0,0,1)) );
         }
 
@@ -331,10 +336,14 @@ struct ClusterVisitor : public osg::NodeVisitor
           osg::NodeVisitor( osg::NodeVisitor::TRAVERSE_ALL_CHILDREN )
     {
         _modelSymbol = dynamic_cast<const ModelSymbol*>( symbol );
-        if ( _modelSymbol )
-            _headingExpr = *_modelSymbol->heading();
 
-        _scaleExpr = *_symbol->scale();
+        // every drawable is replicated once per feature, so evaluate the
+        // scale and heading of each feature just once, up front.
+        if ( _symbol->scale().isSet() )
+            NumericExpressionEvaluator( *_symbol->scale() ).evalAll( _features, _scales, &_cx );
+
+        if ( _modelSymbol && _modelSymbol->heading().isSet() )
+            NumericExpressionEvaluator( *_modelSymbol->heading() ).evalAll( _features, _headings, &_cx );
 
         _makeECEF  = _cx.getSession()->getMapInfo().isGeocentric();
         _srs       = _cx.profile()->getSRS();
@@ -365,7 +374,8 @@ struct ClusterVisitor : public osg::NodeVisitor
                 continue;
 
             // go through the list of input features...
-            for( FeatureList::const_iterator j = _features.begin(); j != _features.end(); j++ )
+            unsigned n = 0;
+            for( FeatureList::const_iterator j = _features.begin(); j != _features.end(); j++, n++ )
             {
                 Feature* feature = j->get();
 
@@ -373,7 +383,7 @@ struct ClusterVisitor : public osg::NodeVisitor
 
                 if ( _symbol->scale().isSet() )
                 {
-                    double scale = feature->eval( _scaleExpr, &_cx );
+                    double scale = _scales[n];
                     scaleMatrix.makeScale( scale, scale, scale );
                 }
 
@@ -392,7 +402,7 @@ struct ClusterVisitor : public osg::NodeVisitor
 #endif
                 if ( _modelSymbol && _modelSymbol->heading().isSet() )
                 {
-                    float heading = feature->eval( _headingExpr, &_cx );
+                    float heading = _headings[n];
                     rotationMatrix.makeRotate( osg::Quat(osg::DegreesToRadians(heading), osg::Vec3(0,0,1)) );
                 }
 
@@ -461,8 +471,8 @@ private:
     const InstanceSymbol*   _symbol;
     const ModelSymbol*      _modelSymbol;
     FeaturesToNodeFilter*   _f2n;
-    NumericExpression       _scaleExpr;
-    NumericExpression       _headingExpr;
+    std::vector<double>     _scales;
+    std::vector<double>     _headings;
     bool                    _makeECEF;
     const SpatialReference* _srs;
     const SpatialReference* _targetSRS;
@@ -34,11 +34,15 @@ _dirty( true )
 }
 
 NumericExpression::NumericExpression( const NumericExpression& rhs ) :
-_src  ( rhs._src ),
-_rpn  ( rhs._rpn ),
-_vars ( rhs._vars ),
-_value( rhs._value ),
-_dirty( rhs._dirty )
+_src       ( rhs._src ),
+_program   ( rhs._program ),
+_vars      ( rhs._vars ),
+_slotNames ( rhs._slotNames ),
+_slotKeys  ( rhs._slotKeys ),
+_slotValues( rhs._slotValues ),
+_value     ( rhs._value ),
+_dirty     ( rhs._dirty ),
+_stackSize ( rhs._stackSize )
 {
     //nop
 }
@@ -51,7 +55,8 @@ _dirty( false )
     init();
 }
 
-NumericExpression::NumericExpression( const Config& conf )
+NumericExpression::NumericExpression( const Config& conf ) :
+_value( 0.0 )
 {
     mergeConfig( conf );
     init();
@@ -77,7 +82,7 @@ void
 NumericExpression::init()
 {
     _vars.clear();
-    _rpn.clear();
+    AtomVector rpn;
 
     StringTokenizer variablesTokenizer( "", "" );
     variablesTokenizer.addDelims( "[]", true );
@@ -177,7 +182,6 @@ NumericExpression::init()
     // convert to RPN:
     // http://en.wikipedia.org/wiki/Shunting-yard_algorithm
     AtomStack s;
-    unsigned var_i = 0;
 
     for( unsigned i=0; i<infix.size(); ++i )
     {
@@ -196,14 +200,14 @@ NumericExpression::init()
                 if ( top.first == LPAREN )
                     break;
                 else
-                    _rpn.push_back( top );
+                    rpn.push_back( top );
             }
         }
         else if ( a.first == COMMA )
         {
             while( s.size() > 0 && s.top().first != LPAREN )
             {
-                _rpn.push_back( s.top() );
+                rpn.push_back( s.top() );
                 s.pop();
             }
         }
@@ -217,7 +221,7 @@ NumericExpression::init()
             {
                 while( s.size() > 0 && a.first < s.top().first && IS_OPERATOR(s.top()) )
                 {
-                    _rpn.push_back( s.top() );
+                    rpn.push_back( s.top() );
                     s.pop();
                 }
                 s.push( a );
@@ -229,29 +233,83 @@ NumericExpression::init()
         }
         else if ( a.first == OPERAND )
         {
-            _rpn.push_back( a );
+            rpn.push_back( a );
         }
         else if ( a.first == VARIABLE )
         {
-            _rpn.push_back( a );
-            _vars[var_i++].second = _rpn.size()-1; // store the index
+            rpn.push_back( a );
         }
     }
 
     while( s.size() > 0 )
     {
-        _rpn.push_back( s.top() );
+        rpn.push_back( s.top() );
         s.pop();
     }
+
+    compile( rpn );
+}
+
+void
+NumericExpression::compile( const AtomVector& rpn )
+{
+    _program.clear();
+    _slotNames.clear();
+    _slotKeys.clear();
+    _stackSize = 0;
+
+    // Variables appear in the RPN in the same order as in _vars. Give each
+    // distinct name one slot.
+    unsigned var_i = 0;
+    unsigned depth = 0;
+
+    for( unsigned i=0; i<rpn.size(); ++i )
+    {
+        const Atom& a = rpn[i];
+
+        if ( a.first == VARIABLE )
+        {
+            Variable& var = _vars[var_i++];
+            unsigned slot = std::find(_slotNames.begin(), _slotNames.end(), var.first) - _slotNames.begin();
+            if ( slot == _slotNames.size() )
+            {
+                _slotNames.push_back( var.first );
+                _slotKeys.push_back( toLower(var.first) );
+            }
+            var.second = slot;
+            _program.push_back( Instruction(VARIABLE, 0.0, slot) );
+            ++depth;
+        }
+        else if ( IS_OPERATOR(a) || a.first == MIN || a.first == MAX )
+        {
+            // an operator without two operands is a no-op, so drop it now
+            // instead of checking at every evaluation.
+            if ( depth >= 2 )
+            {
+                _program.push_back( Instruction(a.first, 0.0, 0) );
+                --depth;
+            }
+        }
+        else
+        {
+            // OPERAND, or an unmatched parenthesis, which evaluates to its value (0).
+            _program.push_back( Instruction(OPERAND, a.second, 0) );
+            ++depth;
+        }
+
+        _stackSize = std::max( _stackSize, depth );
+    }
+
+    _slotValues.assign( _slotNames.size(), 0.0 );
 }
 
 void 
 NumericExpression::set( const Variable& var, double value )
 {
-    Atom& a = _rpn[var.second];
-    if ( a.second != value )
+    double& v = _slotValues[var.second];
+    if ( v != value )
     {
-        a.second = value;
+        v = value;
         _dirty = true;
     }
 }
@@ -261,86 +319,56 @@ NumericExpression::eval() const
 {
     if ( _dirty )
     {
-        std::stack<double> s;
+        const_cast<NumericExpression*>(this)->_value = run( _slotValues.empty() ? 0L : &_slotValues[0] );
+        const_cast<NumericExpression*>(this)->_dirty = false;
+    }
 
-        for( unsigned i=0; i<_rpn.size(); ++i )
-        {
-            const Atom& a = _rpn[i];
+    return !osg::isNaN( _value ) ? _value : 0.0;
+}
 
-            if ( a.first == ADD )
-            {
-                if ( s.size() >= 2 )
-                {
-                    double op2 = s.top(); s.pop();
-                    double op1 = s.top(); s.pop();
-                    s.push( op1 + op2 );
-                }
-            }
-            else if ( a.first == SUB )
-            {
-                if ( s.size() >= 2 )
-                {
-                    double op2 = s.top(); s.pop();
-                    double op1 = s.top(); s.pop();
-                    s.push( op1 - op2 );
-                }
-            }
-            else if ( a.first == MULT )
-            {
-                if ( s.size() >= 2 )
-                {
-                    double op2 = s.top(); s.pop();
-                    double op1 = s.top(); s.pop();
-                    s.push( op1 * op2 );
-                }
-            }
-            else if ( a.first == DIV )
-            {
-                if ( s.size() >= 2 )
-                {
-                    double op2 = s.top(); s.pop();
-                    double op1 = s.top(); s.pop();
-                    s.push( op1 / op2 );
-                }
-            }
-            else if ( a.first == MOD )
-            {
-                if ( s.size() >= 2 )
-                {
-                    double op2 = s.top(); s.pop();
-                    double op1 = s.top(); s.pop();
-                    s.push( fmod(op1, op2) );
-                }
-            }
-            else if ( a.first == MIN )
-            {
-                if ( s.size() >= 2 )
-                {
-                    double op2 = s.top(); s.pop();
-                    double op1 = s.top(); s.pop();
-                    s.push( std::min(op1, op2) );
-                }
-            }
-            else if ( a.first == MAX )
-            {
-                if ( s.size() >= 2 )
-                {
-                    double op2 = s.top(); s.pop();
-                    double op1 = s.top(); s.pop();
-                    s.push( std::max(op1, op2) );
-                }
-            }
-            else // OPERAND or VARIABLE
-            {
-                s.push( a.second );
-            }
-        }
+double
+NumericExpression::eval( const double* slotValues ) const
+{
+    double value = run( slotValues );
+    return !osg::isNaN( value ) ? value : 0.0;
+}
 
-        const_cast<NumericExpression*>(this)->_value = s.size() > 0 ? s.top() : 0.0;
-        const_cast<NumericExpression*>(this)->_dirty = false;
+double
+NumericExpression::run( const double* slotValues ) const
+{
+    // deep enough for any reasonable expression; compile() knows the
+    // actual depth, so only a pathological one goes to the heap.
+    const unsigned FIXED_STACK_SIZE = 32;
+    double fixedStack[FIXED_STACK_SIZE];
+    std::vector<double> heapStack;
+
+    double* s = fixedStack;
+    if ( _stackSize > FIXED_STACK_SIZE )
+    {
+        heapStack.resize( _stackSize );
+        s = &heapStack[0];
     }
 
-    return !osg::isNaN( _value ) ? _value : 0.0;
+    // compile() dropped operators that lack operands, so none of these underflow.
+    unsigned n = 0;
+    for( Program::const_iterator i = _program.begin(); i != _program.end(); ++i )
+    {
+        switch( i->_op )
+        {
+        case OPERAND:  s[n++] = i->_value; break;
+        case VARIABLE: s[n++] = slotValues[i->_slot]; break;
+        case ADD:      --n; s[n-1] = s[n-1] + s[n]; break;
+        case SUB:      --n; s[n-1] = s[n-1] - s[n]; break;
+        case MULT:     --n; s[n-1] = s[n-1] * s[n]; break;
+        case DIV:      --n; s[n-1] = s[n-1] / s[n]; break;
+        case MOD:      --n; s[n-1] = fmod( s[n-1], s[n] ); break;
+        case MIN:      --n; s[n-1] = std::min( s[n-1], s[n] ); break;
+        case MAX:      --n; s[n-1] = std::max( s[n-1], s[n] ); break;
+        default: break;
+        }
+    }
+
+    return n > 0 ? s[n-1] : 0.0;
 }
 
 //------------------------------------------------------------------------
@@ -364,6 +392,7 @@ _dirty     ( true )
 StringExpression::StringExpression( const StringExpression& rhs ) :
 _src( rhs._src ),
 _vars( rhs._vars ),
+_varKeys( rhs._varKeys ),
 _value( rhs._value ),
 _infix( rhs._infix ),
 _dirty( rhs._dirty ),
@@ -493,6 +522,10 @@ StringExpression::init()
         _infix.push_back( Atom(VARIABLE,val) );
       }
     }
+
+    _varKeys.clear();
+    for( Variables::const_iterator v = _vars.begin(); v != _vars.end(); ++v )
+        _varKeys.push_back( toLower(v->first) );
 }
 
 void 
@@ -307,7 +307,8 @@ FeatureReadoutCallback::onHit( FeatureSourceIndexNode* index, FeatureID fid, con
             _grid->setControl( 1, r, new LabelControl(Stringify()<<fid, Color::White) );
             ++r;
 
-            const AttributeTable& attrs = f->getAttrs();
+            AttributeTable attrs;
+            f->getAttrs( attrs );
             for( AttributeTable::const_iterator i = attrs.begin(); i != attrs.end(); ++i, ++r )
             {
                 _grid->setControl( 0, r, new LabelControl(i->first, 14.0f, Color::Yellow) );
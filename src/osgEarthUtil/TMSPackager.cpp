@@ -22,7 +22,16 @@
 #include <osgEarth/ImageToHeightFieldConverter>
 #include <osgDB/FileUtils>
 #include <osgDB/FileNameUtils>
+#include <osgDB/Registry>
 #include <osgDB/WriteFile>
+#include <OpenThreads/Condition>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
+#include <OpenThreads/Thread>
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <sstream>
 
 #define LC "[TMSPackager] "
 
@@ -38,6 +47,9 @@ _overwrite          ( false ),
 _keepEmptyImageTiles( false ),
 _subdivideSingleColorImageTiles ( false ),
 _abortOnError       ( true ),
+_numFetchThreads    ( 4 ),
+_numEncodeThreads   ( std::max(1, OpenThreads::GetNumberOfProcessors()) ),
+_numWriteThreads    ( 1 ),
 _imageWriteOptions  (imageWriteOptions)
 {
     //nop
@@ -70,215 +82,398 @@ TMSPackager::shouldPackageKey( const TileKey& key ) const
 }
 
 
-TMSPackager::Result
-TMSPackager::packageImageTile(ImageLayer*          layer,
-                              const TileKey&       key,
-                              const std::string&   rootDir,
-                              const std::string&   extension,
-                              unsigned&            out_maxLevel )
+//------------------------------------------------------------------------
+
+/**
+ * Packages one layer in three stages that run at the same time: fetch threads
+ * create tiles from the layer, encode threads turn them into image files in
+ * memory, and write threads put those on disk. Bounded queues between the
+ * stages keep fetched and encoded tiles from piling up in memory when one
+ * stage is slower than the next.
+ *
+ * A tile's children are queued for fetching once the tile has been written,
+ * so the set of files produced is the same as a depth-first walk produces.
+ *
+ * When packaging into a writable TileSource instead of a folder, there is no
+ * encode stage; write threads hand the images to TileSource::storeImage,
+ * which does its own encoding.
+ */
+class TMSPackager::Pipeline
 {
-    unsigned minLevel = layer->getImageLayerOptions().minLevel().isSet() ?
-        *layer->getImageLayerOptions().minLevel() : 0;
-    
+public:
+    Pipeline(TMSPackager*       packager,
+             ImageLayer*        imageLayer,
+             ElevationLayer*    elevationLayer,
+             TileSource*        output,
+             const std::string& rootDir,
+             const std::string& extension ) :
+    _packager      ( packager ),
+    _imageLayer    ( imageLayer ),
+    _elevationLayer( elevationLayer ),
+    _output        ( output ),
+    _rootDir       ( rootDir ),
+    _extension     ( extension ),
+    _inFlight      ( 0 ),
+    _stop          ( false ),
+    _maxLevel      ( 0 )
+    {
+        // elevation tiles are written with the default options.
+        if ( _imageLayer )
+            _writeOptions = _packager->_imageWriteOptions.get();
 
-    if ( shouldPackageKey(key) && key.getLevelOfDetail() >= minLevel )
+        _writer = osgDB::Registry::instance()->getReaderWriterForExtension( toLower(extension) );
+
+        _maxQueueSize = 2 * std::max(packager->_numEncodeThreads, packager->_numWriteThreads) + 2;
+    }
+
+    TMSPackager::Result run( const std::vector<TileKey>& rootKeys, unsigned& out_maxLevel )
     {
-        unsigned w, h;
-        key.getProfile()->getNumTiles( key.getLevelOfDetail(), w, h );
-
-        std::string path = Stringify() 
-            << rootDir 
-            << "/" << key.getLevelOfDetail() 
-            << "/" << key.getTileX() 
-            << "/" << h - key.getTileY() - 1
-            << "." << extension;
-
-        bool isSingleColor = false;
-        bool tileOK = osgDB::fileExists(path) && !_overwrite;
-        if ( !tileOK )
+        // keys are taken from the back, so queue them in reverse to start
+        // with the first one.
+        _keys.assign( rootKeys.rbegin(), rootKeys.rend() );
+        _inFlight = _keys.size();
+        if ( _inFlight == 0 )
+            return Result();
+
+        std::vector<StageThread*> threads;
+        for( unsigned i = 0; i < _packager->_numFetchThreads; ++i )
+            threads.push_back( new StageThread(this, &Pipeline::fetchTiles) );
+        for( unsigned i = 0; i < _packager->_numEncodeThreads; ++i )
+            threads.push_back( new StageThread(this, &Pipeline::encodeTiles) );
+        for( unsigned i = 0; i < _packager->_numWriteThreads; ++i )
+            threads.push_back( new StageThread(this, &Pipeline::writeTiles) );
+
+        for( unsigned i = 0; i < threads.size(); ++i )
+            threads[i]->start();
+
+        for( unsigned i = 0; i < threads.size(); ++i )
         {
-            GeoImage image = layer->createImage( key );
-            if ( image.valid() )
+            threads[i]->join();
+            delete threads[i];
+        }
+
+        out_maxLevel = std::max( out_maxLevel, _maxLevel );
+
+        return _error.empty() ? Result() : Result( _error );
+    }
+
+private:
+    typedef OpenThreads::ScopedLock<OpenThreads::Mutex> ScopedLock;
+
+    struct Job : public osg::Referenced
+    {
+        Job( const TileKey& key ) : _key(key), _tileOK(false), _isSingleColor(false), _encoded(false) { }
+        TileKey                  _key;
+        std::string              _path;
+        osg::ref_ptr<osg::Image> _image;
+        std::string              _data;
+        bool                     _tileOK;
+        bool                     _isSingleColor;
+        bool                     _encoded;
+    };
+    typedef std::deque< osg::ref_ptr<Job> > JobQueue;
+
+    struct StageThread : public OpenThreads::Thread
+    {
+        StageThread( Pipeline* pipeline, void (Pipeline::*stage)() ) : _pipeline(pipeline), _stage(stage) { }
+        void run() { (_pipeline->*_stage)(); }
+        Pipeline* _pipeline;
+        void (Pipeline::*_stage)();
+    };
+
+    // Fetch stage: creates the tile from the layer, or completes it right away
+    // when there is nothing to encode.
+    void fetchTiles()
+    {
+        for(;;)
+        {
+            TileKey key;
+            {
+                ScopedLock lock( _mutex );
+                while( _keys.empty() && !_stop )
+                    _changed.wait( &_mutex );
+                if ( _stop )
+                    return;
+                key = _keys.back();
+                _keys.pop_back();
+            }
+
+            osg::ref_ptr<Job> job = new Job( key );
+
+            unsigned minLevel = 0;
+            if ( _imageLayer && _imageLayer->getImageLayerOptions().minLevel().isSet() )
+                minLevel = *_imageLayer->getImageLayerOptions().minLevel();
+            else if ( _elevationLayer && _elevationLayer->getElevationLayerOptions().minLevel().isSet() )
+                minLevel = *_elevationLayer->getElevationLayerOptions().minLevel();
+
+            if ( !_packager->shouldPackageKey(key) || key.getLevelOfDetail() < minLevel )
+            {
+                complete( job.get(), false );
+                continue;
+            }
+
+            if ( !_output.valid() )
+            {
+                unsigned w, h;
+                key.getProfile()->getNumTiles( key.getLevelOfDetail(), w, h );
+
+                job->_path = Stringify() 
+                    << _rootDir 
+                    << "/" << key.getLevelOfDetail() 
+                    << "/" << key.getTileX() 
+                    << "/" << h - key.getTileY() - 1
+                    << "." << _extension;
+
+                job->_tileOK = osgDB::fileExists(job->_path) && !_packager->_overwrite;
+            }
+
+            if ( job->_tileOK )
             {
-                // Check for single color
-                if ( !_subdivideSingleColorImageTiles )
+                if ( _packager->_verbose )
                 {
-                    isSingleColor = ImageUtils::isSingleColorImage(image.getImage());
-                    if ( _verbose )
-                    {
-                        OE_NOTICE << LC << "Not subdividing single color tile " << key.str() << std::endl;
-                    }
+                    OE_NOTICE << LC << "Tile " << key.str() << " already exists" << std::endl;
                 }
+            }
+            else if ( _imageLayer )
+            {
+                fetchImage( job.get() );
+            }
+            else
+            {
+                fetchHeightField( job.get() );
+            }
 
-                // check for empty:
-                if ( !_keepEmptyImageTiles && ImageUtils::isEmptyImage(image.getImage()) )
+            if ( job->_image.valid() )
+            {
+                push( _output.valid() ? _toWrite : _toEncode, job.get() );
+            }
+            else
+            {
+                complete( job.get(), true );
+            }
+        }
+    }
+
+    void fetchImage( Job* job )
+    {
+        GeoImage image = _imageLayer->createImage( job->_key );
+        if ( image.valid() )
+        {
+            // Check for single color
+            if ( !_packager->_subdivideSingleColorImageTiles )
+            {
+                job->_isSingleColor = ImageUtils::isSingleColorImage(image.getImage());
+                if ( _packager->_verbose )
                 {
-                    if ( _verbose )
-                    {
-                        OE_NOTICE << LC << "Skipping empty tile " << key.str() << std::endl;
-                    }
+                    OE_NOTICE << LC << "Not subdividing single color tile " << job->_key.str() << std::endl;
                 }
-                else
+            }
+
+            // check for empty:
+            if ( !_packager->_keepEmptyImageTiles && ImageUtils::isEmptyImage(image.getImage()) )
+            {
+                if ( _packager->_verbose )
                 {
-                    // convert to RGB if necessary
-                    osg::ref_ptr<osg::Image> final = image.getImage();
-                    if ( extension == "jpg" && final->getPixelFormat() != GL_RGB )
-                        final = ImageUtils::convertToRGB8( image.getImage() );
-
-                    // dump it to disk
-                    osgDB::makeDirectoryForFile( path );
-                    tileOK = osgDB::writeImageFile( *final.get(), path, _imageWriteOptions);
-
-                    if ( _verbose )
-                    {
-                        if ( tileOK ) {
-                            OE_NOTICE << LC << "Wrote tile " << key.str() << " (" << key.getExtent().toString() << ")" << std::endl;
-                        }
-                        else {
-                            OE_NOTICE << LC << "Error write tile " << key.str() << std::endl;
-                        }
-                    }
-
-                    if ( _abortOnError && !tileOK )
-                    {
-                        return Result( Stringify() << "Aborting, write failed for tile " << key.str() );
-                    }
+                    OE_NOTICE << LC << "Skipping empty tile " << job->_key.str() << std::endl;
                 }
             }
-        }
-        else
-        {
-            if ( _verbose )
+            else
             {
-                OE_NOTICE << LC << "Tile " << key.str() << " already exists" << std::endl;
+                // convert to RGB if necessary
+                job->_image = image.getImage();
+                if ( _extension == "jpg" && job->_image->getPixelFormat() != GL_RGB )
+                    job->_image = ImageUtils::convertToRGB8( image.getImage() );
             }
         }
+    }
 
-        // increment the maximum detected tile level:
-        if ( tileOK && key.getLevelOfDetail() > out_maxLevel )
+    void fetchHeightField( Job* job )
+    {
+        GeoHeightField hf = _elevationLayer->createHeightField( job->_key );
+        if ( hf.valid() )
         {
-            out_maxLevel = key.getLevelOfDetail();
+            // convert the HF to an image
+            ImageToHeightFieldConverter conv;
+            job->_image = conv.convert( hf.getHeightField() );
         }
+    }
 
-        // see if subdivision should continue.
-        unsigned lod = key.getLevelOfDetail();
-        const ImageLayerOptions& options = layer->getImageLayerOptions();
-
-        unsigned layerMaxLevel = (options.maxLevel().isSet()? *options.maxLevel() : 99);
-        unsigned maxLevel = std::min(_maxLevel, layerMaxLevel);
-        bool subdivide =
-            (options.minLevel().isSet() && lod < *options.minLevel()) ||
-            (tileOK && lod+1 < maxLevel);
-
-        // subdivide if necessary:
-        if ( (subdivide == true) && (isSingleColor == false) )
+    // Encode stage: runs the same plugin that osgDB::writeImageFile would use,
+    // into memory. If the plugin can't write to a stream, the write stage
+    // falls back to writeImageFile.
+    void encodeTiles()
+    {
+        osg::ref_ptr<Job> job;
+        while( pop(_toEncode, job) )
         {
-            for( unsigned q=0; q<4; ++q )
+            if ( _writer.valid() )
             {
-                TileKey childKey = key.createChildKey(q);
-                Result r = packageImageTile( layer, childKey, rootDir, extension, out_maxLevel );
-                if ( _abortOnError && !r.ok )
-                    return r;
+                std::stringstream buf;
+                osgDB::ReaderWriter::WriteResult wr = _writer->writeImage( *job->_image.get(), buf, _writeOptions.get() );
+                if ( wr.success() )
+                {
+                    job->_data    = buf.str();
+                    job->_encoded = true;
+                    job->_image   = 0L;
+                }
             }
+            push( _toWrite, job.get() );
         }
     }
 
-    return Result();
-}
-
-
-TMSPackager::Result
-TMSPackager::packageElevationTile(ElevationLayer*      layer,
-                                  const TileKey&       key,
-                                  const std::string&   rootDir,
-                                  const std::string&   extension,
-                                  unsigned&            out_maxLevel)
-{
-    unsigned minLevel = layer->getElevationLayerOptions().minLevel().isSet() ?
-        *layer->getElevationLayerOptions().minLevel() : 0;
-
-    if ( shouldPackageKey(key) && key.getLevelOfDetail() >= minLevel )
+    // Write stage: puts the encoded tile on disk.
+    void writeTiles()
     {
-        unsigned w, h;
-        key.getProfile()->getNumTiles( key.getLevelOfDetail(), w, h );
-
-        std::string path = Stringify() 
-            << rootDir 
-            << "/" << key.getLevelOfDetail() 
-            << "/" << key.getTileX() 
-            << "/" << h - key.getTileY() - 1
-            << "." << extension;
-
-        bool tileOK = osgDB::fileExists(path) && !_overwrite;
-        if ( !tileOK )
+        osg::ref_ptr<Job> job;
+        while( pop(_toWrite, job) )
         {
-
-            GeoHeightField hf = layer->createHeightField( key );
-            if ( hf.valid() )
+            if ( _output.valid() )
+            {
+                job->_tileOK = _output->storeImage( job->_key, job->_image.get() );
+                job->_image = 0L;
+            }
+            else if ( job->_encoded )
             {
-                // convert the HF to an image
-                ImageToHeightFieldConverter conv;
-                osg::ref_ptr<osg::Image> image = conv.convert( hf.getHeightField() );
-
                 // dump it to disk
-                osgDB::makeDirectoryForFile( path );
-                tileOK = osgDB::writeImageFile( *image.get(), path );
+                osgDB::makeDirectoryForFile( job->_path );
+                std::ofstream out( job->_path.c_str(), std::ios::out | std::ios::binary );
+                out.write( job->_data.data(), job->_data.size() );
+                out.close();
+                job->_tileOK = !out.fail();
+            }
+            else
+            {
+                osgDB::makeDirectoryForFile( job->_path );
+                job->_tileOK = osgDB::writeImageFile( *job->_image.get(), job->_path, _writeOptions.get() );
+            }
 
-                if ( _verbose )
-                {
-                    if ( tileOK ) {
-                        OE_NOTICE << LC << "Wrote tile " << key.str() << " (" << key.getExtent().toString() << ")" << std::endl;
-                    }
-                    else {
-                        OE_NOTICE << LC << "Error write tile " << key.str() << std::endl;
-                    }
+            if ( _packager->_verbose )
+            {
+                if ( job->_tileOK ) {
+                    OE_NOTICE << LC << "Wrote tile " << job->_key.str() << " (" << job->_key.getExtent().toString() << ")" << std::endl;
                 }
-
-                if ( _abortOnError && !tileOK )
-                {
-                    return Result( Stringify() << "Aborting, write failed for tile " << key.str() );
+                else {
+                    OE_NOTICE << LC << "Error write tile " << job->_key.str() << std::endl;
                 }
             }
+
+            if ( _packager->_abortOnError && !job->_tileOK )
+            {
+                ScopedLock lock( _mutex );
+                if ( _error.empty() )
+                    _error = Stringify() << "Aborting, write failed for tile " << job->_key.str();
+                _stop = true;
+                _changed.broadcast();
+                return;
+            }
+
+            complete( job.get(), true );
         }
-        else
+    }
+
+    // Finishes a tile, queuing its children if subdivision should continue.
+    void complete( Job* job, bool packaged )
+    {
+        unsigned lod = job->_key.getLevelOfDetail();
+
+        bool subdivide = false;
+        if ( packaged )
         {
-            if ( _verbose )
+            // see if subdivision should continue.
+            unsigned layerMaxLevel = 99;
+            bool     belowMinLevel = false;
+            if ( _imageLayer )
+            {
+                const ImageLayerOptions& options = _imageLayer->getImageLayerOptions();
+                layerMaxLevel = options.maxLevel().isSet()? *options.maxLevel() : 99;
+                belowMinLevel = options.minLevel().isSet() && lod < *options.minLevel();
+            }
+            else
             {
-                OE_NOTICE << LC << "Tile " << key.str() << " already exists" << std::endl;
+                const ElevationLayerOptions& options = _elevationLayer->getElevationLayerOptions();
+                layerMaxLevel = options.maxLevel().isSet()? *options.maxLevel() : 99;
+                belowMinLevel = options.minLevel().isSet() && lod < *options.minLevel();
             }
+
+            unsigned maxLevel = std::min(_packager->_maxLevel, layerMaxLevel);
+            subdivide =
+                (belowMinLevel || (job->_tileOK && lod+1 < maxLevel)) &&
+                !job->_isSingleColor;
         }
 
+        ScopedLock lock( _mutex );
+
         // increment the maximum detected tile level:
-        if ( tileOK && key.getLevelOfDetail() > out_maxLevel )
+        if ( job->_tileOK && lod > _maxLevel )
         {
-            out_maxLevel = key.getLevelOfDetail();
+            _maxLevel = lod;
         }
 
-        // see if subdivision should continue.
-        unsigned lod = key.getLevelOfDetail();
-        const ElevationLayerOptions& options = layer->getElevationLayerOptions();
-
-        unsigned layerMaxLevel = (options.maxLevel().isSet()? *options.maxLevel() : 99);
-        unsigned maxLevel = std::min(_maxLevel, layerMaxLevel);
-        bool subdivide =
-            (options.minLevel().isSet() && lod < *options.minLevel()) ||
-            (tileOK && lod+1 < maxLevel);
-
-        // subdivide if necessary:
-        if ( subdivide )
+        if ( subdivide && !_stop )
         {
-            for( unsigned q=0; q<4; ++q )
+            for( int q=3; q>=0; --q )
             {
-                TileKey childKey = key.createChildKey(q);
-                Result r = packageElevationTile( layer, childKey, rootDir, extension, out_maxLevel );
-                if ( _abortOnError && !r.ok )
-                    return r;
+                _keys.push_back( job->_key.createChildKey(q) );
             }
+            _inFlight += 4;
         }
+
+        if ( --_inFlight == 0 )
+        {
+            _stop = true;
+        }
+        _changed.broadcast();
     }
 
-    return Result();
-}
+    // Adds a job to a stage queue, waiting while the queue is full.
+    void push( JobQueue& queue, Job* job )
+    {
+        ScopedLock lock( _mutex );
+        while( queue.size() >= _maxQueueSize && !_stop )
+            _changed.wait( &_mutex );
+        if ( !_stop )
+        {
+            queue.push_back( job );
+            _changed.broadcast();
+        }
+    }
+
+    // Takes the next job from a stage queue. Returns false when packaging is over.
+    bool pop( JobQueue& queue, osg::ref_ptr<Job>& out_job )
+    {
+        ScopedLock lock( _mutex );
+        while( queue.empty() && !_stop )
+            _changed.wait( &_mutex );
+        if ( _stop )
+            return false;
+        out_job = queue.front();
+        queue.pop_front();
+        _changed.broadcast();
+        return true;
+    }
+
+    TMSPackager*                         _packager;
+    ImageLayer*                          _imageLayer;
+    ElevationLayer*                      _elevationLayer;
+    osg::ref_ptr<TileSource>             _output;
+    std::string                          _rootDir;
+    std::string                          _extension;
+    osg::ref_ptr<osgDB::ReaderWriter>    _writer;
+    osg::ref_ptr<osgDB::Options>         _writeOptions;
+    unsigned                             _maxQueueSize;
+
+    OpenThreads::Mutex                   _mutex;
+    OpenThreads::Condition               _changed;
+    std::vector<TileKey>                 _keys;
+    JobQueue                             _toEncode;
+    JobQueue                             _toWrite;
+    unsigned                             _inFlight;
+    bool                                 _stop;
+    unsigned                             _maxLevel;
+    std::string                          _error;
+};
+
+//------------------------------------------------------------------------
 
 
 TMSPackager::Result
@@ -349,12 +544,10 @@ TMSPackager::package(ImageLayer*        layer,
 
     // package the tile hierarchy
     unsigned maxLevel = 0;
-    for( std::vector<TileKey>::const_iterator i = rootKeys.begin(); i != rootKeys.end(); ++i )
-    {
-        Result r = packageImageTile( layer, *i, rootFolder, extension, maxLevel );
-        if ( _abortOnError && !r.ok )
-            return r;
-    }
+    Pipeline pipeline( this, layer, 0L, 0L, rootFolder, extension );
+    Result r = pipeline.run( rootKeys, maxLevel );
+    if ( _abortOnError && !r.ok )
+        return r;
 
     // create the tile map metadata:
     osg::ref_ptr<TMS::TileMap> tileMap = TMS::TileMap::create(
@@ -377,6 +570,30 @@ TMSPackager::package(ImageLayer*        layer,
 }
 
 
+TMSPackager::Result
+TMSPackager::package(ImageLayer* layer,
+                     TileSource* output)
+{
+    if ( !layer || !output || !output->getProfile() )
+        return Result( "Illegal null layer or output" );
+
+    // collect the root tile keys of the output's profile:
+    std::vector<TileKey> rootKeys;
+    output->getProfile()->getRootKeys( rootKeys );
+
+    if ( rootKeys.size() == 0 )
+        return Result( "Unable to calculate root key set" );
+
+    unsigned maxLevel = 0;
+    Pipeline pipeline( this, layer, 0L, output, "", output->getExtension() );
+    Result r = pipeline.run( rootKeys, maxLevel );
+    if ( _abortOnError && !r.ok )
+        return r;
+
+    return Result();
+}
+
+
 TMSPackager::Result
 TMSPackager::package(ElevationLayer*    layer,
                      const std::string& rootFolder)
@@ -412,12 +629,10 @@ TMSPackager::package(ElevationLayer*    layer,
         return Result( "Unable to determine heightfield size" );
 
     unsigned maxLevel = 0;
-    for( std::vector<TileKey>::const_iterator i = rootKeys.begin(); i != rootKeys.end(); ++i )
-    {
-        Result r = packageElevationTile( layer, *i, rootFolder, extension, maxLevel );
-        if ( _abortOnError && !r.ok )
-            return r;
-    }
+    Pipeline pipeline( this, 0L, layer, 0L, rootFolder, extension );
+    Result r = pipeline.run( rootKeys, maxLevel );
+    if ( _abortOnError && !r.ok )
+        return r;
 
     // create the tile map metadata:
     osg::ref_ptr<TMS::TileMap> tileMap = TMS::TileMap::create(